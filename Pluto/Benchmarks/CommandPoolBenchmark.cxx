@@ -0,0 +1,142 @@
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Pluto/Libraries/GLFW/GLFW.hxx"
+#include "Pluto/Libraries/Vulkan/Vulkan.hxx"
+
+using namespace Libraries;
+
+/* Runs frames the way the render loop does, with a few long lived threads each recording a per frame command buffer
+    and making a one time command every frame, while the main thread also uses a thread fence. After a warm up phase,
+    runs as many frames again, and fails if any more command buffers or fences were made, since the per thread pools
+    should have grown to what each thread needs by then. Runs headless.
+    Arguments: frames per phase (default 500), worker threads (default 4). */
+int main(int argc, char** argv)
+{
+    uint32_t frames = (argc > 1) ? (uint32_t) std::atoi(argv[1]) : 500;
+    uint32_t threadCount = (argc > 2) ? (uint32_t) std::atoi(argv[2]) : 4;
+
+    GLFW::Get();
+    auto vulkan = Vulkan::Get();
+    vulkan->create_instance(false);
+    vulkan->create_device();
+    auto device = vulkan->get_device();
+    auto submissions = vulkan->get_graphics_submission_queue();
+
+    std::vector<uint64_t> frameSubmissions(MAX_FRAMES_IN_FLIGHT, 0);
+    uint32_t currentFrame = 0;
+
+    /* Workers wait for the main thread to start a frame, record into it, then report back */
+    std::mutex mutex;
+    std::condition_variable condition;
+    uint64_t framesStarted = 0;
+    uint32_t workersFinished = 0;
+    bool stop = false;
+    std::vector<vk::CommandBuffer> recorded;
+
+    std::vector<std::thread> workers;
+    for (uint32_t i = 0; i < threadCount; ++i) {
+        workers.emplace_back([&]() {
+            uint64_t seen = 0;
+            while (true) {
+                uint32_t frame;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    condition.wait(lock, [&]() { return stop || framesStarted > seen; });
+                    if (stop) return;
+                    seen = framesStarted;
+                    frame = currentFrame;
+                }
+
+                auto command = vulkan->begin_one_time_graphics_command();
+                vulkan->end_one_time_graphics_command(command, "benchmark one time command");
+
+                auto commandBuffer = vulkan->get_thread_command_buffer(frame);
+                commandBuffer.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+                commandBuffer.end();
+
+                std::lock_guard<std::mutex> lock(mutex);
+                recorded.push_back(commandBuffer);
+                workersFinished++;
+                condition.notify_all();
+            }
+        });
+    }
+
+    auto runFrames = [&](uint32_t count) {
+        for (uint32_t i = 0; i < count; ++i) {
+            uint32_t frame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+            submissions->wait(frameSubmissions[frame]);
+            vulkan->reset_thread_command_pools(frame);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                currentFrame = frame;
+                recorded.clear();
+                workersFinished = 0;
+                framesStarted++;
+            }
+            condition.notify_all();
+
+            /* The main thread waits on a fence of its own, like swapchain image acquisition does */
+            vk::Fence fence = vulkan->get_thread_fence();
+            vulkan->submit_graphics_commands({}, {}, {}, {}, fence, "benchmark fence");
+
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [&]() { return workersFinished == threadCount; });
+            frameSubmissions[frame] = vulkan->submit_graphics_commands(recorded, {}, {}, {}, vk::Fence(), "benchmark frame");
+            lock.unlock();
+
+            device.waitForFences(fence, true, UINT64_MAX);
+            vulkan->recycle_thread_fence(fence);
+        }
+    };
+
+    using clock = std::chrono::high_resolution_clock;
+    auto start = clock::now();
+    runFrames(frames);
+    double warmupTime = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+    auto warm = vulkan->get_command_pool_statistics();
+    auto warmSubmissions = submissions->get_statistics();
+
+    start = clock::now();
+    runFrames(frames);
+    double measuredTime = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+    auto measured = vulkan->get_command_pool_statistics();
+    auto measuredSubmissions = submissions->get_statistics();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    condition.notify_all();
+    for (auto &worker : workers) worker.join();
+    vulkan->flush_queues();
+
+    printf("%u frames per phase, %u worker threads, %s\n", frames, threadCount,
+        submissions->is_using_timeline_semaphore() ? "timeline semaphore" : "fences");
+    printf("%10s %12s %12s %12s %12s %14s %10s\n", "phase", "buffers", "recycled", "fences", "recycled", "queue fences", "ms/frame");
+    printf("%10s %12llu %12llu %12llu %12llu %14u %10.3f\n", "warm up",
+        (unsigned long long) warm.commandBuffersAllocated, (unsigned long long) warm.commandBuffersRecycled,
+        (unsigned long long) warm.fencesCreated, (unsigned long long) warm.fencesRecycled,
+        warmSubmissions.fencesCreated, warmupTime / frames);
+    printf("%10s %12llu %12llu %12llu %12llu %14u %10.3f\n", "measured",
+        (unsigned long long) measured.commandBuffersAllocated, (unsigned long long) measured.commandBuffersRecycled,
+        (unsigned long long) measured.fencesCreated, (unsigned long long) measured.fencesRecycled,
+        measuredSubmissions.fencesCreated, measuredTime / frames);
+
+    bool steady = (measured.commandBuffersAllocated == warm.commandBuffersAllocated)
+        && (measured.fencesCreated == warm.fencesCreated)
+        && (measuredSubmissions.fencesCreated == warmSubmissions.fencesCreated);
+    printf("%s\n", steady ? "Pools stopped growing after warm up" : "Error: pools kept growing after warm up");
+
+    vulkan->destroy_device();
+    vulkan->destroy_instance();
+    return steady ? 0 : 1;
+}
@@ -0,0 +1,20 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include "Pluto/Transform/Transform.hxx"
+
+/* Times composing local matrices with glm, with the matrix kernel's scalar path, and with its SIMD path,
+    at 1k, 10k and 100k transforms. An optional argument sets the number of passes averaged per size. */
+int main(int argc, char** argv)
+{
+    uint32_t iterations = (argc > 1) ? (uint32_t) std::atoi(argv[1]) : 20;
+
+    printf("Matrix kernel instruction set: %s\n", Transform::GetMatrixKernelInstructionSet().c_str());
+    printf("%10s %12s %12s %12s %10s\n", "count", "glm (ms)", "scalar (ms)", "kernel (ms)", "speedup");
+    for (uint32_t count : {1000u, 10000u, 100000u}) {
+        auto times = Transform::BenchmarkMatrixKernel(count, iterations);
+        printf("%10u %12.3f %12.3f %12.3f %9.2fx\n", count, times[0], times[1], times[2], times[0] / times[2]);
+    }
+    return 0;
+}
@@ -3,11 +3,9 @@
 #include "Pluto/Texture/Texture.hxx"
 #include "Pluto/Material/Material.hxx"
 
-Camera Camera::cameras[MAX_CAMERAS];
-CameraStruct* Camera::pinnedMemory;
+SlotMap<Camera> Camera::cameras(MAX_CAMERAS);
 std::map<std::string, uint32_t> Camera::lookupTable;
-vk::Buffer Camera::ssbo;
-vk::DeviceMemory Camera::ssboMemory;
+Libraries::StorageBuffer Camera::ssbo;
 
 using namespace Libraries;
 
@@ -36,7 +34,6 @@ void Camera::setup(bool allow_recording, bool cubemap, uint32_t tex_width, uint3
 			if (msaa_samples != 1)
 				resolveTexture = Texture::Create2D(name + "_resolve", tex_width, tex_height, true, true, 1, layers);
 		}
-		create_command_buffer();
 		create_render_passes(tex_width, tex_height, (cubemap) ? 6 : layers, msaa_samples);
 		create_frame_buffers(layers);
         for(auto renderpass : renderpasses) {
@@ -45,17 +42,6 @@ void Camera::setup(bool allow_recording, bool cubemap, uint32_t tex_width, uint3
 	}
 }
 
-void Camera::create_command_buffer()
-{
-	auto vulkan = Libraries::Vulkan::Get();
-	auto device = vulkan->get_device();
-	vk::CommandBufferAllocateInfo cmdAllocInfo;
-    cmdAllocInfo.commandPool = vulkan->get_command_pool(1);
-    cmdAllocInfo.level = vk::CommandBufferLevel::ePrimary;
-    cmdAllocInfo.commandBufferCount = 1;
-    command_buffer = device.allocateCommandBuffers(cmdAllocInfo)[0];
-}
-
 void Camera::create_render_passes(uint32_t framebufferWidth, uint32_t framebufferHeight, uint32_t layers, uint32_t sample_count)
 {
     renderpasses.clear();
@@ -203,6 +189,7 @@ void Camera::create_render_passes(uint32_t framebufferWidth, uint32_t framebuffe
 #endif
 
         renderpasses.push_back(device.createRenderPass(renderPassInfo));
+        Material::RegisterRenderPass(renderpasses.back(), renderPassInfo);
     }
 	#pragma endregion
 }
@@ -308,6 +295,7 @@ void Camera::set_perspective_projection(float fov_in_radians, float width, float
 	camera_struct.multiviews[multiview].near_pos = near_pos;
 	camera_struct.multiviews[multiview].proj = MakeInfReversedZProjRH(fov_in_radians, width / height, near_pos);
 	camera_struct.multiviews[multiview].projinv = glm::inverse(camera_struct.multiviews[multiview].proj);
+	mark_dirty();
 };
 
 void Camera::set_custom_projection(glm::mat4 custom_projection, float near_pos, uint32_t multiview)
@@ -316,6 +304,7 @@ void Camera::set_custom_projection(glm::mat4 custom_projection, float near_pos,
 	camera_struct.multiviews[multiview].near_pos = near_pos;
 	camera_struct.multiviews[multiview].proj = custom_projection;
 	camera_struct.multiviews[multiview].projinv = glm::inverse(custom_projection);
+	mark_dirty();
 }
 
 float Camera::get_near_pos(uint32_t multiview) { 
@@ -335,10 +324,12 @@ void Camera::set_view(glm::mat4 view, uint32_t multiview)
 	usedViews = (usedViews >= multiview) ? usedViews : multiview;
 	camera_struct.multiviews[multiview].view = view;
 	camera_struct.multiviews[multiview].viewinv = glm::inverse(view);
+	mark_dirty();
 };
 
 void Camera::set_render_order(uint32_t order) {
 	renderOrder = order;
+	mark_dirty();
 }
 
 glm::mat4 Camera::get_projection(uint32_t multiview) { 
@@ -387,8 +378,42 @@ bool Camera::allows_recording()
 	return allow_recording;
 }
 
+uint32_t Camera::get_view_count()
+{
+	return maxMultiview;
+}
+
+uint32_t Camera::get_visible_entity_count()
+{
+	return visibleEntityCount;
+}
+
+uint32_t Camera::get_culled_entity_count()
+{
+	return culledEntityCount;
+}
+
+void Camera::set_culling_statistics(uint32_t visible, uint32_t culled)
+{
+	visibleEntityCount = visible;
+	culledEntityCount = culled;
+}
+
+bool Camera::are_pipelines_ready()
+{
+	for (auto renderpass : renderpasses)
+		if (!Material::ArePipelinesReady(renderpass)) return false;
+	return true;
+}
+
+void Camera::wait_for_pipelines()
+{
+	for (auto renderpass : renderpasses)
+		Material::WaitForPipelines(renderpass);
+}
+
 // this should be in the render system...
-void Camera::begin_renderpass(vk::CommandBuffer command_buffer, uint32_t index)
+void Camera::begin_renderpass(vk::CommandBuffer command_buffer, uint32_t index, vk::SubpassContents contents)
 {
     if(index >= renderpasses.size())
         throw std::runtime_error( std::string("Error: renderpass index out of bounds"));
@@ -410,8 +435,35 @@ void Camera::begin_renderpass(vk::CommandBuffer command_buffer, uint32_t index)
 	rpInfo.pClearValues = clearValues.data();
 
 	/* Start the render pass */
-	command_buffer.beginRenderPass(rpInfo, vk::SubpassContents::eInline);
+	command_buffer.beginRenderPass(rpInfo, contents);
+
+	/* Dynamic state isn't inherited, so secondary command buffers set their own viewport and scissor */
+	if (contents == vk::SubpassContents::eInline)
+		set_viewport_and_scissor(command_buffer);
+}
+
+void Camera::begin_secondary_command_buffer(vk::CommandBuffer command_buffer, uint32_t index)
+{
+    if(index >= renderpasses.size())
+        throw std::runtime_error( std::string("Error: renderpass index out of bounds"));
+	if (!allow_recording)
+		throw std::runtime_error( std::string("Error: this camera does not allow recording"));
 
+	vk::CommandBufferInheritanceInfo inheritanceInfo;
+	inheritanceInfo.renderPass = renderpasses[index];
+	inheritanceInfo.subpass = 0;
+	inheritanceInfo.framebuffer = framebuffers[index];
+
+	vk::CommandBufferBeginInfo beginInfo;
+	beginInfo.flags = vk::CommandBufferUsageFlagBits::eRenderPassContinue | vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+	beginInfo.pInheritanceInfo = &inheritanceInfo;
+	command_buffer.begin(beginInfo);
+
+	set_viewport_and_scissor(command_buffer);
+}
+
+void Camera::set_viewport_and_scissor(vk::CommandBuffer command_buffer)
+{
 	/* Set viewport*/
 	vk::Viewport viewport;
 	viewport.width = (float)renderTexture->get_width();
@@ -453,84 +505,86 @@ void Camera::end_renderpass(vk::CommandBuffer command_buffer, uint32_t index) {
 	command_buffer.endRenderPass();
 }
 
-vk::CommandBuffer Camera::get_command_buffer() {
-	return command_buffer;
-}
-
 void Camera::set_clear_color(float r, float g, float b, float a) {
 	clearColor = glm::vec4(r, g, b, a);
+	mark_dirty();
 }
 
 void Camera::set_clear_stencil(uint32_t stencil) {
 	clearStencil = stencil;
+	mark_dirty();
 }
 
 void Camera::set_clear_depth(float depth) {
 	clearDepth = depth;
+	mark_dirty();
 }
 
 /* SSBO Logic */
 void Camera::Initialize()
 {
-	auto vulkan = Libraries::Vulkan::Get();
-	auto device = vulkan->get_device();
-	auto physical_device = vulkan->get_physical_device();
-
-	vk::BufferCreateInfo bufferInfo = {};
-	bufferInfo.size = MAX_CAMERAS * sizeof(CameraStruct);
-	bufferInfo.usage = vk::BufferUsageFlagBits::eStorageBuffer;
-	bufferInfo.sharingMode = vk::SharingMode::eExclusive;
-	ssbo = device.createBuffer(bufferInfo);
-
-	vk::MemoryRequirements memReqs = device.getBufferMemoryRequirements(ssbo);
-	vk::MemoryAllocateInfo allocInfo = {};
-	allocInfo.allocationSize = memReqs.size;
+	ssbo.create(cameras.get_capacity() * sizeof(CameraStruct));
+	cameras.mark_all_dirty();
+}
 
-	vk::PhysicalDeviceMemoryProperties memProperties = physical_device.getMemoryProperties();
-	vk::MemoryPropertyFlags properties = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
-	allocInfo.memoryTypeIndex = vulkan->find_memory_type(memReqs.memoryTypeBits, properties);
+void Camera::UploadSSBO(uint32_t frame)
+{
+	if (!ssbo.is_created()) return;
+
+	/* Grow the SSBO if cameras were added since the last upload. The staging copy is kept, so nothing needs to be re-marked. */
+	ssbo.reserve(cameras.get_capacity() * sizeof(CameraStruct));
+
+	/* Copy only the modified cameras into the staging copy, then bring this frame's copy of the SSBO up to date */
+	CameraStruct* pinnedMemory = (CameraStruct*) ssbo.get_staging();
+	cameras.consume_dirty_ranges([&](uint32_t first, uint32_t count) {
+		for (uint32_t i = first; i < first + count; ++i) {
+			pinnedMemory[i] = cameras[i].camera_struct;
+
+			for (uint32_t j = 0; j < cameras[i].maxMultiview; ++j) {
+				pinnedMemory[i].multiviews[j].viewinv = glm::inverse(pinnedMemory[i].multiviews[j].view);
+				pinnedMemory[i].multiviews[j].projinv = glm::inverse(pinnedMemory[i].multiviews[j].proj);
+				pinnedMemory[i].multiviews[j].viewproj = pinnedMemory[i].multiviews[j].proj * pinnedMemory[i].multiviews[j].view;
+			}
+		}
+		ssbo.mark_range(first * sizeof(CameraStruct), count * sizeof(CameraStruct));
+	});
+	ssbo.flush(frame);
+}
 
-	ssboMemory = device.allocateMemory(allocInfo);
-	device.bindBufferMemory(ssbo, ssboMemory, 0);
+vk::Buffer Camera::GetSSBO()
+{
+	return ssbo.get_buffer();
+}
 
-	/* Pin the buffer */
-	pinnedMemory = (CameraStruct*) device.mapMemory(ssboMemory, 0, MAX_CAMERAS * sizeof(CameraStruct));
+uint32_t Camera::GetSSBOSize()
+{
+	return (uint32_t) ssbo.get_size();
 }
 
-void Camera::UploadSSBO()
+uint32_t Camera::GetSSBOOffset(uint32_t frame)
 {
-	if (pinnedMemory == nullptr) return;
-	
-	/* TODO: remove this for loop */
-	for (uint32_t i = 0; i < MAX_CAMERAS; ++i) {
-		if (!cameras[i].is_initialized()) continue;
-		pinnedMemory[i] = cameras[i].camera_struct;
+	return (uint32_t) ssbo.get_offset(frame);
+}
 
-		for (uint32_t j = 0; j < cameras[i].maxMultiview; ++j) {
-			pinnedMemory[i].multiviews[j].viewinv = glm::inverse(pinnedMemory[i].multiviews[j].view);
-			pinnedMemory[i].multiviews[j].projinv = glm::inverse(pinnedMemory[i].multiviews[j].proj);
-			pinnedMemory[i].multiviews[j].viewproj = pinnedMemory[i].multiviews[j].proj * pinnedMemory[i].multiviews[j].view;
-		}
-	};
+uint64_t Camera::GetSSBOBytesUploaded()
+{
+	return ssbo.get_bytes_uploaded();
 }
 
-vk::Buffer Camera::GetSSBO()
+uint64_t Camera::GetSSBOGeneration()
 {
-	return ssbo;
+    return ssbo.get_generation();
 }
 
-uint32_t Camera::GetSSBOSize()
+void Camera::mark_dirty()
 {
-	return MAX_CAMERAS * sizeof(CameraStruct);
+	if (!initialized) return;
+	cameras.mark_dirty(id);
 }
 
 void Camera::CleanUp()
 {
-	auto vulkan = Libraries::Vulkan::Get();
-	auto device = vulkan->get_device();
-	device.destroyBuffer(ssbo);
-	device.unmapMemory(ssboMemory);
-	device.freeMemory(ssboMemory);
+	ssbo.destroy();
 
 	for (uint32_t i = 0; i < GetCount(); ++i) {
 		cameras[i].cleanup();
@@ -541,40 +595,44 @@ void Camera::CleanUp()
 /* Static Factory Implementations */
 Camera* Camera::Create(std::string name, bool allow_recording, bool cubemap, uint32_t tex_width, uint32_t tex_height, uint32_t msaa_samples, uint32_t layers)
 {
-	auto camera = StaticFactory::Create(name, "Camera", lookupTable, cameras, MAX_CAMERAS);
+	auto camera = StaticFactory::Create(name, "Camera", lookupTable, cameras);
 	camera->setup(allow_recording, cubemap, tex_width, tex_height, msaa_samples, layers);
 	return camera;
 }
 
 Camera* Camera::Get(std::string name) {
-	return StaticFactory::Get(name, "Camera", lookupTable, cameras, MAX_CAMERAS);
+	return StaticFactory::Get(name, "Camera", lookupTable, cameras);
 }
 
 Camera* Camera::Get(uint32_t id) {
-	return StaticFactory::Get(id, "Camera", lookupTable, cameras, MAX_CAMERAS);
+	return StaticFactory::Get(id, "Camera", lookupTable, cameras);
+}
+
+Camera* Camera::Get(uint32_t id, uint32_t generation) {
+	return StaticFactory::Get(id, generation, "Camera", lookupTable, cameras);
 }
 
 void Camera::Delete(std::string name) {
-	StaticFactory::Delete(name, "Camera", lookupTable, cameras, MAX_CAMERAS);
+	StaticFactory::Delete(name, "Camera", lookupTable, cameras);
 }
 
 void Camera::Delete(uint32_t id) {
-	StaticFactory::Delete(id, "Camera", lookupTable, cameras, MAX_CAMERAS);
+	StaticFactory::Delete(id, "Camera", lookupTable, cameras);
 }
 
-Camera* Camera::GetFront() {
-	return cameras;
+Camera* Camera::GetFromIndex(uint32_t index) {
+    return StaticFactory::GetFromIndex(index, cameras);
 }
 
 uint32_t Camera::GetCount() {
-	return MAX_CAMERAS;
+	return cameras.get_capacity();
 }
 
 std::vector<Camera *> Camera::GetCamerasByOrder(uint32_t order)
 {
 	/* Todo: improve the performance of this. */
 	std::vector<Camera *> selected_cameras;
-	for (uint32_t i = 0; i < MAX_CAMERAS; ++i) {
+	for (uint32_t i = 0; i < cameras.get_capacity(); ++i) {
 		if (!cameras[i].is_initialized()) continue;
 
 		if (cameras[i].renderOrder == order) {
@@ -589,10 +647,10 @@ void Camera::cleanup()
 	auto vulkan = Vulkan::Get();
 	auto device = vulkan->get_device();
 
-	if (command_buffer)
-		device.freeCommandBuffers(vulkan->get_command_pool(1), {command_buffer});
     if (renderpasses.size() > 0) {
         for(auto renderpass : renderpasses) {
+            /* Pipelines may still be compiling against the renderpass */
+            Material::UnregisterRenderPass(renderpass);
             device.destroyRenderPass(renderpass);
         }
     }
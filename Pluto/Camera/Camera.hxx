@@ -7,6 +7,7 @@
 #include <vulkan/vulkan.hpp>
 
 #include "Pluto/Tools/StaticFactory.hxx"
+#include "Pluto/Libraries/Vulkan/StorageBuffer.hxx"
 #include "Pluto/Camera/CameraStruct.hxx"
 
 class Texture;
@@ -23,8 +24,11 @@ class Camera : public StaticFactory
 	/* Retrieves a camera component by id. */
 	static Camera *Get(uint32_t id);
 
-	/* Returns a pointer to the list of camera components. */
-	static Camera *GetFront();
+	/* Retrieves a camera component by id, failing if that camera has since been deleted and its slot reused. */
+	static Camera *Get(uint32_t id, uint32_t generation);
+
+	/* Returns the camera in the given slot, initialized or not, or nullptr if the slot is out of range. */
+	static Camera *GetFromIndex(uint32_t index);
 
 	/* Returns the total number of reserved cameras. */
 	static uint32_t GetCount();
@@ -42,7 +46,7 @@ class Camera : public StaticFactory
 	static void Initialize();
 
 	/* Transfers all camera components to an SSBO */
-	static void UploadSSBO();
+	static void UploadSSBO(uint32_t frame);
 
 	/* Returns the SSBO vulkan buffer handle */
 	static vk::Buffer GetSSBO();
@@ -50,6 +54,18 @@ class Camera : public StaticFactory
 	/* Returns the size in bytes of the current camera SSBO. */
 	static uint32_t GetSSBOSize();
 
+	/* Returns the byte offset of the given frame's copy within the SSBO */
+	static uint32_t GetSSBOOffset(uint32_t frame);
+
+	/* Returns the total number of bytes written into the camera SSBO, for measuring upload traffic */
+	static uint64_t GetSSBOBytesUploaded();
+
+	/* Returns an id which changes whenever the SSBO is reallocated, so descriptors know to be rewritten */
+	static uint64_t GetSSBOGeneration();
+
+	/* Flags this camera to be copied into the SSBO on the next upload. Called by every setter. */
+	void mark_dirty();
+
 	/* Releases vulkan resources */
 	static void CleanUp();
 
@@ -97,7 +113,13 @@ class Camera : public StaticFactory
 	/* If recording is allowed, records vulkan commands to the given command buffer required to 
 		start a renderpass for the current camera setup. This should only be called by the render 
 		system, and only after the command buffer has begun recording commands. */
-	void begin_renderpass(vk::CommandBuffer command_buffer, uint32_t index = 0);
+	void begin_renderpass(vk::CommandBuffer command_buffer, uint32_t index = 0, 
+		vk::SubpassContents contents = vk::SubpassContents::eInline);
+
+	/* If recording is allowed, begins recording a secondary command buffer which continues the given 
+		renderpass, and sets its viewport and scissor. The primary command buffer must begin that renderpass 
+		with secondary command buffer contents before executing it. Safe to call from any thread. */
+	void begin_secondary_command_buffer(vk::CommandBuffer command_buffer, uint32_t index = 0);
 
 	/* If recording is allowed, returns the vulkan renderpass handle. 
 		Note: This handle might change throughout the lifetime of this camera component. */
@@ -110,9 +132,6 @@ class Camera : public StaticFactory
 		end a renderpass for the current camera setup. */
 	void end_renderpass(vk::CommandBuffer command_buffer, uint32_t index = 0);
 
-	/* Returns the vulkan command buffer handle. */
-	vk::CommandBuffer get_command_buffer();
-
 	/* If recording is allowed, sets the clear color to be used to reset the color image of this camera's
 		texture component when beginning a renderpass. */
 	void set_clear_color(float r, float g, float b, float a);
@@ -133,6 +152,26 @@ class Camera : public StaticFactory
 	/* Returns whether or not a camera is allowed to record draw calls. */
 	bool allows_recording();
 
+	/* Returns the number of views this camera renders to, which is the number of layers in its texture. */
+	uint32_t get_view_count();
+
+	/* Returns the number of entities inside this camera's views during the last recorded frame, summed over its renderpasses. */
+	uint32_t get_visible_entity_count();
+
+	/* Returns the number of entities skipped by this camera during the last recorded frame, because their 
+		bounds were outside of every view's frustum. Summed over the camera's renderpasses. */
+	uint32_t get_culled_entity_count();
+
+	/* Records the visible and culled entity counts. Called by the render system after recording this camera. */
+	void set_culling_statistics(uint32_t visible, uint32_t culled);
+
+	/* Returns true once every pipeline this camera's renderpasses draw with has been compiled. Until then, 
+		entities whose pipelines are still compiling are drawn with a uniform color. */
+	bool are_pipelines_ready();
+
+	/* Blocks until every pipeline this camera's renderpasses draw with has been compiled. */
+	void wait_for_pipelines();
+
   private:
 	/* Marks the total number of multiviews being used by the current camera. */
 	uint32_t usedViews = 1;
@@ -140,6 +179,10 @@ class Camera : public StaticFactory
 	/* Marks the maximum number of views this camera can support, which can be possibly less than MAX_MULTIVIEW. */
 	uint32_t maxMultiview = MAX_MULTIVIEW;
 
+	/* Frustum culling results from the last recorded frame */
+	uint32_t visibleEntityCount = 0;
+	uint32_t culledEntityCount = 0;
+
 	/* Marks when this camera should render during a frame. */
 	uint32_t renderOrder = 0;
 
@@ -154,9 +197,6 @@ class Camera : public StaticFactory
 		Handles all multiviews at once. */
 	std::vector<vk::Framebuffer> framebuffers;
 
-	/* The vulkan command buffer handle, used to record the renderpass. */
-	vk::CommandBuffer command_buffer;
-
 	/* The texture component attached to the framebuffer, which will be rendered to. */
 	Texture *renderTexture = nullptr;
 	
@@ -179,20 +219,14 @@ class Camera : public StaticFactory
 		if 1, it's inferred that a resolve texture is not required.  */
 	uint32_t msaa_samples = 1;
 
-	/* A list of the camera components, allocated statically */
-	static Camera cameras[MAX_CAMERAS];
+	/* A list of the camera components, stored in chunks which grow as cameras are added */
+	static SlotMap<Camera> cameras;
 	
 	/* A lookup table of name to camera id */
 	static std::map<std::string, uint32_t> lookupTable;
 	
-	/* A pointer to the mapped camera SSBO. This memory is shared between the GPU and CPU. */
-	static CameraStruct *pinnedMemory;
-	
-	/* A vulkan buffer handle corresponding to the material SSBO */
-	static vk::Buffer ssbo;
-	
-	/* The corresponding material SSBO memory. */
-	static vk::DeviceMemory ssboMemory;
+	/* The mapped camera SSBO. This memory is shared between the GPU and CPU, and is reallocated as the camera count grows. */
+	static Libraries::StorageBuffer ssbo;
 
 	/* Allocates (and possibly frees existing) textures, renderpass, and framebuffer required for rendering. */
 	void setup(bool allow_recording = false, bool cubemap = false, uint32_t tex_width = 0, uint32_t tex_height = 0, uint32_t msaa_samples = 1, uint32_t layers = 1);
@@ -203,8 +237,8 @@ class Camera : public StaticFactory
 	/* Creates a vulkan framebuffer handle used by the renderpass, which binds image views to the framebuffer attachments. */
 	void create_frame_buffers(uint32_t layers);
 
-	/* Creates a vulkan commandbuffer handle used to record the renderpass. */
-	void create_command_buffer();
+	/* Records the viewport and scissor covering this camera's texture */
+	void set_viewport_and_scissor(vk::CommandBuffer command_buffer);
 
 	/* Updates the usedViews field to account for a new multiview. This is fixed to the allocated texture layers 
 		when recording is enabled. */
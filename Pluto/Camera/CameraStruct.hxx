@@ -4,6 +4,7 @@
 #define MAX_MULTIVIEW 6
 #endif
 
+/* The initial number of camera slots. Storage and the camera SSBO grow past this at runtime. */
 #ifndef MAX_CAMERAS
 #define MAX_CAMERAS 256
 #endif
@@ -2,14 +2,14 @@
 
 #include "Pluto/Libraries/GLFW/GLFW.hxx"
 
-Entity Entity::entities[MAX_ENTITIES];
-EntityStruct* Entity::pinnedMemory;
+SlotMap<Entity> Entity::entities(MAX_ENTITIES);
 std::map<std::string, uint32_t> Entity::lookupTable;
-vk::Buffer Entity::ssbo;
-vk::DeviceMemory Entity::ssboMemory;
+Libraries::StorageBuffer Entity::ssbo;
 std::map<std::string, uint32_t> Entity::windowToEntity;
 std::map<uint32_t, std::string> Entity::entityToWindow;
 uint32_t Entity::entityToVR = -1;
+std::vector<uint32_t> Entity::lightEntities;
+std::mutex Entity::lightEntitiesMutex;
 
 Entity::Entity() {
     this->initialized = false;
@@ -54,6 +54,8 @@ void Entity::set_transform(int32_t transform_id)
     if (transform_id < -1) 
         throw std::runtime_error( std::string("Transform id must be greater than or equal to -1"));
     this->entity_struct.transform_id = transform_id;
+    mark_dirty();
+    link_transforms();
 }
 
 void Entity::set_transform(Transform* transform) 
@@ -61,11 +63,16 @@ void Entity::set_transform(Transform* transform)
     if (!transform) 
         throw std::runtime_error( std::string("Invalid transform handle."));
     this->entity_struct.transform_id = transform->get_id();
+    mark_dirty();
+    link_transforms();
 }
 
 void Entity::clear_transform()
 {
+    auto transform = GetValidTransform(this->entity_struct.transform_id);
+    if (transform && parent != -1) transform->clear_parent();
     this->entity_struct.transform_id = -1;
+    mark_dirty();
 }
 
 int32_t Entity::get_transform() 
@@ -78,6 +85,7 @@ void Entity::set_camera(int32_t camera_id)
     if (camera_id < -1) 
         throw std::runtime_error( std::string("Camera id must be greater than or equal to -1"));
     this->entity_struct.camera_id = camera_id;
+    mark_dirty();
 }
 
 void Entity::set_camera(Camera *camera) 
@@ -85,11 +93,13 @@ void Entity::set_camera(Camera *camera)
     if (!camera)
         throw std::runtime_error( std::string("Invalid camera handle."));
     this->entity_struct.camera_id = camera->get_id();
+    mark_dirty();
 }
 
 void Entity::clear_camera()
 {
     this->entity_struct.camera_id = -1;
+    mark_dirty();
 }
 
 int32_t Entity::get_camera() 
@@ -102,6 +112,7 @@ void Entity::set_material(int32_t material_id)
     if (material_id < -1) 
         throw std::runtime_error( std::string("Material id must be greater than or equal to -1"));
     this->entity_struct.material_id = material_id;
+    mark_dirty();
 }
 
 void Entity::set_material(Material *material) 
@@ -109,11 +120,13 @@ void Entity::set_material(Material *material)
     if (!material)
         throw std::runtime_error( std::string("Invalid material handle."));
     this->entity_struct.material_id = material->get_id();
+    mark_dirty();
 }
 
 void Entity::clear_material()
 {
     this->entity_struct.material_id = -1;
+    mark_dirty();
 }
 
 int32_t Entity::get_material() 
@@ -126,6 +139,8 @@ void Entity::set_light(int32_t light_id)
     if (light_id < -1) 
         throw std::runtime_error( std::string("Light id must be greater than or equal to -1"));
     this->entity_struct.light_id = light_id;
+    mark_dirty();
+    update_light_registration();
 }
 
 void Entity::set_light(Light* light) 
@@ -133,11 +148,15 @@ void Entity::set_light(Light* light)
     if (!light) 
         throw std::runtime_error( std::string("Invalid light handle."));
     this->entity_struct.light_id = light->get_id();
+    mark_dirty();
+    update_light_registration();
 }
 
 void Entity::clear_light()
 {
     this->entity_struct.light_id = -1;
+    mark_dirty();
+    update_light_registration();
 }
 
 int32_t Entity::get_light() 
@@ -145,11 +164,45 @@ int32_t Entity::get_light()
     return this->entity_struct.light_id;
 }
 
+void Entity::update_light_registration()
+{
+    if (!initialized) return;
+    if (entity_struct.light_id == -1) {
+        UnregisterLight(id);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(lightEntitiesMutex);
+    if (lightEntityIndex != -1) return;
+    lightEntityIndex = (int32_t) lightEntities.size();
+    lightEntities.push_back(id);
+}
+
+void Entity::UnregisterLight(uint32_t id)
+{
+    std::lock_guard<std::mutex> lock(lightEntitiesMutex);
+    int32_t index = entities[id].lightEntityIndex;
+    if (index == -1) return;
+
+    uint32_t last = lightEntities.back();
+    lightEntities[index] = last;
+    entities[last].lightEntityIndex = index;
+    lightEntities.pop_back();
+    entities[id].lightEntityIndex = -1;
+}
+
+std::vector<uint32_t> Entity::GetLightEntities()
+{
+    std::lock_guard<std::mutex> lock(lightEntitiesMutex);
+    return lightEntities;
+}
+
 void Entity::set_mesh(int32_t mesh_id) 
 {
     if (mesh_id < -1) 
         throw std::runtime_error( std::string("Mesh id must be greater than or equal to -1"));
     this->entity_struct.mesh_id = mesh_id;
+    mark_dirty();
 }
 
 void Entity::set_mesh(Mesh* mesh) 
@@ -157,11 +210,13 @@ void Entity::set_mesh(Mesh* mesh)
     if (!mesh) 
         throw std::runtime_error( std::string("Invalid mesh handle."));
     this->entity_struct.mesh_id = mesh->get_id();
+    mark_dirty();
 }
 
 void Entity::clear_mesh()
 {
     this->entity_struct.mesh_id = -1;
+    mark_dirty();
 }
 
 int32_t Entity::get_mesh() 
@@ -219,71 +274,99 @@ void Entity::connect_to_vr()
 void Entity::setParent(uint32_t parent) {
     this->parent = parent;
     entities[parent].children.insert(this->id);
+    link_transforms();
 }
 
 void Entity::addChild(uint32_t object) {
     children.insert(object);
     entities[object].parent = this->id;
+    entities[object].link_transforms();
 }
 
 void Entity::removeChild(uint32_t object) {
     children.erase(object);
+    if (entities[object].parent != (int32_t) this->id) return;
+    entities[object].parent = -1;
+    auto transform = GetValidTransform(entities[object].entity_struct.transform_id);
+    if (transform) transform->clear_parent();
+}
+
+Transform* Entity::GetValidTransform(int32_t transform_id) {
+    if (transform_id < 0) return nullptr;
+    auto transform = Transform::GetFromIndex((uint32_t) transform_id);
+    if (!transform || !transform->is_initialized()) return nullptr;
+    return transform;
+}
+
+void Entity::link_transforms() {
+    auto transform = GetValidTransform(this->entity_struct.transform_id);
+    if (!transform) return;
+
+    if (parent >= 0 && (uint32_t) parent < entities.get_capacity()) {
+        auto parent_transform = GetValidTransform(entities[parent].entity_struct.transform_id);
+        if (parent_transform && parent_transform != transform) transform->set_parent(parent_transform);
+    }
+
+    for (auto child : children) {
+        if (child < 0 || (uint32_t) child >= entities.get_capacity()) continue;
+        auto child_transform = GetValidTransform(entities[child].entity_struct.transform_id);
+        if (child_transform && child_transform != transform) child_transform->set_parent(transform);
+    }
 }
 
 /* SSBO logic */
 void Entity::Initialize()
 {
-    auto vulkan = Libraries::Vulkan::Get();
-    auto device = vulkan->get_device();
-    auto physical_device = vulkan->get_physical_device();
-
-    vk::BufferCreateInfo bufferInfo = {};
-    bufferInfo.size = MAX_ENTITIES * sizeof(EntityStruct);
-    bufferInfo.usage = vk::BufferUsageFlagBits::eStorageBuffer;
-    bufferInfo.sharingMode = vk::SharingMode::eExclusive;
-    ssbo = device.createBuffer(bufferInfo);
+    ssbo.create(entities.get_capacity() * sizeof(EntityStruct));
+    entities.mark_all_dirty();
+}
 
-    vk::MemoryRequirements memReqs = device.getBufferMemoryRequirements(ssbo);
-    vk::MemoryAllocateInfo allocInfo = {};
-    allocInfo.allocationSize = memReqs.size;
+void Entity::UploadSSBO(uint32_t frame)
+{
+    if (!ssbo.is_created()) return;
 
-    vk::PhysicalDeviceMemoryProperties memProperties = physical_device.getMemoryProperties();
-    vk::MemoryPropertyFlags properties = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
-    allocInfo.memoryTypeIndex = vulkan->find_memory_type(memReqs.memoryTypeBits, properties);
+    /* Grow the SSBO if entities were added since the last upload. The staging copy is kept, so nothing needs to be re-marked. */
+    ssbo.reserve(entities.get_capacity() * sizeof(EntityStruct));
 
-    ssboMemory = device.allocateMemory(allocInfo);
-    device.bindBufferMemory(ssbo, ssboMemory, 0);
+    /* Copy only the modified entities into the staging copy, then bring this frame's copy of the SSBO up to date */
+    EntityStruct* entity_structs = (EntityStruct*) ssbo.get_staging();
+    entities.consume_dirty_ranges([&](uint32_t first, uint32_t count) {
+        for (uint32_t i = first; i < first + count; ++i)
+            entity_structs[i] = entities[i].entity_struct;
+        ssbo.mark_range(first * sizeof(EntityStruct), count * sizeof(EntityStruct));
+    });
+    ssbo.flush(frame);
+}
 
-    /* Pin the buffer */
-    pinnedMemory = (EntityStruct*) device.mapMemory(ssboMemory, 0, MAX_ENTITIES * sizeof(EntityStruct));
+vk::Buffer Entity::GetSSBO()
+{
+    return ssbo.get_buffer();
 }
 
-void Entity::UploadSSBO()
+uint32_t Entity::GetSSBOSize()
 {
-    if (pinnedMemory == nullptr) return;
-    EntityStruct entity_structs[MAX_ENTITIES];
-    
-    /* TODO: remove this for loop */
-    for (int i = 0; i < MAX_ENTITIES; ++i) {
-        // if (!entities[i].is_initialized()) continue;
-        /* TODO: account for parent transforms */
-        entity_structs[i] = entities[i].entity_struct;
-    };
+    return (uint32_t) ssbo.get_size();
+}
 
-    auto device = Libraries::Vulkan::Get()->get_device();
+uint32_t Entity::GetSSBOOffset(uint32_t frame)
+{
+    return (uint32_t) ssbo.get_offset(frame);
+}
 
-    /* Copy to GPU mapped memory */
-    memcpy(pinnedMemory, entity_structs, sizeof(entity_structs));
+uint64_t Entity::GetSSBOBytesUploaded()
+{
+    return ssbo.get_bytes_uploaded();
 }
 
-vk::Buffer Entity::GetSSBO()
+uint64_t Entity::GetSSBOGeneration()
 {
-    return ssbo;
+    return ssbo.get_generation();
 }
 
-uint32_t Entity::GetSSBOSize()
+void Entity::mark_dirty()
 {
-    return MAX_ENTITIES * sizeof(EntityStruct);
+    if (!initialized) return;
+    entities.mark_dirty(id);
 }
 
 void Entity::CleanUp()
@@ -295,36 +378,41 @@ void Entity::CleanUp()
     if (device == vk::Device())
         throw std::runtime_error( std::string("Invalid vulkan device"));
     
-    device.destroyBuffer(ssbo);
-    device.unmapMemory(ssboMemory);
-    device.freeMemory(ssboMemory);
+    ssbo.destroy();
 }	
 
 /* Static Factory Implementations */
 Entity* Entity::Create(std::string name) {
-    return StaticFactory::Create(name, "Entity", lookupTable, entities, MAX_ENTITIES);
+    return StaticFactory::Create(name, "Entity", lookupTable, entities);
 }
 
 Entity* Entity::Get(std::string name) {
-    return StaticFactory::Get(name, "Entity", lookupTable, entities, MAX_ENTITIES);
+    return StaticFactory::Get(name, "Entity", lookupTable, entities);
 }
 
 Entity* Entity::Get(uint32_t id) {
-    return StaticFactory::Get(id, "Entity", lookupTable, entities, MAX_ENTITIES);
+    return StaticFactory::Get(id, "Entity", lookupTable, entities);
+}
+
+Entity* Entity::Get(uint32_t id, uint32_t generation) {
+    return StaticFactory::Get(id, generation, "Entity", lookupTable, entities);
 }
 
 void Entity::Delete(std::string name) {
-    StaticFactory::Delete(name, "Entity", lookupTable, entities, MAX_ENTITIES);
+    auto it = lookupTable.find(name);
+    if (it != lookupTable.end()) UnregisterLight(it->second);
+    StaticFactory::Delete(name, "Entity", lookupTable, entities);
 }
 
 void Entity::Delete(uint32_t id) {
-    StaticFactory::Delete(id, "Entity", lookupTable, entities, MAX_ENTITIES);
+    if (id < entities.get_capacity()) UnregisterLight(id);
+    StaticFactory::Delete(id, "Entity", lookupTable, entities);
 }
 
-Entity* Entity::GetFront() {
-    return entities;
+Entity* Entity::GetFromIndex(uint32_t index) {
+    return StaticFactory::GetFromIndex(index, entities);
 }
 
 uint32_t Entity::GetCount() {
-    return MAX_ENTITIES;
+    return entities.get_capacity();
 }
@@ -6,6 +6,7 @@
 
 #include "Pluto/Tools/StaticFactory.hxx"
 #include "Pluto/Libraries/Vulkan/Vulkan.hxx"
+#include "Pluto/Libraries/Vulkan/StorageBuffer.hxx"
 #include "Pluto/Camera/Camera.hxx"
 #include "Pluto/Transform/Transform.hxx"
 #include "Pluto/Material/Material.hxx"
@@ -13,7 +14,9 @@
 #include "Pluto/Mesh/Mesh.hxx"
 #include "Pluto/Entity/EntityStruct.hxx"
 
+#include <mutex>
 #include <string>
+#include <vector>
 class Entity : public StaticFactory {
 private:
 	/* If an entity isn't active, its callbacks arent called */
@@ -27,29 +30,51 @@ private:
 	//std::map<std::type_index, std::vector<std::shared_ptr<Component>>> components;
 	
 	/* Static fields */
-	static Entity entities[MAX_ENTITIES];
-	static EntityStruct* pinnedMemory;
+	static SlotMap<Entity> entities;
     static std::map<std::string, uint32_t> lookupTable;
-    static vk::Buffer ssbo;
-    static vk::DeviceMemory ssboMemory;
+    static Libraries::StorageBuffer ssbo;
 
 	static std::map<std::string, uint32_t> windowToEntity;
 	static std::map<uint32_t, std::string> entityToWindow;
 	static uint32_t entityToVR;
 
+	/* Ids of the entities with a light component, so renderers don't need to search every entity for lights.
+		Each entity holds its index into this list, so entities can be removed by swapping with the last one. */
+	static std::vector<uint32_t> lightEntities;
+	static std::mutex lightEntitiesMutex;
+	int32_t lightEntityIndex = -1;
+
+	/* Adds or removes this entity from the light entity list, depending on whether it has a light */
+	void update_light_registration();
+	static void UnregisterLight(uint32_t id);
+
+	/* Returns the transform component with the given id, or nullptr if there isn't one */
+	static Transform* GetValidTransform(int32_t transform_id);
+
+	/* Mirrors the entity hierarchy onto the transform hierarchy, so that this entity's transform is parented 
+		to its parent entity's transform, and its children's transforms are parented to this entity's transform. */
+	void link_transforms();
+
 public:
 	static Entity* Create(std::string name);
 	static Entity* Get(std::string name);
 	static Entity* Get(uint32_t id);
-	static Entity* GetFront();
+	static Entity* Get(uint32_t id, uint32_t generation);
+	static Entity* GetFromIndex(uint32_t index);
 	static uint32_t GetCount();
 	static void Delete(std::string name);
 	static void Delete(uint32_t id);
+
+	/* Returns the ids of every entity with a light component. Kept up to date as lights are set and cleared. */
+	static std::vector<uint32_t> GetLightEntities();
 	
     static void Initialize();
-    static void UploadSSBO();
+    static void UploadSSBO(uint32_t frame);
     static vk::Buffer GetSSBO();
 	static uint32_t GetSSBOSize();
+	static uint32_t GetSSBOOffset(uint32_t frame);
+	static uint64_t GetSSBOBytesUploaded();
+	static uint64_t GetSSBOGeneration();
     static void CleanUp();	
 
 	Entity();
@@ -58,6 +83,8 @@ public:
 
 	std::string to_string();
 
+	void mark_dirty();
+
 	void connect_to_window(std::string key);
 
 	void connect_to_vr();
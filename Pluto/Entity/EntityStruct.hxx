@@ -4,6 +4,7 @@
 #define int32_t int
 #endif
 
+/* The initial number of entity slots. Storage and the entity SSBO grow past this at runtime. */
 #ifndef MAX_ENTITIES
 #define MAX_ENTITIES 256
 #endif
@@ -108,6 +108,7 @@ namespace Libraries {
         window.ptr = ptr;
         window.swapchain_out_of_date = true;
         Windows()[key] = window;
+        windows_changed = true;
         return true;
     }
 
@@ -491,7 +492,7 @@ namespace Libraries {
 
             vk::CommandBuffer cmdBuffer = vulkan->begin_one_time_graphics_command();
             window.textures[i]->setImageLayout( cmdBuffer, data.colorImage, vk::ImageLayout::eUndefined, vk::ImageLayout::ePresentSrcKHR, subresourceRange);
-            auto fut = vulkan->end_one_time_graphics_command(cmdBuffer, "Transition swapchain image", true, true);
+            auto fut = vulkan->end_one_time_graphics_command(cmdBuffer, "Transition swapchain image", true);
         }
         
         window.swapchain_out_of_date = false;
@@ -504,6 +505,11 @@ namespace Libraries {
             throw std::runtime_error( std::string("Error: Window " + key + " does not exist, cannot mark swapchain as out of date"));
 
         Windows()[key].swapchain_out_of_date = true;
+        windows_changed = true;
+    }
+
+    bool GLFW::consume_window_changes() {
+        return windows_changed.exchange(false);
     }
 
     bool GLFW::is_swapchain_out_of_date(std::string key) {
@@ -817,22 +823,27 @@ namespace Libraries {
             if (!window.second.swapchain) continue;
             if (window.second.swapchain_out_of_date) continue;
 
-            vk::Fence acquireFence;
+            /* Fences come from this thread's pool, so acquiring doesn't create and destroy one per window per frame */
+            vk::Fence acquireFence = vulkan->get_thread_fence();
+            bool signaled = true;
             try {
                 /* Acquire a swapchain image, waiting on the acquire fence. 
                 I believe this fence is used for handling vsync, but I could be wrong... */
                 
-                acquireFence = device.createFence(vk::FenceCreateInfo());
                 auto result = device.acquireNextImageKHR(window.second.swapchain, std::numeric_limits<uint32_t>::max(), window.second.imageAvailableSemaphores[current_frame], acquireFence);
                 window.second.current_image_index = result.value;
                 //auto swapchain_texture = glfw->get_texture(keys[i], swapchain_index);
-                device.waitForFences(acquireFence, true, 10000000000);
-                device.destroyFence(acquireFence);
+                if ((result.result == vk::Result::eSuccess) || (result.result == vk::Result::eSuboptimalKHR))
+                    signaled = (device.waitForFences(acquireFence, true, 10000000000) == vk::Result::eSuccess);
             } catch(...)
             {
-                if (acquireFence)
-                    device.destroyFence(acquireFence);
+                set_swapchain_out_of_date(window.first);
+            }
 
+            /* A fence the acquire may still signal can't be reset and reused, so it's destroyed instead */
+            if (signaled) vulkan->recycle_thread_fence(acquireFence);
+            else {
+                device.destroyFence(acquireFence);
                 set_swapchain_out_of_date(window.first);
             }
         }
@@ -5,6 +5,7 @@
 #include <GLFW/glfw3.h>
 #include <iostream>
 
+#include <atomic>
 #include <thread>
 #include <iostream>
 #include <assert.h>
@@ -52,6 +53,9 @@ namespace Libraries {
         void set_swapchain_out_of_date(std::string key);
         bool is_swapchain_out_of_date(std::string key);
         void update_swapchains();
+
+        /* Returns true if a window was created, resized, or had its swapchain invalidated since the last call */
+        bool consume_window_changes();
         bool set_cursor_pos(std::string key, double xpos, double ypos);
         std::vector<double> get_cursor_pos(std::string key);
         bool set_button_data(std::string key, int button, int action, int mods);
@@ -88,6 +92,9 @@ namespace Libraries {
 
         // mutex used to guarantee exclusive access to windows
         std::shared_ptr<std::mutex> window_mutex;
+
+        // set when a window needs to be redrawn, see consume_window_changes
+        std::atomic<bool> windows_changed {false};
         
         struct Window {
             std::vector<vk::Semaphore> imageAvailableSemaphores;
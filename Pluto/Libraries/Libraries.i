@@ -38,11 +38,11 @@ using namespace Libraries;
 %nodefaultctor SpaceMouse;
 %nodefaultdtor SpaceMouse;
 
-// Issue where swig tries to construct a std future from non-existant copy constructor...
-%ignore Libraries::Vulkan::enqueue_graphics_commands(std::vector<vk::CommandBuffer> commandBuffers, std::vector<vk::Semaphore> waitSemaphores, std::vector<vk::PipelineStageFlags> waitDstStageMasks, std::vector<vk::Semaphore> signalSemaphores, vk::Fence fence, std::string hint);
+// Swig can't wrap vectors of vulkan handles, so submissions are only made from C++
+%ignore Libraries::Vulkan::submit_graphics_commands(std::vector<vk::CommandBuffer> commandBuffers, std::vector<vk::Semaphore> waitSemaphores, std::vector<vk::PipelineStageFlags> waitDstStageMasks, std::vector<vk::Semaphore> signalSemaphores, vk::Fence fence, std::string hint);
 %ignore Libraries::Vulkan::enqueue_present_commands(std::vector<vk::SwapchainKHR> swapchains, std::vector<uint32_t> swapchain_indices, std::vector<vk::Semaphore> waitSemaphores);
 
-%ignore CommandQueueItem;
+%ignore PresentQueueItem;
 
 %include "./../Tools/Singleton.hxx";
 %include "./GLFW/GLFW.hxx";
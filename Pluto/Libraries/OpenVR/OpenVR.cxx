@@ -661,6 +661,9 @@ bool OpenVR::submit_textures()
 	left_eye.eColorSpace = ColorSpace_Gamma; // Is this optimal?
 	left_eye.handle = (void *)&left_texture_data;
 
+	/* The compositor submits to our graphics queue, which other threads may be submitting to as well */
+	auto queue_lock = vk->get_graphics_submission_queue()->lock();
+
 	{
 		auto error = VRCompositor()->Submit(Eye_Left, &left_eye, &bounds);
 		if (error != EVRCompositorError::VRCompositorError_None)
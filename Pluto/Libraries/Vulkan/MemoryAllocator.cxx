@@ -0,0 +1,313 @@
+#include "MemoryAllocator.hxx"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+namespace Libraries {
+
+/* Blocks are this large, unless the heap is small enough that a few blocks would exhaust it */
+static const vk::DeviceSize DefaultBlockSize = 64ull * 1024ull * 1024ull;
+
+void MemoryAllocator::initialize(vk::Device device, vk::PhysicalDevice physical_device)
+{
+    this->device = device;
+    memoryProperties = physical_device.getMemoryProperties();
+    statistics = MemoryStatistics();
+
+    /* One pool of linear blocks and one of optimally tiled blocks per memory type */
+    pools.clear();
+    pools.resize(memoryProperties.memoryTypeCount * 2);
+    for (uint32_t type = 0; type < memoryProperties.memoryTypeCount; ++type) {
+        vk::DeviceSize heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[type].heapIndex].size;
+        vk::DeviceSize blockSize = DefaultBlockSize;
+        while (blockSize > MinRangeSize * 4096 && blockSize * 8 > heapSize) blockSize /= 2;
+        for (uint32_t linear = 0; linear < 2; ++linear) {
+            Pool &pool = pools[type * 2 + linear];
+            pool.memoryType = type;
+            pool.linear = (linear == 1);
+            pool.blockSize = blockSize;
+        }
+    }
+}
+
+void MemoryAllocator::destroy()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &pool : pools) {
+        for (auto &block : pool.blocks) {
+            if (!block) continue;
+            if (block->mapped) device.unmapMemory(block->memory);
+            device.freeMemory(block->memory);
+        }
+        pool.blocks.clear();
+    }
+    pools.clear();
+    statistics = MemoryStatistics();
+}
+
+uint32_t MemoryAllocator::find_memory_type(uint32_t type_bits, vk::MemoryPropertyFlags properties) const
+{
+    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+        if ((type_bits & (1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+            return i;
+    throw std::runtime_error(std::string("Error: no memory type with properties " + vk::to_string(properties)));
+}
+
+vk::DeviceMemory MemoryAllocator::allocate_device_memory(uint32_t memory_type, vk::DeviceSize size, uint8_t **mapped)
+{
+    vk::MemoryAllocateInfo allocInfo;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memory_type;
+    vk::DeviceMemory memory = device.allocateMemory(allocInfo);
+    statistics.deviceAllocationsMade++;
+    statistics.bytesReserved += size;
+
+    /* Host visible memory is mapped once, for as long as it's allocated */
+    *mapped = nullptr;
+    if (memoryProperties.memoryTypes[memory_type].propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible)
+        *mapped = (uint8_t*) device.mapMemory(memory, 0, VK_WHOLE_SIZE);
+    return memory;
+}
+
+bool MemoryAllocator::take_range(Block &block, uint32_t level, vk::DeviceSize &offset)
+{
+    /* Find the smallest free range at least as large as requested */
+    int32_t found = (int32_t) level;
+    while (found >= 0 && block.freeRanges[found].empty()) --found;
+    if (found < 0) return false;
+
+    /* Split it in half until it's the requested size, freeing the upper halves. Lower offsets
+        are taken first, which keeps allocations packed towards the start of the block. */
+    offset = *block.freeRanges[found].begin();
+    block.freeRanges[found].erase(block.freeRanges[found].begin());
+    for (uint32_t l = (uint32_t) found + 1; l <= level; ++l)
+        block.freeRanges[l].insert(offset + (block.size >> l));
+    return true;
+}
+
+void MemoryAllocator::return_range(Block &block, uint32_t level, vk::DeviceSize offset)
+{
+    while (level > 0) {
+        vk::DeviceSize buddy = offset ^ (block.size >> level);
+        auto it = block.freeRanges[level].find(buddy);
+        if (it == block.freeRanges[level].end()) break;
+        block.freeRanges[level].erase(it);
+        offset = std::min(offset, buddy);
+        --level;
+    }
+    block.freeRanges[level].insert(offset);
+}
+
+MemoryAllocation MemoryAllocator::place(uint32_t pool_index, uint32_t level, vk::DeviceSize size, uint32_t skip_block, bool grow)
+{
+    Pool &pool = pools[pool_index];
+    vk::DeviceSize rangeSize = pool.blockSize >> level;
+
+    MemoryAllocation allocation;
+    uint32_t blockIndex = ~0u;
+    vk::DeviceSize offset = 0;
+    for (uint32_t i = 0; i < pool.blocks.size() && blockIndex == ~0u; ++i) {
+        if (i == skip_block || !pool.blocks[i]) continue;
+        if (pool.blocks[i]->size - pool.blocks[i]->used < rangeSize) continue;
+        if (take_range(*pool.blocks[i], level, offset)) blockIndex = i;
+    }
+
+    if (blockIndex == ~0u) {
+        if (!grow) return allocation;
+
+        auto block = std::make_unique<Block>();
+        block->size = pool.blockSize;
+        block->memory = allocate_device_memory(pool.memoryType, pool.blockSize, &block->mapped);
+        uint32_t levels = 1;
+        while ((pool.blockSize >> levels) >= MinRangeSize) ++levels;
+        block->freeRanges.resize(levels);
+        block->freeRanges[0].insert(0);
+        statistics.blockCount++;
+
+        /* Reuse the slot of a released block, so block indices stay small */
+        auto slot = std::find(pool.blocks.begin(), pool.blocks.end(), nullptr);
+        if (slot == pool.blocks.end()) slot = pool.blocks.insert(pool.blocks.end(), nullptr);
+        *slot = std::move(block);
+        blockIndex = (uint32_t) (slot - pool.blocks.begin());
+        take_range(*pool.blocks[blockIndex], level, offset);
+    }
+
+    Block &block = *pool.blocks[blockIndex];
+    block.used += rangeSize;
+    block.liveRanges[offset] = {level, size};
+
+    allocation.memory = block.memory;
+    allocation.offset = offset;
+    allocation.size = size;
+    allocation.mapped = (block.mapped) ? block.mapped + offset : nullptr;
+    allocation.pool = pool_index;
+    allocation.block = blockIndex;
+    allocation.level = level;
+
+    statistics.allocationCount++;
+    statistics.bytesAllocated += rangeSize;
+    statistics.bytesRequested += size;
+    return allocation;
+}
+
+MemoryAllocation MemoryAllocator::allocate(const vk::MemoryRequirements &requirements, vk::MemoryPropertyFlags properties, bool linear)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!device)
+        throw std::runtime_error(std::string("Error: memory allocator is not initialized"));
+
+    uint32_t memoryType = find_memory_type(requirements.memoryTypeBits, properties);
+    uint32_t poolIndex = memoryType * 2 + ((linear) ? 1 : 0);
+    Pool &pool = pools[poolIndex];
+
+    /* Ranges are powers of two, starting at offsets which are multiples of their size, so
+        rounding up to the alignment is enough to align them */
+    vk::DeviceSize rangeSize = std::max(MinRangeSize, std::max(requirements.size, requirements.alignment));
+    uint32_t level = 0;
+    while ((pool.blockSize >> (level + 1)) >= rangeSize && (pool.blockSize >> (level + 1)) >= MinRangeSize) ++level;
+
+    /* Anything taking more than half a block gets its own device memory */
+    if (level == 0) {
+        MemoryAllocation allocation;
+        uint8_t *mapped;
+        allocation.memory = allocate_device_memory(memoryType, requirements.size, &mapped);
+        allocation.size = requirements.size;
+        allocation.mapped = mapped;
+        allocation.pool = poolIndex;
+        statistics.dedicatedAllocationCount++;
+        statistics.allocationCount++;
+        statistics.bytesAllocated += requirements.size;
+        statistics.bytesRequested += requirements.size;
+        return allocation;
+    }
+
+    return place(poolIndex, level, requirements.size, ~0u, true);
+}
+
+MemoryAllocation MemoryAllocator::allocate_buffer(vk::Buffer buffer, vk::MemoryPropertyFlags properties)
+{
+    auto allocation = allocate(device.getBufferMemoryRequirements(buffer), properties, true);
+    device.bindBufferMemory(buffer, allocation.memory, allocation.offset);
+    return allocation;
+}
+
+MemoryAllocation MemoryAllocator::allocate_image(vk::Image image, vk::MemoryPropertyFlags properties)
+{
+    /* Images are assumed to be optimally tiled, which is the only tiling this engine creates them with */
+    auto allocation = allocate(device.getImageMemoryRequirements(image), properties, false);
+    device.bindImageMemory(image, allocation.memory, allocation.offset);
+    return allocation;
+}
+
+void MemoryAllocator::release_if_unused(Pool &pool, uint32_t block_index)
+{
+    if (pool.blocks[block_index]->used != 0) return;
+
+    /* Hold on to one empty block, so allocating and freeing around a block boundary doesn't thrash */
+    bool otherEmpty = false;
+    for (uint32_t i = 0; i < pool.blocks.size(); ++i)
+        if (i != block_index && pool.blocks[i] && pool.blocks[i]->used == 0) otherEmpty = true;
+    if (!otherEmpty) return;
+
+    Block &block = *pool.blocks[block_index];
+    if (block.mapped) device.unmapMemory(block.memory);
+    device.freeMemory(block.memory);
+    statistics.bytesReserved -= block.size;
+    statistics.blockCount--;
+    pool.blocks[block_index].reset();
+}
+
+void MemoryAllocator::free(MemoryAllocation &allocation)
+{
+    if (!allocation) return;
+    std::lock_guard<std::mutex> lock(mutex);
+
+    statistics.allocationCount--;
+    statistics.bytesRequested -= allocation.size;
+
+    if (allocation.block == ~0u) {
+        /* Dedicated allocation */
+        if (allocation.mapped) device.unmapMemory(allocation.memory);
+        device.freeMemory(allocation.memory);
+        statistics.dedicatedAllocationCount--;
+        statistics.bytesReserved -= allocation.size;
+        statistics.bytesAllocated -= allocation.size;
+    }
+    else {
+        Pool &pool = pools[allocation.pool];
+        Block &block = *pool.blocks[allocation.block];
+        vk::DeviceSize rangeSize = block.size >> allocation.level;
+        block.liveRanges.erase(allocation.offset);
+        return_range(block, allocation.level, allocation.offset);
+        block.used -= rangeSize;
+        statistics.bytesAllocated -= rangeSize;
+        release_if_unused(pool, allocation.block);
+    }
+
+    allocation = MemoryAllocation();
+}
+
+uint32_t MemoryAllocator::defragment(const std::function<bool(const MemoryAllocation &from, const MemoryAllocation &to)> &move)
+{
+    uint32_t moved = 0;
+    for (uint32_t p = 0; p < (uint32_t) pools.size(); ++p) {
+        /* Only blocks less than half used are worth emptying. Start with the emptiest. */
+        std::vector<std::pair<vk::DeviceSize, uint32_t>> candidates;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto &blocks = pools[p].blocks;
+            for (uint32_t b = 0; b < blocks.size(); ++b)
+                if (blocks[b] && blocks[b]->used > 0 && blocks[b]->used < blocks[b]->size / 2)
+                    candidates.push_back({blocks[b]->used, b});
+        }
+        if (candidates.size() < 2) continue;
+        std::sort(candidates.begin(), candidates.end());
+
+        for (auto &candidate : candidates) {
+            uint32_t b = candidate.second;
+
+            /* Snapshot the block's ranges, since move may free or allocate memory */
+            std::vector<MemoryAllocation> ranges;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                auto &block = pools[p].blocks[b];
+                if (!block) continue;
+                for (auto &live : block->liveRanges) {
+                    MemoryAllocation range;
+                    range.memory = block->memory;
+                    range.offset = live.first;
+                    range.size = live.second.second;
+                    range.mapped = (block->mapped) ? block->mapped + live.first : nullptr;
+                    range.pool = p;
+                    range.block = b;
+                    range.level = live.second.first;
+                    ranges.push_back(range);
+                }
+            }
+
+            for (auto &from : ranges) {
+                MemoryAllocation to;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    to = place(p, from.level, from.size, b, false);
+                }
+                if (!to) break;
+                if (move(from, to)) {
+                    free(from);
+                    moved++;
+                }
+                else free(to);
+            }
+        }
+    }
+    return moved;
+}
+
+MemoryStatistics MemoryAllocator::get_statistics()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return statistics;
+}
+
+}
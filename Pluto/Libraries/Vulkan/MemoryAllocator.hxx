@@ -0,0 +1,124 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+
+namespace Libraries {
+    /* A range of device memory handed out by the memory allocator. Ranges in host visible memory
+        are mapped for as long as they're allocated, so mapped points at the start of the range. */
+    struct MemoryAllocation {
+        vk::DeviceMemory memory;
+        vk::DeviceSize offset = 0;
+        vk::DeviceSize size = 0;
+        void* mapped = nullptr;
+
+        /* Where the range came from. Dedicated allocations aren't part of a pool. */
+        uint32_t pool = ~0u;
+        uint32_t block = ~0u;
+        uint32_t level = 0;
+
+        explicit operator bool() const { return memory != vk::DeviceMemory(); }
+    };
+
+    /* Totals across every memory type */
+    struct MemoryStatistics {
+        uint32_t blockCount = 0;                 /* Device memory blocks ranges are placed in */
+        uint32_t dedicatedAllocationCount = 0;   /* Resources too large for a block, given their own device memory */
+        uint32_t allocationCount = 0;            /* Live ranges, including dedicated allocations */
+        vk::DeviceSize bytesReserved = 0;        /* Device memory held, in blocks or dedicated allocations */
+        vk::DeviceSize bytesAllocated = 0;       /* Bytes handed out, after rounding up to a power of two */
+        vk::DeviceSize bytesRequested = 0;       /* Bytes asked for */
+        uint64_t deviceAllocationsMade = 0;      /* Total calls to vkAllocateMemory since initialization */
+    };
+
+    /* Sub-allocates buffers and images out of large blocks of device memory, so that the number of
+        device allocations stays well under maxMemoryAllocationCount and the driver's allocation cost is
+        paid once per block. Each memory type has two pools of blocks, one for linear resources (buffers)
+        and one for optimally tiled images, so neighbouring resources never violate bufferImageGranularity.
+        Ranges are placed with a buddy allocator, which keeps every range aligned to its own size. */
+    class MemoryAllocator
+    {
+    public:
+        /* Must be called once the logical device exists */
+        void initialize(vk::Device device, vk::PhysicalDevice physical_device);
+
+        /* Frees every block. The caller must ensure the GPU is no longer using them. */
+        void destroy();
+
+        /* Allocates memory meeting the given requirements from the first memory type with the given properties.
+            Linear should be false for optimally tiled images. Throws if the memory can't be allocated. */
+        MemoryAllocation allocate(const vk::MemoryRequirements &requirements, vk::MemoryPropertyFlags properties, bool linear = true);
+
+        /* Allocates memory for the given buffer, and binds it */
+        MemoryAllocation allocate_buffer(vk::Buffer buffer, vk::MemoryPropertyFlags properties);
+
+        /* Allocates memory for the given image, and binds it */
+        MemoryAllocation allocate_image(vk::Image image, vk::MemoryPropertyFlags properties);
+
+        /* Returns a range to its block, and resets the allocation. Safe to call on an empty allocation.
+            The caller must ensure the GPU is no longer using the range. */
+        void free(MemoryAllocation &allocation);
+
+        /* Defragmentation hook. Tries to empty sparsely used blocks by moving their ranges into other blocks
+            of the same pool. For each range, move is given the old and new allocation, and should rebind
+            and copy whatever resource lives in the old range, returning false if it can't be moved. Emptied
+            blocks are released. Returns the number of ranges moved. */
+        uint32_t defragment(const std::function<bool(const MemoryAllocation &from, const MemoryAllocation &to)> &move);
+
+        MemoryStatistics get_statistics();
+
+    private:
+        /* Ranges are never smaller than this */
+        static const vk::DeviceSize MinRangeSize = 256;
+
+        struct Block {
+            vk::DeviceMemory memory;
+            uint8_t* mapped = nullptr;
+            vk::DeviceSize size = 0;
+            vk::DeviceSize used = 0;
+
+            /* Free range offsets, per level. Level 0 is the whole block, and each level halves the range size. */
+            std::vector<std::set<vk::DeviceSize>> freeRanges;
+
+            /* Live range offsets, mapped to their level and the size requested for them */
+            std::map<vk::DeviceSize, std::pair<uint32_t, vk::DeviceSize>> liveRanges;
+        };
+
+        struct Pool {
+            uint32_t memoryType = 0;
+            bool linear = true;
+            vk::DeviceSize blockSize = 0;
+            std::vector<std::unique_ptr<Block>> blocks;
+        };
+
+        vk::Device device;
+        vk::PhysicalDeviceMemoryProperties memoryProperties;
+        std::vector<Pool> pools;
+        std::mutex mutex;
+
+        MemoryStatistics statistics;
+
+        /* Returns the index of the first memory type allowed by type_bits with the given properties */
+        uint32_t find_memory_type(uint32_t type_bits, vk::MemoryPropertyFlags properties) const;
+
+        /* Allocates device memory, mapping it if it's host visible */
+        vk::DeviceMemory allocate_device_memory(uint32_t memory_type, vk::DeviceSize size, uint8_t **mapped);
+
+        /* Takes a range of the given level from a block, splitting larger ranges as needed. Returns false if the block is too full. */
+        bool take_range(Block &block, uint32_t level, vk::DeviceSize &offset);
+
+        /* Returns a range to a block, merging it with its buddy while the buddy is free */
+        void return_range(Block &block, uint32_t level, vk::DeviceSize offset);
+
+        /* Places a range of the given level in a pool, skipping the given block. Adds a block if none have room and grow is set. */
+        MemoryAllocation place(uint32_t pool_index, uint32_t level, vk::DeviceSize size, uint32_t skip_block, bool grow);
+
+        /* Releases a pool's block once it's empty, unless it's the pool's only empty block */
+        void release_if_unused(Pool &pool, uint32_t block_index);
+    };
+}
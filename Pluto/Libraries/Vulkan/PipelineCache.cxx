@@ -0,0 +1,226 @@
+#include "PipelineCache.hxx"
+
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+#include "Pluto/Tools/FileReader.hxx"
+
+namespace Libraries {
+
+void PipelineCache::initialize(vk::Device device, vk::PhysicalDevice physical_device, std::string cache_path)
+{
+    this->device = device;
+    properties = physical_device.getProperties();
+    statistics = PipelineCacheStatistics();
+
+    /* Caches are per device, so machines with more than one GPU don't overwrite each other's */
+    if (cache_path.empty()) {
+        std::string directory = GetDefaultCacheDirectory();
+        if (!directory.empty())
+            cache_path = directory + "/pipelines-" + std::to_string(properties.vendorID) + "-" + std::to_string(properties.deviceID) + ".bin";
+    }
+    cachePath = cache_path;
+
+    std::vector<uint8_t> data = load();
+
+    vk::PipelineCacheCreateInfo info;
+    info.initialDataSize = data.size();
+    info.pInitialData = data.empty() ? nullptr : data.data();
+    try {
+        pipelineCache = device.createPipelineCache(info);
+        statistics.loadedFromDisk = !data.empty();
+        statistics.loadedBytes = data.size();
+    } catch (std::exception &e) {
+        /* The driver rejected the data. Start over with an empty cache. */
+        std::cout << "Warning: unable to use the pipeline cache at " << cachePath << ". " << e.what() << std::endl;
+        pipelineCache = device.createPipelineCache(vk::PipelineCacheCreateInfo());
+    }
+}
+
+void PipelineCache::destroy()
+{
+    if (!device) return;
+
+    save();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &module : shaderModules)
+        device.destroyShaderModule(module.second);
+    shaderModules.clear();
+
+    if (pipelineCache) device.destroyPipelineCache(pipelineCache);
+    pipelineCache = vk::PipelineCache();
+    device = vk::Device();
+}
+
+vk::PipelineCache PipelineCache::get() const
+{
+    return pipelineCache;
+}
+
+vk::ShaderModule PipelineCache::get_shader_module(const std::string &path)
+{
+    auto code = readFile(path);
+    auto key = std::make_pair(path, Hash(code.data(), code.size()));
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto cached = shaderModules.find(key);
+    if (cached != shaderModules.end()) {
+        statistics.shaderModuleHits++;
+        return cached->second;
+    }
+
+    vk::ShaderModuleCreateInfo createInfo;
+    createInfo.codeSize = code.size();
+    createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+    vk::ShaderModule module = device.createShaderModule(createInfo);
+
+    shaderModules[key] = module;
+    statistics.shaderModuleMisses++;
+    return module;
+}
+
+bool PipelineCache::save()
+{
+    if (!device || !pipelineCache || cachePath.empty()) return false;
+
+    std::vector<uint8_t> data = device.getPipelineCacheData(pipelineCache);
+    if (data.empty()) return false;
+
+    FileHeader header;
+    header.magic = FileMagic;
+    header.version = FileVersion;
+    header.vendorID = properties.vendorID;
+    header.deviceID = properties.deviceID;
+    header.driverVersion = properties.driverVersion;
+    memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+    header.dataSize = data.size();
+    header.dataHash = Hash(data.data(), data.size());
+
+    /* Written to a temporary file first, so a crash part way through can't leave a truncated cache behind */
+    std::error_code error;
+    std::filesystem::path path(cachePath);
+    if (path.has_parent_path())
+        std::filesystem::create_directories(path.parent_path(), error);
+
+    std::string temporaryPath = cachePath + ".tmp";
+    {
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            std::cout << "Warning: unable to write the pipeline cache to " << cachePath << std::endl;
+            return false;
+        }
+        file.write(reinterpret_cast<const char*>(&header), sizeof(FileHeader));
+        file.write(reinterpret_cast<const char*>(data.data()), data.size());
+        if (!file.good()) {
+            file.close();
+            std::filesystem::remove(temporaryPath, error);
+            return false;
+        }
+    }
+
+    std::filesystem::rename(temporaryPath, cachePath, error);
+    if (error) {
+        std::filesystem::remove(temporaryPath, error);
+        return false;
+    }
+    return true;
+}
+
+std::string PipelineCache::get_cache_path() const
+{
+    return cachePath;
+}
+
+PipelineCacheStatistics PipelineCache::get_statistics()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    PipelineCacheStatistics result = statistics;
+    result.shaderModuleCount = (uint32_t) shaderModules.size();
+    return result;
+}
+
+std::string PipelineCache::GetDefaultCacheDirectory()
+{
+    #if defined(_WIN32)
+    const char *localAppData = std::getenv("LOCALAPPDATA");
+    if (localAppData && *localAppData) return std::string(localAppData) + "/Pluto";
+    #elif defined(__APPLE__)
+    const char *home = std::getenv("HOME");
+    if (home && *home) return std::string(home) + "/Library/Caches/Pluto";
+    #else
+    const char *xdgCacheHome = std::getenv("XDG_CACHE_HOME");
+    if (xdgCacheHome && *xdgCacheHome) return std::string(xdgCacheHome) + "/pluto";
+    const char *home = std::getenv("HOME");
+    if (home && *home) return std::string(home) + "/.cache/pluto";
+    #endif
+    return "";
+}
+
+std::vector<uint8_t> PipelineCache::load()
+{
+    std::vector<uint8_t> data;
+    if (cachePath.empty()) return data;
+
+    std::ifstream file(cachePath, std::ios::ate | std::ios::binary);
+    if (!file.is_open()) return data;
+
+    size_t fileSize = (size_t) file.tellg();
+    if (fileSize < sizeof(FileHeader)) return data;
+    file.seekg(0);
+
+    FileHeader header;
+    file.read(reinterpret_cast<char*>(&header), sizeof(FileHeader));
+    if (!file.good()) return data;
+
+    /* Anything written by another device, driver, or version of this file format is stale */
+    if ((header.magic != FileMagic) || (header.version != FileVersion)) return data;
+    if ((header.vendorID != properties.vendorID) || (header.deviceID != properties.deviceID)) return data;
+    if (header.driverVersion != properties.driverVersion) return data;
+    if (memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0) return data;
+    if (header.dataSize != fileSize - sizeof(FileHeader)) return data;
+
+    data.resize((size_t) header.dataSize);
+    file.read(reinterpret_cast<char*>(data.data()), data.size());
+    if (!file.good() || (Hash(data.data(), data.size()) != header.dataHash)) {
+        data.clear();
+        return data;
+    }
+
+    /* The driver's own header should agree with ours. If it doesn't, the file was tampered with. */
+    struct DriverHeader {
+        uint32_t headerSize;
+        uint32_t headerVersion;
+        uint32_t vendorID;
+        uint32_t deviceID;
+        uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+    } driverHeader;
+    if (data.size() < sizeof(DriverHeader)) {
+        data.clear();
+        return data;
+    }
+    memcpy(&driverHeader, data.data(), sizeof(DriverHeader));
+    if ((driverHeader.headerVersion != (uint32_t) vk::PipelineCacheHeaderVersion::eOne) ||
+        (driverHeader.vendorID != properties.vendorID) || (driverHeader.deviceID != properties.deviceID) ||
+        (memcmp(driverHeader.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0)) {
+        data.clear();
+    }
+    return data;
+}
+
+uint64_t PipelineCache::Hash(const void *data, size_t size)
+{
+    const uint8_t *bytes = reinterpret_cast<const uint8_t*>(data);
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Libraries {
+    struct PipelineCacheStatistics {
+        uint64_t shaderModuleHits = 0;      /* Shader modules handed out from the cache */
+        uint64_t shaderModuleMisses = 0;    /* Shader modules created, because their path or contents were new */
+        uint32_t shaderModuleCount = 0;     /* Shader modules currently held */
+        size_t loadedBytes = 0;             /* Size of the pipeline cache data read from disk, or 0 if none was usable */
+        bool loadedFromDisk = false;
+    };
+
+    /* Holds the VkPipelineCache every pipeline is created with, and the shader modules pipelines are created from.
+        The pipeline cache is read from a file under the user's cache directory when the device is created, and
+        written back when it's destroyed, so pipelines compiled in earlier runs are reused. The file records the
+        device and driver it was written by, and is ignored if they don't match the current ones.
+
+        Shader modules are kept by path and by a hash of their SPIR-V, so recreating pipelines, for example once
+        per camera, doesn't rebuild modules for shaders that haven't changed on disk. */
+    class PipelineCache
+    {
+    public:
+        /* Must be called once the logical device exists. An empty cache path uses the default location. */
+        void initialize(vk::Device device, vk::PhysicalDevice physical_device, std::string cache_path = "");
+
+        /* Saves the pipeline cache, then destroys it and every cached shader module */
+        void destroy();
+
+        /* Returns the pipeline cache to pass when creating pipelines */
+        vk::PipelineCache get() const;
+
+        /* Returns a shader module for the SPIR-V file at the given path, creating one if the file's path or
+            contents haven't been seen before. Modules are owned by the cache, so must not be destroyed by the
+            caller. Throws if the file can't be read. */
+        vk::ShaderModule get_shader_module(const std::string &path);
+
+        /* Writes the pipeline cache to disk. Returns false if the file couldn't be written. */
+        bool save();
+
+        /* Returns the file the pipeline cache is read from and written to */
+        std::string get_cache_path() const;
+
+        PipelineCacheStatistics get_statistics();
+
+        /* Returns the per user cache directory, eg ~/.cache/pluto, or %LOCALAPPDATA%/Pluto on windows */
+        static std::string GetDefaultCacheDirectory();
+
+    private:
+        /* Precedes the driver's cache data in the file. The driver's own header identifies the device, but not
+            the driver version, and some drivers don't check it, so it's validated here before the data is used. */
+        struct FileHeader {
+            uint32_t magic = 0;
+            uint32_t version = 0;
+            uint32_t vendorID = 0;
+            uint32_t deviceID = 0;
+            uint32_t driverVersion = 0;
+            uint8_t pipelineCacheUUID[VK_UUID_SIZE] = {};
+            uint64_t dataSize = 0;
+            uint64_t dataHash = 0;
+        };
+
+        static const uint32_t FileMagic = 0x43504c50; /* "PLPC" */
+        static const uint32_t FileVersion = 1;
+
+        vk::Device device;
+        vk::PhysicalDeviceProperties properties;
+        vk::PipelineCache pipelineCache;
+        std::string cachePath;
+
+        std::map<std::pair<std::string, uint64_t>, vk::ShaderModule> shaderModules;
+
+        PipelineCacheStatistics statistics;
+        std::mutex mutex;
+
+        /* Reads the cache file, returning the driver's data if it was written by this device and driver */
+        std::vector<uint8_t> load();
+
+        /* FNV-1a */
+        static uint64_t Hash(const void *data, size_t size);
+    };
+}
@@ -0,0 +1,181 @@
+#include "StorageBuffer.hxx"
+#include "Vulkan.hxx"
+
+#include <algorithm>
+#include <cstring>
+
+namespace Libraries {
+
+/* Past this many pending ranges, a frame copy is just flushed in full. */
+static const size_t MaxPendingRanges = 256;
+
+/* Source of buffer generations. Shared by every storage buffer, so generations are never reused. */
+static std::atomic<uint64_t> NextGeneration {1};
+
+void StorageBuffer::create(vk::DeviceSize size, uint32_t frames, vk::BufferUsageFlags usage)
+{
+    this->size = size;
+    this->usage = usage | vk::BufferUsageFlagBits::eStorageBuffer;
+    this->frames = std::max(frames, 1u);
+    staging.assign((size_t) size, 0);
+    pendingRanges.assign(this->frames, {});
+    allocate();
+}
+
+void StorageBuffer::allocate()
+{
+    auto vulkan = Vulkan::Get();
+    auto device = vulkan->get_device();
+
+    /* Each frame copy must start on an offset the device can bind a storage buffer at */
+    vk::DeviceSize alignment = std::max(vulkan->get_physical_device_properties().limits.minStorageBufferOffsetAlignment, (vk::DeviceSize) 1);
+    stride = ((size + alignment - 1) / alignment) * alignment;
+
+    vk::BufferCreateInfo bufferInfo = {};
+    bufferInfo.size = stride * frames;
+    bufferInfo.usage = usage;
+    bufferInfo.sharingMode = vk::SharingMode::eExclusive;
+    buffer = device.createBuffer(bufferInfo);
+
+    /* Host visible memory from the allocator stays mapped, pinning the buffer */
+    vk::MemoryPropertyFlags properties = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+    memory = vulkan->get_memory_allocator()->allocate_buffer(buffer, properties);
+    mapped = (uint8_t*) memory.mapped;
+    generation = NextGeneration++;
+
+    /* Every frame copy starts out stale */
+    for (auto &ranges : pendingRanges) {
+        ranges.clear();
+        ranges.push_back({0, size});
+    }
+}
+
+bool StorageBuffer::reserve(vk::DeviceSize size)
+{
+    if (size <= this->size) return false;
+
+    /* Frames still in flight may be reading from the old buffer, so hold on to it for a full trip around the ring. */
+    retired.push_back({buffer, memory, frames});
+
+    this->size = std::max(size, this->size * 2);
+    staging.resize((size_t) this->size, 0);
+    allocate();
+    return true;
+}
+
+void StorageBuffer::destroy()
+{
+    auto vulkan = Vulkan::Get();
+    auto device = vulkan->get_device();
+    for (auto &r : retired) {
+        device.destroyBuffer(r.buffer);
+        vulkan->get_memory_allocator()->free(r.memory);
+    }
+    retired.clear();
+
+    if (!buffer) return;
+    device.destroyBuffer(buffer);
+    vulkan->get_memory_allocator()->free(memory);
+    buffer = vk::Buffer();
+    mapped = nullptr;
+    size = 0;
+    stride = 0;
+    generation = 0;
+    staging.clear();
+    pendingRanges.clear();
+}
+
+void* StorageBuffer::get_staging()
+{
+    return staging.data();
+}
+
+void StorageBuffer::mark_range(vk::DeviceSize offset, vk::DeviceSize size)
+{
+    if (size == 0) return;
+    for (auto &ranges : pendingRanges) {
+        if (ranges.size() >= MaxPendingRanges) {
+            ranges.clear();
+            ranges.push_back({0, this->size});
+        }
+        else ranges.push_back({offset, size});
+    }
+}
+
+void StorageBuffer::flush(uint32_t frame)
+{
+    /* A retired buffer is safe to free once every frame slot has been reused since it was replaced */
+    if (!retired.empty()) {
+        auto vulkan = Vulkan::Get();
+        auto device = vulkan->get_device();
+        for (auto &r : retired) {
+            if (--r.framesLeft > 0) continue;
+            device.destroyBuffer(r.buffer);
+            vulkan->get_memory_allocator()->free(r.memory);
+        }
+        retired.erase(std::remove_if(retired.begin(), retired.end(),
+            [](const RetiredBuffer &r) { return r.framesLeft == 0; }), retired.end());
+    }
+
+    if (!mapped || frame >= frames) return;
+    auto &ranges = pendingRanges[frame];
+    if (ranges.empty()) return;
+
+    /* Coalesce overlapping and adjacent ranges so each byte is only copied once */
+    std::sort(ranges.begin(), ranges.end());
+    uint8_t* dst = mapped + stride * frame;
+    vk::DeviceSize start = ranges[0].first, end = ranges[0].first + ranges[0].second;
+    for (size_t i = 1; i <= ranges.size(); ++i) {
+        if (i < ranges.size() && ranges[i].first <= end) {
+            end = std::max(end, ranges[i].first + ranges[i].second);
+            continue;
+        }
+        end = std::min(end, size);
+        if (end > start) {
+            memcpy(dst + start, staging.data() + start, (size_t)(end - start));
+            bytesUploaded += end - start;
+        }
+        if (i < ranges.size()) {
+            start = ranges[i].first;
+            end = ranges[i].first + ranges[i].second;
+        }
+    }
+    ranges.clear();
+}
+
+bool StorageBuffer::is_created() const
+{
+    return mapped != nullptr;
+}
+
+vk::Buffer StorageBuffer::get_buffer() const
+{
+    return buffer;
+}
+
+vk::DeviceSize StorageBuffer::get_size() const
+{
+    return size;
+}
+
+vk::DeviceSize StorageBuffer::get_offset(uint32_t frame) const
+{
+    return stride * (frame % std::max(frames, 1u));
+}
+
+uint32_t StorageBuffer::get_frame_count() const
+{
+    return frames;
+}
+
+uint64_t StorageBuffer::get_bytes_uploaded() const
+{
+    return bytesUploaded;
+}
+
+uint64_t StorageBuffer::get_generation() const
+{
+    return generation;
+}
+
+}
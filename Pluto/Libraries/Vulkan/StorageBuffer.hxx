@@ -0,0 +1,89 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <atomic>
+#include <vector>
+#include <utility>
+
+#include "Pluto/Libraries/Vulkan/MemoryAllocator.hxx"
+
+/* The number of frames the CPU may record ahead of the GPU. Each storage buffer keeps one copy
+    of its contents per frame in flight, so writes for the next frame never touch memory the GPU
+    may still be reading. */
+#define MAX_FRAMES_IN_FLIGHT 2
+
+namespace Libraries {
+    /* A host visible, persistently mapped storage buffer, ring buffered per frame in flight.
+        Component factories write into a host side staging copy, and each frame the ranges modified
+        since that frame's copy was last written are flushed into the mapped region for that frame.
+        The buffer can be reallocated as the number of components grows. */
+    class StorageBuffer
+    {
+    public:
+        /* Allocates and maps a buffer holding one copy of size bytes for each frame in flight. 
+            Extra usage flags can be given for buffers also read as something other than a storage buffer, eg indirect draws. */
+        void create(vk::DeviceSize size, uint32_t frames = MAX_FRAMES_IN_FLIGHT, vk::BufferUsageFlags usage = vk::BufferUsageFlagBits::eStorageBuffer);
+
+        /* Reallocates the buffer if a frame copy is smaller than the requested size, returning true
+            if it did. The staging copy is preserved and flushed in full to every frame copy, and the
+            old buffer is kept alive until every frame that may reference it has completed. The buffer
+            is grown geometrically to avoid reallocating every time a component is added. */
+        bool reserve(vk::DeviceSize size);
+
+        /* Unmaps and frees the buffer, along with any buffers retired by reserve.
+            The caller must ensure the GPU is no longer using them. */
+        void destroy();
+
+        /* Returns the host side copy of the buffer contents. Callers write here, then call mark_range. */
+        void* get_staging();
+
+        /* Records that the given byte range of the staging copy was modified, so that it is copied
+            into every frame copy as that frame comes up. */
+        void mark_range(vk::DeviceSize offset, vk::DeviceSize size);
+
+        /* Copies all ranges modified since the given frame copy was last flushed into its mapped memory.
+            Must only be called once the GPU has finished with the previous use of that frame. */
+        void flush(uint32_t frame);
+
+        bool is_created() const;
+        vk::Buffer get_buffer() const;
+
+        /* Returns the size in bytes of a single frame copy, ie the descriptor range. */
+        vk::DeviceSize get_size() const;
+
+        /* Returns the byte offset of the given frame copy within the buffer, ie the descriptor offset. */
+        vk::DeviceSize get_offset(uint32_t frame) const;
+
+        uint32_t get_frame_count() const;
+
+        /* Returns the total number of bytes copied into mapped memory since this buffer was first created. */
+        uint64_t get_bytes_uploaded() const;
+
+        /* Returns an id which changes whenever the buffer is allocated or reallocated, and is never shared by 
+            another buffer. Descriptors written for an older generation must be rewritten. Zero if not created. */
+        uint64_t get_generation() const;
+
+    private:
+        /* A buffer replaced by reserve, destroyed once framesLeft more frames have been flushed. */
+        struct RetiredBuffer {
+            vk::Buffer buffer;
+            MemoryAllocation memory;
+            uint32_t framesLeft;
+        };
+
+        vk::Buffer buffer;
+        MemoryAllocation memory;
+        vk::DeviceSize size = 0;
+        vk::DeviceSize stride = 0;
+        uint32_t frames = 0;
+        vk::BufferUsageFlags usage;
+        uint8_t* mapped = nullptr;
+        uint64_t bytesUploaded = 0;
+        uint64_t generation = 0;
+        std::vector<uint8_t> staging;
+        std::vector<std::vector<std::pair<vk::DeviceSize, vk::DeviceSize>>> pendingRanges;
+        std::vector<RetiredBuffer> retired;
+
+        /* Creates and maps the vulkan buffer for the current size and frame count. */
+        void allocate();
+    };
+}
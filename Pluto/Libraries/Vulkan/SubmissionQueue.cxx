@@ -0,0 +1,265 @@
+#include "SubmissionQueue.hxx"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+namespace Libraries {
+
+void SubmissionQueue::initialize(vk::Device device, vk::Queue queue, bool use_timeline_semaphore)
+{
+    this->device = device;
+    this->queue = queue;
+    submittedValue = 0;
+    completedValue = 0;
+    statistics = SubmissionStatistics();
+
+    if (use_timeline_semaphore) {
+        waitSemaphoresKHR = (PFN_vkWaitSemaphoresKHR) device.getProcAddr("vkWaitSemaphoresKHR");
+        getSemaphoreCounterValueKHR = (PFN_vkGetSemaphoreCounterValueKHR) device.getProcAddr("vkGetSemaphoreCounterValueKHR");
+        if (waitSemaphoresKHR && getSemaphoreCounterValueKHR) {
+            VkSemaphoreTypeCreateInfoKHR typeInfo = {};
+            typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+            typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+            typeInfo.initialValue = 0;
+
+            vk::SemaphoreCreateInfo semaphoreInfo;
+            semaphoreInfo.pNext = &typeInfo;
+            timelineSemaphore = device.createSemaphore(semaphoreInfo);
+        }
+    }
+}
+
+void SubmissionQueue::destroy()
+{
+    if (!device) return;
+
+    wait_idle();
+
+    std::lock_guard<std::mutex> lock(trackingMutex);
+    for (auto &entry : inFlight) device.destroyFence(entry.fence);
+    for (auto fence : signaledFences) device.destroyFence(fence);
+    for (auto fence : freeFences) device.destroyFence(fence);
+    inFlight.clear();
+    signaledFences.clear();
+    freeFences.clear();
+
+    if (timelineSemaphore) device.destroySemaphore(timelineSemaphore);
+    timelineSemaphore = vk::Semaphore();
+    device = vk::Device();
+    queue = vk::Queue();
+}
+
+uint64_t SubmissionQueue::submit(const std::vector<vk::CommandBuffer> &command_buffers,
+    const std::vector<vk::Semaphore> &wait_semaphores,
+    const std::vector<vk::PipelineStageFlags> &wait_dst_stage_masks,
+    const std::vector<vk::Semaphore> &signal_semaphores,
+    vk::Fence fence)
+{
+    if (wait_semaphores.size() != wait_dst_stage_masks.size())
+        throw std::runtime_error("Error: every wait semaphore needs a destination stage mask");
+
+    std::lock_guard<std::mutex> lock(queueMutex);
+    if (!device) throw std::runtime_error("Error: submission queue is not initialized");
+    uint64_t value = submittedValue + 1;
+
+    vk::SubmitInfo submitInfo;
+    submitInfo.waitSemaphoreCount = (uint32_t) wait_semaphores.size();
+    submitInfo.pWaitSemaphores = wait_semaphores.data();
+    submitInfo.pWaitDstStageMask = wait_dst_stage_masks.data();
+    submitInfo.commandBufferCount = (uint32_t) command_buffers.size();
+    submitInfo.pCommandBuffers = command_buffers.data();
+    submitInfo.signalSemaphoreCount = (uint32_t) signal_semaphores.size();
+    submitInfo.pSignalSemaphores = signal_semaphores.data();
+
+    if (timelineSemaphore) {
+        /* Binary semaphores ignore their values, but every semaphore needs one */
+        std::vector<vk::Semaphore> signalSemaphores = signal_semaphores;
+        signalSemaphores.push_back(timelineSemaphore);
+        std::vector<uint64_t> signalValues(signalSemaphores.size(), 0);
+        signalValues.back() = value;
+        std::vector<uint64_t> waitValues(wait_semaphores.size(), 0);
+
+        VkTimelineSemaphoreSubmitInfoKHR timelineInfo = {};
+        timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+        timelineInfo.waitSemaphoreValueCount = (uint32_t) waitValues.size();
+        timelineInfo.pWaitSemaphoreValues = waitValues.data();
+        timelineInfo.signalSemaphoreValueCount = (uint32_t) signalValues.size();
+        timelineInfo.pSignalSemaphoreValues = signalValues.data();
+
+        submitInfo.pNext = &timelineInfo;
+        submitInfo.signalSemaphoreCount = (uint32_t) signalSemaphores.size();
+        submitInfo.pSignalSemaphores = signalSemaphores.data();
+        queue.submit(submitInfo, fence);
+
+        submittedValue = value;
+        statistics.submissionCount++;
+        return value;
+    }
+
+    vk::Fence tracked;
+    {
+        std::lock_guard<std::mutex> trackingLock(trackingMutex);
+        tracked = take_fence();
+    }
+
+    try {
+        /* A submission only signals one fence. If the caller gave one, an empty submission signals ours right after. */
+        if (fence) {
+            queue.submit(submitInfo, fence);
+            queue.submit(0, nullptr, tracked);
+        }
+        else queue.submit(submitInfo, tracked);
+    } catch (...) {
+        std::lock_guard<std::mutex> trackingLock(trackingMutex);
+        freeFences.push_back(tracked);
+        throw;
+    }
+
+    {
+        std::lock_guard<std::mutex> trackingLock(trackingMutex);
+        inFlight.push_back({value, tracked});
+    }
+    submittedValue = value;
+    statistics.submissionCount++;
+    return value;
+}
+
+vk::Result SubmissionQueue::present(const vk::PresentInfoKHR &present_info)
+{
+    std::lock_guard<std::mutex> lock(queueMutex);
+    return queue.presentKHR(present_info);
+}
+
+std::unique_lock<std::mutex> SubmissionQueue::lock()
+{
+    return std::unique_lock<std::mutex>(queueMutex);
+}
+
+uint64_t SubmissionQueue::get_submitted_value()
+{
+    std::lock_guard<std::mutex> lock(queueMutex);
+    return submittedValue;
+}
+
+uint64_t SubmissionQueue::get_completed_value()
+{
+    if (timelineSemaphore) {
+        uint64_t value = 0;
+        getSemaphoreCounterValueKHR((VkDevice) device, (VkSemaphore) timelineSemaphore, &value);
+        std::lock_guard<std::mutex> lock(trackingMutex);
+        completedValue = std::max(completedValue, value);
+        return completedValue;
+    }
+
+    std::lock_guard<std::mutex> lock(trackingMutex);
+    poll_fences();
+    return completedValue;
+}
+
+bool SubmissionQueue::is_complete(uint64_t value)
+{
+    {
+        std::lock_guard<std::mutex> lock(trackingMutex);
+        if (value <= completedValue) return true;
+    }
+    return value <= get_completed_value();
+}
+
+bool SubmissionQueue::wait(uint64_t value, uint64_t timeout)
+{
+    if (is_complete(value)) return true;
+    if (value > get_submitted_value())
+        throw std::runtime_error("Error: waiting on value " + std::to_string(value) + ", which was never submitted");
+
+    if (timelineSemaphore) {
+        VkSemaphore semaphore = (VkSemaphore) timelineSemaphore;
+        VkSemaphoreWaitInfoKHR waitInfo = {};
+        waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores = &semaphore;
+        waitInfo.pValues = &value;
+        VkResult result = waitSemaphoresKHR((VkDevice) device, &waitInfo, timeout);
+
+        std::lock_guard<std::mutex> lock(trackingMutex);
+        statistics.hostWaitCount++;
+        if (result != VK_SUCCESS) return false;
+        completedValue = std::max(completedValue, value);
+        return true;
+    }
+
+    /* Fences only cover their own submission, so wait on every one up to the value */
+    std::vector<vk::Fence> fences;
+    {
+        std::lock_guard<std::mutex> lock(trackingMutex);
+        poll_fences();
+        if (value <= completedValue) return true;
+        for (auto &entry : inFlight) {
+            if (entry.value > value) break;
+            fences.push_back(entry.fence);
+        }
+        waiters++;
+        statistics.hostWaitCount++;
+    }
+
+    vk::Result result = device.waitForFences(fences, true, timeout);
+
+    std::lock_guard<std::mutex> lock(trackingMutex);
+    waiters--;
+    poll_fences();
+    return result == vk::Result::eSuccess;
+}
+
+void SubmissionQueue::wait_idle()
+{
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        if (!queue) return;
+        queue.waitIdle();
+    }
+    get_completed_value();
+}
+
+bool SubmissionQueue::is_using_timeline_semaphore()
+{
+    return (bool) timelineSemaphore;
+}
+
+SubmissionStatistics SubmissionQueue::get_statistics()
+{
+    std::lock_guard<std::mutex> lock(queueMutex);
+    std::lock_guard<std::mutex> trackingLock(trackingMutex);
+    SubmissionStatistics result = statistics;
+    result.fencesInFlight = (uint32_t) inFlight.size();
+    return result;
+}
+
+vk::Fence SubmissionQueue::take_fence()
+{
+    poll_fences();
+    if (!freeFences.empty()) {
+        vk::Fence fence = freeFences.back();
+        freeFences.pop_back();
+        return fence;
+    }
+    statistics.fencesCreated++;
+    return device.createFence(vk::FenceCreateInfo());
+}
+
+void SubmissionQueue::poll_fences()
+{
+    while (!inFlight.empty() && (device.getFenceStatus(inFlight.front().fence) == vk::Result::eSuccess)) {
+        completedValue = inFlight.front().value;
+        signaledFences.push_back(inFlight.front().fence);
+        inFlight.pop_front();
+    }
+
+    /* A waiting thread may still be passing one of these to vkWaitForFences */
+    if ((waiters == 0) && !signaledFences.empty()) {
+        device.resetFences(signaledFences);
+        freeFences.insert(freeFences.end(), signaledFences.begin(), signaledFences.end());
+        signaledFences.clear();
+    }
+}
+
+}
@@ -0,0 +1,105 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "Pluto/Libraries/Vulkan/TimelineSemaphore.hxx"
+
+namespace Libraries {
+    struct SubmissionStatistics {
+        uint64_t submissionCount = 0;   /* Calls to vkQueueSubmit made through this queue */
+        uint64_t hostWaitCount = 0;     /* Waits which had to block, because the value waited on hadn't completed yet */
+        uint32_t fencesCreated = 0;     /* Fences made for tracking values, when timeline semaphores aren't available */
+        uint32_t fencesInFlight = 0;
+    };
+
+    /* Submits work to one queue from any thread, tagging every submission with the next value on a 64 bit timeline.
+        Submissions complete in order, so a value having completed means every earlier one has too, and waiting on
+        work becomes a host wait on its value, rather than on a fence made for it.
+
+        With VK_KHR_timeline_semaphore (see TimelineSemaphore.hxx), each submission also signals a timeline semaphore
+        to its value, and waits are vkWaitSemaphores calls. Without it, every submission signals a fence taken from a
+        recycled pool, and values are tracked by which fences have signaled. */
+    class SubmissionQueue
+    {
+    public:
+        /* Must be called once the logical device exists. Timeline semaphores are only used if requested and the
+            extension was enabled on the device. */
+        void initialize(vk::Device device, vk::Queue queue, bool use_timeline_semaphore = false);
+
+        /* Waits for the queue to go idle, then destroys the semaphore and fences */
+        void destroy();
+
+        /* Submits the command buffers right away, and returns the submission's timeline value. The fence is optional,
+            and is signaled along with the submission for callers which still need one. */
+        uint64_t submit(const std::vector<vk::CommandBuffer> &command_buffers,
+            const std::vector<vk::Semaphore> &wait_semaphores = {},
+            const std::vector<vk::PipelineStageFlags> &wait_dst_stage_masks = {},
+            const std::vector<vk::Semaphore> &signal_semaphores = {},
+            vk::Fence fence = vk::Fence());
+
+        /* Presents through the queue, under the same lock as submissions, since a queue must only be used from one
+            thread at a time */
+        vk::Result present(const vk::PresentInfoKHR &present_info);
+
+        /* Locks the queue for code which uses it directly, like the OpenVR compositor. Nothing is submitted 
+            through this queue until the lock is released. */
+        std::unique_lock<std::mutex> lock();
+
+        /* Returns the value of the latest submission */
+        uint64_t get_submitted_value();
+
+        /* Returns the value of the latest submission known to have completed on the GPU */
+        uint64_t get_completed_value();
+
+        /* Returns true once the submission with the given value has completed */
+        bool is_complete(uint64_t value);
+
+        /* Blocks until the submission with the given value completes, or the timeout in nanoseconds passes.
+            Returns false on timeout. */
+        bool wait(uint64_t value, uint64_t timeout = UINT64_MAX);
+
+        /* Blocks until everything submitted has completed */
+        void wait_idle();
+
+        /* Returns true if values are tracked with a timeline semaphore rather than fences */
+        bool is_using_timeline_semaphore();
+
+        SubmissionStatistics get_statistics();
+
+    private:
+        struct FenceValue {
+            uint64_t value;
+            vk::Fence fence;
+        };
+
+        vk::Device device;
+        vk::Queue queue;
+
+        /* Held while using the queue. Completion tracking has its own lock, so waits and polls don't hold up submits. */
+        std::mutex queueMutex;
+        std::mutex trackingMutex;
+
+        uint64_t submittedValue = 0;
+        uint64_t completedValue = 0;
+
+        vk::Semaphore timelineSemaphore;
+        PFN_vkWaitSemaphoresKHR waitSemaphoresKHR = nullptr;
+        PFN_vkGetSemaphoreCounterValueKHR getSemaphoreCounterValueKHR = nullptr;
+
+        /* Fences for submissions not yet known to have completed, oldest first. Signaled fences are only reset and
+            reused once no thread is waiting on them. */
+        std::deque<FenceValue> inFlight;
+        std::vector<vk::Fence> signaledFences;
+        std::vector<vk::Fence> freeFences;
+        uint32_t waiters = 0;
+
+        SubmissionStatistics statistics;
+
+        /* These expect the tracking mutex to be held */
+        vk::Fence take_fence();
+        void poll_fences();
+    };
+}
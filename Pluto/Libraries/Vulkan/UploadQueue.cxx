@@ -0,0 +1,460 @@
+#include "UploadQueue.hxx"
+#include "Vulkan.hxx"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+
+namespace Libraries {
+
+void UploadQueue::initialize(vk::Device device, uint32_t graphics_family, MemoryAllocator *allocator,
+    uint32_t transfer_family, vk::Queue transfer_queue, vk::Extent3D transfer_granularity, vk::DeviceSize ring_size)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    this->device = device;
+    this->allocator = allocator;
+    graphicsFamily = graphics_family;
+    transferFamily = (transfer_queue) ? transfer_family : graphics_family;
+    transferQueue = (transferFamily != graphicsFamily) ? transfer_queue : vk::Queue();
+    transferGranularity = transfer_granularity;
+
+    vk::CommandPoolCreateInfo poolInfo;
+    poolInfo.queueFamilyIndex = graphicsFamily;
+    poolInfo.flags = vk::CommandPoolCreateFlagBits::eTransient | vk::CommandPoolCreateFlagBits::eResetCommandBuffer;
+    graphicsPool.pool = device.createCommandPool(poolInfo);
+    if (transferQueue) {
+        poolInfo.queueFamilyIndex = transferFamily;
+        transferPool.pool = device.createCommandPool(poolInfo);
+    }
+
+    ringBuffer = create_staging_buffer(ring_size, ringMemory);
+    ringSize = ring_size;
+    ringHead = ringTail = ringUsed = 0;
+
+    pending = Batch();
+    pending.token = 1;
+    lastFlushed = lastCompleted = 0;
+    statistics = UploadStatistics();
+}
+
+void UploadQueue::destroy()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!device) return;
+
+    auto submissions = Vulkan::Get()->get_graphics_submission_queue();
+    if (!inFlight.empty()) submissions->wait(inFlight.back().submission);
+    retire_completed();
+
+    for (auto &overflow : pending.overflowBuffers) {
+        device.destroyBuffer(overflow.buffer);
+        allocator->free(overflow.memory);
+    }
+    pending = Batch();
+
+    for (auto semaphore : freeSemaphores) device.destroySemaphore(semaphore);
+    freeSemaphores.clear();
+    for (auto pool : {&graphicsPool, &transferPool}) {
+        if (pool->pool) device.destroyCommandPool(pool->pool);
+        *pool = CommandPool();
+    }
+    transferQueue = vk::Queue();
+
+    device.destroyBuffer(ringBuffer);
+    allocator->free(ringMemory);
+    device = vk::Device();
+}
+
+vk::Buffer UploadQueue::create_staging_buffer(vk::DeviceSize size, MemoryAllocation &memory)
+{
+    /* Staging buffers are read by both families when there's a transfer queue */
+    uint32_t families[2] = {graphicsFamily, transferFamily};
+
+    vk::BufferCreateInfo bufferInfo;
+    bufferInfo.size = size;
+    bufferInfo.usage = vk::BufferUsageFlagBits::eTransferSrc;
+    if (transferQueue) {
+        bufferInfo.sharingMode = vk::SharingMode::eConcurrent;
+        bufferInfo.queueFamilyIndexCount = 2;
+        bufferInfo.pQueueFamilyIndices = families;
+    }
+    else bufferInfo.sharingMode = vk::SharingMode::eExclusive;
+    vk::Buffer buffer = device.createBuffer(bufferInfo);
+    memory = allocator->allocate_buffer(buffer, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+    return buffer;
+}
+
+bool UploadQueue::take_ring_space(vk::DeviceSize size, vk::DeviceSize alignment, vk::DeviceSize &offset)
+{
+    if (size > ringSize) return false;
+    if (ringUsed == 0) ringHead = ringTail = 0;
+
+    vk::DeviceSize start = ((ringHead + alignment - 1) / alignment) * alignment;
+    vk::DeviceSize consumed;
+    if (ringUsed > 0 && ringHead == ringTail) return false;
+    if (ringHead >= ringTail) {
+        /* Free space runs from the head to the end, then wraps around to the tail */
+        if (start + size <= ringSize) consumed = start + size - ringHead;
+        else if (size <= ringTail) {
+            start = 0;
+            consumed = ringSize - ringHead + size;
+        }
+        else return false;
+    }
+    else {
+        /* Free space runs from the head to the tail */
+        if (start + size > ringTail) return false;
+        consumed = start + size - ringHead;
+    }
+
+    ringHead = start + size;
+    ringUsed += consumed;
+    pending.ringBytes += consumed;
+    offset = start;
+    return true;
+}
+
+vk::Buffer UploadQueue::stage(const void *data, vk::DeviceSize size, vk::DeviceSize alignment, vk::DeviceSize &offset)
+{
+    /* Copy offsets into images must be a multiple of four as well as the texel block size */
+    alignment = std::lcm(std::max<vk::DeviceSize>(alignment, 1), (vk::DeviceSize) 4);
+
+    bool fits = take_ring_space(size, alignment, offset);
+    if (!fits) {
+        retire_completed();
+        fits = take_ring_space(size, alignment, offset);
+    }
+
+    statistics.uploadCount++;
+    if (fits) {
+        memcpy((uint8_t*) ringMemory.mapped + offset, data, (size_t) size);
+        statistics.bytesStaged += size;
+        return ringBuffer;
+    }
+
+    /* Rather than stall until the GPU frees up ring space, give this upload a staging buffer of its own */
+    OverflowBuffer overflow;
+    overflow.buffer = create_staging_buffer(size, overflow.memory);
+    memcpy(overflow.memory.mapped, data, (size_t) size);
+    pending.overflowBuffers.push_back(overflow);
+    statistics.overflowBytes += size;
+    offset = 0;
+    return overflow.buffer;
+}
+
+UploadToken UploadQueue::upload_buffer(vk::Buffer buffer, vk::DeviceSize offset, const void *data, vk::DeviceSize size)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!device)
+        throw std::runtime_error( std::string("Error: upload queue not initialized"));
+    if (size == 0) return lastFlushed;
+
+    BufferCopy copy;
+    copy.destination = buffer;
+    copy.source = stage(data, size, 4, copy.region.srcOffset);
+    copy.region.dstOffset = offset;
+    copy.region.size = size;
+    pending.bufferCopies.push_back(copy);
+    return pending.token;
+}
+
+UploadToken UploadQueue::upload_image(vk::Image image, vk::Extent3D extent, const void *data, vk::DeviceSize size,
+    std::vector<vk::BufferImageCopy> regions, vk::ImageSubresourceRange range,
+    vk::ImageLayout old_layout, vk::ImageLayout new_layout, vk::DeviceSize alignment)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!device)
+        throw std::runtime_error( std::string("Error: upload queue not initialized"));
+
+    ImageCopy copy;
+    vk::DeviceSize offset = 0;
+    copy.source = (size > 0) ? stage(data, size, alignment, offset) : ringBuffer;
+    copy.destination = image;
+    copy.extent = extent;
+    copy.regions = regions;
+    for (auto &region : copy.regions) region.bufferOffset += offset;
+    copy.range = range;
+    copy.oldLayout = old_layout;
+    copy.newLayout = new_layout;
+    pending.imageCopies.push_back(copy);
+    return pending.token;
+}
+
+UploadToken UploadQueue::flush()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!device) return lastFlushed;
+    return flush_pending();
+}
+
+vk::CommandBuffer UploadQueue::begin(CommandPool &pool)
+{
+    vk::CommandBuffer cmd;
+    if (!pool.freeBuffers.empty()) {
+        cmd = pool.freeBuffers.back();
+        pool.freeBuffers.pop_back();
+    }
+    else {
+        vk::CommandBufferAllocateInfo allocInfo;
+        allocInfo.commandPool = pool.pool;
+        allocInfo.level = vk::CommandBufferLevel::ePrimary;
+        allocInfo.commandBufferCount = 1;
+        cmd = device.allocateCommandBuffers(allocInfo)[0];
+    }
+
+    vk::CommandBufferBeginInfo beginInfo;
+    beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+    cmd.begin(beginInfo);
+    return cmd;
+}
+
+bool UploadQueue::fits_transfer_granularity(const ImageCopy &copy)
+{
+    /* A granularity of zero means only whole mip levels can be copied. Otherwise each offset must be a multiple
+        of it, and each extent too, unless the region reaches the edge of its mip level. For compressed formats the
+        granularity counts texel blocks, but this compares it against texels, so it's only exact for regions 
+        covering whole mip levels, which is how textures are uploaded. */
+    auto fits = [](uint32_t granularity, int32_t offset, uint32_t extent, uint32_t mipExtent) {
+        if (granularity == 0) return (offset == 0) && (extent == mipExtent);
+        if (offset % granularity != 0) return false;
+        return (extent % granularity == 0) || (offset + extent == mipExtent);
+    };
+
+    for (auto &region : copy.regions) {
+        uint32_t mip = region.imageSubresource.mipLevel;
+        if (!fits(transferGranularity.width, region.imageOffset.x, region.imageExtent.width, std::max(copy.extent.width >> mip, 1u))) return false;
+        if (!fits(transferGranularity.height, region.imageOffset.y, region.imageExtent.height, std::max(copy.extent.height >> mip, 1u))) return false;
+        if (!fits(transferGranularity.depth, region.imageOffset.z, region.imageExtent.depth, std::max(copy.extent.depth >> mip, 1u))) return false;
+    }
+    return true;
+}
+
+UploadToken UploadQueue::flush_pending()
+{
+    if (pending.empty()) return lastFlushed;
+
+    /* Split the copies between the queues. Images with contents to keep stay on the graphics queue, since moving 
+        them to the transfer family and back would cost more than the copy, as do copies the transfer family's 
+        granularity doesn't allow. */
+    std::vector<const ImageCopy*> transferImages, graphicsImages;
+    for (auto &copy : pending.imageCopies) {
+        if (transferQueue && copy.oldLayout == vk::ImageLayout::eUndefined && fits_transfer_granularity(copy)) 
+            transferImages.push_back(&copy);
+        else graphicsImages.push_back(&copy);
+    }
+    bool useTransferQueue = transferQueue && (!pending.bufferCopies.empty() || !transferImages.empty());
+
+    /* Records copies from staging into the given images, leaving them in their new layouts. Images changing family 
+        are released here, and acquired on the graphics queue with an identical barrier. */
+    auto recordImageCopies = [&](vk::CommandBuffer cmd, const std::vector<const ImageCopy*> &copies, bool release) {
+        std::vector<vk::ImageMemoryBarrier> toTransfer, fromTransfer;
+        for (auto copy : copies) {
+            vk::ImageMemoryBarrier barrier;
+            barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.image = copy->destination;
+            barrier.subresourceRange = copy->range;
+            barrier.oldLayout = copy->oldLayout;
+            barrier.newLayout = vk::ImageLayout::eTransferDstOptimal;
+            barrier.srcAccessMask = (release) ? vk::AccessFlags() : vk::AccessFlagBits::eMemoryWrite;
+            barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+            toTransfer.push_back(barrier);
+
+            barrier.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+            barrier.newLayout = copy->newLayout;
+            barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+            barrier.dstAccessMask = (release) ? vk::AccessFlags() : vk::AccessFlagBits::eMemoryRead | vk::AccessFlagBits::eMemoryWrite;
+            if (release) {
+                barrier.srcQueueFamilyIndex = transferFamily;
+                barrier.dstQueueFamilyIndex = graphicsFamily;
+            }
+            fromTransfer.push_back(barrier);
+        }
+        if (!toTransfer.empty())
+            cmd.pipelineBarrier((release) ? vk::PipelineStageFlagBits::eTopOfPipe : vk::PipelineStageFlagBits::eAllCommands, 
+                vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags(), {}, {}, toTransfer);
+        for (auto copy : copies)
+            cmd.copyBufferToImage(copy->source, copy->destination, vk::ImageLayout::eTransferDstOptimal, copy->regions);
+        return fromTransfer;
+    };
+
+    vk::MemoryBarrier memoryBarrier;
+    memoryBarrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+    memoryBarrier.dstAccessMask = vk::AccessFlagBits::eMemoryRead | vk::AccessFlagBits::eMemoryWrite;
+
+    std::vector<vk::BufferMemoryBarrier> acquireBuffers;
+    std::vector<vk::ImageMemoryBarrier> acquireImages;
+    if (useTransferQueue) {
+        vk::CommandBuffer cmd = pending.transferCommandBuffer = begin(transferPool);
+        auto releaseImages = recordImageCopies(cmd, transferImages, true);
+        std::vector<vk::BufferMemoryBarrier> releaseBuffers;
+        for (auto &copy : pending.bufferCopies) {
+            cmd.copyBuffer(copy.source, copy.destination, copy.region);
+
+            vk::BufferMemoryBarrier barrier;
+            barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+            barrier.srcQueueFamilyIndex = transferFamily;
+            barrier.dstQueueFamilyIndex = graphicsFamily;
+            barrier.buffer = copy.destination;
+            barrier.offset = copy.region.dstOffset;
+            barrier.size = copy.region.size;
+            releaseBuffers.push_back(barrier);
+        }
+
+        /* Release everything written to the graphics family */
+        cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe,
+            vk::DependencyFlags(), {}, releaseBuffers, releaseImages);
+        cmd.end();
+
+        /* The acquiring barriers must match the releasing ones, aside from their access masks */
+        for (auto barrier : releaseBuffers) {
+            barrier.srcAccessMask = vk::AccessFlags();
+            barrier.dstAccessMask = vk::AccessFlagBits::eMemoryRead | vk::AccessFlagBits::eMemoryWrite;
+            acquireBuffers.push_back(barrier);
+        }
+        for (auto barrier : releaseImages) {
+            barrier.srcAccessMask = vk::AccessFlags();
+            barrier.dstAccessMask = vk::AccessFlagBits::eMemoryRead | vk::AccessFlagBits::eMemoryWrite;
+            acquireImages.push_back(barrier);
+        }
+
+        if (!freeSemaphores.empty()) {
+            pending.transferComplete = freeSemaphores.back();
+            freeSemaphores.pop_back();
+        }
+        else pending.transferComplete = device.createSemaphore(vk::SemaphoreCreateInfo());
+
+        /* Nothing else submits to the transfer queue, so it's guarded by our own mutex. Submit now, so the 
+            copies start while the render loop carries on. */
+        vk::SubmitInfo submitInfo;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &cmd;
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores = &pending.transferComplete;
+        transferQueue.submit(submitInfo, vk::Fence());
+        statistics.transferBatchCount++;
+    }
+
+    /* The graphics side acquires whatever the transfer queue wrote, then makes the remaining copies */
+    vk::CommandBuffer cmd = pending.commandBuffer = begin(graphicsPool);
+    if (!acquireBuffers.empty() || !acquireImages.empty())
+        cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eAllCommands,
+            vk::DependencyFlags(), {}, acquireBuffers, acquireImages);
+    auto graphicsBarriers = recordImageCopies(cmd, graphicsImages, false);
+    if (!useTransferQueue)
+        for (auto &copy : pending.bufferCopies)
+            cmd.copyBuffer(copy.source, copy.destination, copy.region);
+
+    /* Make the copies visible to every command submitted after this batch */
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eAllCommands,
+        vk::DependencyFlags(), {memoryBarrier}, {}, graphicsBarriers);
+    cmd.end();
+
+    auto vulkan = Vulkan::Get();
+    std::vector<vk::Semaphore> waitSemaphores;
+    std::vector<vk::PipelineStageFlags> waitStages;
+    if (pending.transferComplete) {
+        waitSemaphores.push_back(pending.transferComplete);
+        waitStages.push_back(vk::PipelineStageFlagBits::eAllCommands);
+    }
+    pending.submission = vulkan->submit_graphics_commands({cmd}, waitSemaphores, waitStages, {}, vk::Fence(), "upload batch");
+
+    pending.ringEnd = ringHead;
+    lastFlushed = pending.token;
+    statistics.batchCount++;
+    inFlight.push_back(std::move(pending));
+
+    pending = Batch();
+    pending.token = lastFlushed + 1;
+    return lastFlushed;
+}
+
+void UploadQueue::release(Batch &batch)
+{
+    for (auto &overflow : batch.overflowBuffers) {
+        device.destroyBuffer(overflow.buffer);
+        allocator->free(overflow.memory);
+    }
+    batch.overflowBuffers.clear();
+
+    /* The graphics side waited on the transfer side, so once its submission completes both are done */
+    batch.commandBuffer.reset(vk::CommandBufferResetFlags());
+    graphicsPool.freeBuffers.push_back(batch.commandBuffer);
+    if (batch.transferCommandBuffer) {
+        batch.transferCommandBuffer.reset(vk::CommandBufferResetFlags());
+        transferPool.freeBuffers.push_back(batch.transferCommandBuffer);
+    }
+    if (batch.transferComplete) freeSemaphores.push_back(batch.transferComplete);
+
+    ringUsed -= batch.ringBytes;
+    ringTail = batch.ringEnd;
+    lastCompleted = batch.token;
+}
+
+void UploadQueue::retire_completed()
+{
+    /* Batches share a queue, so they complete in order. Stop at the first one still in use. */
+    auto submissions = Vulkan::Get()->get_graphics_submission_queue();
+    while (!inFlight.empty()) {
+        Batch &batch = inFlight.front();
+        if (!submissions->is_complete(batch.submission)) break;
+        release(batch);
+        inFlight.pop_front();
+    }
+}
+
+void UploadQueue::retire()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!device) return;
+    retire_completed();
+}
+
+bool UploadQueue::is_complete(UploadToken token)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!device) return true;
+    retire_completed();
+    return token <= lastCompleted;
+}
+
+void UploadQueue::wait(UploadToken token)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!device) return;
+    retire_completed();
+    if (token <= lastCompleted) return;
+
+    if (token > lastFlushed) flush_pending();
+
+    /* Waiting on the newest batch needed covers every batch before it */
+    auto submissions = Vulkan::Get()->get_graphics_submission_queue();
+    uint64_t submission = 0;
+    for (auto &batch : inFlight)
+        if (batch.token <= token) submission = batch.submission;
+    submissions->wait(submission);
+    while (!inFlight.empty() && inFlight.front().token <= token) {
+        release(inFlight.front());
+        inFlight.pop_front();
+    }
+}
+
+UploadStatistics UploadQueue::get_statistics()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    UploadStatistics result = statistics;
+    result.ringSize = ringSize;
+    result.ringUsed = ringUsed;
+    return result;
+}
+
+bool UploadQueue::is_using_transfer_queue()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return bool(transferQueue);
+}
+
+}
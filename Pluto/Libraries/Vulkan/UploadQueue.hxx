@@ -0,0 +1,170 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "Pluto/Libraries/Vulkan/MemoryAllocator.hxx"
+
+namespace Libraries {
+    /* Identifies the batch an upload was placed in. Batches complete in the order they were flushed. */
+    typedef uint64_t UploadToken;
+
+    struct UploadStatistics {
+        uint64_t uploadCount = 0;           /* Buffer and image uploads staged */
+        uint64_t batchCount = 0;            /* Command buffers enqueued, each holding every upload staged since the last */
+        uint64_t transferBatchCount = 0;    /* Batches whose copies ran on the dedicated transfer queue */
+        uint64_t bytesStaged = 0;           /* Bytes copied through the staging ring */
+        uint64_t overflowBytes = 0;         /* Bytes that didn't fit in the ring, and were given staging buffers of their own */
+        vk::DeviceSize ringSize = 0;
+        vk::DeviceSize ringUsed = 0;        /* Ring bytes held by batches the GPU hasn't finished with */
+    };
+
+    /* Stages uploads in a persistently mapped ring buffer, and records the copies for every upload staged between
+        flushes into a single command buffer. The render loop flushes once per frame, so loading many meshes or
+        textures between frames costs one submission. Ring space is reclaimed as each batch's submission completes.
+
+        Given a transfer queue from a family other than graphics, copies are submitted there as soon as they're 
+        flushed, so they overlap with rendering. Ownership of the destinations is released to the graphics family, 
+        and a small batch on the graphics queue waits on the copies and acquires them, ahead of any later commands. */
+    class UploadQueue
+    {
+    public:
+        /* Must be called once the logical device and memory allocator exist. The transfer queue is optional. 
+            Transfer granularity is the transfer family's minImageTransferGranularity. */
+        void initialize(vk::Device device, uint32_t graphics_family, MemoryAllocator *allocator,
+            uint32_t transfer_family = ~0u, vk::Queue transfer_queue = vk::Queue(), 
+            vk::Extent3D transfer_granularity = vk::Extent3D(1, 1, 1), vk::DeviceSize ring_size = 32 * 1024 * 1024);
+
+        /* Waits for every enqueued batch to complete, then frees the ring. Uploads that were never flushed are dropped. */
+        void destroy();
+
+        /* Copies size bytes of data into the staging ring, to be copied to the buffer at the given offset.
+            The buffer must have been created with eTransferDst. With a transfer queue, the rest of the buffer 
+            isn't carried over to the transfer family, so only upload to buffers the GPU hasn't used yet. */
+        UploadToken upload_buffer(vk::Buffer buffer, vk::DeviceSize offset, const void *data, vk::DeviceSize size);
+
+        /* Copies size bytes of data into the staging ring, to be copied to the image through the given regions, whose
+            buffer offsets are relative to data. Extent is the size of the image's first mip level. The subresource 
+            range is moved from old_layout to new_layout around the copy. Alignment must be a multiple of the format's 
+            texel block size. Images whose old layout isn't undefined have contents worth keeping, and images with 
+            regions the transfer family can't copy (see minImageTransferGranularity) are copied on the graphics queue. */
+        UploadToken upload_image(vk::Image image, vk::Extent3D extent, const void *data, vk::DeviceSize size,
+            std::vector<vk::BufferImageCopy> regions, vk::ImageSubresourceRange range,
+            vk::ImageLayout old_layout, vk::ImageLayout new_layout, vk::DeviceSize alignment = 16);
+
+        /* Records every staged upload into one command buffer, and submits it. With a transfer queue, the copies 
+            are submitted there, and the graphics side of the batch waits on them. Returns the token of the last 
+            batch submitted. */
+        UploadToken flush();
+
+        /* Reclaims the staging space of batches the GPU has finished with */
+        void retire();
+
+        /* Returns true once the copies of the given batch have completed on the GPU */
+        bool is_complete(UploadToken token);
+
+        /* Blocks until the given batch completes, flushing and submitting it first if needed */
+        void wait(UploadToken token);
+
+        UploadStatistics get_statistics();
+
+        /* Returns true if copies are submitted to a dedicated transfer queue */
+        bool is_using_transfer_queue();
+
+    private:
+        struct BufferCopy {
+            vk::Buffer source, destination;
+            vk::BufferCopy region;
+        };
+
+        struct ImageCopy {
+            vk::Buffer source;
+            vk::Image destination;
+            vk::Extent3D extent;
+            std::vector<vk::BufferImageCopy> regions;
+            vk::ImageSubresourceRange range;
+            vk::ImageLayout oldLayout, newLayout;
+        };
+
+        /* Uploads that don't fit in the ring get a staging buffer of their own, freed along with their batch */
+        struct OverflowBuffer {
+            vk::Buffer buffer;
+            MemoryAllocation memory;
+        };
+
+        struct Batch {
+            UploadToken token = 0;
+            std::vector<BufferCopy> bufferCopies;
+            std::vector<ImageCopy> imageCopies;
+            std::vector<OverflowBuffer> overflowBuffers;
+
+            /* Ring bytes consumed by this batch, including padding, and where the ring's head was once it was flushed */
+            vk::DeviceSize ringBytes = 0;
+            vk::DeviceSize ringEnd = 0;
+
+            /* Copies run in the transfer command buffer, if there's a transfer queue. The graphics command buffer 
+                acquires what they wrote, and makes any copies that must stay on the graphics queue. */
+            vk::CommandBuffer transferCommandBuffer;
+            vk::CommandBuffer commandBuffer;
+            vk::Semaphore transferComplete;
+
+            /* The graphics queue's timeline value for the batch, see SubmissionQueue */
+            uint64_t submission = 0;
+
+            bool empty() const { return bufferCopies.empty() && imageCopies.empty(); }
+        };
+
+        struct CommandPool {
+            vk::CommandPool pool;
+            std::vector<vk::CommandBuffer> freeBuffers;
+        };
+
+        vk::Device device;
+        MemoryAllocator *allocator = nullptr;
+        uint32_t graphicsFamily = 0;
+        uint32_t transferFamily = 0;
+        vk::Queue transferQueue;
+        vk::Extent3D transferGranularity;
+        CommandPool graphicsPool, transferPool;
+        std::vector<vk::Semaphore> freeSemaphores;
+
+        /* The ring is used front to back. The head is where the next upload goes, the tail is the start of the
+            oldest range the GPU may still be reading. */
+        vk::Buffer ringBuffer;
+        MemoryAllocation ringMemory;
+        vk::DeviceSize ringSize = 0;
+        vk::DeviceSize ringHead = 0;
+        vk::DeviceSize ringTail = 0;
+        vk::DeviceSize ringUsed = 0;
+
+        Batch pending;
+        std::deque<Batch> inFlight;
+        UploadToken lastFlushed = 0;
+        UploadToken lastCompleted = 0;
+
+        UploadStatistics statistics;
+        std::mutex mutex;
+
+        /* Copies data into the ring, or an overflow buffer if the ring is full. Returns the buffer it landed in. */
+        vk::Buffer stage(const void *data, vk::DeviceSize size, vk::DeviceSize alignment, vk::DeviceSize &offset);
+
+        /* Creates a host visible buffer copies can be made from, on either queue family */
+        vk::Buffer create_staging_buffer(vk::DeviceSize size, MemoryAllocation &memory);
+
+        /* Takes space from the ring. Returns false if there isn't enough room. */
+        bool take_ring_space(vk::DeviceSize size, vk::DeviceSize alignment, vk::DeviceSize &offset);
+
+        /* Takes a command buffer from the pool, and begins it */
+        vk::CommandBuffer begin(CommandPool &pool);
+
+        /* Returns true if every region of the copy meets the transfer family's image transfer granularity */
+        bool fits_transfer_granularity(const ImageCopy &copy);
+
+        /* These expect the mutex to be held */
+        UploadToken flush_pending();
+        void retire_completed();
+        void release(Batch &batch);
+    };
+}
@@ -209,7 +209,7 @@ vk::DispatchLoaderDynamic Vulkan::get_dldi()
 }
 
 /* Vulkan Device */ 
-bool Vulkan::create_device(set<string> device_extensions, set<string> device_features, uint32_t num_command_pools, vk::SurfaceKHR surface, bool use_openvr)
+bool Vulkan::create_device(set<string> device_extensions, set<string> device_features, vk::SurfaceKHR surface, bool use_openvr)
 {
     if (device)
         return false;
@@ -414,6 +414,74 @@ bool Vulkan::create_device(set<string> device_extensions, set<string> device_fea
         physicalDevice.getProperties2(&props, dldi);
     }
     
+    /* Descriptor indexing lets descriptors be updated after their sets are bound. It's optional, so only enable it 
+        if the device supports update after bind for every descriptor type in the shared descriptor set layouts. */
+    vk::PhysicalDeviceDescriptorIndexingFeaturesEXT descriptorIndexingFeatures;
+    updateAfterBindEnabled = false;
+    bindlessEnabled = false;
+    if (physicalDevice.getProperties().apiVersion >= VK_MAKE_VERSION(1, 1, 0)) {
+        for (const auto &extension : physicalDevice.enumerateDeviceExtensionProperties()) {
+            if (std::string(extension.extensionName) != VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME) continue;
+            vk::PhysicalDeviceDescriptorIndexingFeaturesEXT supported;
+            vk::PhysicalDeviceFeatures2 features2;
+            features2.pNext = &supported;
+            physicalDevice.getFeatures2(&features2, dldi);
+            if (supported.descriptorBindingStorageBufferUpdateAfterBind && supported.descriptorBindingSampledImageUpdateAfterBind) {
+                descriptorIndexingFeatures.descriptorBindingStorageBufferUpdateAfterBind = true;
+                descriptorIndexingFeatures.descriptorBindingSampledImageUpdateAfterBind = true;
+                deviceExtensions.insert(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+                updateAfterBindEnabled = true;
+
+                /* Partially bound, variable sized arrays let the texture table be sized at runtime, 
+                    up to the device's update after bind limits */
+                if (supported.descriptorBindingPartiallyBound && supported.descriptorBindingVariableDescriptorCount) {
+                    descriptorIndexingFeatures.descriptorBindingPartiallyBound = true;
+                    descriptorIndexingFeatures.descriptorBindingVariableDescriptorCount = true;
+                    vk::PhysicalDeviceProperties2 props;
+                    props.pNext = &descriptorIndexingProperties;
+                    physicalDevice.getProperties2(&props, dldi);
+                    bindlessEnabled = true;
+                }
+            }
+        }
+    }
+    
+    /* Timeline semaphores let every submission be tracked by a counter value instead of a fence. They're core in 
+        Vulkan 1.2. The bundled headers predate them, so TimelineSemaphore.hxx declares the extension. */
+    timelineSemaphoreEnabled = false;
+    VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineSemaphoreFeatures = {};
+    timelineSemaphoreFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+    if (physicalDevice.getProperties().apiVersion >= VK_MAKE_VERSION(1, 1, 0)) {
+        for (const auto &extension : physicalDevice.enumerateDeviceExtensionProperties()) {
+            if (std::string(extension.extensionName) != VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME) continue;
+            VkPhysicalDeviceTimelineSemaphoreFeaturesKHR supported = {};
+            supported.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+            vk::PhysicalDeviceFeatures2 features2;
+            features2.pNext = &supported;
+            physicalDevice.getFeatures2(&features2, dldi);
+            if (supported.timelineSemaphore) {
+                timelineSemaphoreFeatures.timelineSemaphore = VK_TRUE;
+                deviceExtensions.insert(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+                timelineSemaphoreEnabled = true;
+            }
+        }
+    }
+
+    /* Uploads can run on a transfer only queue family, overlapping with rendering. Prefer a family without compute 
+        either, which usually maps to a dedicated copy engine. Without one, uploads go through the graphics queue. */
+    transferFamilyIndex = -1;
+    {
+        auto queueFamilyProperties = physicalDevice.getQueueFamilyProperties();
+        for (int32_t i = 0; i < (int32_t) queueFamilyProperties.size(); ++i) {
+            auto flags = queueFamilyProperties[i].queueFlags;
+            if (queueFamilyProperties[i].queueCount == 0 || i == presentFamilyIndex) continue;
+            if (!(flags & vk::QueueFlagBits::eTransfer) || (flags & vk::QueueFlagBits::eGraphics)) continue;
+            if (transferFamilyIndex == -1 || !(flags & vk::QueueFlagBits::eCompute)) transferFamilyIndex = i;
+        }
+        if (transferFamilyIndex != -1)
+            transferImageGranularity = queueFamilyProperties[transferFamilyIndex].minImageTransferGranularity;
+    }
+
     /* We now need to create a logical device, which is like an instance of a physical device */
     std::vector<vk::DeviceQueueCreateInfo> queueCreateInfos;
     
@@ -438,12 +506,26 @@ bool Vulkan::create_device(set<string> device_extensions, set<string> device_fea
         queueCreateInfos.push_back(pQueueInfo);
     }
 
+    /* Transfer queue (if the device has a separate family for it) */
+    if (transferFamilyIndex != -1) {
+        vk::DeviceQueueCreateInfo tQueueInfo;
+        tQueueInfo.queueFamilyIndex = transferFamilyIndex;
+        tQueueInfo.queueCount = 1;
+        tQueueInfo.pQueuePriorities = queuePriorities.data();
+        queueCreateInfos.push_back(tQueueInfo);
+    }
+
     auto createInfo = vk::DeviceCreateInfo();
 
     /* Add pointers to the device features and queue creation structs */
     createInfo.queueCreateInfoCount = (uint32_t)queueCreateInfos.size();
     createInfo.pQueueCreateInfos = queueCreateInfos.data();
     createInfo.pEnabledFeatures = &deviceFeatures;
+    if (updateAfterBindEnabled) createInfo.pNext = &descriptorIndexingFeatures;
+    if (timelineSemaphoreEnabled) {
+        timelineSemaphoreFeatures.pNext = const_cast<void*>(createInfo.pNext);
+        createInfo.pNext = &timelineSemaphoreFeatures;
+    }
 
     /* We can specify device specific extensions, like "VK_KHR_swapchain", which may not be
     available for particular compute only devices. */
@@ -455,6 +537,8 @@ bool Vulkan::create_device(set<string> device_extensions, set<string> device_fea
 
     /* Now create the logical device! */
     device = physicalDevice.createDevice(createInfo);
+    memoryAllocator.initialize(device, physicalDevice);
+    pipelineCache.initialize(device, physicalDevice);
 
     /* Queues are implicitly created when creating device. This just gets handles. */
     for (uint32_t i = 0; i < numGraphicsQueues; ++i)
@@ -463,14 +547,21 @@ bool Vulkan::create_device(set<string> device_extensions, set<string> device_fea
         for (uint32_t i = 0; i < numPresentQueues; ++i)
             presentQueues.push_back(device.getQueue(presentFamilyIndex, i));
 
-    /* Command pools manage the memory that is used to store the buffers and command buffers are allocated from them */
-    for (uint32_t i = 0; i < num_command_pools; ++i) {
-        auto poolInfo = vk::CommandPoolCreateInfo();
-        poolInfo.queueFamilyIndex = graphicsFamilyIndex;
-        poolInfo.flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer; // Optional
-        commandPools.push_back(device.createCommandPool(poolInfo));
-    }
+    if (transferFamilyIndex != -1)
+        transferQueue = device.getQueue(transferFamilyIndex, 0);
+
+    /* Every graphics submission goes through one queue, so its timeline values order all of them */
+    graphicsSubmissions.initialize(device, graphicsQueues[0], timelineSemaphoreEnabled);
 
+    /* Command pools are created per thread as they're needed. See get_thread_command_pool. */
+
+    /* Uploads are staged through one ring, and recorded into batches submitted on the transfer queue if there 
+        is one, or the graphics queue otherwise */
+    if (transferQueue)
+        uploadQueue.initialize(device, graphicsFamilyIndex, &memoryAllocator, transferFamilyIndex, transferQueue, 
+            transferImageGranularity);
+    else
+        uploadQueue.initialize(device, graphicsFamilyIndex, &memoryAllocator);
 
     initialized = true;
     return true;
@@ -483,11 +574,25 @@ bool Vulkan::destroy_device()
         if (!device)
             return false;
 
-        // for (uint32_t i = 0; i < commandPools.size(); ++i) {
-        //     if (commandPools[i] != vk::CommandPool())
-        //         device.destroyCommandPool(commandPools[i]);
-        // }
+        uploadQueue.destroy();
+        graphicsSubmissions.destroy();
+
+        {
+            std::lock_guard<std::mutex> lock(thread_pools_mutex);
+            for (auto &pools : threadCommandPools) {
+                if (!pools) continue;
+                for (auto fence : pools->freeFences) device.destroyFence(fence);
+                if (pools->oneTimePool) device.destroyCommandPool(pools->oneTimePool);
+                for (auto &frame : pools->frames) device.destroyCommandPool(frame.pool);
+            }
+            threadCommandPools.clear();
+        }
+        pipelineCache.destroy();
+        memoryAllocator.destroy();
         device.destroy();
+        transferQueue = vk::Queue();
+        graphicsQueues.clear();
+        presentQueues.clear();
         
         return true;
     }
@@ -513,6 +618,13 @@ vk::PhysicalDeviceProperties Vulkan::get_physical_device_properties() const
     return deviceProperties;
 }
 
+vk::PhysicalDeviceFeatures Vulkan::get_physical_device_features() const
+{
+    if (!physicalDevice)
+        return vk::PhysicalDeviceFeatures();
+    return deviceFeatures;
+}
+
 vk::PhysicalDeviceRayTracingPropertiesNV Vulkan::get_physical_device_ray_tracing_properties() const
 {
     if (!physicalDevice)
@@ -774,13 +886,116 @@ uint32_t Vulkan::get_present_family() const
     return presentFamilyIndex;
 }
 
-vk::CommandPool Vulkan::get_command_pool(uint32_t index) const
+uint32_t Vulkan::get_transfer_family() const
 {
-    if (index >= commandPools.size()) {
-        std::cout<<"Error, max command pool index is " << commandPools.size() - 1 << std::endl;
-        return vk::CommandPool();
+    return (transferFamilyIndex != -1) ? transferFamilyIndex : graphicsFamilyIndex;
+}
+
+vk::Queue Vulkan::get_transfer_queue() const
+{
+    return (transferQueue) ? transferQueue : graphicsQueues[0];
+}
+
+bool Vulkan::is_transfer_queue_enabled() const
+{
+    return bool(transferQueue);
+}
+
+Vulkan::ThreadCommandPools &Vulkan::get_thread_command_pools()
+{
+    uint32_t id = get_thread_id();
+    std::lock_guard<std::mutex> lock(thread_pools_mutex);
+    if (id >= threadCommandPools.size()) threadCommandPools.resize(id + 1);
+    if (!threadCommandPools[id]) threadCommandPools[id] = std::make_unique<ThreadCommandPools>();
+    return *threadCommandPools[id];
+}
+
+vk::CommandPool Vulkan::get_thread_command_pool()
+{
+    auto &pools = get_thread_command_pools();
+    if (!pools.oneTimePool) {
+        auto poolInfo = vk::CommandPoolCreateInfo();
+        poolInfo.queueFamilyIndex = graphicsFamilyIndex;
+        poolInfo.flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer | vk::CommandPoolCreateFlagBits::eTransient;
+        pools.oneTimePool = device.createCommandPool(poolInfo);
+    }
+    return pools.oneTimePool;
+}
+
+vk::CommandBuffer Vulkan::get_thread_command_buffer(uint32_t frame, vk::CommandBufferLevel level)
+{
+    auto &pools = get_thread_command_pools();
+
+    /* The frame list is only resized by its own thread, but reset_thread_command_pools reads it, so guard it */
+    ThreadCommandPools::Frame *f;
+    {
+        std::lock_guard<std::mutex> lock(thread_pools_mutex);
+        if (frame >= pools.frames.size()) pools.frames.resize(frame + 1);
+        f = &pools.frames[frame];
+    }
+
+    if (!f->pool) {
+        auto poolInfo = vk::CommandPoolCreateInfo();
+        poolInfo.queueFamilyIndex = graphicsFamilyIndex;
+        poolInfo.flags = vk::CommandPoolCreateFlagBits::eTransient;
+        f->pool = device.createCommandPool(poolInfo);
     }
-    return commandPools[index];
+
+    bool primary = (level == vk::CommandBufferLevel::ePrimary);
+    auto &buffers = primary ? f->primaries : f->secondaries;
+    auto &used = primary ? f->usedPrimaries : f->usedSecondaries;
+    if (used == buffers.size()) {
+        vk::CommandBufferAllocateInfo allocInfo;
+        allocInfo.commandPool = f->pool;
+        allocInfo.level = level;
+        allocInfo.commandBufferCount = 1;
+        buffers.push_back(device.allocateCommandBuffers(allocInfo)[0]);
+        commandBuffersAllocated++;
+    }
+    return buffers[used++];
+}
+
+void Vulkan::reset_thread_command_pools(uint32_t frame)
+{
+    std::lock_guard<std::mutex> lock(thread_pools_mutex);
+    for (auto &pools : threadCommandPools) {
+        if (!pools || frame >= pools->frames.size()) continue;
+        auto &f = pools->frames[frame];
+        if (!f.pool || (f.usedPrimaries == 0 && f.usedSecondaries == 0)) continue;
+        device.resetCommandPool(f.pool, vk::CommandPoolResetFlags());
+        f.usedPrimaries = 0;
+        f.usedSecondaries = 0;
+    }
+}
+
+vk::Fence Vulkan::get_thread_fence()
+{
+    auto &pools = get_thread_command_pools();
+    if (!pools.freeFences.empty()) {
+        vk::Fence fence = pools.freeFences.back();
+        pools.freeFences.pop_back();
+        fencesRecycled++;
+        return fence;
+    }
+    fencesCreated++;
+    return device.createFence(vk::FenceCreateInfo());
+}
+
+void Vulkan::recycle_thread_fence(vk::Fence fence)
+{
+    if (!fence) return;
+    device.resetFences(fence);
+    get_thread_command_pools().freeFences.push_back(fence);
+}
+
+CommandPoolStatistics Vulkan::get_command_pool_statistics()
+{
+    CommandPoolStatistics statistics;
+    statistics.commandBuffersAllocated = commandBuffersAllocated;
+    statistics.commandBuffersRecycled = commandBuffersRecycled;
+    statistics.fencesCreated = fencesCreated;
+    statistics.fencesRecycled = fencesRecycled;
+    return statistics;
 }
 
 vk::Queue Vulkan::get_graphics_queue(uint32_t index) const
@@ -821,13 +1036,42 @@ uint32_t Vulkan::find_memory_type(uint32_t typeFilter, vk::MemoryPropertyFlags p
     return -1;
 }
 
+MemoryAllocator* Vulkan::get_memory_allocator() {
+    return &memoryAllocator;
+}
+
+UploadQueue* Vulkan::get_upload_queue() {
+    return &uploadQueue;
+}
+
+PipelineCache* Vulkan::get_pipeline_cache() {
+    return &pipelineCache;
+}
+
+SubmissionQueue* Vulkan::get_graphics_submission_queue() {
+    return &graphicsSubmissions;
+}
+
+bool Vulkan::is_timeline_semaphore_enabled() {
+    return timelineSemaphoreEnabled;
+}
+
 vk::CommandBuffer Vulkan::begin_one_time_graphics_command() {
-    uint32_t pool_id = get_thread_id();
-    vk::CommandBufferAllocateInfo cmdAllocInfo;
-    cmdAllocInfo.commandPool = get_command_pool(pool_id);
-    cmdAllocInfo.level = vk::CommandBufferLevel::ePrimary;
-    cmdAllocInfo.commandBufferCount = 1;
-    vk::CommandBuffer cmdBuffer = device.allocateCommandBuffers(cmdAllocInfo)[0];
+    auto &pools = get_thread_command_pools();
+    vk::CommandBuffer cmdBuffer;
+    if (!pools.freeOneTimeBuffers.empty()) {
+        cmdBuffer = pools.freeOneTimeBuffers.back();
+        pools.freeOneTimeBuffers.pop_back();
+        commandBuffersRecycled++;
+    }
+    else {
+        vk::CommandBufferAllocateInfo cmdAllocInfo;
+        cmdAllocInfo.commandPool = get_thread_command_pool();
+        cmdAllocInfo.level = vk::CommandBufferLevel::ePrimary;
+        cmdAllocInfo.commandBufferCount = 1;
+        cmdBuffer = device.allocateCommandBuffers(cmdAllocInfo)[0];
+        commandBuffersAllocated++;
+    }
 
     vk::CommandBufferBeginInfo beginInfo;
     beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
@@ -835,30 +1079,24 @@ vk::CommandBuffer Vulkan::begin_one_time_graphics_command() {
     return cmdBuffer;
 }
 
-bool Vulkan::end_one_time_graphics_command(vk::CommandBuffer command_buffer, std::string hint, bool free_after_use, bool submit_immediately) {
+bool Vulkan::end_one_time_graphics_command(vk::CommandBuffer command_buffer, std::string hint, bool free_after_use) {
     command_buffer.end();
 
-    uint32_t pool_id = get_thread_id();
-
-    vk::FenceCreateInfo fenceInfo;
-    vk::Fence fence = device.createFence(fenceInfo);
-
-    std::future<void> fut = enqueue_graphics_commands({command_buffer}, {},{}, {}, fence, hint);
+    /* The command may read buffers or images with uploads still staged, so send those ahead of it */
+    uploadQueue.flush();
 
-    if (submit_immediately) submit_graphics_commands();
+    uint64_t submission = submit_graphics_commands({command_buffer}, {}, {}, {}, vk::Fence(), hint);
+    graphicsSubmissions.wait(submission);
 
-    fut.wait();
-
-    device.waitForFences(fence, true, 10000000000);
-
-    if (free_after_use)
-        device.freeCommandBuffers(get_command_pool(pool_id), {command_buffer});
-    device.destroyFence(fence);
+    /* The GPU is done with it, so it can be reset and handed out again */
+    if (free_after_use) {
+        command_buffer.reset(vk::CommandBufferResetFlags());
+        get_thread_command_pools().freeOneTimeBuffers.push_back(command_buffer);
+    }
     return true;
 }
 
-// This could probably use a mutex...
-std::future<void> Vulkan::enqueue_graphics_commands
+uint64_t Vulkan::submit_graphics_commands
 (
     vector<vk::CommandBuffer> commandBuffers, 
     vector<vk::Semaphore> waitSemaphores,
@@ -867,78 +1105,29 @@ std::future<void> Vulkan::enqueue_graphics_commands
     vk::Fence fence,
     std::string hint
 ) {
-    std::lock_guard<std::mutex> lock(graphics_queue_mutex);
-
-    CommandQueueItem item;
-    item.commandBuffers = commandBuffers;
-    item.waitSemaphores = waitSemaphores;
-    item.waitDstStageMask = waitDstStageMasks;
-    item.signalSemaphores = signalSemaphores;
-    item.fence = fence;
-    item.promise = std::make_shared<std::promise<void>>();
-    item.should_free = false;
-    item.hint = hint;
-    auto new_future = item.promise->get_future();
-    graphicsCommandQueue.push(item);
-
-    return new_future;
+    try {
+        return graphicsSubmissions.submit(commandBuffers, waitSemaphores, waitDstStageMasks, signalSemaphores, fence);
+    }
+    catch (std::exception &e) {
+        throw std::runtime_error("Error: failed to submit " + hint + ". " + e.what());
+    }
 }
 
-std::future<void> Vulkan::enqueue_present_commands(
+uint64_t Vulkan::enqueue_present_commands(
     std::vector<vk::SwapchainKHR> swapchains, 
     std::vector<uint32_t> swapchain_indices, 
     std::vector<vk::Semaphore> waitSemaphores) 
 {
-    std::lock_guard<std::mutex> lock(present_queue_mutex);
-
-    CommandQueueItem item;
+    PresentQueueItem item;
     item.swapchains = swapchains;
     item.swapchain_indices = swapchain_indices;
     item.waitSemaphores = waitSemaphores;
-    item.promise = std::make_shared<std::promise<void>>();
-    auto new_future = item.promise->get_future();
-    presentCommandQueue.push(item);
-    return new_future;
-}
-
-bool Vulkan::submit_graphics_commands() {
-    std::lock_guard<std::mutex> lock(graphics_queue_mutex);
-
-    while (!graphicsCommandQueue.empty()) {
-        auto item = graphicsCommandQueue.front();
-
-        vk::SubmitInfo submit_info;
-        submit_info.waitSemaphoreCount = (uint32_t) item.waitSemaphores.size();
-        submit_info.pWaitSemaphores = item.waitSemaphores.data();
-        submit_info.pWaitDstStageMask = item.waitDstStageMask.data();
-        submit_info.commandBufferCount = (uint32_t) item.commandBuffers.size();
-        submit_info.pCommandBuffers = item.commandBuffers.data();
-        submit_info.signalSemaphoreCount = (uint32_t) item.signalSemaphores.size();
-        submit_info.pSignalSemaphores = item.signalSemaphores.data();
-
-        graphicsQueues[0].submit(submit_info, item.fence);
-        try {
-            item.promise->set_value();
-        }
-        catch (std::future_error& e) {
-            if (e.code() == std::make_error_condition(std::future_errc::promise_already_satisfied))
-                std::cout << "[promise already satisfied]\n";
-            else
-                std::cout << "[unknown exception]\n";
-        }
-        graphicsCommandQueue.pop();
-    }
-
-    return true;
+    return presentCommandQueue.push(std::move(item));
 }
 
 bool Vulkan::submit_present_commands() {
-    std::lock_guard<std::mutex> lock(present_queue_mutex);
-
     bool result = true;
-    while (!presentCommandQueue.empty()) {
-        auto item = presentCommandQueue.front();
-
+    presentCommandQueue.drain([this, &result] (PresentQueueItem &item) {
         try {
             vk::PresentInfoKHR presentInfo;
             presentInfo.swapchainCount = (uint32_t) item.swapchains.size();
@@ -947,32 +1136,41 @@ bool Vulkan::submit_present_commands() {
             presentInfo.pWaitSemaphores = item.waitSemaphores.data();
             presentInfo.waitSemaphoreCount = (uint32_t) item.waitSemaphores.size();
 
-            presentQueues[0].presentKHR(presentInfo);
-            //presentQueues[0].waitIdle();
+            /* If presentation shares the graphics queue, it has to go through the submission queue's lock */
+            if (presentQueues[0] == graphicsQueues[0]) graphicsSubmissions.present(presentInfo);
+            else {
+                std::lock_guard<std::mutex> lock(present_queue_mutex);
+                presentQueues[0].presentKHR(presentInfo);
+            }
         }
         catch (...) {
             result = false;
         }
-        item.promise->set_value();
-
-        presentCommandQueue.pop();
-    }
+    });
     return result;
 }
 
+bool Vulkan::is_present_complete(uint64_t token) {
+    return presentCommandQueue.is_complete(token);
+}
+
+void Vulkan::wait_for_present(uint64_t token) {
+    presentCommandQueue.wait(token);
+}
+
 bool Vulkan::flush_queues()
 {
-    presentQueues[0].waitIdle();
-    graphicsQueues[0].waitIdle();
+    if (!presentQueues.empty() && (presentQueues[0] != graphicsQueues[0])) {
+        std::lock_guard<std::mutex> lock(present_queue_mutex);
+        presentQueues[0].waitIdle();
+    }
+    graphicsSubmissions.wait_idle();
     return true;
 }
 
 uint32_t Vulkan::get_thread_id() {
-    /* Todo: make this thread safe */
-    if (thread_id == -1){
-        thread_id = registered_threads;
-        registered_threads++;
-    }
+    if (thread_id == -1)
+        thread_id = (int32_t) registered_threads.fetch_add(1);
     return thread_id;
 }
 
@@ -980,6 +1178,19 @@ bool Vulkan::is_ray_tracing_enabled() {
     return rayTracingEnabled;
 }
 
+bool Vulkan::is_update_after_bind_enabled() {
+    return updateAfterBindEnabled;
+}
+
+bool Vulkan::is_bindless_enabled() {
+    return bindlessEnabled;
+}
+
+vk::PhysicalDeviceDescriptorIndexingPropertiesEXT Vulkan::get_physical_device_descriptor_indexing_properties() const
+{
+    return descriptorIndexingProperties;
+}
+
 /* Flag comparison not supported by c++ vulkan bindings. *sigh* */
 vk::SampleCountFlags Vulkan::min(vk::SampleCountFlags A, vk::SampleCountFlags B) {
     int a, b;
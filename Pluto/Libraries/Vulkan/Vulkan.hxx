@@ -6,12 +6,28 @@
 #include <vector>
 #include <set>
 #include <condition_variable>
-#include <queue>
+#include <atomic>
+#include <memory>
 
 #include "Pluto/Tools/Singleton.hxx"
+#include "Pluto/Tools/CommandRing.hxx"
+#include "Pluto/Libraries/Vulkan/MemoryAllocator.hxx"
+#include "Pluto/Libraries/Vulkan/UploadQueue.hxx"
+#include "Pluto/Libraries/Vulkan/PipelineCache.hxx"
+#include "Pluto/Libraries/Vulkan/SubmissionQueue.hxx"
 
 namespace Libraries {
     using namespace std;
+
+    /* Counts the command buffers and fences made by the per thread pools. Once every pool has grown to what its 
+        thread needs, these stop increasing. */
+    struct CommandPoolStatistics {
+        uint64_t commandBuffersAllocated = 0;   /* One time and per frame command buffers allocated */
+        uint64_t commandBuffersRecycled = 0;    /* One time command buffers handed out again, rather than allocated */
+        uint64_t fencesCreated = 0;
+        uint64_t fencesRecycled = 0;            /* Fences handed out again, rather than created */
+    };
+
     class Vulkan : public Singleton
     {
     public:
@@ -27,7 +43,6 @@ namespace Libraries {
         bool create_device(
             set<string> device_extensions = set<string>(),
             set<string> device_features = set<string>(),
-            uint32_t num_command_pools = 8, 
             vk::SurfaceKHR surface = vk::SurfaceKHR(),
             bool use_openvr = false
         );
@@ -37,33 +52,105 @@ namespace Libraries {
         vk::Instance get_instance() const;
         vk::PhysicalDevice get_physical_device() const;
         vk::PhysicalDeviceProperties get_physical_device_properties() const;
+        vk::PhysicalDeviceFeatures get_physical_device_features() const;
         vk::PhysicalDeviceRayTracingPropertiesNV get_physical_device_ray_tracing_properties() const;
         vk::Device get_device() const;
         uint32_t get_graphics_family() const;
         uint32_t get_present_family() const;
-        vk::CommandPool get_command_pool(uint32_t index = 0) const;
+
+        /* The family and queue uploads are submitted to. These are the graphics family and queue unless the 
+            device has a separate transfer family, see is_transfer_queue_enabled. */
+        uint32_t get_transfer_family() const;
+        vk::Queue get_transfer_queue() const;
+
+        /* Returns true if the device has a transfer only queue family, which uploads are moved to so that 
+            they overlap with rendering */
+        bool is_transfer_queue_enabled() const;
+
+        /* Returns the calling thread's command pool for one time commands, creating it on first use. 
+            Command pools must not be used from more than one thread at a time, so each thread gets its own. */
+        vk::CommandPool get_thread_command_pool();
+
+        /* Returns a command buffer from the calling thread's pool for the given frame in flight. Buffers handed 
+            out this way are recycled, not freed, once reset_thread_command_pools is called for that frame. */
+        vk::CommandBuffer get_thread_command_buffer(uint32_t frame, vk::CommandBufferLevel level = vk::CommandBufferLevel::ePrimary);
+
+        /* Resets every thread's pool for the given frame, returning all of its command buffers for reuse. 
+            The GPU must be done with that frame, and no thread may be recording into it. */
+        void reset_thread_command_pools(uint32_t frame);
+
+        /* Returns an unsignaled fence from the calling thread's pool, creating one if the pool is empty. Give it 
+            back with recycle_thread_fence once nothing is waiting on it, from the same thread. A fence an unfinished 
+            operation may still signal can't be recycled, and should be destroyed instead. */
+        vk::Fence get_thread_fence();
+
+        /* Resets the fence, and returns it to the calling thread's pool */
+        void recycle_thread_fence(vk::Fence fence);
+
+        CommandPoolStatistics get_command_pool_statistics();
         vk::Queue get_graphics_queue(uint32_t index = 0) const;
         vk::Queue get_present_queue(uint32_t index = 0) const;
         vk::DispatchLoaderDynamic get_dispatch_loader_dynamic() const;
         
         uint32_t find_memory_type(uint32_t typeFilter, vk::MemoryPropertyFlags properties);
+
+        /* Returns the allocator every buffer and image should get its device memory from */
+        MemoryAllocator* get_memory_allocator();
+
+        /* Returns the queue staging uploads are batched through. Uploads are flushed once per frame, and before 
+            any one time command is submitted, so later commands always see them. */
+        UploadQueue* get_upload_queue();
+
+        /* Returns the cache pipelines should be created with, and shader modules taken from. It's loaded from 
+            disk when the device is created, and saved when it's destroyed. */
+        PipelineCache* get_pipeline_cache();
         
-        std::future<void> enqueue_graphics_commands(
+        /* Returns the queue graphics work is submitted through. Each submission gets a timeline value, which 
+            can be waited on from any thread. */
+        SubmissionQueue* get_graphics_submission_queue();
+
+        /* Submits the command buffers to the graphics queue right away, from any thread, and returns the 
+            submission's timeline value. The fence is optional. */
+        uint64_t submit_graphics_commands(
             std::vector<vk::CommandBuffer> commandBuffers, 
             std::vector<vk::Semaphore> waitSemaphores,
             std::vector<vk::PipelineStageFlags> waitDstStageMasks,
             std::vector<vk::Semaphore> signalSemaphores,
             vk::Fence fence,
             std::string hint);
-        std::future<void> enqueue_present_commands(
+        /* Queues a present, to be made by the next submit_present_commands call. Safe to call from any thread. 
+            Returns a token which is_present_complete and wait_for_present take. */
+        uint64_t enqueue_present_commands(
             std::vector<vk::SwapchainKHR> swapchains, 
             std::vector<uint32_t> swapchain_indices, 
             std::vector<vk::Semaphore> waitSemaphores
         );
-        bool submit_graphics_commands();
+
+        /* Makes every queued present. Only the render thread may call this. */
         bool submit_present_commands();
+
+        /* Returns true once submit_present_commands has made the present with the given token */
+        bool is_present_complete(uint64_t token);
+
+        /* Blocks until submit_present_commands has made the present with the given token */
+        void wait_for_present(uint64_t token);
         bool flush_queues();
+
+        /* Returns true if VK_KHR_timeline_semaphore was enabled, so submissions are tracked with a timeline 
+            semaphore rather than recycled fences */
+        bool is_timeline_semaphore_enabled();
         bool is_ray_tracing_enabled();
+
+        /* Returns true if VK_EXT_descriptor_indexing was enabled with update after bind support for storage buffers 
+            and sampled images, so descriptor sets can be created whose descriptors may be updated after being bound. */
+        bool is_update_after_bind_enabled();
+
+        /* Returns true if descriptor arrays can also be partially bound and variably sized, allowing a texture 
+            table sized at runtime. Implies is_update_after_bind_enabled. */
+        bool is_bindless_enabled();
+
+        /* Returns the descriptor indexing limits of the physical device. Only filled in if bindless is enabled. */
+        vk::PhysicalDeviceDescriptorIndexingPropertiesEXT get_physical_device_descriptor_indexing_properties() const;
         bool is_ASTC_supported();
         bool is_ETC2_supported();
         bool is_BC_supported();
@@ -73,14 +160,27 @@ namespace Libraries {
         vk::SampleCountFlagBits get_closest_sample_count_flag(uint32_t samples);
         vk::SampleCountFlags get_msaa_sample_flags();
 
+        /* Returns a command buffer, ready for recording, from the calling thread's pool. Buffers returned to the 
+            pool by end_one_time_graphics_command are reused before any new ones are allocated. */
         vk::CommandBuffer begin_one_time_graphics_command();
-        bool end_one_time_graphics_command(vk::CommandBuffer command_buffer, std::string hint, bool free_after_use = true, bool submit_immediately = false);
+
+        /* Submits the command buffer, and blocks until the GPU has run it. The buffer then goes back to the 
+            calling thread's pool, unless free_after_use is false, in which case the caller keeps it. */
+        bool end_one_time_graphics_command(vk::CommandBuffer command_buffer, std::string hint, bool free_after_use = true);
 
         vk::DispatchLoaderDynamic get_dldi();
     private:
-        uint32_t registered_threads = 0; 
+        std::atomic<uint32_t> registered_threads {0};
         bool validationEnabled = true;
         bool rayTracingEnabled = false;
+        bool updateAfterBindEnabled = false;
+        MemoryAllocator memoryAllocator;
+        UploadQueue uploadQueue;
+        PipelineCache pipelineCache;
+        SubmissionQueue graphicsSubmissions;
+        bool timelineSemaphoreEnabled = false;
+        bool bindlessEnabled = false;
+        vk::PhysicalDeviceDescriptorIndexingPropertiesEXT descriptorIndexingProperties;
         vk::SampleCountFlags supportedMSAASamples;
         set<string> validationLayers;
         set<string> instanceExtensions;
@@ -95,7 +195,33 @@ namespace Libraries {
         thread eventThread;
         int32_t graphicsFamilyIndex = -1;
         int32_t presentFamilyIndex = -1;
-        std::vector<vk::CommandPool> commandPools;
+        int32_t transferFamilyIndex = -1;
+
+        /* The transfer family's minImageTransferGranularity. Image copies on that family must be aligned to it. */
+        vk::Extent3D transferImageGranularity = vk::Extent3D(1, 1, 1);
+
+        /* The command pools created for one thread. Only that thread allocates from or records into them. */
+        struct ThreadCommandPools {
+            vk::CommandPool oneTimePool;
+            std::vector<vk::CommandBuffer> freeOneTimeBuffers;
+            std::vector<vk::Fence> freeFences;
+            struct Frame {
+                vk::CommandPool pool;
+                std::vector<vk::CommandBuffer> primaries, secondaries;
+                uint32_t usedPrimaries = 0, usedSecondaries = 0;
+            };
+            std::vector<Frame> frames;
+        };
+
+        /* Indexed by thread id. Entries are never moved, so a thread can keep using its entry while others are added. */
+        std::mutex thread_pools_mutex;
+        std::vector<std::unique_ptr<ThreadCommandPools>> threadCommandPools;
+        ThreadCommandPools &get_thread_command_pools();
+
+        std::atomic<uint64_t> commandBuffersAllocated {0};
+        std::atomic<uint64_t> commandBuffersRecycled {0};
+        std::atomic<uint64_t> fencesCreated {0};
+        std::atomic<uint64_t> fencesRecycled {0};
 
         struct QueueFamilyIndices {
             int graphicsFamily = -1;
@@ -120,26 +246,19 @@ namespace Libraries {
         vk::Device device;
         std::vector<vk::Queue> graphicsQueues;
         std::vector<vk::Queue> presentQueues;	
+        vk::Queue transferQueue;
 
-            // vk::SubmitInfo submission;
-
-        struct CommandQueueItem {
-            std::string hint;
+        /* Presents are queued by window, and made together once the frame's graphics work is submitted */
+        struct PresentQueueItem {
             std::vector<vk::SwapchainKHR> swapchains;
             std::vector<uint32_t> swapchain_indices;
-            std::vector<vk::PipelineStageFlags> waitDstStageMask;
             std::vector<vk::Semaphore> waitSemaphores;
-            std::vector<vk::CommandBuffer> commandBuffers;
-            std::vector<vk::Semaphore> signalSemaphores;
-            vk::Fence fence;
-            std::shared_ptr<std::promise<void>> promise;
-            bool should_free;
         };
 
-        std::mutex graphics_queue_mutex;
+        /* Presents are run outside of any lock. The mutex only guards the present queue itself, when it isn't 
+            the graphics queue, since flush_queues may wait on it from another thread. */
+        CommandRing<PresentQueueItem> presentCommandQueue;
         std::mutex present_queue_mutex;
-        std::queue<CommandQueueItem> graphicsCommandQueue;
-        std::queue<CommandQueueItem> presentCommandQueue;
         
         vk::DebugReportCallbackEXT internalCallback;
         function<void()> externalCallback;
@@ -1,14 +1,13 @@
 #include "./Light.hxx"
 
-Light Light::lights[MAX_LIGHTS];
-LightStruct* Light::pinnedMemory;
+SlotMap<Light> Light::lights(MAX_LIGHTS);
 std::map<std::string, uint32_t> Light::lookupTable;
-vk::Buffer Light::ssbo;
-vk::DeviceMemory Light::ssboMemory;
+Libraries::StorageBuffer Light::ssbo;
 
 Light::Light()
 {
     this->initialized = false;
+    light_struct.range = 0.0f;
 }
 
 Light::Light(std::string name, uint32_t id)
@@ -16,6 +15,7 @@ Light::Light(std::string name, uint32_t id)
     this->initialized = true;
     this->name = name;
     this->id = id;
+    light_struct.range = 0.0f;
 }
 
 void Light::set_color(float r, float g, float b)
@@ -23,6 +23,20 @@ void Light::set_color(float r, float g, float b)
     light_struct.ambient = glm::vec4(r, g, b, 1.0);
     light_struct.diffuse = glm::vec4(r, g, b, 1.0);
     light_struct.specular = glm::vec4(r, g, b, 1.0);
+    mark_dirty();
+}
+
+void Light::set_range(float range)
+{
+    if (range < 0.0f)
+        throw std::runtime_error( std::string("Light range must be greater than or equal to 0"));
+    light_struct.range = range;
+    mark_dirty();
+}
+
+float Light::get_range()
+{
+    return light_struct.range;
 }
 
 std::string Light::to_string() {
@@ -49,51 +63,56 @@ void Light::Initialize()
     if (physical_device == vk::PhysicalDevice())
         throw std::runtime_error( std::string("Invalid vulkan physical device"));
 
-    vk::BufferCreateInfo bufferInfo = {};
-    bufferInfo.size = MAX_LIGHTS * sizeof(LightStruct);
-    bufferInfo.usage = vk::BufferUsageFlagBits::eStorageBuffer;
-    bufferInfo.sharingMode = vk::SharingMode::eExclusive;
-    ssbo = device.createBuffer(bufferInfo);
-
-    vk::MemoryRequirements memReqs = device.getBufferMemoryRequirements(ssbo);
-    vk::MemoryAllocateInfo allocInfo = {};
-    allocInfo.allocationSize = memReqs.size;
-
-    vk::PhysicalDeviceMemoryProperties memProperties = physical_device.getMemoryProperties();
-    vk::MemoryPropertyFlags properties = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
-    allocInfo.memoryTypeIndex = vulkan->find_memory_type(memReqs.memoryTypeBits, properties);
+    ssbo.create(lights.get_capacity() * sizeof(LightStruct));
+    lights.mark_all_dirty();
+}
 
-    ssboMemory = device.allocateMemory(allocInfo);
-    device.bindBufferMemory(ssbo, ssboMemory, 0);
+void Light::UploadSSBO(uint32_t frame)
+{
+    if (!ssbo.is_created()) return;
+
+    /* Grow the SSBO if lights were added since the last upload. The staging copy is kept, so nothing needs to be re-marked. */
+    ssbo.reserve(lights.get_capacity() * sizeof(LightStruct));
+
+    /* Copy only the modified lights into the staging copy, then bring this frame's copy of the SSBO up to date */
+    LightStruct* light_structs = (LightStruct*) ssbo.get_staging();
+    lights.consume_dirty_ranges([&](uint32_t first, uint32_t count) {
+        for (uint32_t i = first; i < first + count; ++i)
+            light_structs[i] = lights[i].light_struct;
+        ssbo.mark_range(first * sizeof(LightStruct), count * sizeof(LightStruct));
+    });
+    ssbo.flush(frame);
+}
 
-    /* Pin the buffer */
-    pinnedMemory = (LightStruct*) device.mapMemory(ssboMemory, 0, MAX_LIGHTS * sizeof(LightStruct));
+vk::Buffer Light::GetSSBO()
+{
+    return ssbo.get_buffer();
 }
 
-void Light::UploadSSBO()
+uint32_t Light::GetSSBOSize()
 {
-    if (pinnedMemory == nullptr) return;
-    LightStruct light_structs[MAX_LIGHTS];
-    
-    /* TODO: remove this for loop */
-    for (int i = 0; i < MAX_LIGHTS; ++i) {
-        if (!lights[i].is_initialized()) continue;
+    return (uint32_t) ssbo.get_size();
+}
 
-        light_structs[i] = lights[i].light_struct;
-    };
+uint32_t Light::GetSSBOOffset(uint32_t frame)
+{
+    return (uint32_t) ssbo.get_offset(frame);
+}
 
-    /* Copy to GPU mapped memory */
-    memcpy(pinnedMemory, light_structs, sizeof(light_structs));
+uint64_t Light::GetSSBOBytesUploaded()
+{
+    return ssbo.get_bytes_uploaded();
 }
 
-vk::Buffer Light::GetSSBO()
+uint64_t Light::GetSSBOGeneration()
 {
-    return ssbo;
+    return ssbo.get_generation();
 }
 
-uint32_t Light::GetSSBOSize()
+void Light::mark_dirty()
 {
-    return MAX_LIGHTS * sizeof(LightStruct);
+    if (!initialized) return;
+    lights.mark_dirty(id);
 }
 
 void Light::CleanUp()
@@ -105,36 +124,38 @@ void Light::CleanUp()
     if (device == vk::Device())
         throw std::runtime_error( std::string("Invalid vulkan device"));
 
-    device.destroyBuffer(ssbo);
-    device.unmapMemory(ssboMemory);
-    device.freeMemory(ssboMemory);
+    ssbo.destroy();
 }	
 
 /* Static Factory Implementations */
 Light* Light::Create(std::string name) {
-    return StaticFactory::Create(name, "Light", lookupTable, lights, MAX_LIGHTS);
+    return StaticFactory::Create(name, "Light", lookupTable, lights);
 }
 
 Light* Light::Get(std::string name) {
-    return StaticFactory::Get(name, "Light", lookupTable, lights, MAX_LIGHTS);
+    return StaticFactory::Get(name, "Light", lookupTable, lights);
 }
 
 Light* Light::Get(uint32_t id) {
-    return StaticFactory::Get(id, "Light", lookupTable, lights, MAX_LIGHTS);
+    return StaticFactory::Get(id, "Light", lookupTable, lights);
+}
+
+Light* Light::Get(uint32_t id, uint32_t generation) {
+    return StaticFactory::Get(id, generation, "Light", lookupTable, lights);
 }
 
 void Light::Delete(std::string name) {
-    StaticFactory::Delete(name, "Light", lookupTable, lights, MAX_LIGHTS);
+    StaticFactory::Delete(name, "Light", lookupTable, lights);
 }
 
 void Light::Delete(uint32_t id) {
-    StaticFactory::Delete(id, "Light", lookupTable, lights, MAX_LIGHTS);
+    StaticFactory::Delete(id, "Light", lookupTable, lights);
 }
 
-Light* Light::GetFront() {
-    return lights;
+Light* Light::GetFromIndex(uint32_t index) {
+    return StaticFactory::GetFromIndex(index, lights);
 }
 
 uint32_t Light::GetCount() {
-    return MAX_LIGHTS;
+    return lights.get_capacity();
 }
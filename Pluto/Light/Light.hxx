@@ -2,17 +2,16 @@
 
 #include "Pluto/Tools/StaticFactory.hxx"
 #include "Pluto/Libraries/Vulkan/Vulkan.hxx"
+#include "Pluto/Libraries/Vulkan/StorageBuffer.hxx"
 #include "Pluto/Light/LightStruct.hxx"
 
 class Light : public StaticFactory
 {
     private:
         /* Factory fields */
-        static Light lights[MAX_LIGHTS];
-        static LightStruct* pinnedMemory;
+        static SlotMap<Light> lights;
         static std::map<std::string, uint32_t> lookupTable;
-        static vk::Buffer ssbo;
-        static vk::DeviceMemory ssboMemory;
+        static Libraries::StorageBuffer ssbo;
         
         /* Instance fields*/
         LightStruct light_struct;
@@ -22,15 +21,19 @@ class Light : public StaticFactory
         static Light* Create(std::string name);
         static Light* Get(std::string name);
         static Light* Get(uint32_t id);
-        static Light* GetFront();
+        static Light* Get(uint32_t id, uint32_t generation);
+        static Light* GetFromIndex(uint32_t index);
 	    static uint32_t GetCount();
         static void Delete(std::string name);
         static void Delete(uint32_t id);
     
         static void Initialize();
-        static void UploadSSBO();
+        static void UploadSSBO(uint32_t frame);
         static vk::Buffer GetSSBO();
         static uint32_t GetSSBOSize();
+        static uint32_t GetSSBOOffset(uint32_t frame);
+        static uint64_t GetSSBOBytesUploaded();
+        static uint64_t GetSSBOGeneration();
         static void CleanUp();
 
         /* Instance functions */
@@ -41,5 +44,13 @@ class Light : public StaticFactory
 
         void set_color(float r, float g, float b);
 
+        /* Limits how far the light reaches, fading it out smoothly to nothing at the given distance.
+            Ranged lights are only evaluated by surfaces in the clusters they overlap, so scenes can have many of them.
+            A range of 0, the default, reaches everywhere. */
+        void set_range(float range);
+        float get_range();
+
         std::string to_string();
+
+        void mark_dirty();
 };
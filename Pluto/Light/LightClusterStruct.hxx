@@ -0,0 +1,55 @@
+/* File shared by both GLSL and C++ */
+#ifndef LIGHTCLUSTERSTRUCT_HXX
+#define LIGHTCLUSTERSTRUCT_HXX
+
+#ifdef GLSL
+#ifndef int32_t
+#define int32_t int
+#endif
+#endif
+
+#ifndef GLSL
+#include <glm/glm.hpp>
+using namespace glm;
+#endif
+
+/* Dimensions of the froxel grid lights are assigned to. Tiles divide the screen evenly,
+    and depth slices grow exponentially from the near plane. */
+#ifndef LIGHT_CLUSTER_X
+#define LIGHT_CLUSTER_X 16
+#endif
+
+#ifndef LIGHT_CLUSTER_Y
+#define LIGHT_CLUSTER_Y 9
+#endif
+
+#ifndef LIGHT_CLUSTER_Z
+#define LIGHT_CLUSTER_Z 24
+#endif
+
+#define LIGHT_CLUSTER_COUNT (LIGHT_CLUSTER_X * LIGHT_CLUSTER_Y * LIGHT_CLUSTER_Z)
+
+/* The froxel grid of one view of one camera. Lights without a range reach every cluster,
+    so they're listed once per frame as global lights rather than in each cluster. */
+struct LightClusterGrid
+{
+    mat4 world_to_view;
+    mat4 world_to_clip;
+    float near_pos;
+    float slice_scale; /* LIGHT_CLUSTER_Z / log(far / near) */
+    int32_t first_cluster;
+    int32_t first_global_light;
+    int32_t global_light_count;
+    int32_t pad0;
+    int32_t pad1;
+    int32_t pad2;
+};
+
+/* A range of the light index buffer, holding the entities whose lights may reach this cluster */
+struct LightCluster
+{
+    int32_t first_light;
+    int32_t light_count;
+};
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef LIGHTSTRUCT_HXX
 #define LIGHTSTRUCT_HXX
 
+/* The initial number of light slots. Storage and the light SSBO grow past this at runtime. */
 #ifndef MAX_LIGHTS
 #define MAX_LIGHTS 8
 #endif
@@ -17,7 +18,9 @@ struct LightStruct {
 	vec4 specular;
 
 	float ambientContribution, constantAttenuation, linearAttenuation, quadraticAttenuation;
-	float spotCutoff, spotExponent, pad1, pad2;
+	float spotCutoff, spotExponent;
+	float range; /* Distance past which the light has no effect, or 0 if the light reaches everywhere */
+	float pad2;
 };
 
 #endif
\ No newline at end of file
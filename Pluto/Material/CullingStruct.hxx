@@ -0,0 +1,41 @@
+// File compiled by both c++ and glsl
+#ifndef CULLINGSTRUCT_HXX
+#define CULLINGSTRUCT_HXX
+
+#ifdef GLSL
+#ifndef int32_t
+#define int32_t int
+#endif
+#ifndef uint32_t
+#define uint32_t uint
+#endif
+#endif
+
+/* An entity a pass may draw, and the indirect draw it's added to as an instance if it passes culling */
+struct CullCandidate
+{
+    int32_t entity_id;
+    int32_t draw_command;
+};
+
+/* Matches the layout of VkDrawIndexedIndirectCommand. The culling shader counts instances up from zero. */
+struct DrawIndexedIndirectCommand
+{
+    uint32_t index_count;
+    uint32_t instance_count;
+    uint32_t first_index;
+    int32_t vertex_offset;
+    uint32_t first_instance;
+};
+
+/* Per dispatch parameters of the culling compute shader. A view count of zero disables culling. */
+struct CullingPushConsts
+{
+    int32_t camera_entity_id;
+    int32_t first_candidate;
+    int32_t candidate_count;
+    int32_t first_view;
+    int32_t view_count;
+};
+
+#endif
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+
+#include "Pluto/Libraries/Vulkan/Vulkan.hxx"
+
+/* Everything needed to record one draw, resolved ahead of recording. Sorting packets by sort_key groups 
+    draws by pipeline, then mesh, then material, so that state is only bound when it changes. 
+    Volumes sort after everything else, so they're still drawn last. */
+struct DrawPacket {
+    uint64_t sort_key;
+    int32_t entity_id;
+    bool volume;
+    vk::Pipeline pipeline;
+    vk::PipelineLayout pipeline_layout;
+    vk::Buffer point_buffer, color_buffer, normal_buffer, texcoord_buffer, index_buffer;
+    uint32_t index_count;
+
+    bool operator<(const DrawPacket &other) const
+    {
+        return sort_key < other.sort_key;
+    }
+};
+
+/* Counts of the draws and state changes recorded from a list of draw packets */
+struct DrawStatistics {
+    uint32_t draws = 0;
+    uint32_t instances = 0;
+    uint32_t pipeline_binds = 0;
+    uint32_t mesh_binds = 0;
+    uint32_t push_constants = 0;
+    uint32_t push_constant_bytes = 0;
+
+    void add(const DrawStatistics &other)
+    {
+        draws += other.draws;
+        instances += other.instances;
+        pipeline_binds += other.pipeline_binds;
+        mesh_binds += other.mesh_binds;
+        push_constants += other.push_constants;
+        push_constant_bytes += other.push_constant_bytes;
+    }
+};
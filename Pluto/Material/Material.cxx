@@ -1,18 +1,30 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
 #include "./Material.hxx"
 #include "Pluto/Tools/Options.hxx"
 #include "Pluto/Tools/FileReader.hxx"
+#include "Pluto/Tools/TaskQueue.hxx"
 
 #include "Pluto/Entity/Entity.hxx"
 #include "Pluto/Transform/Transform.hxx"
 #include "Pluto/Camera/Camera.hxx"
 #include "Pluto/Light/Light.hxx"
 #include "Pluto/Texture/Texture.hxx"
+#include "Pluto/Mesh/Mesh.hxx"
 
-Material Material::materials[MAX_MATERIALS];
-MaterialStruct* Material::pinnedMemory;
+SlotMap<Material> Material::materials(MAX_MATERIALS);
 std::map<std::string, uint32_t> Material::lookupTable;
-vk::Buffer Material::ssbo;
-vk::DeviceMemory Material::ssboMemory;
+Libraries::StorageBuffer Material::ssbo;
+Libraries::StorageBuffer Material::instanceSSBO;
+Libraries::StorageBuffer Material::cullCandidateSSBO;
+Libraries::StorageBuffer Material::drawCommandSSBO;
+Libraries::StorageBuffer Material::lightGridSSBO;
+Libraries::StorageBuffer Material::lightClusterSSBO;
+Libraries::StorageBuffer Material::lightIndexSSBO;
+vk::Pipeline Material::cullingPipeline;
+vk::PipelineLayout Material::cullingPipelineLayout;
 
 vk::DescriptorSetLayout Material::componentDescriptorSetLayout;
 vk::DescriptorSetLayout Material::textureDescriptorSetLayout;
@@ -22,8 +34,10 @@ vk::DescriptorPool Material::textureDescriptorPool;
 vk::DescriptorPool Material::raytracingDescriptorPool;
 std::vector<vk::VertexInputBindingDescription> Material::vertexInputBindingDescriptions;
 std::vector<vk::VertexInputAttributeDescription> Material::vertexInputAttributeDescriptions;
-vk::DescriptorSet Material::componentDescriptorSet;
-vk::DescriptorSet Material::textureDescriptorSet;
+vk::DescriptorSet Material::componentDescriptorSets[MAX_FRAMES_IN_FLIGHT];
+vk::DescriptorSet Material::textureDescriptorSets[MAX_FRAMES_IN_FLIGHT];
+Material::DescriptorCache Material::descriptorCaches[MAX_FRAMES_IN_FLIGHT];
+uint32_t Material::descriptorWriteCount = 0;
 
 std::map<vk::RenderPass, Material::RasterPipelineResources> Material::uniformColor;
 std::map<vk::RenderPass, Material::RasterPipelineResources> Material::blinn;
@@ -35,6 +49,19 @@ std::map<vk::RenderPass, Material::RasterPipelineResources> Material::depth;
 std::map<vk::RenderPass, Material::RasterPipelineResources> Material::volume;
 
 std::map<vk::RenderPass, Material::RaytracingPipelineResources> Material::rttest;
+std::shared_mutex Material::pipelineMutex;
+std::map<vk::RenderPass, std::vector<std::shared_future<void>>> Material::pipelineCompiles;
+std::unordered_map<std::vector<uint64_t>, std::shared_ptr<Material::SharedPipeline>, KeyHasher> Material::pipelineRegistry;
+std::map<vk::RenderPass, std::vector<uint64_t>> Material::renderPassSignatures;
+std::mutex Material::registryMutex;
+uint64_t Material::pipelineReuseCount = 0;
+
+/* Pipelines compile on a few threads of their own, leaving the rest of the cores for recording */
+static TaskQueue* GetPipelineCompileQueue()
+{
+    static TaskQueue queue(std::min(std::max(std::thread::hardware_concurrency() / 2, 1u), 4u));
+    return &queue;
+}
 
 Material::Material() {
     this->initialized = false;
@@ -98,17 +125,10 @@ std::string Material::to_string() {
     return output;
 }
 
-/* Wrapper for shader module creation */
-vk::ShaderModule Material::CreateShaderModule(const std::vector<char>& code) {
+/* Wrapper for shader module lookup */
+vk::ShaderModule Material::GetShaderModule(std::string path) {
     auto vulkan = Libraries::Vulkan::Get();
-    auto device = vulkan->get_device();
-
-    vk::ShaderModuleCreateInfo createInfo;
-    createInfo.codeSize = code.size();
-    createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
-
-    vk::ShaderModule shaderModule = device.createShaderModule(createInfo);
-    return shaderModule;
+    return vulkan->get_pipeline_cache()->get_shader_module(path);
 }
 
 /* Under the hood, all material types have a set of Vulkan pipeline objects. */
@@ -126,47 +146,171 @@ void Material::CreateRasterPipeline(
     auto vulkan = Libraries::Vulkan::Get();
     auto device = vulkan->get_device();
 
-    /* Vertex Input */
-    vk::PipelineVertexInputStateCreateInfo vertexInputInfo;
-    vertexInputInfo.vertexBindingDescriptionCount = (uint32_t)bindingDescriptions.size();
-    vertexInputInfo.pVertexBindingDescriptions = bindingDescriptions.data();
-    vertexInputInfo.vertexAttributeDescriptionCount = (uint32_t)attributeDescriptions.size();
-    vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
-
-    vk::PushConstantRange range;
-    range.offset = 0;
-    range.size = sizeof(PushConsts);
-    range.stageFlags = vk::ShaderStageFlagBits::eAll;
-
-    /* Connect things together with pipeline layout */
-    vk::PipelineLayoutCreateInfo pipelineLayoutInfo;
-    pipelineLayoutInfo.setLayoutCount = (uint32_t)componentDescriptorSetLayouts.size();
-    pipelineLayoutInfo.pSetLayouts = componentDescriptorSetLayouts.data();
-    pipelineLayoutInfo.pushConstantRangeCount = 1; // TODO: this needs to account for entity id
-    pipelineLayoutInfo.pPushConstantRanges = &range; // TODO: this needs to account for entity id
-
-    /* Create the pipeline layout */
-    layout = device.createPipelineLayout(pipelineLayoutInfo);
-    
-    vk::GraphicsPipelineCreateInfo pipelineInfo;
-    pipelineInfo.stageCount = (uint32_t)shaderStages.size();
-    pipelineInfo.pStages = shaderStages.data();
-    pipelineInfo.pVertexInputState = &vertexInputInfo;
-    pipelineInfo.pInputAssemblyState = &parameters.inputAssembly;
-    pipelineInfo.pViewportState = &parameters.viewportState;
-    pipelineInfo.pRasterizationState = &parameters.rasterizer;
-    pipelineInfo.pMultisampleState = &parameters.multisampling;
-    pipelineInfo.pDepthStencilState = &parameters.depthStencil;
-    pipelineInfo.pColorBlendState = &parameters.colorBlending;
-    pipelineInfo.pDynamicState = &parameters.dynamicState; // Optional
-    pipelineInfo.layout = layout;
-    pipelineInfo.renderPass = renderpass;
-    pipelineInfo.subpass = subpass;
-    pipelineInfo.basePipelineHandle = vk::Pipeline(); // Optional
-    pipelineInfo.basePipelineIndex = -1; // Optional
-
-    /* Create pipeline */
-    pipeline = device.createGraphicsPipelines(vk::PipelineCache(), {pipelineInfo})[0];
+    /* The texture and sampler tables are sized at runtime, so shaders size their arrays with specialization constants */
+    std::array<uint32_t, 2> tableSizes = { Texture::GetDescriptorCapacity(), Texture::GetSamplerCapacity() };
+
+    /* Pipelines can be used with any renderpass compatible with the one they were made for, so they're keyed by the
+        renderpass's signature rather than the renderpass itself, along with everything else that goes into them. 
+        Variable length parts are preceded by their lengths, so that no two different inputs give the same key. */
+    std::vector<uint64_t> key;
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        auto signature = renderPassSignatures.find(renderpass);
+        if (signature != renderPassSignatures.end()) {
+            key_append(key, signature->second.size());
+            key.insert(key.end(), signature->second.begin(), signature->second.end());
+        }
+        /* Unregistered renderpasses only share with themselves */
+        else key_append(key, 0, reinterpret_cast<uint64_t>((VkRenderPass) renderpass));
+    }
+    key_append(key, subpass, tableSizes[0], tableSizes[1]);
+    parameters.append_key(key);
+    key_append(key, shaderStages.size());
+    for (auto &stage : shaderStages)
+        key_append(key, (VkShaderStageFlags) stage.stage, reinterpret_cast<uint64_t>((VkShaderModule) stage.module), std::string(stage.pName));
+    key_append(key, bindingDescriptions.size());
+    for (auto &binding : bindingDescriptions)
+        key_append(key, binding.binding, binding.stride, binding.inputRate);
+    key_append(key, attributeDescriptions.size());
+    for (auto &attribute : attributeDescriptions)
+        key_append(key, attribute.location, attribute.binding, attribute.format, attribute.offset);
+    key_append(key, componentDescriptorSetLayouts.size());
+    for (auto &setLayout : componentDescriptorSetLayouts)
+        key_append(key, reinterpret_cast<uint64_t>((VkDescriptorSetLayout) setLayout));
+
+    /* If another renderpass already made this pipeline, or is making it, share theirs */
+    std::shared_ptr<SharedPipeline> shared;
+    std::promise<void> created;
+    bool creator = false;
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        auto existing = pipelineRegistry.find(key);
+        if (existing != pipelineRegistry.end()) {
+            shared = existing->second;
+            pipelineReuseCount++;
+        } else {
+            shared = std::make_shared<SharedPipeline>();
+            shared->created = created.get_future().share();
+            pipelineRegistry[key] = shared;
+            creator = true;
+        }
+    }
+    if (!creator) {
+        /* Rethrows if the pipeline couldn't be made */
+        shared->created.get();
+        pipeline = shared->pipeline;
+        layout = shared->pipelineLayout;
+        return;
+    }
+
+    try {
+        /* Vertex Input */
+        vk::PipelineVertexInputStateCreateInfo vertexInputInfo;
+        vertexInputInfo.vertexBindingDescriptionCount = (uint32_t)bindingDescriptions.size();
+        vertexInputInfo.pVertexBindingDescriptions = bindingDescriptions.data();
+        vertexInputInfo.vertexAttributeDescriptionCount = (uint32_t)attributeDescriptions.size();
+        vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+
+        vk::PushConstantRange range;
+        range.offset = 0;
+        range.size = sizeof(PushConsts);
+        range.stageFlags = vk::ShaderStageFlagBits::eAll;
+
+        /* Connect things together with pipeline layout */
+        vk::PipelineLayoutCreateInfo pipelineLayoutInfo;
+        pipelineLayoutInfo.setLayoutCount = (uint32_t)componentDescriptorSetLayouts.size();
+        pipelineLayoutInfo.pSetLayouts = componentDescriptorSetLayouts.data();
+        pipelineLayoutInfo.pushConstantRangeCount = 1; // TODO: this needs to account for entity id
+        pipelineLayoutInfo.pPushConstantRanges = &range; // TODO: this needs to account for entity id
+
+        /* Create the pipeline layout */
+        layout = device.createPipelineLayout(pipelineLayoutInfo);
+
+        std::array<vk::SpecializationMapEntry, 2> tableSizeEntries;
+        for (uint32_t i = 0; i < (uint32_t) tableSizes.size(); ++i) {
+            tableSizeEntries[i].constantID = i;
+            tableSizeEntries[i].offset = i * sizeof(uint32_t);
+            tableSizeEntries[i].size = sizeof(uint32_t);
+        }
+        vk::SpecializationInfo specializationInfo;
+        specializationInfo.mapEntryCount = (uint32_t) tableSizeEntries.size();
+        specializationInfo.pMapEntries = tableSizeEntries.data();
+        specializationInfo.dataSize = tableSizes.size() * sizeof(uint32_t);
+        specializationInfo.pData = tableSizes.data();
+        for (auto &stage : shaderStages) stage.pSpecializationInfo = &specializationInfo;
+
+        vk::GraphicsPipelineCreateInfo pipelineInfo;
+        pipelineInfo.stageCount = (uint32_t)shaderStages.size();
+        pipelineInfo.pStages = shaderStages.data();
+        pipelineInfo.pVertexInputState = &vertexInputInfo;
+        pipelineInfo.pInputAssemblyState = &parameters.inputAssembly;
+        pipelineInfo.pViewportState = &parameters.viewportState;
+        pipelineInfo.pRasterizationState = &parameters.rasterizer;
+        pipelineInfo.pMultisampleState = &parameters.multisampling;
+        pipelineInfo.pDepthStencilState = &parameters.depthStencil;
+        pipelineInfo.pColorBlendState = &parameters.colorBlending;
+        pipelineInfo.pDynamicState = &parameters.dynamicState; // Optional
+        pipelineInfo.layout = layout;
+        pipelineInfo.renderPass = renderpass;
+        pipelineInfo.subpass = subpass;
+        pipelineInfo.basePipelineHandle = vk::Pipeline(); // Optional
+        pipelineInfo.basePipelineIndex = -1; // Optional
+
+        /* Create pipeline */
+        pipeline = device.createGraphicsPipelines(vulkan->get_pipeline_cache()->get(), {pipelineInfo})[0];
+    } catch (...) {
+        if (layout) device.destroyPipelineLayout(layout);
+        layout = vk::PipelineLayout();
+        std::lock_guard<std::mutex> lock(registryMutex);
+        pipelineRegistry.erase(key);
+        created.set_exception(std::current_exception());
+        throw;
+    }
+
+    shared->pipeline = pipeline;
+    shared->pipelineLayout = layout;
+    created.set_value();
+}
+
+void Material::CreateComputePipelines()
+{
+    auto vulkan = Libraries::Vulkan::Get();
+    auto device = vulkan->get_device();
+
+    /* ------ FRUSTUM CULLING  ------ */
+    {
+        vk::ShaderModule compShaderModule;
+        try {
+            std::string ResourcePath = Options::GetResourcePath();
+            compShaderModule = GetShaderModule(ResourcePath + std::string("/Shaders/ComputeShaders/FrustumCulling/comp.spv"));
+        } catch (std::exception &e) {
+            /* Without the culling shader, the render system falls back to culling on the CPU */
+            std::cout << "Warning: unable to load the frustum culling shader. " << e.what() << std::endl;
+            return;
+        }
+
+        vk::PipelineShaderStageCreateInfo compShaderStageInfo;
+        compShaderStageInfo.stage = vk::ShaderStageFlagBits::eCompute;
+        compShaderStageInfo.module = compShaderModule;
+        compShaderStageInfo.pName = "main";
+
+        vk::PushConstantRange range;
+        range.offset = 0;
+        range.size = sizeof(CullingPushConsts);
+        range.stageFlags = vk::ShaderStageFlagBits::eCompute;
+
+        vk::PipelineLayoutCreateInfo pipelineLayoutInfo;
+        pipelineLayoutInfo.setLayoutCount = 1;
+        pipelineLayoutInfo.pSetLayouts = &componentDescriptorSetLayout;
+        pipelineLayoutInfo.pushConstantRangeCount = 1;
+        pipelineLayoutInfo.pPushConstantRanges = &range;
+        cullingPipelineLayout = device.createPipelineLayout(pipelineLayoutInfo);
+
+        vk::ComputePipelineCreateInfo pipelineInfo;
+        pipelineInfo.stage = compShaderStageInfo;
+        pipelineInfo.layout = cullingPipelineLayout;
+        cullingPipeline = device.createComputePipelines(vulkan->get_pipeline_cache()->get(), {pipelineInfo})[0];
+    }
 }
 
 /* Compiles all shaders */
@@ -180,16 +324,14 @@ void Material::SetupGraphicsPipelines(vk::RenderPass renderpass, uint32_t sample
     /* RASTER GRAPHICS PIPELINES */
 
     /* ------ UNIFORM COLOR  ------ */
+    /* Built right away, since it's what the other pipelines fall back to while they compile */
     {
-        uniformColor[renderpass] = RasterPipelineResources();
+        RasterPipelineResources resources;
 
         std::string ResourcePath = Options::GetResourcePath();
-        auto vertShaderCode = readFile(ResourcePath + std::string("/Shaders/SurfaceMaterials/UniformColor/vert.spv"));
-        auto fragShaderCode = readFile(ResourcePath + std::string("/Shaders/SurfaceMaterials/UniformColor/frag.spv"));
-
-        /* Create shader modules */
-        auto vertShaderModule = CreateShaderModule(vertShaderCode);
-        auto fragShaderModule = CreateShaderModule(fragShaderCode);
+        /* Shader modules are cached, so unchanged shaders are only built once */
+        auto vertShaderModule = GetShaderModule(ResourcePath + std::string("/Shaders/SurfaceMaterials/UniformColor/vert.spv"));
+        auto fragShaderModule = GetShaderModule(ResourcePath + std::string("/Shaders/SurfaceMaterials/UniformColor/frag.spv"));
 
         /* Info for shader stages */
         vk::PipelineShaderStageCreateInfo vertShaderStageInfo;
@@ -205,31 +347,33 @@ void Material::SetupGraphicsPipelines(vk::RenderPass renderpass, uint32_t sample
         std::vector<vk::PipelineShaderStageCreateInfo> shaderStages = { vertShaderStageInfo, fragShaderStageInfo };
         
         /* Account for possibly multiple samples */
-        uniformColor[renderpass].pipelineParameters.multisampling.sampleShadingEnable = (sampleFlag == vk::SampleCountFlagBits::e1) ? false : true;
-        uniformColor[renderpass].pipelineParameters.multisampling.rasterizationSamples = sampleFlag;
+        resources.pipelineParameters.multisampling.sampleShadingEnable = (sampleFlag == vk::SampleCountFlagBits::e1) ? false : true;
+        resources.pipelineParameters.multisampling.rasterizationSamples = sampleFlag;
 
         CreateRasterPipeline(shaderStages, vertexInputBindingDescriptions, vertexInputAttributeDescriptions, 
             { componentDescriptorSetLayout, textureDescriptorSetLayout }, 
-            uniformColor[renderpass].pipelineParameters, 
+            resources.pipelineParameters, 
             renderpass, 0, 
-            uniformColor[renderpass].pipeline, uniformColor[renderpass].pipelineLayout);
+            resources.pipeline, resources.pipelineLayout);
 
-        device.destroyShaderModule(fragShaderModule);
-        device.destroyShaderModule(vertShaderModule);
+        PublishRasterPipeline(uniformColor, renderpass, resources);
     }
 
+    /* The rest compile in the background. Until they're ready, draws using them fall back to uniform color. */
+    {
+        std::unique_lock<std::shared_mutex> lock(pipelineMutex);
+        for (auto pipelines : { &blinn, &pbr, &normalsurface, &texcoordsurface, &skybox, &depth, &volume })
+            (*pipelines)[renderpass] = RasterPipelineResources();
+    }
 
     /* ------ BLINN GRAPHICS ------ */
-    {
-        blinn[renderpass] = RasterPipelineResources();
+    EnqueuePipelineCompile(renderpass, [=] () {
+        RasterPipelineResources resources;
 
         std::string ResourcePath = Options::GetResourcePath();
-        auto vertShaderCode = readFile(ResourcePath + std::string("/Shaders/SurfaceMaterials/Blinn/vert.spv"));
-        auto fragShaderCode = readFile(ResourcePath + std::string("/Shaders/SurfaceMaterials/Blinn/frag.spv"));
-
-        /* Create shader modules */
-        auto vertShaderModule = CreateShaderModule(vertShaderCode);
-        auto fragShaderModule = CreateShaderModule(fragShaderCode);
+        /* Shader modules are cached, so unchanged shaders are only built once */
+        auto vertShaderModule = GetShaderModule(ResourcePath + std::string("/Shaders/SurfaceMaterials/Blinn/vert.spv"));
+        auto fragShaderModule = GetShaderModule(ResourcePath + std::string("/Shaders/SurfaceMaterials/Blinn/frag.spv"));
 
         /* Info for shader stages */
         vk::PipelineShaderStageCreateInfo vertShaderStageInfo;
@@ -245,30 +389,26 @@ void Material::SetupGraphicsPipelines(vk::RenderPass renderpass, uint32_t sample
         std::vector<vk::PipelineShaderStageCreateInfo> shaderStages = { vertShaderStageInfo, fragShaderStageInfo };
         
         /* Account for possibly multiple samples */
-        blinn[renderpass].pipelineParameters.multisampling.sampleShadingEnable = (sampleFlag == vk::SampleCountFlagBits::e1) ? false : true;
-        blinn[renderpass].pipelineParameters.multisampling.rasterizationSamples = sampleFlag;
+        resources.pipelineParameters.multisampling.sampleShadingEnable = (sampleFlag == vk::SampleCountFlagBits::e1) ? false : true;
+        resources.pipelineParameters.multisampling.rasterizationSamples = sampleFlag;
 
         CreateRasterPipeline(shaderStages, vertexInputBindingDescriptions, vertexInputAttributeDescriptions, 
             { componentDescriptorSetLayout, textureDescriptorSetLayout }, 
-            blinn[renderpass].pipelineParameters, 
+            resources.pipelineParameters, 
             renderpass, 0, 
-            blinn[renderpass].pipeline, blinn[renderpass].pipelineLayout);
+            resources.pipeline, resources.pipelineLayout);
 
-        device.destroyShaderModule(fragShaderModule);
-        device.destroyShaderModule(vertShaderModule);
-    }
+        PublishRasterPipeline(blinn, renderpass, resources);
+    });
 
     /* ------ PBR  ------ */
-    {
-        pbr[renderpass] = RasterPipelineResources();
+    EnqueuePipelineCompile(renderpass, [=] () {
+        RasterPipelineResources resources;
 
         std::string ResourcePath = Options::GetResourcePath();
-        auto vertShaderCode = readFile(ResourcePath + std::string("/Shaders/SurfaceMaterials/PBRSurface/vert.spv"));
-        auto fragShaderCode = readFile(ResourcePath + std::string("/Shaders/SurfaceMaterials/PBRSurface/frag.spv"));
-
-        /* Create shader modules */
-        auto vertShaderModule = CreateShaderModule(vertShaderCode);
-        auto fragShaderModule = CreateShaderModule(fragShaderCode);
+        /* Shader modules are cached, so unchanged shaders are only built once */
+        auto vertShaderModule = GetShaderModule(ResourcePath + std::string("/Shaders/SurfaceMaterials/PBRSurface/vert.spv"));
+        auto fragShaderModule = GetShaderModule(ResourcePath + std::string("/Shaders/SurfaceMaterials/PBRSurface/frag.spv"));
 
         /* Info for shader stages */
         vk::PipelineShaderStageCreateInfo vertShaderStageInfo;
@@ -284,30 +424,26 @@ void Material::SetupGraphicsPipelines(vk::RenderPass renderpass, uint32_t sample
         std::vector<vk::PipelineShaderStageCreateInfo> shaderStages = { vertShaderStageInfo, fragShaderStageInfo };
         
         /* Account for possibly multiple samples */
-        pbr[renderpass].pipelineParameters.multisampling.sampleShadingEnable = (sampleFlag == vk::SampleCountFlagBits::e1) ? false : true;
-        pbr[renderpass].pipelineParameters.multisampling.rasterizationSamples = sampleFlag;
+        resources.pipelineParameters.multisampling.sampleShadingEnable = (sampleFlag == vk::SampleCountFlagBits::e1) ? false : true;
+        resources.pipelineParameters.multisampling.rasterizationSamples = sampleFlag;
 
         CreateRasterPipeline(shaderStages, vertexInputBindingDescriptions, vertexInputAttributeDescriptions, 
             { componentDescriptorSetLayout, textureDescriptorSetLayout }, 
-            pbr[renderpass].pipelineParameters, 
+            resources.pipelineParameters, 
             renderpass, 0, 
-            pbr[renderpass].pipeline, pbr[renderpass].pipelineLayout);
+            resources.pipeline, resources.pipelineLayout);
 
-        device.destroyShaderModule(fragShaderModule);
-        device.destroyShaderModule(vertShaderModule);
-    }
+        PublishRasterPipeline(pbr, renderpass, resources);
+    });
 
     /* ------ NORMAL SURFACE ------ */
-    {
-        normalsurface[renderpass] = RasterPipelineResources();
+    EnqueuePipelineCompile(renderpass, [=] () {
+        RasterPipelineResources resources;
 
         std::string ResourcePath = Options::GetResourcePath();
-        auto vertShaderCode = readFile(ResourcePath + std::string("/Shaders/SurfaceMaterials/NormalSurface/vert.spv"));
-        auto fragShaderCode = readFile(ResourcePath + std::string("/Shaders/SurfaceMaterials/NormalSurface/frag.spv"));
-
-        /* Create shader modules */
-        auto vertShaderModule = CreateShaderModule(vertShaderCode);
-        auto fragShaderModule = CreateShaderModule(fragShaderCode);
+        /* Shader modules are cached, so unchanged shaders are only built once */
+        auto vertShaderModule = GetShaderModule(ResourcePath + std::string("/Shaders/SurfaceMaterials/NormalSurface/vert.spv"));
+        auto fragShaderModule = GetShaderModule(ResourcePath + std::string("/Shaders/SurfaceMaterials/NormalSurface/frag.spv"));
 
         /* Info for shader stages */
         vk::PipelineShaderStageCreateInfo vertShaderStageInfo;
@@ -323,30 +459,26 @@ void Material::SetupGraphicsPipelines(vk::RenderPass renderpass, uint32_t sample
         std::vector<vk::PipelineShaderStageCreateInfo> shaderStages = { vertShaderStageInfo, fragShaderStageInfo };
         
         /* Account for possibly multiple samples */
-        normalsurface[renderpass].pipelineParameters.multisampling.sampleShadingEnable = (sampleFlag == vk::SampleCountFlagBits::e1) ? false : true;
-        normalsurface[renderpass].pipelineParameters.multisampling.rasterizationSamples = sampleFlag;
+        resources.pipelineParameters.multisampling.sampleShadingEnable = (sampleFlag == vk::SampleCountFlagBits::e1) ? false : true;
+        resources.pipelineParameters.multisampling.rasterizationSamples = sampleFlag;
 
         CreateRasterPipeline(shaderStages, vertexInputBindingDescriptions, vertexInputAttributeDescriptions, 
             { componentDescriptorSetLayout, textureDescriptorSetLayout }, 
-            normalsurface[renderpass].pipelineParameters, 
+            resources.pipelineParameters, 
             renderpass, 0, 
-            normalsurface[renderpass].pipeline, normalsurface[renderpass].pipelineLayout);
+            resources.pipeline, resources.pipelineLayout);
 
-        device.destroyShaderModule(fragShaderModule);
-        device.destroyShaderModule(vertShaderModule);
-    }
+        PublishRasterPipeline(normalsurface, renderpass, resources);
+    });
 
     /* ------ TEXCOORD SURFACE  ------ */
-    {
-        texcoordsurface[renderpass] = RasterPipelineResources();
+    EnqueuePipelineCompile(renderpass, [=] () {
+        RasterPipelineResources resources;
 
         std::string ResourcePath = Options::GetResourcePath();
-        auto vertShaderCode = readFile(ResourcePath + std::string("/Shaders/SurfaceMaterials/TexCoordSurface/vert.spv"));
-        auto fragShaderCode = readFile(ResourcePath + std::string("/Shaders/SurfaceMaterials/TexCoordSurface/frag.spv"));
-
-        /* Create shader modules */
-        auto vertShaderModule = CreateShaderModule(vertShaderCode);
-        auto fragShaderModule = CreateShaderModule(fragShaderCode);
+        /* Shader modules are cached, so unchanged shaders are only built once */
+        auto vertShaderModule = GetShaderModule(ResourcePath + std::string("/Shaders/SurfaceMaterials/TexCoordSurface/vert.spv"));
+        auto fragShaderModule = GetShaderModule(ResourcePath + std::string("/Shaders/SurfaceMaterials/TexCoordSurface/frag.spv"));
 
         /* Info for shader stages */
         vk::PipelineShaderStageCreateInfo vertShaderStageInfo;
@@ -362,30 +494,26 @@ void Material::SetupGraphicsPipelines(vk::RenderPass renderpass, uint32_t sample
         std::vector<vk::PipelineShaderStageCreateInfo> shaderStages = { vertShaderStageInfo, fragShaderStageInfo };
         
         /* Account for possibly multiple samples */
-        texcoordsurface[renderpass].pipelineParameters.multisampling.sampleShadingEnable = (sampleFlag == vk::SampleCountFlagBits::e1) ? false : true;
-        texcoordsurface[renderpass].pipelineParameters.multisampling.rasterizationSamples = sampleFlag;
+        resources.pipelineParameters.multisampling.sampleShadingEnable = (sampleFlag == vk::SampleCountFlagBits::e1) ? false : true;
+        resources.pipelineParameters.multisampling.rasterizationSamples = sampleFlag;
 
         CreateRasterPipeline(shaderStages, vertexInputBindingDescriptions, vertexInputAttributeDescriptions, 
             { componentDescriptorSetLayout, textureDescriptorSetLayout }, 
-            texcoordsurface[renderpass].pipelineParameters, 
+            resources.pipelineParameters, 
             renderpass, 0, 
-            texcoordsurface[renderpass].pipeline, texcoordsurface[renderpass].pipelineLayout);
+            resources.pipeline, resources.pipelineLayout);
 
-        device.destroyShaderModule(fragShaderModule);
-        device.destroyShaderModule(vertShaderModule);
-    }
+        PublishRasterPipeline(texcoordsurface, renderpass, resources);
+    });
 
     /* ------ SKYBOX  ------ */
-    {
-        skybox[renderpass] = RasterPipelineResources();
+    EnqueuePipelineCompile(renderpass, [=] () {
+        RasterPipelineResources resources;
 
         std::string ResourcePath = Options::GetResourcePath();
-        auto vertShaderCode = readFile(ResourcePath + std::string("/Shaders/SurfaceMaterials/Skybox/vert.spv"));
-        auto fragShaderCode = readFile(ResourcePath + std::string("/Shaders/SurfaceMaterials/Skybox/frag.spv"));
-
-        /* Create shader modules */
-        auto vertShaderModule = CreateShaderModule(vertShaderCode);
-        auto fragShaderModule = CreateShaderModule(fragShaderCode);
+        /* Shader modules are cached, so unchanged shaders are only built once */
+        auto vertShaderModule = GetShaderModule(ResourcePath + std::string("/Shaders/SurfaceMaterials/Skybox/vert.spv"));
+        auto fragShaderModule = GetShaderModule(ResourcePath + std::string("/Shaders/SurfaceMaterials/Skybox/frag.spv"));
 
         /* Info for shader stages */
         vk::PipelineShaderStageCreateInfo vertShaderStageInfo;
@@ -401,33 +529,29 @@ void Material::SetupGraphicsPipelines(vk::RenderPass renderpass, uint32_t sample
         std::vector<vk::PipelineShaderStageCreateInfo> shaderStages = { vertShaderStageInfo, fragShaderStageInfo };
         
         /* Skyboxes don't do back face culling. */
-        skybox[renderpass].pipelineParameters.rasterizer.setCullMode(vk::CullModeFlagBits::eNone);
+        resources.pipelineParameters.rasterizer.setCullMode(vk::CullModeFlagBits::eNone);
 
         /* Account for possibly multiple samples */
-        skybox[renderpass].pipelineParameters.multisampling.sampleShadingEnable = (sampleFlag == vk::SampleCountFlagBits::e1) ? false : true;
-        skybox[renderpass].pipelineParameters.multisampling.rasterizationSamples = sampleFlag;
+        resources.pipelineParameters.multisampling.sampleShadingEnable = (sampleFlag == vk::SampleCountFlagBits::e1) ? false : true;
+        resources.pipelineParameters.multisampling.rasterizationSamples = sampleFlag;
 
         CreateRasterPipeline(shaderStages, vertexInputBindingDescriptions, vertexInputAttributeDescriptions, 
             { componentDescriptorSetLayout, textureDescriptorSetLayout }, 
-            skybox[renderpass].pipelineParameters, 
+            resources.pipelineParameters, 
             renderpass, 0, 
-            skybox[renderpass].pipeline, skybox[renderpass].pipelineLayout);
+            resources.pipeline, resources.pipelineLayout);
 
-        device.destroyShaderModule(fragShaderModule);
-        device.destroyShaderModule(vertShaderModule);
-    }
+        PublishRasterPipeline(skybox, renderpass, resources);
+    });
 
     /* ------ DEPTH  ------ */
-    {
-        depth[renderpass] = RasterPipelineResources();
+    EnqueuePipelineCompile(renderpass, [=] () {
+        RasterPipelineResources resources;
 
         std::string ResourcePath = Options::GetResourcePath();
-        auto vertShaderCode = readFile(ResourcePath + std::string("/Shaders/SurfaceMaterials/Depth/vert.spv"));
-        auto fragShaderCode = readFile(ResourcePath + std::string("/Shaders/SurfaceMaterials/Depth/frag.spv"));
-
-        /* Create shader modules */
-        auto vertShaderModule = CreateShaderModule(vertShaderCode);
-        auto fragShaderModule = CreateShaderModule(fragShaderCode);
+        /* Shader modules are cached, so unchanged shaders are only built once */
+        auto vertShaderModule = GetShaderModule(ResourcePath + std::string("/Shaders/SurfaceMaterials/Depth/vert.spv"));
+        auto fragShaderModule = GetShaderModule(ResourcePath + std::string("/Shaders/SurfaceMaterials/Depth/frag.spv"));
 
         /* Info for shader stages */
         vk::PipelineShaderStageCreateInfo vertShaderStageInfo;
@@ -443,30 +567,26 @@ void Material::SetupGraphicsPipelines(vk::RenderPass renderpass, uint32_t sample
         std::vector<vk::PipelineShaderStageCreateInfo> shaderStages = { vertShaderStageInfo, fragShaderStageInfo };
         
         /* Account for possibly multiple samples */
-        depth[renderpass].pipelineParameters.multisampling.sampleShadingEnable = (sampleFlag == vk::SampleCountFlagBits::e1) ? false : true;
-        depth[renderpass].pipelineParameters.multisampling.rasterizationSamples = sampleFlag;
+        resources.pipelineParameters.multisampling.sampleShadingEnable = (sampleFlag == vk::SampleCountFlagBits::e1) ? false : true;
+        resources.pipelineParameters.multisampling.rasterizationSamples = sampleFlag;
 
         CreateRasterPipeline(shaderStages, vertexInputBindingDescriptions, vertexInputAttributeDescriptions, 
             { componentDescriptorSetLayout, textureDescriptorSetLayout }, 
-            depth[renderpass].pipelineParameters, 
+            resources.pipelineParameters, 
             renderpass, 0, 
-            depth[renderpass].pipeline, depth[renderpass].pipelineLayout);
+            resources.pipeline, resources.pipelineLayout);
 
-        device.destroyShaderModule(fragShaderModule);
-        device.destroyShaderModule(vertShaderModule);
-    }
+        PublishRasterPipeline(depth, renderpass, resources);
+    });
 
     /* ------ Volume  ------ */
-    {
-        volume[renderpass] = RasterPipelineResources();
+    EnqueuePipelineCompile(renderpass, [=] () {
+        RasterPipelineResources resources;
 
         std::string ResourcePath = Options::GetResourcePath();
-        auto vertShaderCode = readFile(ResourcePath + std::string("/Shaders/VolumeMaterials/Volume/vert.spv"));
-        auto fragShaderCode = readFile(ResourcePath + std::string("/Shaders/VolumeMaterials/Volume/frag.spv"));
-
-        /* Create shader modules */
-        auto vertShaderModule = CreateShaderModule(vertShaderCode);
-        auto fragShaderModule = CreateShaderModule(fragShaderCode);
+        /* Shader modules are cached, so unchanged shaders are only built once */
+        auto vertShaderModule = GetShaderModule(ResourcePath + std::string("/Shaders/VolumeMaterials/Volume/vert.spv"));
+        auto fragShaderModule = GetShaderModule(ResourcePath + std::string("/Shaders/VolumeMaterials/Volume/frag.spv"));
 
         /* Info for shader stages */
         vk::PipelineShaderStageCreateInfo vertShaderStageInfo;
@@ -482,31 +602,28 @@ void Material::SetupGraphicsPipelines(vk::RenderPass renderpass, uint32_t sample
         std::vector<vk::PipelineShaderStageCreateInfo> shaderStages = { vertShaderStageInfo, fragShaderStageInfo };
         
         /* Account for possibly multiple samples */
-        volume[renderpass].pipelineParameters.multisampling.sampleShadingEnable = (sampleFlag == vk::SampleCountFlagBits::e1) ? false : true;
-        volume[renderpass].pipelineParameters.multisampling.rasterizationSamples = sampleFlag;
+        resources.pipelineParameters.multisampling.sampleShadingEnable = (sampleFlag == vk::SampleCountFlagBits::e1) ? false : true;
+        resources.pipelineParameters.multisampling.rasterizationSamples = sampleFlag;
 
         CreateRasterPipeline(shaderStages, vertexInputBindingDescriptions, vertexInputAttributeDescriptions, 
             { componentDescriptorSetLayout, textureDescriptorSetLayout }, 
-            volume[renderpass].pipelineParameters, 
+            resources.pipelineParameters, 
             renderpass, 0, 
-            volume[renderpass].pipeline, volume[renderpass].pipelineLayout);
+            resources.pipeline, resources.pipelineLayout);
 
-        device.destroyShaderModule(fragShaderModule);
-        device.destroyShaderModule(vertShaderModule);
-    }
+        PublishRasterPipeline(volume, renderpass, resources);
+    });
 
     if (!vulkan->is_ray_tracing_enabled()) return;
-    auto dldi = vulkan->get_dldi();
 
     /* RAY TRACING PIPELINES */
-    {
-        rttest[renderpass] = RaytracingPipelineResources();
+    EnqueuePipelineCompile(renderpass, [=] () {
+        auto dldi = vulkan->get_dldi();
+        RaytracingPipelineResources resources;
 
         std::string ResourcePath = Options::GetResourcePath();
-        auto raygenShaderCode = readFile(ResourcePath + std::string("/Shaders/RaytracedMaterials/TutorialShaders/rgen.spv"));
-        
-        /* Create shader modules */
-        auto raygenShaderModule = CreateShaderModule(raygenShaderCode);
+        /* Shader modules are cached, so unchanged shaders are only built once */
+        auto raygenShaderModule = GetShaderModule(ResourcePath + std::string("/Shaders/RaytracedMaterials/TutorialShaders/rgen.spv"));
 
         /* Info for shader stages */
         vk::PipelineShaderStageCreateInfo raygenShaderStageInfo;
@@ -522,7 +639,7 @@ void Material::SetupGraphicsPipelines(vk::RenderPass renderpass, uint32_t sample
         pipelineLayoutCreateInfo.pushConstantRangeCount = 0;
         pipelineLayoutCreateInfo.pPushConstantRanges = nullptr;
 
-        rttest[renderpass].pipelineLayout = device.createPipelineLayout(pipelineLayoutCreateInfo);
+        resources.pipelineLayout = device.createPipelineLayout(pipelineLayoutCreateInfo);
 
         std::vector<vk::RayTracingShaderGroupCreateInfoNV> shaderGroups;
         vk::RayTracingShaderGroupCreateInfoNV rayGenGroupInfo;
@@ -539,17 +656,164 @@ void Material::SetupGraphicsPipelines(vk::RenderPass renderpass, uint32_t sample
         rayPipelineInfo.groupCount = (uint32_t) shaderGroups.size();
         rayPipelineInfo.pGroups = shaderGroups.data();
         rayPipelineInfo.maxRecursionDepth = 1;
-        rayPipelineInfo.layout = rttest[renderpass].pipelineLayout;
+        rayPipelineInfo.layout = resources.pipelineLayout;
         rayPipelineInfo.basePipelineHandle = vk::Pipeline();
         rayPipelineInfo.basePipelineIndex = 0;
 
-        rttest[renderpass].pipeline = device.createRayTracingPipelinesNV(vk::PipelineCache(), 
+        resources.pipeline = device.createRayTracingPipelinesNV(vulkan->get_pipeline_cache()->get(), 
             {rayPipelineInfo}, nullptr, dldi)[0];
 
-        device.destroyShaderModule(raygenShaderModule);
+        std::unique_lock<std::shared_mutex> lock(pipelineMutex);
+        rttest[renderpass] = resources;
+        SetupRaytracingShaderBindingTable(renderpass);
+    });
+}
+
+void Material::EnqueuePipelineCompile(vk::RenderPass renderpass, std::function<void()> compile)
+{
+    /* Queue and record the compile under the lock, so WaitForPipelines can't miss one that has already started.
+        Compiles only take the lock on another thread, once they're done, so this can't deadlock. */
+    std::unique_lock<std::shared_mutex> lock(pipelineMutex);
+    auto future = GetPipelineCompileQueue()->enqueue([compile] () {
+        try {
+            compile();
+        } catch (std::exception &e) {
+            /* Draws keep falling back to uniform color */
+            std::cout << "Warning: unable to compile pipeline. " << e.what() << std::endl;
+        }
+    });
+    pipelineCompiles[renderpass].push_back(future);
+}
+
+void Material::PublishRasterPipeline(std::map<vk::RenderPass, RasterPipelineResources> &pipelines, vk::RenderPass renderpass, RasterPipelineResources &resources)
+{
+    std::unique_lock<std::shared_mutex> lock(pipelineMutex);
+    resources.ready = true;
+    pipelines[renderpass] = resources;
+}
+
+void Material::RegisterRenderPass(vk::RenderPass renderpass, const vk::RenderPassCreateInfo &info)
+{
+    /* Render passes are compatible when their attachments match in format and sample count, and they're otherwise
+        identical, ignoring load and store ops and image layouts */
+    std::vector<uint64_t> signature;
+    key_append(signature, info.attachmentCount, info.subpassCount, info.dependencyCount);
+    for (uint32_t i = 0; i < info.attachmentCount; ++i)
+        key_append(signature, info.pAttachments[i].format, info.pAttachments[i].samples);
+
+    auto appendReferences = [&signature] (uint32_t count, const vk::AttachmentReference *references) {
+        key_append(signature, (references) ? count : 0);
+        if (references)
+            for (uint32_t i = 0; i < count; ++i) key_append(signature, references[i].attachment);
+    };
+    for (uint32_t i = 0; i < info.subpassCount; ++i) {
+        auto &subpass = info.pSubpasses[i];
+        key_append(signature, subpass.pipelineBindPoint);
+        appendReferences(subpass.inputAttachmentCount, subpass.pInputAttachments);
+        appendReferences(subpass.colorAttachmentCount, subpass.pColorAttachments);
+        appendReferences(subpass.colorAttachmentCount, subpass.pResolveAttachments);
+        appendReferences(1, subpass.pDepthStencilAttachment);
+    }
+    for (uint32_t i = 0; i < info.dependencyCount; ++i) {
+        auto &dependency = info.pDependencies[i];
+        key_append(signature, dependency.srcSubpass, dependency.dstSubpass, 
+            (VkPipelineStageFlags) dependency.srcStageMask, (VkPipelineStageFlags) dependency.dstStageMask,
+            (VkAccessFlags) dependency.srcAccessMask, (VkAccessFlags) dependency.dstAccessMask, 
+            (VkDependencyFlags) dependency.dependencyFlags);
+    }
+
+    /* Multiview render passes are only compatible if they render the same views */
+    for (auto next = (const VkBaseInStructure*) info.pNext; next; next = next->pNext) {
+        if (next->sType != VK_STRUCTURE_TYPE_RENDER_PASS_MULTIVIEW_CREATE_INFO) continue;
+        auto multiview = (const VkRenderPassMultiviewCreateInfo*) next;
+        key_append(signature, multiview->subpassCount, multiview->correlationMaskCount);
+        for (uint32_t i = 0; i < multiview->subpassCount; ++i) key_append(signature, multiview->pViewMasks[i]);
+        for (uint32_t i = 0; i < multiview->correlationMaskCount; ++i) key_append(signature, multiview->pCorrelationMasks[i]);
     }
 
-    SetupRaytracingShaderBindingTable(renderpass);
+    std::lock_guard<std::mutex> lock(registryMutex);
+    renderPassSignatures[renderpass] = std::move(signature);
+}
+
+void Material::UnregisterRenderPass(vk::RenderPass renderpass)
+{
+    WaitForPipelines(renderpass);
+    {
+        std::unique_lock<std::shared_mutex> lock(pipelineMutex);
+        for (auto pipelines : { &uniformColor, &blinn, &pbr, &normalsurface, &texcoordsurface, &skybox, &depth, &volume })
+            pipelines->erase(renderpass);
+    }
+
+    /* The renderpass's pipelines stay registered, for other renderpasses with the same signature */
+    std::lock_guard<std::mutex> lock(registryMutex);
+    renderPassSignatures.erase(renderpass);
+}
+
+uint32_t Material::GetPipelineCount()
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+    return (uint32_t) pipelineRegistry.size();
+}
+
+uint64_t Material::GetPipelineReuseCount()
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+    return pipelineReuseCount;
+}
+
+bool Material::ArePipelinesReady(vk::RenderPass renderpass)
+{
+    std::unique_lock<std::shared_mutex> lock(pipelineMutex);
+    auto compiles = pipelineCompiles.find(renderpass);
+    if (compiles == pipelineCompiles.end()) return true;
+
+    auto &futures = compiles->second;
+    futures.erase(std::remove_if(futures.begin(), futures.end(), [] (const std::shared_future<void> &future) {
+        return future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }), futures.end());
+    if (!futures.empty()) return false;
+    pipelineCompiles.erase(compiles);
+    return true;
+}
+
+uint32_t Material::GetPendingPipelineCount()
+{
+    return GetPipelineCompileQueue()->get_pending_count();
+}
+
+void Material::WaitForPipelines(vk::RenderPass renderpass)
+{
+    /* Compiles take the lock once they're done, so wait on copies of the futures without holding it */
+    std::vector<std::shared_future<void>> futures;
+    {
+        std::unique_lock<std::shared_mutex> lock(pipelineMutex);
+        auto compiles = pipelineCompiles.find(renderpass);
+        if (compiles == pipelineCompiles.end()) return;
+        futures = compiles->second;
+    }
+    for (auto &future : futures) future.wait();
+    ArePipelinesReady(renderpass);
+}
+
+void Material::WaitForPipelines()
+{
+    /* Forget the recorded compiles before waiting, so one queued in between stays recorded */
+    {
+        std::unique_lock<std::shared_mutex> lock(pipelineMutex);
+        pipelineCompiles.clear();
+    }
+    GetPipelineCompileQueue()->wait_idle();
+}
+
+bool Material::is_pipeline_ready()
+{
+    auto pipelines = GetRasterPipelines(renderMode);
+    if (!pipelines) return true;
+
+    std::shared_lock<std::shared_mutex> lock(pipelineMutex);
+    for (auto &resources : *pipelines)
+        if (!resources.second.ready) return false;
+    return true;
 }
 
 void Material::SetupRaytracingShaderBindingTable(vk::RenderPass renderpass)
@@ -580,20 +844,12 @@ void Material::SetupRaytracingShaderBindingTable(vk::RenderPass renderpass)
     bufferInfo.sharingMode = vk::SharingMode::eExclusive;
     rttest[renderpass].shaderBindingTable = device.createBuffer(bufferInfo);
 
-    /* Create memory for binding table */
-    vk::MemoryRequirements memRequirements = device.getBufferMemoryRequirements(rttest[renderpass].shaderBindingTable);
-    vk::MemoryAllocateInfo allocInfo;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = vulkan->find_memory_type(memRequirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eHostVisible);
-    rttest[renderpass].shaderBindingTableMemory = device.allocateMemory(allocInfo);
-
-    /* Bind buffer to memeory */
-    device.bindBufferMemory(rttest[renderpass].shaderBindingTable, rttest[renderpass].shaderBindingTableMemory, 0);
+    /* Create memory for binding table, and bind the buffer to it */
+    rttest[renderpass].shaderBindingTableMemory = vulkan->get_memory_allocator()->allocate_buffer(rttest[renderpass].shaderBindingTable, 
+        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
 
-    /* Map the binding table, then fill with shader group handles */
-    void* mappedMemory = device.mapMemory(rttest[renderpass].shaderBindingTableMemory, 0, shaderBindingTableSize, vk::MemoryMapFlags());
-    device.getRayTracingShaderGroupHandlesNV(rttest[renderpass].pipeline, 0, groupNum, shaderBindingTableSize, mappedMemory, dldi);
-    device.unmapMemory(rttest[renderpass].shaderBindingTableMemory);
+    /* Fill the mapped binding table with shader group handles */
+    device.getRayTracingShaderGroupHandlesNV(rttest[renderpass].pipeline, 0, groupNum, shaderBindingTableSize, rttest[renderpass].shaderBindingTableMemory.mapped, dldi);
 }
 
 void Material::Initialize()
@@ -604,7 +860,9 @@ void Material::Initialize()
     Material::CreateVertexInputBindingDescriptions();
     Material::CreateVertexAttributeDescriptions();
     Material::CreateSSBO();
-    Material::UpdateRasterDescriptorSets();
+    Material::CreateComputePipelines();
+    for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame)
+        Material::UpdateRasterDescriptorSets(frame);
     Material::UpdateRaytracingDescriptorSets();
 }
 
@@ -622,7 +880,7 @@ void Material::CreateRasterDescriptorSetLayouts()
     eboLayoutBinding.binding = 0;
     eboLayoutBinding.descriptorType = vk::DescriptorType::eStorageBuffer;
     eboLayoutBinding.descriptorCount = 1;
-    eboLayoutBinding.stageFlags = vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment;
+    eboLayoutBinding.stageFlags = vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment | vk::ShaderStageFlagBits::eCompute;
     eboLayoutBinding.pImmutableSamplers = nullptr; // Optional
 
     // Transform SSBO
@@ -630,7 +888,7 @@ void Material::CreateRasterDescriptorSetLayouts()
     tboLayoutBinding.binding = 1;
     tboLayoutBinding.descriptorType = vk::DescriptorType::eStorageBuffer;
     tboLayoutBinding.descriptorCount = 1;
-    tboLayoutBinding.stageFlags = vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment;
+    tboLayoutBinding.stageFlags = vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment | vk::ShaderStageFlagBits::eCompute;
     tboLayoutBinding.pImmutableSamplers = nullptr; // Optional
 
     // Camera SSBO
@@ -638,7 +896,7 @@ void Material::CreateRasterDescriptorSetLayouts()
     cboLayoutBinding.binding = 2;
     cboLayoutBinding.descriptorType = vk::DescriptorType::eStorageBuffer;
     cboLayoutBinding.descriptorCount = 1;
-    cboLayoutBinding.stageFlags = vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment;
+    cboLayoutBinding.stageFlags = vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment | vk::ShaderStageFlagBits::eCompute;
     cboLayoutBinding.pImmutableSamplers = nullptr; // Optional
 
     // Material SSBO
@@ -647,7 +905,7 @@ void Material::CreateRasterDescriptorSetLayouts()
     mboLayoutBinding.descriptorCount = 1;
     mboLayoutBinding.descriptorType = vk::DescriptorType::eStorageBuffer;
     mboLayoutBinding.pImmutableSamplers = nullptr;
-    mboLayoutBinding.stageFlags = vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment;
+    mboLayoutBinding.stageFlags = vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment | vk::ShaderStageFlagBits::eCompute;
 
     // Light SSBO
     vk::DescriptorSetLayoutBinding lboLayoutBinding;
@@ -655,9 +913,65 @@ void Material::CreateRasterDescriptorSetLayouts()
     lboLayoutBinding.descriptorCount = 1;
     lboLayoutBinding.descriptorType = vk::DescriptorType::eStorageBuffer;
     lboLayoutBinding.pImmutableSamplers = nullptr;
-    lboLayoutBinding.stageFlags = vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment;
-
-    std::array<vk::DescriptorSetLayoutBinding, 5> ssbobindings = { eboLayoutBinding, tboLayoutBinding, cboLayoutBinding, mboLayoutBinding, lboLayoutBinding};
+    lboLayoutBinding.stageFlags = vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment | vk::ShaderStageFlagBits::eCompute;
+
+    // Instance SSBO
+    vk::DescriptorSetLayoutBinding iboLayoutBinding;
+    iboLayoutBinding.binding = 5;
+    iboLayoutBinding.descriptorCount = 1;
+    iboLayoutBinding.descriptorType = vk::DescriptorType::eStorageBuffer;
+    iboLayoutBinding.pImmutableSamplers = nullptr;
+    iboLayoutBinding.stageFlags = vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment | vk::ShaderStageFlagBits::eCompute;
+
+    // Mesh SSBO
+    vk::DescriptorSetLayoutBinding mshboLayoutBinding;
+    mshboLayoutBinding.binding = 6;
+    mshboLayoutBinding.descriptorCount = 1;
+    mshboLayoutBinding.descriptorType = vk::DescriptorType::eStorageBuffer;
+    mshboLayoutBinding.pImmutableSamplers = nullptr;
+    mshboLayoutBinding.stageFlags = vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment | vk::ShaderStageFlagBits::eCompute;
+
+    // Cull Candidate SSBO
+    vk::DescriptorSetLayoutBinding ccboLayoutBinding;
+    ccboLayoutBinding.binding = 7;
+    ccboLayoutBinding.descriptorCount = 1;
+    ccboLayoutBinding.descriptorType = vk::DescriptorType::eStorageBuffer;
+    ccboLayoutBinding.pImmutableSamplers = nullptr;
+    ccboLayoutBinding.stageFlags = vk::ShaderStageFlagBits::eCompute;
+
+    // Draw Command SSBO
+    vk::DescriptorSetLayoutBinding dcboLayoutBinding;
+    dcboLayoutBinding.binding = 8;
+    dcboLayoutBinding.descriptorCount = 1;
+    dcboLayoutBinding.descriptorType = vk::DescriptorType::eStorageBuffer;
+    dcboLayoutBinding.pImmutableSamplers = nullptr;
+    dcboLayoutBinding.stageFlags = vk::ShaderStageFlagBits::eCompute;
+
+    // Light Cluster Grid SSBO
+    vk::DescriptorSetLayoutBinding lgboLayoutBinding;
+    lgboLayoutBinding.binding = 9;
+    lgboLayoutBinding.descriptorCount = 1;
+    lgboLayoutBinding.descriptorType = vk::DescriptorType::eStorageBuffer;
+    lgboLayoutBinding.pImmutableSamplers = nullptr;
+    lgboLayoutBinding.stageFlags = vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment;
+
+    // Light Cluster SSBO
+    vk::DescriptorSetLayoutBinding lcboLayoutBinding;
+    lcboLayoutBinding.binding = 10;
+    lcboLayoutBinding.descriptorCount = 1;
+    lcboLayoutBinding.descriptorType = vk::DescriptorType::eStorageBuffer;
+    lcboLayoutBinding.pImmutableSamplers = nullptr;
+    lcboLayoutBinding.stageFlags = vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment;
+
+    // Light Index SSBO
+    vk::DescriptorSetLayoutBinding liboLayoutBinding;
+    liboLayoutBinding.binding = 11;
+    liboLayoutBinding.descriptorCount = 1;
+    liboLayoutBinding.descriptorType = vk::DescriptorType::eStorageBuffer;
+    liboLayoutBinding.pImmutableSamplers = nullptr;
+    liboLayoutBinding.stageFlags = vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment;
+
+    std::array<vk::DescriptorSetLayoutBinding, 12> ssbobindings = { eboLayoutBinding, tboLayoutBinding, cboLayoutBinding, mboLayoutBinding, lboLayoutBinding, iboLayoutBinding, mshboLayoutBinding, ccboLayoutBinding, dcboLayoutBinding, lgboLayoutBinding, lcboLayoutBinding, liboLayoutBinding};
     vk::DescriptorSetLayoutCreateInfo ssboLayoutInfo;
     ssboLayoutInfo.bindingCount = (uint32_t)ssbobindings.size();
     ssboLayoutInfo.pBindings = ssbobindings.data();
@@ -674,7 +988,7 @@ void Material::CreateRasterDescriptorSetLayouts()
 
     // Texture samplers
     vk::DescriptorSetLayoutBinding samplerBinding;
-    samplerBinding.descriptorCount = MAX_SAMPLERS;
+    samplerBinding.descriptorCount = Texture::GetSamplerCapacity();
     samplerBinding.binding = 1;
     samplerBinding.descriptorType = vk::DescriptorType::eSampler;
     samplerBinding.stageFlags = vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment;
@@ -682,7 +996,7 @@ void Material::CreateRasterDescriptorSetLayouts()
 
     // 2D Textures
     vk::DescriptorSetLayoutBinding texture2DsBinding;
-    texture2DsBinding.descriptorCount = MAX_TEXTURES;
+    texture2DsBinding.descriptorCount = Texture::GetDescriptorCapacity();
     texture2DsBinding.binding = 2;
     texture2DsBinding.descriptorType = vk::DescriptorType::eSampledImage;
     texture2DsBinding.stageFlags = vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment;
@@ -690,7 +1004,7 @@ void Material::CreateRasterDescriptorSetLayouts()
 
     // Texture Cubes
     vk::DescriptorSetLayoutBinding textureCubesBinding;
-    textureCubesBinding.descriptorCount = MAX_TEXTURES;
+    textureCubesBinding.descriptorCount = Texture::GetDescriptorCapacity();
     textureCubesBinding.binding = 3;
     textureCubesBinding.descriptorType = vk::DescriptorType::eSampledImage;
     textureCubesBinding.stageFlags = vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment;
@@ -698,7 +1012,7 @@ void Material::CreateRasterDescriptorSetLayouts()
 
     // 3D Textures
     vk::DescriptorSetLayoutBinding texture3DsBinding;
-    texture3DsBinding.descriptorCount = MAX_TEXTURES;
+    texture3DsBinding.descriptorCount = Texture::GetDescriptorCapacity();
     texture3DsBinding.binding = 4;
     texture3DsBinding.descriptorType = vk::DescriptorType::eSampledImage;
     texture3DsBinding.stageFlags = vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment;
@@ -709,6 +1023,35 @@ void Material::CreateRasterDescriptorSetLayouts()
     textureLayoutInfo.bindingCount = (uint32_t)bindings.size();
     textureLayoutInfo.pBindings = bindings.data();
 
+    /* With update after bind, descriptors can be rewritten while their sets are bound in a command buffer being recorded */
+    std::array<vk::DescriptorBindingFlagsEXT, 12> ssboBindingFlags;
+    std::array<vk::DescriptorBindingFlagsEXT, 5> textureBindingFlags;
+    ssboBindingFlags.fill(vk::DescriptorBindingFlagBitsEXT::eUpdateAfterBind);
+    textureBindingFlags.fill(vk::DescriptorBindingFlagBitsEXT::eUpdateAfterBind);
+
+    /* Bindless texture tables only write the slots textures have been created in, so the sampler and texture 
+        arrays are partially bound. The last array's size is given when the set is allocated. */
+    if (vulkan->is_bindless_enabled()) {
+        for (uint32_t binding = 1; binding < textureBindingFlags.size(); ++binding)
+            textureBindingFlags[binding] |= vk::DescriptorBindingFlagBitsEXT::ePartiallyBound;
+        textureBindingFlags[4] |= vk::DescriptorBindingFlagBitsEXT::eVariableDescriptorCount;
+    }
+
+    vk::DescriptorSetLayoutBindingFlagsCreateInfoEXT ssboBindingFlagsInfo;
+    ssboBindingFlagsInfo.bindingCount = (uint32_t)ssboBindingFlags.size();
+    ssboBindingFlagsInfo.pBindingFlags = ssboBindingFlags.data();
+
+    vk::DescriptorSetLayoutBindingFlagsCreateInfoEXT textureBindingFlagsInfo;
+    textureBindingFlagsInfo.bindingCount = (uint32_t)textureBindingFlags.size();
+    textureBindingFlagsInfo.pBindingFlags = textureBindingFlags.data();
+
+    if (vulkan->is_update_after_bind_enabled()) {
+        ssboLayoutInfo.flags = vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPoolEXT;
+        ssboLayoutInfo.pNext = &ssboBindingFlagsInfo;
+        textureLayoutInfo.flags = vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPoolEXT;
+        textureLayoutInfo.pNext = &textureBindingFlagsInfo;
+    }
+
     // Create the layouts
     componentDescriptorSetLayout = device.createDescriptorSetLayout(ssboLayoutInfo);
     textureDescriptorSetLayout = device.createDescriptorSetLayout(textureLayoutInfo);
@@ -753,7 +1096,7 @@ void Material::CreateDescriptorPools()
     auto device = vulkan->get_device();
 
     /* SSBO Descriptor Pool Info */
-    std::array<vk::DescriptorPoolSize, 5> ssboPoolSizes = {};
+    std::array<vk::DescriptorPoolSize, 12> ssboPoolSizes = {};
     
     // Entity SSBO
     ssboPoolSizes[0].type = vk::DescriptorType::eStorageBuffer;
@@ -775,11 +1118,41 @@ void Material::CreateDescriptorPools()
     ssboPoolSizes[4].type = vk::DescriptorType::eStorageBuffer;
     ssboPoolSizes[4].descriptorCount = MAX_MATERIALS;
 
+    // Instance SSBO
+    ssboPoolSizes[5].type = vk::DescriptorType::eStorageBuffer;
+    ssboPoolSizes[5].descriptorCount = MAX_MATERIALS;
+
+    // Mesh SSBO
+    ssboPoolSizes[6].type = vk::DescriptorType::eStorageBuffer;
+    ssboPoolSizes[6].descriptorCount = MAX_MATERIALS;
+
+    // Cull Candidate SSBO
+    ssboPoolSizes[7].type = vk::DescriptorType::eStorageBuffer;
+    ssboPoolSizes[7].descriptorCount = MAX_MATERIALS;
+
+    // Draw Command SSBO
+    ssboPoolSizes[8].type = vk::DescriptorType::eStorageBuffer;
+    ssboPoolSizes[8].descriptorCount = MAX_MATERIALS;
+
+    // Light Cluster Grid SSBO
+    ssboPoolSizes[9].type = vk::DescriptorType::eStorageBuffer;
+    ssboPoolSizes[9].descriptorCount = MAX_MATERIALS;
+
+    // Light Cluster SSBO
+    ssboPoolSizes[10].type = vk::DescriptorType::eStorageBuffer;
+    ssboPoolSizes[10].descriptorCount = MAX_MATERIALS;
+
+    // Light Index SSBO
+    ssboPoolSizes[11].type = vk::DescriptorType::eStorageBuffer;
+    ssboPoolSizes[11].descriptorCount = MAX_MATERIALS;
+
     vk::DescriptorPoolCreateInfo ssboPoolInfo;
     ssboPoolInfo.poolSizeCount = (uint32_t)ssboPoolSizes.size();
     ssboPoolInfo.pPoolSizes = ssboPoolSizes.data();
     ssboPoolInfo.maxSets = MAX_MATERIALS;
     ssboPoolInfo.flags = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet;
+    if (vulkan->is_update_after_bind_enabled())
+        ssboPoolInfo.flags |= vk::DescriptorPoolCreateFlagBits::eUpdateAfterBindEXT;
 
     /* Texture Descriptor Pool Info */
     std::array<vk::DescriptorPoolSize, 5> texturePoolSizes = {};
@@ -790,25 +1163,27 @@ void Material::CreateDescriptorPools()
 
     // Sampler
     texturePoolSizes[1].type = vk::DescriptorType::eSampler;
-    texturePoolSizes[1].descriptorCount = MAX_MATERIALS;
+    texturePoolSizes[1].descriptorCount = std::max((uint32_t) MAX_MATERIALS, Texture::GetSamplerCapacity() * MAX_FRAMES_IN_FLIGHT);
     
     // 2D Texture array
     texturePoolSizes[2].type = vk::DescriptorType::eSampledImage;
-    texturePoolSizes[2].descriptorCount = MAX_MATERIALS;
+    texturePoolSizes[2].descriptorCount = std::max((uint32_t) MAX_MATERIALS, Texture::GetDescriptorCapacity() * MAX_FRAMES_IN_FLIGHT);
 
     // Texture Cube array
     texturePoolSizes[3].type = vk::DescriptorType::eSampledImage;
-    texturePoolSizes[3].descriptorCount = MAX_MATERIALS;
+    texturePoolSizes[3].descriptorCount = std::max((uint32_t) MAX_MATERIALS, Texture::GetDescriptorCapacity() * MAX_FRAMES_IN_FLIGHT);
 
     // 3D Texture array
     texturePoolSizes[4].type = vk::DescriptorType::eSampledImage;
-    texturePoolSizes[4].descriptorCount = MAX_MATERIALS;
+    texturePoolSizes[4].descriptorCount = std::max((uint32_t) MAX_MATERIALS, Texture::GetDescriptorCapacity() * MAX_FRAMES_IN_FLIGHT);
     
     vk::DescriptorPoolCreateInfo texturePoolInfo;
     texturePoolInfo.poolSizeCount = (uint32_t)texturePoolSizes.size();
     texturePoolInfo.pPoolSizes = texturePoolSizes.data();
     texturePoolInfo.maxSets = MAX_MATERIALS;
     texturePoolInfo.flags = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet;
+    if (vulkan->is_update_after_bind_enabled())
+        texturePoolInfo.flags |= vk::DescriptorPoolCreateFlagBits::eUpdateAfterBindEXT;
 
     /* Raytrace Descriptor Pool Info */
     std::array<vk::DescriptorPoolSize, 2> raytracingPoolSizes = {};
@@ -835,190 +1210,186 @@ void Material::CreateDescriptorPools()
         raytracingDescriptorPool = device.createDescriptorPool(raytracingPoolInfo);
 }
 
-void Material::UpdateRasterDescriptorSets()
+void Material::UpdateRasterDescriptorSets(uint32_t frame)
 {
     if (  (componentDescriptorPool == vk::DescriptorPool()) || (textureDescriptorPool == vk::DescriptorPool())) return;
+    if (frame >= MAX_FRAMES_IN_FLIGHT)
+        throw std::runtime_error( std::string("Error: frame index out of bounds"));
     auto vulkan = Libraries::Vulkan::Get();
     auto device = vulkan->get_device();
+
+    DescriptorCache &cache = descriptorCaches[frame];
+    descriptorWriteCount = 0;
     
-    /* ------ Component Descriptor Set  ------ */
+    /* Freshly allocated sets hold nothing, so everything in them needs to be written */
     vk::DescriptorSetLayout ssboLayouts[] = { componentDescriptorSetLayout };
-    std::array<vk::WriteDescriptorSet, 5> ssboDescriptorWrites = {};
-    if (componentDescriptorSet == vk::DescriptorSet())
+    if (componentDescriptorSets[frame] == vk::DescriptorSet())
     {
         vk::DescriptorSetAllocateInfo allocInfo;
         allocInfo.descriptorPool = componentDescriptorPool;
         allocInfo.descriptorSetCount = 1;
         allocInfo.pSetLayouts = ssboLayouts;
-        componentDescriptorSet = device.allocateDescriptorSets(allocInfo)[0];
+        componentDescriptorSets[frame] = device.allocateDescriptorSets(allocInfo)[0];
+        cache.valid = false;
     }
 
-    // Entity SSBO
-    vk::DescriptorBufferInfo entityBufferInfo;
-    entityBufferInfo.buffer = Entity::GetSSBO();
-    entityBufferInfo.offset = 0;
-    entityBufferInfo.range = Entity::GetSSBOSize();
-
-    ssboDescriptorWrites[0].dstSet = componentDescriptorSet;
-    ssboDescriptorWrites[0].dstBinding = 0;
-    ssboDescriptorWrites[0].dstArrayElement = 0;
-    ssboDescriptorWrites[0].descriptorType = vk::DescriptorType::eStorageBuffer;
-    ssboDescriptorWrites[0].descriptorCount = 1;
-    ssboDescriptorWrites[0].pBufferInfo = &entityBufferInfo;
-
-    // Transform SSBO
-    vk::DescriptorBufferInfo transformBufferInfo;
-    transformBufferInfo.buffer = Transform::GetSSBO();
-    transformBufferInfo.offset = 0;
-    transformBufferInfo.range = Transform::GetSSBOSize();
-
-    ssboDescriptorWrites[1].dstSet = componentDescriptorSet;
-    ssboDescriptorWrites[1].dstBinding = 1;
-    ssboDescriptorWrites[1].dstArrayElement = 0;
-    ssboDescriptorWrites[1].descriptorType = vk::DescriptorType::eStorageBuffer;
-    ssboDescriptorWrites[1].descriptorCount = 1;
-    ssboDescriptorWrites[1].pBufferInfo = &transformBufferInfo;
-
-    // Camera SSBO
-    vk::DescriptorBufferInfo cameraBufferInfo;
-    cameraBufferInfo.buffer = Camera::GetSSBO();
-    cameraBufferInfo.offset = 0;
-    cameraBufferInfo.range = Camera::GetSSBOSize();
-
-    ssboDescriptorWrites[2].dstSet = componentDescriptorSet;
-    ssboDescriptorWrites[2].dstBinding = 2;
-    ssboDescriptorWrites[2].dstArrayElement = 0;
-    ssboDescriptorWrites[2].descriptorType = vk::DescriptorType::eStorageBuffer;
-    ssboDescriptorWrites[2].descriptorCount = 1;
-    ssboDescriptorWrites[2].pBufferInfo = &cameraBufferInfo;
-
-    // Material SSBO
-    vk::DescriptorBufferInfo materialBufferInfo;
-    materialBufferInfo.buffer = Material::GetSSBO();
-    materialBufferInfo.offset = 0;
-    materialBufferInfo.range = Material::GetSSBOSize();
-
-    ssboDescriptorWrites[3].dstSet = componentDescriptorSet;
-    ssboDescriptorWrites[3].dstBinding = 3;
-    ssboDescriptorWrites[3].dstArrayElement = 0;
-    ssboDescriptorWrites[3].descriptorType = vk::DescriptorType::eStorageBuffer;
-    ssboDescriptorWrites[3].descriptorCount = 1;
-    ssboDescriptorWrites[3].pBufferInfo = &materialBufferInfo;
-
-    // Light SSBO
-    vk::DescriptorBufferInfo lightBufferInfo;
-    lightBufferInfo.buffer = Light::GetSSBO();
-    lightBufferInfo.offset = 0;
-    lightBufferInfo.range = Light::GetSSBOSize();
-
-    ssboDescriptorWrites[4].dstSet = componentDescriptorSet;
-    ssboDescriptorWrites[4].dstBinding = 4;
-    ssboDescriptorWrites[4].dstArrayElement = 0;
-    ssboDescriptorWrites[4].descriptorType = vk::DescriptorType::eStorageBuffer;
-    ssboDescriptorWrites[4].descriptorCount = 1;
-    ssboDescriptorWrites[4].pBufferInfo = &lightBufferInfo;
-    
-    device.updateDescriptorSets((uint32_t)ssboDescriptorWrites.size(), ssboDescriptorWrites.data(), 0, nullptr);
-    
-    /* ------ Texture Descriptor Set  ------ */
     vk::DescriptorSetLayout textureLayouts[] = { textureDescriptorSetLayout };
-    std::array<vk::WriteDescriptorSet, 5> textureDescriptorWrites = {};
-    
-    if (textureDescriptorSet == vk::DescriptorSet())
+    if (textureDescriptorSets[frame] == vk::DescriptorSet())
     {
         vk::DescriptorSetAllocateInfo allocInfo;
         allocInfo.descriptorPool = textureDescriptorPool;
         allocInfo.descriptorSetCount = 1;
         allocInfo.pSetLayouts = textureLayouts;
 
-        textureDescriptorSet = device.allocateDescriptorSets(allocInfo)[0];
+        /* Size the variable length 3D texture array to match the others */
+        uint32_t textureCapacity = Texture::GetDescriptorCapacity();
+        vk::DescriptorSetVariableDescriptorCountAllocateInfoEXT variableCountInfo;
+        variableCountInfo.descriptorSetCount = 1;
+        variableCountInfo.pDescriptorCounts = &textureCapacity;
+        if (vulkan->is_bindless_enabled()) allocInfo.pNext = &variableCountInfo;
+
+        textureDescriptorSets[frame] = device.allocateDescriptorSets(allocInfo)[0];
+        cache.valid = false;
     }
 
-    auto texture2DLayouts = Texture::GetLayouts(vk::ImageViewType::e2D);
-    auto texture2DViews = Texture::GetImageViews(vk::ImageViewType::e2D);
-    auto textureCubeLayouts = Texture::GetLayouts(vk::ImageViewType::eCube);
-    auto textureCubeViews = Texture::GetImageViews(vk::ImageViewType::eCube);
-    auto texture3DLayouts = Texture::GetLayouts(vk::ImageViewType::e3D);
-    auto texture3DViews = Texture::GetImageViews(vk::ImageViewType::e3D);
-    auto samplers = Texture::GetSamplers();
+    /* ------ Component Descriptor Set  ------ */
+    /* A storage buffer keeps its handle, size and per frame offsets until it's reallocated, 
+        so a binding only needs rewriting when its buffer's generation changes. */
+    std::array<vk::DescriptorBufferInfo, 12> bufferInfos;
+    std::array<uint64_t, 12> bufferGenerations;
+    auto describe = [&](uint32_t binding, vk::Buffer buffer, vk::DeviceSize offset, vk::DeviceSize size, uint64_t generation) {
+        bufferInfos[binding].buffer = buffer;
+        bufferInfos[binding].offset = offset;
+        bufferInfos[binding].range = size;
+        bufferGenerations[binding] = generation;
+    };
+    describe(0, Entity::GetSSBO(), Entity::GetSSBOOffset(frame), Entity::GetSSBOSize(), Entity::GetSSBOGeneration());
+    describe(1, Transform::GetSSBO(), Transform::GetSSBOOffset(frame), Transform::GetSSBOSize(), Transform::GetSSBOGeneration());
+    describe(2, Camera::GetSSBO(), Camera::GetSSBOOffset(frame), Camera::GetSSBOSize(), Camera::GetSSBOGeneration());
+    describe(3, Material::GetSSBO(), Material::GetSSBOOffset(frame), Material::GetSSBOSize(), Material::GetSSBOGeneration());
+    describe(4, Light::GetSSBO(), Light::GetSSBOOffset(frame), Light::GetSSBOSize(), Light::GetSSBOGeneration());
+    describe(5, instanceSSBO.get_buffer(), instanceSSBO.get_offset(frame), instanceSSBO.get_size(), instanceSSBO.get_generation());
+    describe(6, Mesh::GetSSBO(), Mesh::GetSSBOOffset(frame), Mesh::GetSSBOSize(), Mesh::GetSSBOGeneration());
+    describe(7, cullCandidateSSBO.get_buffer(), cullCandidateSSBO.get_offset(frame), cullCandidateSSBO.get_size(), cullCandidateSSBO.get_generation());
+    describe(8, drawCommandSSBO.get_buffer(), drawCommandSSBO.get_offset(frame), drawCommandSSBO.get_size(), drawCommandSSBO.get_generation());
+    describe(9, lightGridSSBO.get_buffer(), lightGridSSBO.get_offset(frame), lightGridSSBO.get_size(), lightGridSSBO.get_generation());
+    describe(10, lightClusterSSBO.get_buffer(), lightClusterSSBO.get_offset(frame), lightClusterSSBO.get_size(), lightClusterSSBO.get_generation());
+    describe(11, lightIndexSSBO.get_buffer(), lightIndexSSBO.get_offset(frame), lightIndexSSBO.get_size(), lightIndexSSBO.get_generation());
+
+    std::array<vk::WriteDescriptorSet, 12> ssboDescriptorWrites = {};
+    uint32_t ssboWriteCount = 0;
+    for (uint32_t binding = 0; binding < (uint32_t) bufferInfos.size(); ++binding)
+    {
+        if (cache.valid && cache.bufferGenerations[binding] == bufferGenerations[binding]) continue;
+        cache.bufferGenerations[binding] = bufferGenerations[binding];
+
+        auto &write = ssboDescriptorWrites[ssboWriteCount++];
+        write.dstSet = componentDescriptorSets[frame];
+        write.dstBinding = binding;
+        write.dstArrayElement = 0;
+        write.descriptorType = vk::DescriptorType::eStorageBuffer;
+        write.descriptorCount = 1;
+        write.pBufferInfo = &bufferInfos[binding];
+    }
+    
+    if (ssboWriteCount > 0)
+        device.updateDescriptorSets(ssboWriteCount, ssboDescriptorWrites.data(), 0, nullptr);
+    descriptorWriteCount += ssboWriteCount;
+    
+    /* ------ Texture Descriptor Set  ------ */
+    /* Writes are batched, and flushed whenever the batch fills up */
+    std::array<vk::WriteDescriptorSet, 16> textureDescriptorWrites = {};
+    uint32_t textureWriteCount = 0;
+    auto flush = [&]() {
+        if (textureWriteCount > 0)
+            device.updateDescriptorSets(textureWriteCount, textureDescriptorWrites.data(), 0, nullptr);
+        textureWriteCount = 0;
+    };
+    auto write = [&](uint32_t binding, vk::DescriptorType type, uint32_t first, uint32_t count, 
+        const vk::DescriptorImageInfo *imageInfos, const vk::DescriptorBufferInfo *bufferInfo) 
+    {
+        if (textureWriteCount == textureDescriptorWrites.size()) flush();
+        auto &descriptorWrite = textureDescriptorWrites[textureWriteCount++];
+        descriptorWrite.dstSet = textureDescriptorSets[frame];
+        descriptorWrite.dstBinding = binding;
+        descriptorWrite.dstArrayElement = first;
+        descriptorWrite.descriptorType = type;
+        descriptorWrite.descriptorCount = count;
+        descriptorWrite.pImageInfo = imageInfos;
+        descriptorWrite.pBufferInfo = bufferInfo;
+        descriptorWriteCount += count;
+    };
 
     // Texture SSBO
     vk::DescriptorBufferInfo textureBufferInfo;
     textureBufferInfo.buffer = Texture::GetSSBO();
-    textureBufferInfo.offset = 0;
+    textureBufferInfo.offset = Texture::GetSSBOOffset(frame);
     textureBufferInfo.range = Texture::GetSSBOSize();
-
-    textureDescriptorWrites[0].dstSet = textureDescriptorSet;
-    textureDescriptorWrites[0].dstBinding = 0;
-    textureDescriptorWrites[0].dstArrayElement = 0;
-    textureDescriptorWrites[0].descriptorType = vk::DescriptorType::eStorageBuffer;
-    textureDescriptorWrites[0].descriptorCount = 1;
-    textureDescriptorWrites[0].pBufferInfo = &textureBufferInfo;
-
-    // Samplers
-    vk::DescriptorImageInfo samplerDescriptorInfos[MAX_SAMPLERS];
-    for (int i = 0; i < MAX_SAMPLERS; ++i) 
-    {
-        samplerDescriptorInfos[i].sampler = samplers[i];
+    uint64_t textureSSBOGeneration = Texture::GetSSBOGeneration();
+    if (!cache.valid || cache.textureSSBOGeneration != textureSSBOGeneration) {
+        cache.textureSSBOGeneration = textureSSBOGeneration;
+        write(0, vk::DescriptorType::eStorageBuffer, 0, 1, nullptr, &textureBufferInfo);
     }
 
-    textureDescriptorWrites[1].dstSet = textureDescriptorSet;
-    textureDescriptorWrites[1].dstBinding = 1;
-    textureDescriptorWrites[1].dstArrayElement = 0;
-    textureDescriptorWrites[1].descriptorType = vk::DescriptorType::eSampler;
-    textureDescriptorWrites[1].descriptorCount = MAX_SAMPLERS;
-    textureDescriptorWrites[1].pImageInfo = samplerDescriptorInfos;
-
-    // 2D Textures
-    vk::DescriptorImageInfo texture2DDescriptorInfos[MAX_TEXTURES];
-    for (int i = 0; i < MAX_TEXTURES; ++i) 
+    /* Samplers and texture arrays only change when the texture table does. When it has, copy the new 
+        descriptors into the cache, and write each run of elements that differ from what was there. */
+    uint64_t textureGeneration = Texture::GetDescriptorGeneration();
+    if (!cache.valid || cache.textureGeneration != textureGeneration) 
     {
-        texture2DDescriptorInfos[i].sampler = nullptr;
-        texture2DDescriptorInfos[i].imageLayout = texture2DLayouts[i];
-        texture2DDescriptorInfos[i].imageView = texture2DViews[i];
+        cache.textureGeneration = textureGeneration;
+        if (!cache.valid) {
+            cache.samplers.assign(Texture::GetSamplerCapacity(), vk::DescriptorImageInfo());
+            cache.texture2Ds.assign(Texture::GetDescriptorCapacity(), vk::DescriptorImageInfo());
+            cache.textureCubes.assign(Texture::GetDescriptorCapacity(), vk::DescriptorImageInfo());
+            cache.texture3Ds.assign(Texture::GetDescriptorCapacity(), vk::DescriptorImageInfo());
+        }
+        auto update = [&](uint32_t binding, vk::DescriptorType type, vk::DescriptorImageInfo *cached, 
+            const vk::DescriptorImageInfo *infos, uint32_t count) 
+        {
+            uint32_t i = 0;
+            while (i < count) {
+                if (cache.valid && cached[i] == infos[i]) { ++i; continue; }
+                uint32_t first = i;
+                while (i < count && (!cache.valid || cached[i] != infos[i])) {
+                    cached[i] = infos[i];
+                    ++i;
+                }
+                write(binding, type, first, i - first, &cached[first], nullptr);
+            }
+        };
+
+        // Samplers
+        auto samplers = Texture::GetSamplers();
+        std::vector<vk::DescriptorImageInfo> samplerDescriptorInfos(samplers.size());
+        for (uint32_t i = 0; i < samplers.size(); ++i) 
+            samplerDescriptorInfos[i].sampler = samplers[i];
+        update(1, vk::DescriptorType::eSampler, cache.samplers.data(), samplerDescriptorInfos.data(), (uint32_t) samplers.size());
+
+        /* Only slots the texture table has grown to are written. Bindless arrays leave the rest unbound, while
+            fixed size arrays are never larger than the table. */
+        std::vector<vk::DescriptorImageInfo> textureDescriptorInfos(Texture::GetDescriptorCapacity());
+        uint32_t textureCount;
+
+        // 2D Textures
+        textureCount = Texture::GetImageInfos(vk::ImageViewType::e2D, textureDescriptorInfos.data());
+        update(2, vk::DescriptorType::eSampledImage, cache.texture2Ds.data(), textureDescriptorInfos.data(), textureCount);
+
+        // Texture Cubes
+        textureCount = Texture::GetImageInfos(vk::ImageViewType::eCube, textureDescriptorInfos.data());
+        update(3, vk::DescriptorType::eSampledImage, cache.textureCubes.data(), textureDescriptorInfos.data(), textureCount);
+
+        // 3D Textures
+        textureCount = Texture::GetImageInfos(vk::ImageViewType::e3D, textureDescriptorInfos.data());
+        update(4, vk::DescriptorType::eSampledImage, cache.texture3Ds.data(), textureDescriptorInfos.data(), textureCount);
     }
-
-    textureDescriptorWrites[2].dstSet = textureDescriptorSet;
-    textureDescriptorWrites[2].dstBinding = 2;
-    textureDescriptorWrites[2].dstArrayElement = 0;
-    textureDescriptorWrites[2].descriptorType = vk::DescriptorType::eSampledImage;
-    textureDescriptorWrites[2].descriptorCount = MAX_TEXTURES;
-    textureDescriptorWrites[2].pImageInfo = texture2DDescriptorInfos;
-
-    // Texture Cubes
-    vk::DescriptorImageInfo textureCubeDescriptorInfos[MAX_TEXTURES];
-    for (int i = 0; i < MAX_TEXTURES; ++i) 
-    {
-        textureCubeDescriptorInfos[i].sampler = nullptr;
-        textureCubeDescriptorInfos[i].imageLayout = textureCubeLayouts[i];
-        textureCubeDescriptorInfos[i].imageView = textureCubeViews[i];
-    }
-
-    textureDescriptorWrites[3].dstSet = textureDescriptorSet;
-    textureDescriptorWrites[3].dstBinding = 3;
-    textureDescriptorWrites[3].dstArrayElement = 0;
-    textureDescriptorWrites[3].descriptorType = vk::DescriptorType::eSampledImage;
-    textureDescriptorWrites[3].descriptorCount = MAX_TEXTURES;
-    textureDescriptorWrites[3].pImageInfo = textureCubeDescriptorInfos;
-
-
-    // 3D Textures
-    vk::DescriptorImageInfo texture3DDescriptorInfos[MAX_TEXTURES];
-    for (int i = 0; i < MAX_TEXTURES; ++i) 
-    {
-        texture3DDescriptorInfos[i].sampler = nullptr;
-        texture3DDescriptorInfos[i].imageLayout = texture3DLayouts[i];
-        texture3DDescriptorInfos[i].imageView = texture3DViews[i];
-    }
-
-    textureDescriptorWrites[4].dstSet = textureDescriptorSet;
-    textureDescriptorWrites[4].dstBinding = 4;
-    textureDescriptorWrites[4].dstArrayElement = 0;
-    textureDescriptorWrites[4].descriptorType = vk::DescriptorType::eSampledImage;
-    textureDescriptorWrites[4].descriptorCount = MAX_TEXTURES;
-    textureDescriptorWrites[4].pImageInfo = texture3DDescriptorInfos;
     
-    device.updateDescriptorSets((uint32_t)textureDescriptorWrites.size(), textureDescriptorWrites.data(), 0, nullptr);
+    flush();
+    cache.valid = true;
+}
+
+uint32_t Material::GetDescriptorWriteCount()
+{
+    return descriptorWriteCount;
 }
 
 void Material::UpdateRaytracingDescriptorSets()
@@ -1078,150 +1449,343 @@ void Material::CreateVertexAttributeDescriptions() {
     vertexInputAttributeDescriptions = attributeDescriptions;
 }
 
-void Material::BindDescriptorSets(vk::CommandBuffer &command_buffer, vk::RenderPass &render_pass) 
+void Material::BindDescriptorSets(vk::CommandBuffer &command_buffer, vk::RenderPass &render_pass, uint32_t frame) 
 {
-    std::vector<vk::DescriptorSet> descriptorSets = {componentDescriptorSet, textureDescriptorSet};
-    command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, normalsurface[render_pass].pipelineLayout, 0, 2, descriptorSets.data(), 0, nullptr);
-    command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, blinn[render_pass].pipelineLayout, 0, 2, descriptorSets.data(), 0, nullptr);
-    command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, texcoordsurface[render_pass].pipelineLayout, 0, 2, descriptorSets.data(), 0, nullptr);
-    command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pbr[render_pass].pipelineLayout, 0, 2, descriptorSets.data(), 0, nullptr);
-    command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, skybox[render_pass].pipelineLayout, 0, 2, descriptorSets.data(), 0, nullptr);
-    command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, depth[render_pass].pipelineLayout, 0, 2, descriptorSets.data(), 0, nullptr);
-    command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, volume[render_pass].pipelineLayout, 0, 2, descriptorSets.data(), 0, nullptr);
-}
-
-void Material::DrawEntity(vk::CommandBuffer &command_buffer, vk::RenderPass &render_pass, Entity &entity, PushConsts &push_constants) //int32_t camera_id, int32_t environment_id, int32_t diffuse_id, int32_t irradiance_id, float gamma, float exposure, std::vector<int32_t> &light_entity_ids, double time)
-{    
-    /* Need a mesh to render. */
-    auto mesh_id = entity.get_mesh();
-    if (mesh_id < 0 || mesh_id >= MAX_MESHES) return;
-    auto m = Mesh::Get((uint32_t) mesh_id);
-    if (!m) return;
-
-    /* Need a transform to render. */
-    auto transform_id = entity.get_transform();
-    if (transform_id < 0 || transform_id >= MAX_TRANSFORMS) return;
-
-    /* Need a material to render. */
-    auto material_id = entity.get_material();
-    if (material_id < 0 || material_id >= MAX_MATERIALS) return;
-    auto material = Material::Get(material_id);
-    if (!material) return;
-
-    /* Dont render volumes yet. */
-    if (material->renderMode == VOLUME) return;
-    if (material->renderMode == HIDDEN) return;
+    /* Every raster pipeline layout is made from the same set layouts and push constant range, so they're all compatible, 
+        and sets bound through one stay bound for the others. Uniform color's is used, as it's never still compiling. */
+    std::shared_lock<std::shared_mutex> lock(pipelineMutex);
+    auto resources = uniformColor.find(render_pass);
+    if (resources == uniformColor.end()) return;
+
+    std::vector<vk::DescriptorSet> descriptorSets = {componentDescriptorSets[frame], textureDescriptorSets[frame]};
+    command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, resources->second.pipelineLayout, 0, 2, descriptorSets.data(), 0, nullptr);
+}
 
-    if (material->renderMode == NORMAL) {
-        command_buffer.pushConstants(normalsurface[render_pass].pipelineLayout, vk::ShaderStageFlagBits::eAll, 0, sizeof(PushConsts), &push_constants);
-        command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, normalsurface[render_pass].pipeline);
-    }
-    else if (material->renderMode == BLINN) {
-        command_buffer.pushConstants(blinn[render_pass].pipelineLayout, vk::ShaderStageFlagBits::eAll, 0, sizeof(PushConsts), &push_constants);
-        command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, blinn[render_pass].pipeline);
-    }
-    else if (material->renderMode == TEXCOORD) {
-        command_buffer.pushConstants(texcoordsurface[render_pass].pipelineLayout, vk::ShaderStageFlagBits::eAll, 0, sizeof(PushConsts), &push_constants);
-        command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, texcoordsurface[render_pass].pipeline);
-    }
-    else if (material->renderMode == PBR) {
-        command_buffer.pushConstants(pbr[render_pass].pipelineLayout, vk::ShaderStageFlagBits::eAll, 0, sizeof(PushConsts), &push_constants);
-        command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pbr[render_pass].pipeline);
-    }
-    else if (material->renderMode == DEPTH) {
-        command_buffer.pushConstants(depth[render_pass].pipelineLayout, vk::ShaderStageFlagBits::eAll, 0, sizeof(PushConsts), &push_constants);
-        command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, depth[render_pass].pipeline);
+std::map<vk::RenderPass, Material::RasterPipelineResources>* Material::GetRasterPipelines(RenderMode render_mode)
+{
+    switch (render_mode) {
+        case BLINN: return &blinn;
+        case PBR: return &pbr;
+        case NORMAL: return &normalsurface;
+        case TEXCOORD: return &texcoordsurface;
+        case SKYBOX: return &skybox;
+        case BASECOLOR: return &uniformColor;
+        case DEPTH: return &depth;
+        case VOLUME: return &volume;
+        default: return nullptr;
     }
-    else if (material->renderMode == SKYBOX) {
-        command_buffer.pushConstants(skybox[render_pass].pipelineLayout, vk::ShaderStageFlagBits::eAll, 0, sizeof(PushConsts), &push_constants);
-        command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, skybox[render_pass].pipeline);
+}
+
+bool Material::GetRasterPipelineResources(vk::RenderPass &render_pass, RenderMode render_mode, RasterPipelineHandles &handles)
+{
+    auto pipelines = GetRasterPipelines(render_mode);
+    if (!pipelines) return false;
+
+    /* The maps can be modified once the lock is released, so copy the handles out rather than pointing into them */
+    std::shared_lock<std::shared_mutex> lock(pipelineMutex);
+    auto resources = pipelines->find(render_pass);
+    if (resources == pipelines->end()) return false;
+
+    /* Still compiling */
+    if (!resources->second.ready) {
+        resources = uniformColor.find(render_pass);
+        if (resources == uniformColor.end()) return false;
     }
-    
-    command_buffer.bindVertexBuffers(0, {m->get_point_buffer(), m->get_color_buffer(), m->get_normal_buffer(), m->get_texcoord_buffer()}, {0,0,0,0});
-    command_buffer.bindIndexBuffer(m->get_index_buffer(), 0, vk::IndexType::eUint32);
-    command_buffer.drawIndexed(m->get_total_indices(), 1, 0, 0, 0);
+
+    handles.pipeline = resources->second.pipeline;
+    handles.pipelineLayout = resources->second.pipelineLayout;
+    return true;
 }
 
-void Material::DrawVolume(vk::CommandBuffer &command_buffer, vk::RenderPass &render_pass, Entity &entity, PushConsts &push_constants) //int32_t camera_id, int32_t environment_id, int32_t diffuse_id, int32_t irradiance_id, float gamma, float exposure, std::vector<int32_t> &light_entity_ids, double time)
-{    
+bool Material::CreateDrawPacket(vk::RenderPass &render_pass, Entity &entity, int32_t entity_id, DrawPacket &packet)
+{
     /* Need a mesh to render. */
     auto mesh_id = entity.get_mesh();
-    if (mesh_id < 0 || mesh_id >= MAX_MESHES) return;
-    auto m = Mesh::Get((uint32_t) mesh_id);
-    if (!m) return;
+    if (mesh_id < 0 || mesh_id >= (int32_t) Mesh::GetCount()) return false;
+    auto m = Mesh::GetFromIndex((uint32_t) mesh_id);
+    if (!m || !m->is_initialized()) return false;
 
     /* Need a transform to render. */
     auto transform_id = entity.get_transform();
-    if (transform_id < 0 || transform_id >= MAX_TRANSFORMS) return;
+    if (transform_id < 0 || transform_id >= (int32_t) Transform::GetCount()) return false;
+    auto transform = Transform::GetFromIndex((uint32_t) transform_id);
+    if (!transform || !transform->is_initialized()) return false;
 
     /* Need a material to render. */
     auto material_id = entity.get_material();
-    if (material_id < 0 || material_id >= MAX_MATERIALS) return;
-    auto material = Material::Get(material_id);
-    if (!material) return;
+    if (material_id < 0 || material_id >= (int32_t) Material::GetCount()) return false;
+    auto material = Material::GetFromIndex((uint32_t) material_id);
+    if (!material || !material->is_initialized()) return false;
+
+    if (material->renderMode == HIDDEN) return false;
+    RasterPipelineHandles handles;
+    if (!GetRasterPipelineResources(render_pass, material->renderMode, handles)) return false;
+
+    /* Volume bit, then render mode (which picks the pipeline), then mesh, then material */
+    packet.volume = (material->renderMode == VOLUME);
+    packet.sort_key = ((uint64_t) packet.volume << 63)
+        | ((uint64_t) (material->renderMode & 0x7F) << 56)
+        | ((uint64_t) (mesh_id & 0xFFFFFF) << 32)
+        | (uint64_t) (uint32_t) material_id;
+    packet.entity_id = entity_id;
+    packet.pipeline = handles.pipeline;
+    packet.pipeline_layout = handles.pipelineLayout;
+    packet.point_buffer = m->get_point_buffer();
+    packet.color_buffer = m->get_color_buffer();
+    packet.normal_buffer = m->get_normal_buffer();
+    packet.texcoord_buffer = m->get_texcoord_buffer();
+    packet.index_buffer = m->get_index_buffer();
+    packet.index_count = m->get_total_indices();
+    return true;
+}
 
-    if (material->renderMode != VOLUME) return;
-    
-    {
-        command_buffer.pushConstants(volume[render_pass].pipelineLayout, vk::ShaderStageFlagBits::eAll, 0, sizeof(PushConsts), &push_constants);
-        command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, volume[render_pass].pipeline);
+void Material::RecordDrawPackets(vk::CommandBuffer &command_buffer, const std::vector<DrawPacket> &packets, PushConsts &push_constants, uint32_t first_instance, DrawStatistics &statistics)
+{
+    if ((first_instance + packets.size()) * sizeof(int32_t) > instanceSSBO.get_size())
+        throw std::runtime_error( std::string("Error: not enough instances reserved to record draw packets"));
+
+    /* Each packet's entity id goes into the instance buffer, so that packets sharing a pipeline and mesh 
+        can be drawn together, with the shaders looking up their entity through gl_InstanceIndex */
+    int32_t* entity_ids = (int32_t*) instanceSSBO.get_staging();
+    for (uint32_t i = 0; i < (uint32_t) packets.size(); ++i)
+        entity_ids[first_instance + i] = packets[i].entity_id;
+
+    vk::PipelineLayout pipeline_layout;
+    vk::Pipeline pipeline;
+    vk::Buffer point_buffer, index_buffer;
+
+    for (uint32_t first = 0, count = 0; first < (uint32_t) packets.size(); first += count) {
+        auto &packet = packets[first];
+        for (count = 1; first + count < (uint32_t) packets.size(); ++count) {
+            auto &next = packets[first + count];
+            if ((next.pipeline != packet.pipeline) || (next.point_buffer != packet.point_buffer) || (next.index_buffer != packet.index_buffer)) break;
+        }
+
+        /* Push constants persist between draws, so they only need pushing again if the layout changes */
+        if (packet.pipeline_layout != pipeline_layout) {
+            pipeline_layout = packet.pipeline_layout;
+            command_buffer.pushConstants(pipeline_layout, vk::ShaderStageFlagBits::eAll, 0, sizeof(PushConsts), &push_constants);
+            statistics.push_constants++;
+            statistics.push_constant_bytes += sizeof(PushConsts);
+        }
+
+        if (packet.pipeline != pipeline) {
+            pipeline = packet.pipeline;
+            command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+            statistics.pipeline_binds++;
+        }
+
+        if ((packet.point_buffer != point_buffer) || (packet.index_buffer != index_buffer)) {
+            point_buffer = packet.point_buffer;
+            index_buffer = packet.index_buffer;
+            command_buffer.bindVertexBuffers(0, {packet.point_buffer, packet.color_buffer, packet.normal_buffer, packet.texcoord_buffer}, {0,0,0,0});
+            command_buffer.bindIndexBuffer(packet.index_buffer, 0, vk::IndexType::eUint32);
+            statistics.mesh_binds++;
+        }
+
+        command_buffer.drawIndexed(packet.index_count, count, 0, 0, first_instance + first);
+        statistics.draws++;
+        statistics.instances += count;
     }
-    
-    command_buffer.bindVertexBuffers(0, {m->get_point_buffer(), m->get_color_buffer(), m->get_normal_buffer(), m->get_texcoord_buffer()}, {0,0,0,0});
-    command_buffer.bindIndexBuffer(m->get_index_buffer(), 0, vk::IndexType::eUint32);
-    command_buffer.drawIndexed(m->get_total_indices(), 1, 0, 0, 0);
 }
 
-void Material::CreateSSBO() 
+void Material::RecordIndirectDrawPackets(vk::CommandBuffer &command_buffer, uint32_t frame, const std::vector<DrawPacket> &packets, PushConsts &push_constants, uint32_t first_instance, DrawStatistics &statistics)
 {
-    auto vulkan = Libraries::Vulkan::Get();
-    auto device = vulkan->get_device();
-    auto physical_device = vulkan->get_physical_device();
+    if ((first_instance + packets.size()) * sizeof(CullCandidate) > cullCandidateSSBO.get_size())
+        throw std::runtime_error( std::string("Error: not enough candidates reserved to record indirect draw packets"));
+
+    CullCandidate* candidates = (CullCandidate*) cullCandidateSSBO.get_staging();
+    DrawIndexedIndirectCommand* commands = (DrawIndexedIndirectCommand*) drawCommandSSBO.get_staging();
+
+    vk::PipelineLayout pipeline_layout;
+    vk::Pipeline pipeline;
+    vk::Buffer point_buffer, index_buffer;
+
+    for (uint32_t first = 0, count = 0; first < (uint32_t) packets.size(); first += count) {
+        auto &packet = packets[first];
+        for (count = 1; first + count < (uint32_t) packets.size(); ++count) {
+            auto &next = packets[first + count];
+            if ((next.pipeline != packet.pipeline) || (next.point_buffer != packet.point_buffer) || (next.index_buffer != packet.index_buffer)) break;
+        }
+
+        /* Each bucket gets the command slot matching its first candidate, so slots never overlap between passes. 
+            Instances start at zero, and are counted up by the culling shader. */
+        uint32_t command = first_instance + first;
+        commands[command].index_count = packet.index_count;
+        commands[command].instance_count = 0;
+        commands[command].first_index = 0;
+        commands[command].vertex_offset = 0;
+        commands[command].first_instance = command;
+        for (uint32_t i = first; i < first + count; ++i) {
+            candidates[first_instance + i].entity_id = packets[i].entity_id;
+            candidates[first_instance + i].draw_command = (int32_t) command;
+        }
+
+        if (packet.pipeline_layout != pipeline_layout) {
+            pipeline_layout = packet.pipeline_layout;
+            command_buffer.pushConstants(pipeline_layout, vk::ShaderStageFlagBits::eAll, 0, sizeof(PushConsts), &push_constants);
+            statistics.push_constants++;
+            statistics.push_constant_bytes += sizeof(PushConsts);
+        }
+
+        if (packet.pipeline != pipeline) {
+            pipeline = packet.pipeline;
+            command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+            statistics.pipeline_binds++;
+        }
+
+        if ((packet.point_buffer != point_buffer) || (packet.index_buffer != index_buffer)) {
+            point_buffer = packet.point_buffer;
+            index_buffer = packet.index_buffer;
+            command_buffer.bindVertexBuffers(0, {packet.point_buffer, packet.color_buffer, packet.normal_buffer, packet.texcoord_buffer}, {0,0,0,0});
+            command_buffer.bindIndexBuffer(packet.index_buffer, 0, vk::IndexType::eUint32);
+            statistics.mesh_binds++;
+        }
+
+        command_buffer.drawIndexedIndirect(drawCommandSSBO.get_buffer(), 
+            drawCommandSSBO.get_offset(frame) + command * sizeof(DrawIndexedIndirectCommand), 1, sizeof(DrawIndexedIndirectCommand));
+        statistics.draws++;
+        statistics.instances += count;
+    }
+}
 
-    vk::BufferCreateInfo bufferInfo = {};
-    bufferInfo.size = MAX_MATERIALS * sizeof(MaterialStruct);
-    bufferInfo.usage = vk::BufferUsageFlagBits::eStorageBuffer;
-    bufferInfo.sharingMode = vk::SharingMode::eExclusive;
-    ssbo = device.createBuffer(bufferInfo);
+void Material::RecordCulling(vk::CommandBuffer &command_buffer, uint32_t frame, const std::vector<CullingPushConsts> &dispatches)
+{
+    if (!IsGPUCullingSupported()) 
+        throw std::runtime_error( std::string("Error: GPU culling is not supported on this device"));
+    if (dispatches.size() == 0) return;
+
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, cullingPipeline);
+    command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, cullingPipelineLayout, 0, 1, &componentDescriptorSets[frame], 0, nullptr);
+    for (auto &dispatch : dispatches) {
+        if (dispatch.candidate_count <= 0) continue;
+        command_buffer.pushConstants(cullingPipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(CullingPushConsts), &dispatch);
+        command_buffer.dispatch((dispatch.candidate_count + 63) / 64, 1, 1);
+    }
 
-    vk::MemoryRequirements memReqs = device.getBufferMemoryRequirements(ssbo);
-    vk::MemoryAllocateInfo allocInfo = {};
-    allocInfo.allocationSize = memReqs.size;
+    /* Draws read the instance counts as indirect commands, and vertex shaders read the instance list */
+    vk::MemoryBarrier barrier;
+    barrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+    barrier.dstAccessMask = vk::AccessFlagBits::eIndirectCommandRead | vk::AccessFlagBits::eShaderRead;
+    command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, 
+        vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eVertexShader | vk::PipelineStageFlagBits::eFragmentShader, 
+        vk::DependencyFlags(), {barrier}, {}, {});
+}
 
-    vk::PhysicalDeviceMemoryProperties memProperties = physical_device.getMemoryProperties();
-    vk::MemoryPropertyFlags properties = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
-    allocInfo.memoryTypeIndex = vulkan->find_memory_type(memReqs.memoryTypeBits, properties);
+bool Material::IsGPUCullingSupported()
+{
+    /* Indirect draws start at a non zero instance, to index their range of the instance buffer */
+    auto vulkan = Libraries::Vulkan::Get();
+    return cullingPipeline && vulkan->get_physical_device_features().drawIndirectFirstInstance;
+}
+
+void Material::ReserveIndirectDraws(uint32_t count)
+{
+    if (!cullCandidateSSBO.is_created() || !drawCommandSSBO.is_created()) return;
+    cullCandidateSSBO.reserve(std::max(count, 1u) * sizeof(CullCandidate));
+    drawCommandSSBO.reserve(std::max(count, 1u) * sizeof(DrawIndexedIndirectCommand));
+}
+
+void Material::UploadIndirectDraws(uint32_t frame, uint32_t count)
+{
+    if (!cullCandidateSSBO.is_created() || !drawCommandSSBO.is_created()) return;
+    if (count > 0) {
+        cullCandidateSSBO.mark_range(0, count * sizeof(CullCandidate));
+        drawCommandSSBO.mark_range(0, count * sizeof(DrawIndexedIndirectCommand));
+    }
+    cullCandidateSSBO.flush(frame);
+    drawCommandSSBO.flush(frame);
+}
 
-    ssboMemory = device.allocateMemory(allocInfo);
-    device.bindBufferMemory(ssbo, ssboMemory, 0);
+void Material::ReserveInstances(uint32_t count)
+{
+    if (!instanceSSBO.is_created()) return;
+    instanceSSBO.reserve(std::max(count, 1u) * sizeof(int32_t));
+}
 
-    /* Pin the buffer */
-    pinnedMemory = (MaterialStruct*) device.mapMemory(ssboMemory, 0, MAX_MATERIALS * sizeof(MaterialStruct));
+void Material::UploadInstances(uint32_t frame, uint32_t count)
+{
+    if (!instanceSSBO.is_created()) return;
+    if (count > 0) instanceSSBO.mark_range(0, count * sizeof(int32_t));
+    instanceSSBO.flush(frame);
 }
 
-void Material::UploadSSBO()
+void Material::UploadLightClusters(uint32_t frame, const std::vector<LightClusterGrid> &grids, 
+    const std::vector<LightCluster> &clusters, const std::vector<int32_t> &light_indices)
 {
-    if (pinnedMemory == nullptr) return;
-    MaterialStruct material_structs[MAX_MATERIALS];
-    
-    /* TODO: remove this for loop */
-    for (int i = 0; i < MAX_MATERIALS; ++i) {
-        if (!materials[i].is_initialized()) continue;
-        material_structs[i] = materials[i].material_struct;
+    if (!lightGridSSBO.is_created() || !lightClusterSSBO.is_created() || !lightIndexSSBO.is_created()) return;
+
+    auto upload = [frame](Libraries::StorageBuffer &buffer, const void* data, size_t size) {
+        buffer.reserve(std::max(size, (size_t) 1));
+        if (size > 0) {
+            memcpy(buffer.get_staging(), data, size);
+            buffer.mark_range(0, size);
+        }
+        buffer.flush(frame);
     };
+    upload(lightGridSSBO, grids.data(), grids.size() * sizeof(LightClusterGrid));
+    upload(lightClusterSSBO, clusters.data(), clusters.size() * sizeof(LightCluster));
+    upload(lightIndexSSBO, light_indices.data(), light_indices.size() * sizeof(int32_t));
+}
+
+void Material::CreateSSBO() 
+{
+    ssbo.create(materials.get_capacity() * sizeof(MaterialStruct));
+    materials.mark_all_dirty();
+    instanceSSBO.create(MAX_ENTITIES * sizeof(int32_t));
+    cullCandidateSSBO.create(MAX_ENTITIES * sizeof(CullCandidate));
+    drawCommandSSBO.create(MAX_ENTITIES * sizeof(DrawIndexedIndirectCommand), MAX_FRAMES_IN_FLIGHT, vk::BufferUsageFlagBits::eIndirectBuffer);
+    lightGridSSBO.create(sizeof(LightClusterGrid));
+    lightClusterSSBO.create(LIGHT_CLUSTER_COUNT * sizeof(LightCluster));
+    lightIndexSSBO.create(MAX_LIGHTS * sizeof(int32_t));
+}
 
-    /* Copy to GPU mapped memory */
-    memcpy(pinnedMemory, material_structs, sizeof(material_structs));
+void Material::UploadSSBO(uint32_t frame)
+{
+    if (!ssbo.is_created()) return;
+
+    /* Grow the SSBO if materials were added since the last upload. The staging copy is kept, so nothing needs to be re-marked. */
+    ssbo.reserve(materials.get_capacity() * sizeof(MaterialStruct));
+
+    /* Copy only the modified materials into the staging copy, then bring this frame's copy of the SSBO up to date */
+    MaterialStruct* material_structs = (MaterialStruct*) ssbo.get_staging();
+    materials.consume_dirty_ranges([&](uint32_t first, uint32_t count) {
+        for (uint32_t i = first; i < first + count; ++i)
+            material_structs[i] = materials[i].material_struct;
+        ssbo.mark_range(first * sizeof(MaterialStruct), count * sizeof(MaterialStruct));
+    });
+    ssbo.flush(frame);
 }
 
 vk::Buffer Material::GetSSBO()
 {
-    return ssbo;
+    return ssbo.get_buffer();
 }
 
 uint32_t Material::GetSSBOSize()
 {
-    return MAX_MATERIALS * sizeof(MaterialStruct);
+    return (uint32_t) ssbo.get_size();
+}
+
+uint32_t Material::GetSSBOOffset(uint32_t frame)
+{
+    return (uint32_t) ssbo.get_offset(frame);
+}
+
+uint64_t Material::GetSSBOBytesUploaded()
+{
+    return ssbo.get_bytes_uploaded();
+}
+
+uint64_t Material::GetSSBOGeneration()
+{
+    return ssbo.get_generation();
+}
+
+void Material::mark_dirty()
+{
+    if (!initialized) return;
+    materials.mark_dirty(id);
 }
 
 void Material::CleanUp()
@@ -1233,49 +1797,89 @@ void Material::CleanUp()
     if (device == vk::Device())
         throw std::runtime_error( std::string("Invalid vulkan device"));
 
-    device.destroyBuffer(ssbo);
-    device.unmapMemory(ssboMemory);
-    device.freeMemory(ssboMemory);
+    /* Compiles still running would be using the device */
+    WaitForPipelines();
+
+    ssbo.destroy();
+    instanceSSBO.destroy();
+    cullCandidateSSBO.destroy();
+    drawCommandSSBO.destroy();
+    lightGridSSBO.destroy();
+    lightClusterSSBO.destroy();
+    lightIndexSSBO.destroy();
+
+    /* Shared pipelines were made by whichever renderpass asked first, so they're only destroyed here */
+    {
+        std::unique_lock<std::shared_mutex> lock(pipelineMutex);
+        for (auto pipelines : { &uniformColor, &blinn, &pbr, &normalsurface, &texcoordsurface, &skybox, &depth, &volume })
+            pipelines->clear();
+    }
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        for (auto &entry : pipelineRegistry) {
+            if (entry.second->pipeline) device.destroyPipeline(entry.second->pipeline);
+            if (entry.second->pipelineLayout) device.destroyPipelineLayout(entry.second->pipelineLayout);
+        }
+        pipelineRegistry.clear();
+        renderPassSignatures.clear();
+    }
+
+    if (cullingPipeline) device.destroyPipeline(cullingPipeline);
+    if (cullingPipelineLayout) device.destroyPipelineLayout(cullingPipelineLayout);
+    cullingPipeline = vk::Pipeline();
+    cullingPipelineLayout = vk::PipelineLayout();
 
     device.destroyDescriptorSetLayout(componentDescriptorSetLayout);
     device.destroyDescriptorPool(componentDescriptorPool);
 
     device.destroyDescriptorSetLayout(textureDescriptorSetLayout);
     device.destroyDescriptorPool(textureDescriptorPool);
+
+    /* Destroying the pools frees their sets */
+    for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame) {
+        componentDescriptorSets[frame] = vk::DescriptorSet();
+        textureDescriptorSets[frame] = vk::DescriptorSet();
+        descriptorCaches[frame].valid = false;
+    }
 }	
 
 /* Static Factory Implementations */
 Material* Material::Create(std::string name) {
-    return StaticFactory::Create(name, "Material", lookupTable, materials, MAX_MATERIALS);
+    return StaticFactory::Create(name, "Material", lookupTable, materials);
 }
 
 Material* Material::Get(std::string name) {
-    return StaticFactory::Get(name, "Material", lookupTable, materials, MAX_MATERIALS);
+    return StaticFactory::Get(name, "Material", lookupTable, materials);
 }
 
 Material* Material::Get(uint32_t id) {
-    return StaticFactory::Get(id, "Material", lookupTable, materials, MAX_MATERIALS);
+    return StaticFactory::Get(id, "Material", lookupTable, materials);
+}
+
+Material* Material::Get(uint32_t id, uint32_t generation) {
+    return StaticFactory::Get(id, generation, "Material", lookupTable, materials);
 }
 
 void Material::Delete(std::string name) {
-    StaticFactory::Delete(name, "Material", lookupTable, materials, MAX_MATERIALS);
+    StaticFactory::Delete(name, "Material", lookupTable, materials);
 }
 
 void Material::Delete(uint32_t id) {
-    StaticFactory::Delete(id, "Material", lookupTable, materials, MAX_MATERIALS);
+    StaticFactory::Delete(id, "Material", lookupTable, materials);
 }
 
-Material* Material::GetFront() {
-    return materials;
+Material* Material::GetFromIndex(uint32_t index) {
+    return StaticFactory::GetFromIndex(index, materials);
 }
 
 uint32_t Material::GetCount() {
-    return MAX_MATERIALS;
+    return materials.get_capacity();
 }
 
 void Material::use_base_color_texture(uint32_t texture_id) 
 {
     this->material_struct.base_color_texture_id = texture_id;
+    mark_dirty();
 }
 
 void Material::use_base_color_texture(Texture *texture) 
@@ -1283,15 +1887,18 @@ void Material::use_base_color_texture(Texture *texture)
     if (!texture) 
         throw std::runtime_error( std::string("Invalid texture handle"));
     this->material_struct.base_color_texture_id = texture->get_id();
+    mark_dirty();
 }
 
 void Material::clear_base_color_texture() {
     this->material_struct.base_color_texture_id = -1;
+    mark_dirty();
 }
 
 void Material::use_roughness_texture(uint32_t texture_id) 
 {
     this->material_struct.roughness_texture_id = texture_id;
+    mark_dirty();
 }
 
 void Material::use_roughness_texture(Texture *texture) 
@@ -1299,20 +1906,24 @@ void Material::use_roughness_texture(Texture *texture)
     if (!texture) 
         throw std::runtime_error( std::string("Invalid texture handle"));
     this->material_struct.roughness_texture_id = texture->get_id();
+    mark_dirty();
 }
 
 void Material::use_vertex_colors(bool use)
 {
     if (use) {
         this->material_struct.flags |= (1 << 0);
+        mark_dirty();
     } else {
         this->material_struct.flags &= ~(1 << 0);
+        mark_dirty();
     }
 }
 
 void Material::use_volume_texture(uint32_t texture_id)
 {
     this->material_struct.volume_texture_id = texture_id;
+    mark_dirty();
 }
 
 void Material::use_volume_texture(Texture *texture)
@@ -1320,10 +1931,12 @@ void Material::use_volume_texture(Texture *texture)
     if (!texture) 
         throw std::runtime_error( std::string("Invalid texture handle"));
     this->material_struct.volume_texture_id = texture->get_id();
+    mark_dirty();
 }
 
 void Material::clear_roughness_texture() {
     this->material_struct.roughness_texture_id = -1;
+    mark_dirty();
 }
 
 void Material::show_pbr() {
@@ -1364,28 +1977,35 @@ void Material::hide() {
 
 void Material::set_base_color(glm::vec4 color) {
     this->material_struct.base_color = color;
+    mark_dirty();
 }
 
 void Material::set_base_color(float r, float g, float b, float a) {
     this->material_struct.base_color = glm::vec4(r, g, b, a);
+    mark_dirty();
 }
 
 void Material::set_roughness(float roughness) {
     this->material_struct.roughness = roughness;
+    mark_dirty();
 }
 
 void Material::set_metallic(float metallic) {
     this->material_struct.metallic = metallic;
+    mark_dirty();
 }
 
 void Material::set_transmission(float transmission) {
     this->material_struct.transmission = transmission;
+    mark_dirty();
 }
 
 void Material::set_transmission_roughness(float transmission_roughness) {
     this->material_struct.transmission_roughness = transmission_roughness;
+    mark_dirty();
 }
 
 void Material::set_ior(float ior) {
     this->material_struct.ior = ior;
+    mark_dirty();
 }
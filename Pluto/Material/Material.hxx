@@ -15,14 +15,21 @@
 #include <glm/gtx/quaternion.hpp>
 #include <glm/gtx/string_cast.hpp>
 
+#include <functional>
 #include <iostream>
 #include <map>
+#include <shared_mutex>
+#include <unordered_map>
 
 #include "Pluto/Libraries/Vulkan/Vulkan.hxx"
+#include "Pluto/Libraries/Vulkan/StorageBuffer.hxx"
 #include "Pluto/Tools/StaticFactory.hxx"
 
 #include "./MaterialStruct.hxx"
 #include "./PushConstants.hxx"
+#include "./DrawPacket.hxx"
+#include "./CullingStruct.hxx"
+#include "Pluto/Light/LightClusterStruct.hxx"
 #include "Pluto/Material/PipelineParameters.hxx"
 
 class Entity;
@@ -41,8 +48,11 @@ class Material : public StaticFactory
         /* Retrieves a material component by id */
         static Material* Get(uint32_t id);
 
-        /* Returns a pointer to the list of material components */
-        static Material* GetFront();
+        /* Retrieves a material component by id, failing if that material has since been deleted and its slot reused */
+        static Material* Get(uint32_t id, uint32_t generation);
+
+        /* Returns the material in the given slot, initialized or not, or nullptr if the slot is out of range */
+        static Material* GetFromIndex(uint32_t index);
 
         /* Returns the total number of reserved materials */
 	    static uint32_t GetCount();
@@ -53,9 +63,41 @@ class Material : public StaticFactory
         /* Deallocates a material with the given id */
         static void Delete(uint32_t id);
 
-        /* Initializes the vulkan resources required to render during the specified renderpass */
+        /* Creates pipelines which don't depend on a renderpass, like the culling compute pipeline */
+        static void CreateComputePipelines();
+
+        /* Initializes the vulkan resources required to render during the specified renderpass. Only the uniform color 
+            pipeline is built before returning. The rest are compiled on background threads, and until each is ready,
+            draws which would use it are drawn with uniform color instead. */
         static void SetupGraphicsPipelines(vk::RenderPass renderpass, uint32_t sampleCount);
 
+        /* Records a renderpass's compatibility signature, made from its attachment formats and sample counts, subpasses,
+            dependencies and view masks. Pipelines are shared between renderpasses with the same signature, so this
+            should be called before SetupGraphicsPipelines. */
+        static void RegisterRenderPass(vk::RenderPass renderpass, const vk::RenderPassCreateInfo &info);
+
+        /* Waits for the renderpass's pipelines to compile, then forgets the renderpass. Must be called before the 
+            renderpass is destroyed. The pipelines themselves are kept, since other renderpasses may share them. */
+        static void UnregisterRenderPass(vk::RenderPass renderpass);
+
+        /* Returns the number of distinct raster pipelines created, across all renderpasses */
+        static uint32_t GetPipelineCount();
+
+        /* Returns the number of times a raster pipeline was shared with a compatible renderpass, instead of created */
+        static uint64_t GetPipelineReuseCount();
+
+        /* Returns true once every pipeline for the given renderpass has finished compiling */
+        static bool ArePipelinesReady(vk::RenderPass renderpass);
+
+        /* Returns the number of pipelines still waiting to be compiled, across all renderpasses */
+        static uint32_t GetPendingPipelineCount();
+
+        /* Blocks until every pipeline for the given renderpass has finished compiling */
+        static void WaitForPipelines(vk::RenderPass renderpass);
+
+        /* Blocks until every queued pipeline has finished compiling */
+        static void WaitForPipelines();
+
         /* EXPLAIN THIS */
         static void SetupRaytracingShaderBindingTable(vk::RenderPass renderpass);
 
@@ -63,11 +105,17 @@ class Material : public StaticFactory
         static void Initialize();
 
         /* Transfers all material components to an SSBO */
-        static void UploadSSBO();
+        static void UploadSSBO(uint32_t frame);
+
+        /* Copies SSBO / texture handles into the texture and component descriptor sets used by the given 
+            frame in flight, pointing each SSBO descriptor at that frame's copy. Also, allocates the descriptor 
+            sets if not yet allocated. Only descriptors whose SSBO was reallocated, or texture array elements 
+            which changed, are rewritten. Must only be called once the GPU is done with the previous use of that 
+            frame. If update after bind is enabled, the sets may also be updated after being bound during recording. */
+        static void UpdateRasterDescriptorSets(uint32_t frame);
 
-        /* Copies SSBO / texture handles into the texture and component descriptor sets. 
-            Also, allocates the descriptor sets if not yet allocated. */
-        static void UpdateRasterDescriptorSets();
+        /* Returns the number of descriptors written by the last call to UpdateRasterDescriptorSets */
+        static uint32_t GetDescriptorWriteCount();
 
         /* EXPLAIN THIS */
         static void UpdateRaytracingDescriptorSets();
@@ -78,17 +126,67 @@ class Material : public StaticFactory
         /* Returns the size in bytes of the current material SSBO */
         static uint32_t GetSSBOSize();
 
+        /* Returns the byte offset of the given frame's copy within the SSBO */
+        static uint32_t GetSSBOOffset(uint32_t frame);
+
+        /* Returns the total number of bytes written into the material SSBO, for measuring upload traffic */
+        static uint64_t GetSSBOBytesUploaded();
+
+        /* Returns an id which changes whenever the SSBO is reallocated, so descriptors know to be rewritten */
+        static uint64_t GetSSBOGeneration();
+
+        /* Flags this material to be copied into the SSBO on the next upload. Called by every setter. */
+        void mark_dirty();
+
+        /* Returns false if this material's pipeline is still compiling for any renderpass, in which case 
+            it's being drawn with uniform color until the pipeline is ready. */
+        bool is_pipeline_ready();
+
         /* Releases vulkan resources */
         static void CleanUp();
 
-        /* Records a bind of all descriptor sets to each possible pipeline to the given command buffer. Call this at the beginning of a renderpass. */
-        static void BindDescriptorSets(vk::CommandBuffer &command_buffer, vk::RenderPass &render_pass);
+        /* Records a bind of the given frame's descriptor sets to each possible pipeline to the given command buffer. Call this at the beginning of a renderpass. */
+        static void BindDescriptorSets(vk::CommandBuffer &command_buffer, vk::RenderPass &render_pass, uint32_t frame);
+
+        /* Resolves the pipeline and buffers needed to draw the supplied entity in the given renderpass into a draw packet.
+            Returns false if the entity can't be drawn, eg if it's missing a mesh, transform or material. */
+        static bool CreateDrawPacket(vk::RenderPass &render_pass, Entity &entity, int32_t entity_id, DrawPacket &packet);
+
+        /* Records draws for a list of packets to the current command buffer. Consecutive packets sharing a pipeline and mesh 
+            become one instanced draw, and pipelines and meshes are only bound when they change. Packets should be sorted first. 
+            Entity ids are written to the instance buffer starting at first_instance, which must have room reserved for every packet.
+            Call this during a renderpass. */
+        static void RecordDrawPackets(vk::CommandBuffer &command_buffer, const std::vector<DrawPacket> &packets, PushConsts &push_constants, uint32_t first_instance, DrawStatistics &statistics);
+
+        /* Records the same draws as RecordDrawPackets, but as indirect draws whose instances are filled in by the culling
+            compute shader. Writes a culling candidate for every packet, starting at first_instance, which also gives the 
+            range of the instance buffer these draws use. Call this during a renderpass. */
+        static void RecordIndirectDrawPackets(vk::CommandBuffer &command_buffer, uint32_t frame, const std::vector<DrawPacket> &packets, PushConsts &push_constants, uint32_t first_instance, DrawStatistics &statistics);
+
+        /* Records a culling dispatch for each range of candidates, then a barrier making the results visible to indirect draws.
+            Call this outside of a renderpass, before the renderpasses that draw the culled packets. */
+        static void RecordCulling(vk::CommandBuffer &command_buffer, uint32_t frame, const std::vector<CullingPushConsts> &dispatches);
+
+        /* Returns true if the culling compute pipeline was created, and the device supports the indirect draws it fills in. */
+        static bool IsGPUCullingSupported();
+
+        /* Grows the culling candidate and indirect draw buffers to hold at least count packets. Call before UpdateRasterDescriptorSets. */
+        static void ReserveIndirectDraws(uint32_t count);
+
+        /* Copies the first count culling candidates and indirect draws into the given frame's copy of their buffers. */
+        static void UploadIndirectDraws(uint32_t frame, uint32_t count);
 
-        /* Records a draw of the supplied entity to the current command buffer. Call this during a renderpass. */
-        static void DrawEntity(vk::CommandBuffer &command_buffer, vk::RenderPass &render_pass, Entity &entity, PushConsts &push_constants); // int32_t camera_id, int32_t environment_id, int32_t diffuse_id, int32_t irradiance_id, float gamma, float exposure, std::vector<int32_t> &light_entity_ids, double time
+        /* Grows the instance buffer, which maps gl_InstanceIndex to an entity id, to hold at least count instances. 
+            Call before UpdateRasterDescriptorSets, since growing the buffer reallocates it. */
+        static void ReserveInstances(uint32_t count);
 
-        /* Records a draw of the supplied entity to the current command buffer. Call this during a renderpass. */
-        static void DrawVolume(vk::CommandBuffer &command_buffer, vk::RenderPass &render_pass, Entity &entity, PushConsts &push_constants); // int32_t camera_id, int32_t environment_id, int32_t diffuse_id, int32_t irradiance_id, float gamma, float exposure, std::vector<int32_t> &light_entity_ids, double time
+        /* Copies the first count instances written while recording into the given frame's copy of the instance buffer. */
+        static void UploadInstances(uint32_t frame, uint32_t count);
+
+        /* Replaces the given frame's light cluster grids, clusters and light index list, growing their buffers as needed.
+            Call before UpdateRasterDescriptorSets, since growing the buffers reallocates them. */
+        static void UploadLightClusters(uint32_t frame, const std::vector<LightClusterGrid> &grids, 
+            const std::vector<LightCluster> &clusters, const std::vector<int32_t> &light_indices);
 
         /* Creates an uninitialized material. Useful for preallocation. */
         Material();
@@ -138,20 +236,30 @@ class Material : public StaticFactory
         void use_volume_texture(Texture *texture);
     private:
     
-        /*  A list of the material components, allocated statically */
-        static Material materials[MAX_MATERIALS];
+        /*  A list of the material components, stored in chunks which grow as materials are added */
+        static SlotMap<Material> materials;
 
         /* A lookup table of name to material id */
         static std::map<std::string, uint32_t> lookupTable;
         
-        /* A pointer to the mapped material SSBO. This memory is shared between the GPU and CPU. */
-        static MaterialStruct* pinnedMemory;
+        /* The mapped material SSBO. This memory is shared between the GPU and CPU, and is reallocated as the material count grows. */
+        static Libraries::StorageBuffer ssbo;
+
+        /* The entity id drawn by each instance, rewritten every frame as draw packets are recorded */
+        static Libraries::StorageBuffer instanceSSBO;
+
+        /* The entities each pass may draw, and the indirect draws the culling shader adds them to */
+        static Libraries::StorageBuffer cullCandidateSSBO;
+        static Libraries::StorageBuffer drawCommandSSBO;
 
-        /* A vulkan buffer handle corresponding to the material SSBO  */
-        static vk::Buffer ssbo;
+        /* Lights assigned to the froxels of each camera view, read by surface shaders */
+        static Libraries::StorageBuffer lightGridSSBO;
+        static Libraries::StorageBuffer lightClusterSSBO;
+        static Libraries::StorageBuffer lightIndexSSBO;
 
-        /* The corresponding material SSBO memory */
-        static vk::DeviceMemory ssboMemory;
+        /* The compute pipeline culling candidates on the GPU */
+        static vk::Pipeline cullingPipeline;
+        static vk::PipelineLayout cullingPipelineLayout;
 
         /* A vector of vertex input binding descriptions, describing binding and stride of per vertex data. */
         static std::vector<vk::VertexInputBindingDescription> vertexInputBindingDescriptions;
@@ -165,13 +273,22 @@ class Material : public StaticFactory
             PipelineParameters pipelineParameters;
             vk::Pipeline pipeline;
             vk::PipelineLayout pipelineLayout;
+
+            /* False while the pipeline is being compiled in the background */
+            bool ready = false;
+        };
+
+        /* The handles needed to draw with a raster pipeline, copied out of the pipeline maps while they're locked */
+        struct RasterPipelineHandles {
+            vk::Pipeline pipeline;
+            vk::PipelineLayout pipelineLayout;
         };
 
         struct RaytracingPipelineResources {
             vk::Pipeline pipeline;
             vk::PipelineLayout pipelineLayout;
             vk::Buffer shaderBindingTable;
-            vk::DeviceMemory shaderBindingTableMemory;
+            Libraries::MemoryAllocation shaderBindingTableMemory;
         };
         
         /* The descriptor set layout describing where component SSBOs are bound */
@@ -193,11 +310,28 @@ class Material : public StaticFactory
         /* The descriptor pool used to allocate the raytracing descriptor set */
         static vk::DescriptorPool raytracingDescriptorPool;
 
-        /* The descriptor set containing references to all component SSBO buffers to be used as uniforms. */
-        static vk::DescriptorSet componentDescriptorSet;
+        /* The descriptor sets containing references to all component SSBO buffers to be used as uniforms, one per frame in flight. */
+        static vk::DescriptorSet componentDescriptorSets[MAX_FRAMES_IN_FLIGHT];
+
+        /* The descriptor sets containing references to all array of textues to be used as uniforms, one per frame in flight. */
+        static vk::DescriptorSet textureDescriptorSets[MAX_FRAMES_IN_FLIGHT];
+
+        /* What was last written into a frame's descriptor sets. Buffer descriptors are compared by storage buffer 
+            generation, and texture arrays element by element once the texture table's generation changes. */
+        struct DescriptorCache {
+            bool valid = false;
+            uint64_t bufferGenerations[12];
+            uint64_t textureSSBOGeneration;
+            uint64_t textureGeneration;
+            std::vector<vk::DescriptorImageInfo> samplers;
+            std::vector<vk::DescriptorImageInfo> texture2Ds;
+            std::vector<vk::DescriptorImageInfo> textureCubes;
+            std::vector<vk::DescriptorImageInfo> texture3Ds;
+        };
+        static DescriptorCache descriptorCaches[MAX_FRAMES_IN_FLIGHT];
 
-        /* The descriptor set containing references to all array of textues to be used as uniforms. */
-        static vk::DescriptorSet textureDescriptorSet;
+        /* The number of descriptors written by the last descriptor set update */
+        static uint32_t descriptorWriteCount;
         
         /* The pipeline resources for each of the possible material types */
         static std::map<vk::RenderPass, RasterPipelineResources> uniformColor;
@@ -211,9 +345,43 @@ class Material : public StaticFactory
 
         static std::map<vk::RenderPass, RaytracingPipelineResources> rttest;
 
+        /* A graphics pipeline, shared by every compatible renderpass which uses it */
+        struct SharedPipeline {
+            vk::Pipeline pipeline;
+            vk::PipelineLayout pipelineLayout;
 
-        /* Wrapper for shader module creation.  */
-        static vk::ShaderModule CreateShaderModule(const std::vector<char>& code);
+            /* Ready once the pipeline is made, or holds the reason it couldn't be */
+            std::shared_future<void> created;
+        };
+
+        /* Raster pipelines, keyed by their renderpass's signature and everything else they're made from, written out 
+            in full with key_append. Keys are hashed to pick a bucket, but compared in full, so a hash collision 
+            can't hand one renderpass another's pipeline. */
+        static std::unordered_map<std::vector<uint64_t>, std::shared_ptr<SharedPipeline>, KeyHasher> pipelineRegistry;
+
+        /* The compatibility signature of each registered renderpass, also written out with key_append */
+        static std::map<vk::RenderPass, std::vector<uint64_t>> renderPassSignatures;
+
+        /* Guards the registry and signatures */
+        static std::mutex registryMutex;
+        static uint64_t pipelineReuseCount;
+
+        /* Guards the pipeline maps above, which are filled in by the compile threads while being read when recording */
+        static std::shared_mutex pipelineMutex;
+
+        /* Pipeline compiles not yet known to have finished, per renderpass */
+        static std::map<vk::RenderPass, std::vector<std::shared_future<void>>> pipelineCompiles;
+
+        /* Queues a job which compiles one of a renderpass's pipelines in the background */
+        static void EnqueuePipelineCompile(vk::RenderPass renderpass, std::function<void()> compile);
+
+        /* Makes a compiled pipeline available for drawing */
+        static void PublishRasterPipeline(std::map<vk::RenderPass, RasterPipelineResources> &pipelines, vk::RenderPass renderpass, RasterPipelineResources &resources);
+
+
+        /* Returns the shader module for the SPIR-V file at the given path. Modules are cached by path and contents,
+            and owned by the pipeline cache, so they mustn't be destroyed after creating a pipeline. */
+        static vk::ShaderModule GetShaderModule(std::string path);
 
         /* Wraps the vulkan boilerplate for creation of a graphics pipeline */
         static void CreateRasterPipeline(
@@ -252,4 +420,11 @@ class Material : public StaticFactory
         /* An enumeration used to select a pipeline type for use when drawing a given entity. */
         enum RenderMode { BLINN, PBR, NORMAL, TEXCOORD, SKYBOX, BASECOLOR, DEPTH, VOLUME, HIDDEN };
         RenderMode renderMode = PBR;
+
+        /* Returns the pipelines for the given render mode, one per renderpass, or nullptr if the mode isn't drawn */
+        static std::map<vk::RenderPass, RasterPipelineResources>* GetRasterPipelines(RenderMode render_mode);
+
+        /* Copies out the handles used to draw the given render mode in the given renderpass. Returns false if there are none.
+            If that pipeline is still compiling, the uniform color pipeline's handles are given instead. */
+        static bool GetRasterPipelineResources(vk::RenderPass &render_pass, RenderMode render_mode, RasterPipelineHandles &handles);
 };
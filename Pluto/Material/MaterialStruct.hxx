@@ -1,4 +1,5 @@
 /* File shared by both GLSL and C++ */
+/* The initial number of material slots. Storage and the material SSBO grow past this at runtime. */
 #ifndef MAX_MATERIALS
 #define MAX_MATERIALS 256
 #endif
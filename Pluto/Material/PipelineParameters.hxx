@@ -1,5 +1,8 @@
 #pragma once
+#include <functional>
+#include <vector>
 #include "Pluto/Libraries/Vulkan/Vulkan.hxx"
+#include "Pluto/Tools/HashCombiner.hxx"
 
 struct PipelineParameters {
 	vk::PipelineInputAssemblyStateCreateInfo inputAssembly;
@@ -92,4 +95,31 @@ struct PipelineParameters {
 		dynamicState.dynamicStateCount = 3;
 		dynamicState.pDynamicStates = dynamicStates;
 	}
+
+	/* Appends every fixed function setting which ends up in a pipeline to the key, following the blend attachment 
+		and dynamic state pointers, so that two parameter sets with equal keys build the same pipeline. */
+	void append_key(std::vector<uint64_t> &key) const {
+		key_append(key, inputAssembly.topology, inputAssembly.primitiveRestartEnable);
+		key_append(key, rasterizer.depthClampEnable, rasterizer.rasterizerDiscardEnable, rasterizer.polygonMode,
+			(VkCullModeFlags) rasterizer.cullMode, rasterizer.frontFace, rasterizer.depthBiasEnable, rasterizer.depthBiasConstantFactor,
+			rasterizer.depthBiasClamp, rasterizer.depthBiasSlopeFactor, rasterizer.lineWidth);
+		key_append(key, viewportState.viewportCount, viewportState.scissorCount);
+		key_append(key, multisampling.rasterizationSamples, multisampling.sampleShadingEnable, multisampling.minSampleShading,
+			multisampling.alphaToCoverageEnable, multisampling.alphaToOneEnable);
+		key_append(key, depthStencil.depthTestEnable, depthStencil.depthWriteEnable, depthStencil.depthCompareOp,
+			depthStencil.depthBoundsTestEnable, depthStencil.minDepthBounds, depthStencil.maxDepthBounds, depthStencil.stencilTestEnable);
+		for (auto stencil : { &depthStencil.front, &depthStencil.back })
+			key_append(key, stencil->failOp, stencil->passOp, stencil->depthFailOp, stencil->compareOp,
+				stencil->compareMask, stencil->writeMask, stencil->reference);
+		key_append(key, colorBlending.logicOpEnable, colorBlending.logicOp, colorBlending.attachmentCount);
+		for (uint32_t i = 0; i < colorBlending.attachmentCount; ++i) {
+			auto &attachment = colorBlending.pAttachments[i];
+			key_append(key, attachment.blendEnable, attachment.srcColorBlendFactor, attachment.dstColorBlendFactor,
+				attachment.colorBlendOp, attachment.srcAlphaBlendFactor, attachment.dstAlphaBlendFactor, attachment.alphaBlendOp,
+				(VkColorComponentFlags) attachment.colorWriteMask);
+		}
+		for (uint32_t i = 0; i < 4; ++i) key_append(key, colorBlending.blendConstants[i]);
+		key_append(key, dynamicState.dynamicStateCount);
+		for (uint32_t i = 0; i < dynamicState.dynamicStateCount; ++i) key_append(key, dynamicState.pDynamicStates[i]);
+	}
 };
\ No newline at end of file
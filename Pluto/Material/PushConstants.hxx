@@ -16,7 +16,7 @@ using namespace glm;
 
 struct PushConsts
 {
-    int32_t target_id;
+    int32_t target_id; /* Unused by raster shaders, which find their entity through the instance buffer */
     int32_t camera_id;
     int32_t brdf_lut_id;
     int32_t environment_id;
@@ -29,7 +29,7 @@ struct PushConsts
     float exposure;
     float time;
     float environment_roughness;
-    int32_t light_entity_ids[MAX_LIGHTS];
+    int32_t light_cluster_grid; /* The light cluster grid of the camera's first view */
     int32_t viewIndex;
     int32_t ph4;
     int32_t ph5;
@@ -8,6 +8,7 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <algorithm>
 
 #include "./Mesh.hxx"
 
@@ -22,12 +23,13 @@
 #undef MemoryBarrier
 #endif
 
-Mesh Mesh::meshes[MAX_MESHES];
+SlotMap<Mesh> Mesh::meshes(MAX_MESHES);
 std::map<std::string, uint32_t> Mesh::lookupTable;
+Libraries::StorageBuffer Mesh::ssbo;
 vk::AccelerationStructureNV Mesh::topAS;
-vk::DeviceMemory Mesh::topASMemory;
+Libraries::MemoryAllocation Mesh::topASMemory;
 vk::Buffer Mesh::instanceBuffer;
-vk::DeviceMemory Mesh::instanceBufferMemory;
+Libraries::MemoryAllocation Mesh::instanceBufferMemory;
 
 class Vertex
 {
@@ -156,6 +158,112 @@ glm::vec3 Mesh::get_centroid()
     return centroid;
 }
 
+void Mesh::compute_bounds()
+{
+    if (points.size() == 0) {
+        aabbMin = aabbMax = boundingSphereCenter = glm::vec3(0.0f);
+        boundingSphereRadius = 0.0f;
+        mark_dirty();
+        return;
+    }
+
+    aabbMin = aabbMax = points[0];
+    for (auto &p : points) {
+        aabbMin = glm::min(aabbMin, p);
+        aabbMax = glm::max(aabbMax, p);
+    }
+
+    /* Centering the sphere on the box is not minimal, but is cheap and usually close */
+    boundingSphereCenter = (aabbMin + aabbMax) * 0.5f;
+    float radius2 = 0.0f;
+    for (auto &p : points) {
+        glm::vec3 d = p - boundingSphereCenter;
+        radius2 = glm::max(radius2, glm::dot(d, d));
+    }
+    boundingSphereRadius = glm::sqrt(radius2);
+    mark_dirty();
+}
+
+glm::vec3 Mesh::get_min_aabb_corner()
+{
+    return aabbMin;
+}
+
+glm::vec3 Mesh::get_max_aabb_corner()
+{
+    return aabbMax;
+}
+
+glm::vec3 Mesh::get_aabb_center()
+{
+    return (aabbMin + aabbMax) * 0.5f;
+}
+
+glm::vec3 Mesh::get_bounding_sphere_center()
+{
+    return boundingSphereCenter;
+}
+
+float Mesh::get_bounding_sphere_radius()
+{
+    return boundingSphereRadius;
+}
+
+void Mesh::mark_dirty()
+{
+    if (!initialized) return;
+    meshes.mark_dirty(id);
+}
+
+void Mesh::UploadSSBO(uint32_t frame)
+{
+    if (!ssbo.is_created()) return;
+
+    /* Grow the SSBO if meshes were added since the last upload. The staging copy is kept, so nothing needs to be re-marked. */
+    ssbo.reserve(meshes.get_capacity() * sizeof(MeshStruct));
+
+    /* Copy only the modified bounds into the staging copy, then bring this frame's copy of the SSBO up to date */
+    MeshStruct* mesh_structs = (MeshStruct*) ssbo.get_staging();
+    meshes.consume_dirty_ranges([&](uint32_t first, uint32_t count) {
+        for (uint32_t i = first; i < first + count; ++i)
+            mesh_structs[i].bounding_sphere = glm::vec4(meshes[i].boundingSphereCenter, meshes[i].boundingSphereRadius);
+        ssbo.mark_range(first * sizeof(MeshStruct), count * sizeof(MeshStruct));
+    });
+    ssbo.flush(frame);
+}
+
+vk::Buffer Mesh::GetSSBO()
+{
+    return ssbo.get_buffer();
+}
+
+uint32_t Mesh::GetSSBOSize()
+{
+    return (uint32_t) ssbo.get_size();
+}
+
+uint32_t Mesh::GetSSBOOffset(uint32_t frame)
+{
+    return (uint32_t) ssbo.get_offset(frame);
+}
+
+uint64_t Mesh::GetSSBOGeneration()
+{
+    return ssbo.get_generation();
+}
+
+void Mesh::CleanUp()
+{
+    auto vulkan = Libraries::Vulkan::Get();
+    if (!vulkan->is_initialized())
+        throw std::runtime_error( std::string("Vulkan library is not initialized"));
+    auto device = vulkan->get_device();
+    if (device == vk::Device())
+        throw std::runtime_error( std::string("Invalid vulkan device"));
+
+    ssbo.destroy();
+}
+
 void Mesh::cleanup()
 {
     auto vulkan = Libraries::Vulkan::Get();
@@ -165,28 +273,34 @@ void Mesh::cleanup()
     if (device == vk::Device())
         throw std::runtime_error( std::string("Invalid vulkan device"));
 
+    /* Staged data may not have been copied into the buffers yet */
+    if (uploadToken) vulkan->get_upload_queue()->wait(uploadToken);
+
     /* Destroy index buffer */
     device.destroyBuffer(indexBuffer);
-    device.freeMemory(indexBufferMemory);
+    vulkan->get_memory_allocator()->free(indexBufferMemory);
 
     /* Destroy vertex buffer */
     device.destroyBuffer(pointBuffer);
-    device.freeMemory(pointBufferMemory);
+    vulkan->get_memory_allocator()->free(pointBufferMemory);
 
     /* Destroy vertex color buffer */
     device.destroyBuffer(colorBuffer);
-    device.freeMemory(colorBufferMemory);
+    vulkan->get_memory_allocator()->free(colorBufferMemory);
 
     /* Destroy normal buffer */
     device.destroyBuffer(normalBuffer);
-    device.freeMemory(normalBufferMemory);
+    vulkan->get_memory_allocator()->free(normalBufferMemory);
 
     /* Destroy uv buffer */
     device.destroyBuffer(texCoordBuffer);
-    device.freeMemory(texCoordBufferMemory);
+    vulkan->get_memory_allocator()->free(texCoordBufferMemory);
 }
 
 void Mesh::Initialize() {
+    ssbo.create(meshes.get_capacity() * sizeof(MeshStruct));
+    meshes.mark_all_dirty();
+
     auto cube = CreateCube("DefaultCube");
     auto sphere = CreateSphere("DefaultSphere");
     auto plane = CreatePlane("DefaultPlane");
@@ -300,6 +414,7 @@ void Mesh::load_obj(std::string objPath, bool allow_edits, bool submit_immediate
 
     cleanup();
     compute_centroid();
+    compute_bounds();
     createPointBuffer(allow_edits, submit_immediately);
     createColorBuffer(allow_edits, submit_immediately);
     createIndexBuffer(allow_edits, submit_immediately);
@@ -365,6 +480,7 @@ void Mesh::load_stl(std::string stlPath, bool allow_edits, bool submit_immediate
 
     cleanup();
     compute_centroid();
+    compute_bounds();
     createPointBuffer(allow_edits, submit_immediately);
     createColorBuffer(allow_edits, submit_immediately);
     createIndexBuffer(allow_edits, submit_immediately);
@@ -485,6 +601,7 @@ void Mesh::load_glb(std::string glbPath, bool allow_edits, bool submit_immediate
 
     cleanup();
     compute_centroid();
+    compute_bounds();
     createPointBuffer(allow_edits, submit_immediately);
     createColorBuffer(allow_edits, submit_immediately);
     createIndexBuffer(allow_edits, submit_immediately);
@@ -585,6 +702,7 @@ void Mesh::load_raw(
 
     cleanup();
     compute_centroid();
+    compute_bounds();
     createPointBuffer(allow_edits, submit_immediately);
     createColorBuffer(allow_edits, submit_immediately);
     createIndexBuffer(allow_edits, submit_immediately);
@@ -606,9 +724,16 @@ void Mesh::edit_position(uint32_t index, glm::vec3 new_position)
     if (index >= this->points.size())
         throw std::runtime_error("Error: index out of bounds. Max index is " + std::to_string(this->points.size() - 1));
     
-    void *data = device.mapMemory(pointBufferMemory, (index * sizeof(glm::vec3)), sizeof(glm::vec3), vk::MemoryMapFlags());
+    void *data = (uint8_t*) pointBufferMemory.mapped + index * sizeof(glm::vec3);
     memcpy(data, &new_position, sizeof(glm::vec3));
-    device.unmapMemory(pointBufferMemory);
+
+    /* Grow the bounds to fit the new position. They can end up looser than needed, but editing 
+        one position at a time stays constant time. */
+    points[index] = new_position;
+    aabbMin = glm::min(aabbMin, new_position);
+    aabbMax = glm::max(aabbMax, new_position);
+    boundingSphereRadius = glm::max(boundingSphereRadius, glm::distance(boundingSphereCenter, new_position));
+    mark_dirty();
 }
 
 void Mesh::edit_positions(uint32_t index, std::vector<glm::vec3> new_positions)
@@ -628,9 +753,11 @@ void Mesh::edit_positions(uint32_t index, std::vector<glm::vec3> new_positions)
     if ((index + new_positions.size()) > this->points.size())
         throw std::runtime_error("Error: too many positions for given index, out of bounds. Max index is " + std::to_string(this->points.size() - 1));
     
-    void *data = device.mapMemory(pointBufferMemory, (index * sizeof(glm::vec3)), sizeof(glm::vec3) * new_positions.size(), vk::MemoryMapFlags());
+    void *data = (uint8_t*) pointBufferMemory.mapped + index * sizeof(glm::vec3);
     memcpy(data, new_positions.data(), sizeof(glm::vec3) * new_positions.size());
-    device.unmapMemory(pointBufferMemory);
+
+    std::copy(new_positions.begin(), new_positions.end(), points.begin() + index);
+    compute_bounds();
 }
 
 void Mesh::edit_normal(uint32_t index, glm::vec3 new_normal)
@@ -647,9 +774,8 @@ void Mesh::edit_normal(uint32_t index, glm::vec3 new_normal)
     if (index >= this->normals.size())
         throw std::runtime_error("Error: index out of bounds. Max index is " + std::to_string(this->normals.size() - 1));
     
-    void *data = device.mapMemory(normalBufferMemory, (index * sizeof(glm::vec3)), sizeof(glm::vec3), vk::MemoryMapFlags());
+    void *data = (uint8_t*) normalBufferMemory.mapped + index * sizeof(glm::vec3);
     memcpy(data, &new_normal, sizeof(glm::vec3));
-    device.unmapMemory(normalBufferMemory);
 }
 
 void Mesh::edit_normals(uint32_t index, std::vector<glm::vec3> new_normals)
@@ -669,9 +795,8 @@ void Mesh::edit_normals(uint32_t index, std::vector<glm::vec3> new_normals)
     if ((index + new_normals.size()) > this->normals.size())
         throw std::runtime_error("Error: too many normals for given index, out of bounds. Max index is " + std::to_string(this->normals.size() - 1));
     
-    void *data = device.mapMemory(normalBufferMemory, (index * sizeof(glm::vec3)), sizeof(glm::vec3) * new_normals.size(), vk::MemoryMapFlags());
+    void *data = (uint8_t*) normalBufferMemory.mapped + index * sizeof(glm::vec3);
     memcpy(data, new_normals.data(), sizeof(glm::vec3) * new_normals.size());
-    device.unmapMemory(normalBufferMemory);
 }
 
 void Mesh::edit_vertex_color(uint32_t index, glm::vec4 new_color)
@@ -688,9 +813,8 @@ void Mesh::edit_vertex_color(uint32_t index, glm::vec4 new_color)
     if (index >= this->colors.size())
         throw std::runtime_error("Error: index out of bounds. Max index is " + std::to_string(this->colors.size() - 1));
     
-    void *data = device.mapMemory(colorBufferMemory, (index * sizeof(glm::vec4)), sizeof(glm::vec4), vk::MemoryMapFlags());
+    void *data = (uint8_t*) colorBufferMemory.mapped + index * sizeof(glm::vec4);
     memcpy(data, &new_color, sizeof(glm::vec4));
-    device.unmapMemory(colorBufferMemory);
 }
 
 void Mesh::edit_vertex_colors(uint32_t index, std::vector<glm::vec4> new_colors)
@@ -710,9 +834,8 @@ void Mesh::edit_vertex_colors(uint32_t index, std::vector<glm::vec4> new_colors)
     if ((index + new_colors.size()) > this->colors.size())
         throw std::runtime_error("Error: too many colors for given index, out of bounds. Max index is " + std::to_string(this->colors.size() - 1));
     
-    void *data = device.mapMemory(colorBufferMemory, (index * sizeof(glm::vec4)), sizeof(glm::vec4) * new_colors.size(), vk::MemoryMapFlags());
+    void *data = (uint8_t*) colorBufferMemory.mapped + index * sizeof(glm::vec4);
     memcpy(data, new_colors.data(), sizeof(glm::vec4) * new_colors.size());
-    device.unmapMemory(colorBufferMemory);
 }
 
 void Mesh::edit_texture_coordinate(uint32_t index, glm::vec2 new_texcoord)
@@ -729,9 +852,8 @@ void Mesh::edit_texture_coordinate(uint32_t index, glm::vec2 new_texcoord)
     if (index >= this->texcoords.size())
         throw std::runtime_error("Error: index out of bounds. Max index is " + std::to_string(this->texcoords.size() - 1));
     
-    void *data = device.mapMemory(texCoordBufferMemory, (index * sizeof(glm::vec2)), sizeof(glm::vec2), vk::MemoryMapFlags());
+    void *data = (uint8_t*) texCoordBufferMemory.mapped + index * sizeof(glm::vec2);
     memcpy(data, &new_texcoord, sizeof(glm::vec2));
-    device.unmapMemory(texCoordBufferMemory);
 }
 
 void Mesh::edit_texture_coordinates(uint32_t index, std::vector<glm::vec2> new_texcoords)
@@ -751,9 +873,8 @@ void Mesh::edit_texture_coordinates(uint32_t index, std::vector<glm::vec2> new_t
     if ((index + new_texcoords.size()) > this->texcoords.size())
         throw std::runtime_error("Error: too many texture coordinates for given index, out of bounds. Max index is " + std::to_string(this->texcoords.size() - 1));
     
-    void *data = device.mapMemory(texCoordBufferMemory, (index * sizeof(glm::vec2)), sizeof(glm::vec2) * new_texcoords.size(), vk::MemoryMapFlags());
+    void *data = (uint8_t*) texCoordBufferMemory.mapped + index * sizeof(glm::vec2);
     memcpy(data, new_texcoords.data(), sizeof(glm::vec2) * new_texcoords.size());
-    device.unmapMemory(texCoordBufferMemory);
 }
 
 void Mesh::build_top_level_bvh(bool submit_immediately)
@@ -770,7 +891,7 @@ void Mesh::build_top_level_bvh(bool submit_immediately)
         throw std::runtime_error("Error: vulkan device not initialized");
 
     auto CreateAccelerationStructure = [&](vk::AccelerationStructureTypeNV type, uint32_t geometryCount,
-        vk::GeometryNV* geometries, uint32_t instanceCount, vk::AccelerationStructureNV& AS, vk::DeviceMemory& memory)
+        vk::GeometryNV* geometries, uint32_t instanceCount, vk::AccelerationStructureNV& AS, Libraries::MemoryAllocation& memory)
     {
         vk::AccelerationStructureCreateInfoNV accelerationStructureInfo;
         accelerationStructureInfo.compactedSize = 0;
@@ -788,16 +909,12 @@ void Mesh::build_top_level_bvh(bool submit_immediately)
         vk::MemoryRequirements2 memoryRequirements;
         memoryRequirements = device.getAccelerationStructureMemoryRequirementsNV(memoryRequirementsInfo, dldi);
 
-        vk::MemoryAllocateInfo memoryAllocateInfo;
-        memoryAllocateInfo.allocationSize = memoryRequirements.memoryRequirements.size;
-        memoryAllocateInfo.memoryTypeIndex = vulkan->find_memory_type(memoryRequirements.memoryRequirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
-
-        memory = device.allocateMemory(memoryAllocateInfo);
+        memory = vulkan->get_memory_allocator()->allocate(memoryRequirements.memoryRequirements, vk::MemoryPropertyFlagBits::eDeviceLocal);
         
         vk::BindAccelerationStructureMemoryInfoNV bindInfo;
         bindInfo.accelerationStructure = AS;
-        bindInfo.memory = memory;
-        bindInfo.memoryOffset = 0;
+        bindInfo.memory = memory.memory;
+        bindInfo.memoryOffset = memory.offset;
         bindInfo.deviceIndexCount = 0;
         bindInfo.pDeviceIndices = nullptr;
 
@@ -811,7 +928,7 @@ void Mesh::build_top_level_bvh(bool submit_immediately)
 
     /* Gather Instances */
     std::vector<VkGeometryInstance> instances;
-    for (uint32_t i = 0; i < MAX_MESHES; ++i)
+    for (uint32_t i = 0; i < meshes.get_capacity(); ++i)
     {
         if (!meshes[i].is_initialized()) continue;
         if (!meshes[i].lowBVHBuilt) continue;
@@ -829,21 +946,10 @@ void Mesh::build_top_level_bvh(bool submit_immediately)
 
         instanceBuffer = device.createBuffer(instanceBufferInfo);
 
-        vk::MemoryRequirements instanceBufferRequirements;
-        instanceBufferRequirements = device.getBufferMemoryRequirements(instanceBuffer);
-
-        vk::MemoryAllocateInfo instanceMemoryAllocateInfo;
-        instanceMemoryAllocateInfo.allocationSize = instanceBufferRequirements.size;
-        instanceMemoryAllocateInfo.memoryTypeIndex = vulkan->find_memory_type(instanceBufferRequirements.memoryTypeBits, 
+        instanceBufferMemory = vulkan->get_memory_allocator()->allocate_buffer(instanceBuffer,
             vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent );
 
-        instanceBufferMemory = device.allocateMemory(instanceMemoryAllocateInfo);
-        
-        device.bindBufferMemory(instanceBuffer, instanceBufferMemory, 0);
-
-        void* ptr = device.mapMemory(instanceBufferMemory, 0, instanceBufferSize);
-        memcpy(ptr, instances.data(), instanceBufferSize);
-        device.unmapMemory(instanceBufferMemory);
+        memcpy(instanceBufferMemory.mapped, instances.data(), instanceBufferSize);
     }
 
     /* Build top level BVH */
@@ -869,15 +975,8 @@ void Mesh::build_top_level_bvh(bool submit_immediately)
         bufferInfo.sharingMode = vk::SharingMode::eExclusive;
         vk::Buffer accelerationStructureScratchBuffer = device.createBuffer(bufferInfo);
         
-        vk::MemoryRequirements scratchBufferRequirements;
-        scratchBufferRequirements = device.getBufferMemoryRequirements(accelerationStructureScratchBuffer);
-        
-        vk::MemoryAllocateInfo scratchMemoryAllocateInfo;
-        scratchMemoryAllocateInfo.allocationSize = scratchBufferRequirements.size;
-        scratchMemoryAllocateInfo.memoryTypeIndex = vulkan->find_memory_type(scratchBufferRequirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
-
-        vk::DeviceMemory accelerationStructureScratchMemory = device.allocateMemory(scratchMemoryAllocateInfo);
-        device.bindBufferMemory(accelerationStructureScratchBuffer, accelerationStructureScratchMemory, 0);
+        Libraries::MemoryAllocation accelerationStructureScratchMemory = vulkan->get_memory_allocator()->allocate_buffer(
+            accelerationStructureScratchBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal);
 
         /* Now we can build our acceleration structure */
         vk::MemoryBarrier memoryBarrier;
@@ -907,7 +1006,7 @@ void Mesh::build_top_level_bvh(bool submit_immediately)
         //     vk::PipelineStageFlagBits::eRayTracingShaderNV, 
         //     vk::DependencyFlags(), {memoryBarrier}, {}, {});
 
-        vulkan->end_one_time_graphics_command(cmd, "build acceleration structure", true, submit_immediately);
+        vulkan->end_one_time_graphics_command(cmd, "build acceleration structure", true);
     }
 
 }
@@ -952,7 +1051,7 @@ void Mesh::build_low_level_bvh(bool submit_immediately)
     // Bottom level acceleration structures correspond to the geometry
 
     auto CreateAccelerationStructure = [&](vk::AccelerationStructureTypeNV type, uint32_t geometryCount,
-        vk::GeometryNV* geometries, uint32_t instanceCount, vk::AccelerationStructureNV& AS, vk::DeviceMemory& memory)
+        vk::GeometryNV* geometries, uint32_t instanceCount, vk::AccelerationStructureNV& AS, Libraries::MemoryAllocation& memory)
     {
         vk::AccelerationStructureCreateInfoNV accelerationStructureInfo;
         accelerationStructureInfo.compactedSize = 0;
@@ -970,16 +1069,12 @@ void Mesh::build_low_level_bvh(bool submit_immediately)
         vk::MemoryRequirements2 memoryRequirements;
         memoryRequirements = device.getAccelerationStructureMemoryRequirementsNV(memoryRequirementsInfo, dldi);
 
-        vk::MemoryAllocateInfo memoryAllocateInfo;
-        memoryAllocateInfo.allocationSize = memoryRequirements.memoryRequirements.size;
-        memoryAllocateInfo.memoryTypeIndex = vulkan->find_memory_type(memoryRequirements.memoryRequirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
-
-        memory = device.allocateMemory(memoryAllocateInfo);
+        memory = vulkan->get_memory_allocator()->allocate(memoryRequirements.memoryRequirements, vk::MemoryPropertyFlagBits::eDeviceLocal);
         
         vk::BindAccelerationStructureMemoryInfoNV bindInfo;
         bindInfo.accelerationStructure = AS;
-        bindInfo.memory = memory;
-        bindInfo.memoryOffset = 0;
+        bindInfo.memory = memory.memory;
+        bindInfo.memoryOffset = memory.offset;
         bindInfo.deviceIndexCount = 0;
         bindInfo.pDeviceIndices = nullptr;
 
@@ -1031,15 +1126,8 @@ void Mesh::build_low_level_bvh(bool submit_immediately)
         bufferInfo.sharingMode = vk::SharingMode::eExclusive;
         vk::Buffer accelerationStructureScratchBuffer = device.createBuffer(bufferInfo);
         
-        vk::MemoryRequirements scratchBufferRequirements;
-        scratchBufferRequirements = device.getBufferMemoryRequirements(accelerationStructureScratchBuffer);
-        
-        vk::MemoryAllocateInfo scratchMemoryAllocateInfo;
-        scratchMemoryAllocateInfo.allocationSize = scratchBufferRequirements.size;
-        scratchMemoryAllocateInfo.memoryTypeIndex = vulkan->find_memory_type(scratchBufferRequirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
-
-        vk::DeviceMemory accelerationStructureScratchMemory = device.allocateMemory(scratchMemoryAllocateInfo);
-        device.bindBufferMemory(accelerationStructureScratchBuffer, accelerationStructureScratchMemory, 0);
+        Libraries::MemoryAllocation accelerationStructureScratchMemory = vulkan->get_memory_allocator()->allocate_buffer(
+            accelerationStructureScratchBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal);
 
         /* Now we can build our acceleration structure */
         vk::MemoryBarrier memoryBarrier;
@@ -1068,7 +1156,7 @@ void Mesh::build_low_level_bvh(bool submit_immediately)
         //     vk::PipelineStageFlagBits::eAccelerationStructureBuildNV, 
         //     vk::DependencyFlags(), {memoryBarrier}, {}, {});
 
-        vulkan->end_one_time_graphics_command(cmd, "build acceleration structure", true, submit_immediately);
+        vulkan->end_one_time_graphics_command(cmd, "build acceleration structure", true);
     }
 
     /* Might need a fence here */
@@ -1077,16 +1165,20 @@ void Mesh::build_low_level_bvh(bool submit_immediately)
 
 /* Static Factory Implementations */
 Mesh* Mesh::Get(std::string name) {
-    return StaticFactory::Get(name, "Mesh", lookupTable, meshes, MAX_MESHES);
+    return StaticFactory::Get(name, "Mesh", lookupTable, meshes);
 }
 
 Mesh* Mesh::Get(uint32_t id) {
-    return StaticFactory::Get(id, "Mesh", lookupTable, meshes, MAX_MESHES);
+    return StaticFactory::Get(id, "Mesh", lookupTable, meshes);
+}
+
+Mesh* Mesh::Get(uint32_t id, uint32_t generation) {
+    return StaticFactory::Get(id, generation, "Mesh", lookupTable, meshes);
 }
 
 Mesh* Mesh::CreateCube(std::string name, bool allow_edits, bool submit_immediately)
 {
-    auto mesh = StaticFactory::Create(name, "Mesh", lookupTable, meshes, MAX_MESHES);
+    auto mesh = StaticFactory::Create(name, "Mesh", lookupTable, meshes);
     if (!mesh) return nullptr;
     mesh->make_cube(allow_edits, submit_immediately);
     return mesh;
@@ -1094,7 +1186,7 @@ Mesh* Mesh::CreateCube(std::string name, bool allow_edits, bool submit_immediate
 
 Mesh* Mesh::CreatePlane(std::string name, bool allow_edits, bool submit_immediately)
 {
-    auto mesh = StaticFactory::Create(name, "Mesh", lookupTable, meshes, MAX_MESHES);
+    auto mesh = StaticFactory::Create(name, "Mesh", lookupTable, meshes);
     if (!mesh) return nullptr;
     mesh->make_plane(allow_edits, submit_immediately);
     return mesh;
@@ -1102,7 +1194,7 @@ Mesh* Mesh::CreatePlane(std::string name, bool allow_edits, bool submit_immediat
 
 Mesh* Mesh::CreateSphere(std::string name, bool allow_edits, bool submit_immediately)
 {
-    auto mesh = StaticFactory::Create(name, "Mesh", lookupTable, meshes, MAX_MESHES);
+    auto mesh = StaticFactory::Create(name, "Mesh", lookupTable, meshes);
     if (!mesh) return nullptr;
     mesh->make_sphere(allow_edits, submit_immediately);
     return mesh;
@@ -1110,21 +1202,21 @@ Mesh* Mesh::CreateSphere(std::string name, bool allow_edits, bool submit_immedia
 
 Mesh* Mesh::CreateFromOBJ(std::string name, std::string objPath, bool allow_edits, bool submit_immediately)
 {
-    auto mesh = StaticFactory::Create(name, "Mesh", lookupTable, meshes, MAX_MESHES);
+    auto mesh = StaticFactory::Create(name, "Mesh", lookupTable, meshes);
     mesh->load_obj(objPath, allow_edits, submit_immediately);
     return mesh;
 }
 
 Mesh* Mesh::CreateFromSTL(std::string name, std::string stlPath, bool allow_edits, bool submit_immediately)
 {
-    auto mesh = StaticFactory::Create(name, "Mesh", lookupTable, meshes, MAX_MESHES);
+    auto mesh = StaticFactory::Create(name, "Mesh", lookupTable, meshes);
     mesh->load_stl(stlPath, allow_edits, submit_immediately);
     return mesh;
 }
 
 Mesh* Mesh::CreateFromGLB(std::string name, std::string glbPath, bool allow_edits, bool submit_immediately)
 {
-    auto mesh = StaticFactory::Create(name, "Mesh", lookupTable, meshes, MAX_MESHES);
+    auto mesh = StaticFactory::Create(name, "Mesh", lookupTable, meshes);
     mesh->load_glb(glbPath, allow_edits, submit_immediately);
     return mesh;
 }
@@ -1139,28 +1231,28 @@ Mesh* Mesh::CreateFromRaw (
     bool allow_edits, 
     bool submit_immediately)
 {
-    auto mesh = StaticFactory::Create(name, "Mesh", lookupTable, meshes, MAX_MESHES);
+    auto mesh = StaticFactory::Create(name, "Mesh", lookupTable, meshes);
     mesh->load_raw(points, normals, colors, texcoords, indices, allow_edits, submit_immediately);
     return mesh;
 }
 
 void Mesh::Delete(std::string name) {
-    StaticFactory::Delete(name, "Mesh", lookupTable, meshes, MAX_MESHES);
+    StaticFactory::Delete(name, "Mesh", lookupTable, meshes);
 }
 
 void Mesh::Delete(uint32_t id) {
-    StaticFactory::Delete(id, "Mesh", lookupTable, meshes, MAX_MESHES);
+    StaticFactory::Delete(id, "Mesh", lookupTable, meshes);
 }
 
-Mesh* Mesh::GetFront() {
-    return meshes;
+Mesh* Mesh::GetFromIndex(uint32_t index) {
+    return StaticFactory::GetFromIndex(index, meshes);
 }
 
 uint32_t Mesh::GetCount() {
-    return MAX_MESHES;
+    return meshes.get_capacity();
 }
 
-void Mesh::createBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties, vk::Buffer &buffer, vk::DeviceMemory &bufferMemory)
+void Mesh::createBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties, vk::Buffer &buffer, Libraries::MemoryAllocation &bufferMemory)
 {
     auto vulkan = Libraries::Vulkan::Get();
     auto device = vulkan->get_device();
@@ -1174,37 +1266,15 @@ void Mesh::createBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage, vk::Mem
     /* Now create the buffer */
     buffer = device.createBuffer(bufferInfo);
 
-    /* Identify the memory requirements for the vertex buffer */
-    vk::MemoryRequirements memRequirements = device.getBufferMemoryRequirements(buffer);
-
-    /* Look for a suitable type that meets our property requirements */
-    vk::MemoryAllocateInfo allocInfo;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = vulkan->find_memory_type(memRequirements.memoryTypeBits, properties);
-
-    /* Now, allocate the memory for that buffer */
-    bufferMemory = device.allocateMemory(allocInfo);
-
-    /* Associate the allocated memory with the VBO handle */
-    device.bindBufferMemory(buffer, bufferMemory, 0);
+    /* Place the buffer in one of the allocator's memory blocks, and bind it */
+    bufferMemory = vulkan->get_memory_allocator()->allocate_buffer(buffer, properties);
 }
 
 void Mesh::createPointBuffer(bool allow_edits, bool submit_immediately)
 {
     auto vulkan = Libraries::Vulkan::Get();
-    auto device = vulkan->get_device();
 
     vk::DeviceSize bufferSize = points.size() * sizeof(glm::vec3);
-    vk::Buffer stagingBuffer;
-    vk::DeviceMemory stagingBufferMemory;
-    createBuffer(bufferSize, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, stagingBuffer, stagingBufferMemory);
-
-    /* Map the memory to a pointer on the host */
-    void *data = device.mapMemory(stagingBufferMemory, 0, bufferSize,  vk::MemoryMapFlags());
-
-    /* Copy over our vertex data, then unmap */
-    memcpy(data, points.data(), (size_t)bufferSize);
-    device.unmapMemory(stagingBufferMemory);
 
     vk::MemoryPropertyFlags memoryProperties;
     if (!allowEdits) memoryProperties = vk::MemoryPropertyFlagBits::eDeviceLocal;
@@ -1213,34 +1283,18 @@ void Mesh::createPointBuffer(bool allow_edits, bool submit_immediately)
         memoryProperties |= vk::MemoryPropertyFlagBits::eHostCoherent;
     }
     createBuffer(bufferSize, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eVertexBuffer, memoryProperties, pointBuffer, pointBufferMemory);
-    
-    auto cmd = vulkan->begin_one_time_graphics_command();
-    vk::BufferCopy copyRegion;
-    copyRegion.size = bufferSize;
-    cmd.copyBuffer(stagingBuffer, pointBuffer, copyRegion);
-    vulkan->end_one_time_graphics_command(cmd, "copy point buffer", true, submit_immediately);
 
-    /* Clean up the staging buffer */
-    device.destroyBuffer(stagingBuffer);
-    device.freeMemory(stagingBufferMemory);
+    /* Stage the data. It's copied over with the rest of the uploads in the next batch. */
+    auto uploads = vulkan->get_upload_queue();
+    uploadToken = uploads->upload_buffer(pointBuffer, 0, points.data(), bufferSize);
+    if (submit_immediately) uploads->flush();
 }
 
 void Mesh::createColorBuffer(bool allow_edits, bool submit_immediately)
 {
     auto vulkan = Libraries::Vulkan::Get();
-    auto device = vulkan->get_device();
 
     vk::DeviceSize bufferSize = colors.size() * sizeof(glm::vec4);
-    vk::Buffer stagingBuffer;
-    vk::DeviceMemory stagingBufferMemory;
-    createBuffer(bufferSize, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, stagingBuffer, stagingBufferMemory);
-
-    /* Map the memory to a pointer on the host */
-    void *data = device.mapMemory(stagingBufferMemory, 0, bufferSize,  vk::MemoryMapFlags());
-
-    /* Copy over our vertex data, then unmap */
-    memcpy(data, colors.data(), (size_t)bufferSize);
-    device.unmapMemory(stagingBufferMemory);
 
     vk::MemoryPropertyFlags memoryProperties;
     if (!allowEdits) memoryProperties = vk::MemoryPropertyFlagBits::eDeviceLocal;
@@ -1249,31 +1303,18 @@ void Mesh::createColorBuffer(bool allow_edits, bool submit_immediately)
         memoryProperties |= vk::MemoryPropertyFlagBits::eHostCoherent;
     }
     createBuffer(bufferSize, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eVertexBuffer, memoryProperties, colorBuffer, colorBufferMemory);
-    
-    auto cmd = vulkan->begin_one_time_graphics_command();
-    vk::BufferCopy copyRegion;
-    copyRegion.size = bufferSize;
-    cmd.copyBuffer(stagingBuffer, colorBuffer, copyRegion);
-    vulkan->end_one_time_graphics_command(cmd, "copy point color buffer", true, submit_immediately);
 
-    /* Clean up the staging buffer */
-    device.destroyBuffer(stagingBuffer);
-    device.freeMemory(stagingBufferMemory);
+    /* Stage the data. It's copied over with the rest of the uploads in the next batch. */
+    auto uploads = vulkan->get_upload_queue();
+    uploadToken = uploads->upload_buffer(colorBuffer, 0, colors.data(), bufferSize);
+    if (submit_immediately) uploads->flush();
 }
 
 void Mesh::createIndexBuffer(bool allow_edits, bool submit_immediately)
 {
     auto vulkan = Libraries::Vulkan::Get();
-    auto device = vulkan->get_device();
 
     vk::DeviceSize bufferSize = indices.size() * sizeof(uint32_t);
-    vk::Buffer stagingBuffer;
-    vk::DeviceMemory stagingBufferMemory;
-    createBuffer(bufferSize, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, stagingBuffer, stagingBufferMemory);
-
-    void *data = device.mapMemory(stagingBufferMemory, 0, bufferSize, vk::MemoryMapFlags());
-    memcpy(data, indices.data(), (size_t)bufferSize);
-    device.unmapMemory(stagingBufferMemory);
 
     vk::MemoryPropertyFlags memoryProperties;
     if (!allowEdits) memoryProperties = vk::MemoryPropertyFlagBits::eDeviceLocal;
@@ -1282,33 +1323,18 @@ void Mesh::createIndexBuffer(bool allow_edits, bool submit_immediately)
         memoryProperties |= vk::MemoryPropertyFlagBits::eHostCoherent;
     }
     createBuffer(bufferSize, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eIndexBuffer, memoryProperties, indexBuffer, indexBufferMemory);
-    
-    auto cmd = vulkan->begin_one_time_graphics_command();
-    vk::BufferCopy copyRegion;
-    copyRegion.size = bufferSize;
-    cmd.copyBuffer(stagingBuffer, indexBuffer, copyRegion);
-    vulkan->end_one_time_graphics_command(cmd, "copy point index buffer", true, submit_immediately);
 
-    device.destroyBuffer(stagingBuffer);
-    device.freeMemory(stagingBufferMemory);
+    /* Stage the data. It's copied over with the rest of the uploads in the next batch. */
+    auto uploads = vulkan->get_upload_queue();
+    uploadToken = uploads->upload_buffer(indexBuffer, 0, indices.data(), bufferSize);
+    if (submit_immediately) uploads->flush();
 }
 
 void Mesh::createNormalBuffer(bool allow_edits, bool submit_immediately)
 {
     auto vulkan = Libraries::Vulkan::Get();
-    auto device = vulkan->get_device();
 
     vk::DeviceSize bufferSize = normals.size() * sizeof(glm::vec3);
-    vk::Buffer stagingBuffer;
-    vk::DeviceMemory stagingBufferMemory;
-    createBuffer(bufferSize, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, stagingBuffer, stagingBufferMemory);
-
-    /* Map the memory to a pointer on the host */
-    void *data = device.mapMemory(stagingBufferMemory, 0, bufferSize, vk::MemoryMapFlags());
-
-    /* Copy over our normal data, then unmap */
-    memcpy(data, normals.data(), (size_t)bufferSize);
-    device.unmapMemory(stagingBufferMemory);
 
     vk::MemoryPropertyFlags memoryProperties;
     if (!allowEdits) memoryProperties = vk::MemoryPropertyFlagBits::eDeviceLocal;
@@ -1317,34 +1343,18 @@ void Mesh::createNormalBuffer(bool allow_edits, bool submit_immediately)
         memoryProperties |= vk::MemoryPropertyFlagBits::eHostCoherent;
     }
     createBuffer(bufferSize, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eVertexBuffer, memoryProperties, normalBuffer, normalBufferMemory);
-    
-    auto cmd = vulkan->begin_one_time_graphics_command();
-    vk::BufferCopy copyRegion;
-    copyRegion.size = bufferSize;
-    cmd.copyBuffer(stagingBuffer, normalBuffer, copyRegion);
-    vulkan->end_one_time_graphics_command(cmd, "copy point normal buffer", true, submit_immediately);
 
-    /* Clean up the staging buffer */
-    device.destroyBuffer(stagingBuffer);
-    device.freeMemory(stagingBufferMemory);
+    /* Stage the data. It's copied over with the rest of the uploads in the next batch. */
+    auto uploads = vulkan->get_upload_queue();
+    uploadToken = uploads->upload_buffer(normalBuffer, 0, normals.data(), bufferSize);
+    if (submit_immediately) uploads->flush();
 }
 
 void Mesh::createTexCoordBuffer(bool allow_edits, bool submit_immediately)
 {
     auto vulkan = Libraries::Vulkan::Get();
-    auto device = vulkan->get_device();
 
     vk::DeviceSize bufferSize = texcoords.size() * sizeof(glm::vec2);
-    vk::Buffer stagingBuffer;
-    vk::DeviceMemory stagingBufferMemory;
-    createBuffer(bufferSize, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, stagingBuffer, stagingBufferMemory);
-
-    /* Map the memory to a pointer on the host */
-    void *data = device.mapMemory(stagingBufferMemory, 0, bufferSize, vk::MemoryMapFlags());
-
-    /* Copy over our normal data, then unmap */
-    memcpy(data, texcoords.data(), (size_t)bufferSize);
-    device.unmapMemory(stagingBufferMemory);
 
     vk::MemoryPropertyFlags memoryProperties;
     if (!allowEdits) memoryProperties = vk::MemoryPropertyFlagBits::eDeviceLocal;
@@ -1353,16 +1363,11 @@ void Mesh::createTexCoordBuffer(bool allow_edits, bool submit_immediately)
         memoryProperties |= vk::MemoryPropertyFlagBits::eHostCoherent;
     }
     createBuffer(bufferSize, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eVertexBuffer, memoryProperties, texCoordBuffer, texCoordBufferMemory);
-    
-    auto cmd = vulkan->begin_one_time_graphics_command();
-    vk::BufferCopy copyRegion;
-    copyRegion.size = bufferSize;
-    cmd.copyBuffer(stagingBuffer, texCoordBuffer, copyRegion);
-    vulkan->end_one_time_graphics_command(cmd, "copy point texcoord buffer", true, submit_immediately);
 
-    /* Clean up the staging buffer */
-    device.destroyBuffer(stagingBuffer);
-    device.freeMemory(stagingBufferMemory);
+    /* Stage the data. It's copied over with the rest of the uploads in the next batch. */
+    auto uploads = vulkan->get_upload_queue();
+    uploadToken = uploads->upload_buffer(texCoordBuffer, 0, texcoords.data(), bufferSize);
+    if (submit_immediately) uploads->flush();
 }
 
 void Mesh::make_cube(bool allow_edits, bool submit_immediately)
@@ -1412,6 +1417,7 @@ void Mesh::make_cube(bool allow_edits, bool submit_immediately)
 
     indices.assign({0,3,6,0,6,9,12,21,18,12,18,15,1,13,16,1,16,4,5,17,19,5,19,7,8,20,22,8,22,10,14,2,11,14,11,23,});
     compute_centroid();
+    compute_bounds();
     createPointBuffer(allow_edits, submit_immediately);
     createColorBuffer(allow_edits, submit_immediately);
     createNormalBuffer(allow_edits, submit_immediately);
@@ -1449,6 +1455,7 @@ void Mesh::make_plane(bool allow_edits, bool submit_immediately)
     indices.assign({0,1,3,0,3,2});
 
     compute_centroid();
+    compute_bounds();
     createPointBuffer(allow_edits, submit_immediately);
     createColorBuffer(allow_edits, submit_immediately);
     createNormalBuffer(allow_edits, submit_immediately);
@@ -1886,6 +1893,7 @@ void Mesh::make_sphere(bool allow_edits, bool submit_immediately)
     });
 
     compute_centroid();
+    compute_bounds();
     createPointBuffer(allow_edits, submit_immediately);
     createColorBuffer(allow_edits, submit_immediately);
     createNormalBuffer(allow_edits, submit_immediately);
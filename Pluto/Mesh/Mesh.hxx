@@ -7,23 +7,36 @@
 
 #include "Pluto/Tools/Options.hxx"
 #include "Pluto/Libraries/Vulkan/Vulkan.hxx"
+#include "Pluto/Libraries/Vulkan/StorageBuffer.hxx"
 #include "Pluto/Tools/StaticFactory.hxx"
 
+#include "./MeshStruct.hxx"
+
+/* The initial number of mesh slots. Mesh storage grows past this as meshes are created. */
 #define MAX_MESHES 1024
 
 /* A mesh contains vertex information that has been loaded to the GPU. */
 class Mesh : public StaticFactory
 {
   private:
-    static Mesh meshes[MAX_MESHES];
+    static SlotMap<Mesh> meshes;
     static std::map<std::string, uint32_t> lookupTable;
+
+    /* The mapped mesh SSBO, holding the bounds the GPU culls against */
+    static Libraries::StorageBuffer ssbo;
     static vk::AccelerationStructureNV topAS;
-    static vk::DeviceMemory topASMemory;
+    static Libraries::MemoryAllocation topASMemory;
     static vk::Buffer instanceBuffer;
-    static vk::DeviceMemory instanceBufferMemory;
+    static Libraries::MemoryAllocation instanceBufferMemory;
 
     glm::vec3 centroid;
 
+    /* Mesh space bounds, kept up to date as positions are edited so that meshes can be frustum culled */
+    glm::vec3 aabbMin = glm::vec3(0.0f);
+    glm::vec3 aabbMax = glm::vec3(0.0f);
+    glm::vec3 boundingSphereCenter = glm::vec3(0.0f);
+    float boundingSphereRadius = 0.0f;
+
     std::vector<glm::vec3> points;
     std::vector<glm::vec3> normals;
     std::vector<glm::vec4> colors;
@@ -33,19 +46,22 @@ class Mesh : public StaticFactory
     tinyobj::attrib_t attrib;
 
     vk::Buffer pointBuffer;
-    vk::DeviceMemory pointBufferMemory;
+    Libraries::MemoryAllocation pointBufferMemory;
 
     vk::Buffer colorBuffer;
-    vk::DeviceMemory colorBufferMemory;
+    Libraries::MemoryAllocation colorBufferMemory;
 
     vk::Buffer indexBuffer;
-    vk::DeviceMemory indexBufferMemory;
+    Libraries::MemoryAllocation indexBufferMemory;
 
     vk::Buffer normalBuffer;
-    vk::DeviceMemory normalBufferMemory;
+    Libraries::MemoryAllocation normalBufferMemory;
 
     vk::Buffer texCoordBuffer;
-    vk::DeviceMemory texCoordBufferMemory;
+    Libraries::MemoryAllocation texCoordBufferMemory;
+
+    /* The upload batch the buffers above were last staged in */
+    Libraries::UploadToken uploadToken = 0;
 
     /* RTX raytracing stuff */
     struct VkGeometryInstance
@@ -61,10 +77,13 @@ class Mesh : public StaticFactory
     vk::GeometryNV geometry;
     VkGeometryInstance instance;
     vk::AccelerationStructureNV lowAS;
-    vk::DeviceMemory lowASMemory;
+    Libraries::MemoryAllocation lowASMemory;
     bool lowBVHBuilt = false;
     bool allowEdits = false;
 
+    /* Flags this mesh's bounds to be copied into the SSBO on the next upload. */
+    void mark_dirty();
+
   public:
     static Mesh* Get(std::string name);
 	static Mesh* Get(uint32_t id);
@@ -83,7 +102,8 @@ class Mesh : public StaticFactory
         std::vector<uint32_t> indices = {},
         bool allow_edits = false, bool submit_immediately = false);
     //static Mesh* Create(std::string name);
-	static Mesh* GetFront();
+	static Mesh* Get(uint32_t id, uint32_t generation);
+	static Mesh* GetFromIndex(uint32_t index);
 	static uint32_t GetCount();
 	static void Delete(std::string name);
 	static void Delete(uint32_t id);
@@ -96,6 +116,24 @@ class Mesh : public StaticFactory
 	
     static void Initialize();
 
+    /* Copies the bounds of meshes modified since the given frame was last uploaded into that frame's copy of the SSBO */
+    static void UploadSSBO(uint32_t frame);
+
+    /* Returns the SSBO vulkan buffer handle */
+    static vk::Buffer GetSSBO();
+
+    /* Returns the size in bytes of the current mesh SSBO */
+    static uint32_t GetSSBOSize();
+
+    /* Returns the byte offset of the given frame's copy within the SSBO */
+    static uint32_t GetSSBOOffset(uint32_t frame);
+
+    /* Returns an id which changes whenever the SSBO is reallocated, so descriptors know to be rewritten */
+    static uint64_t GetSSBOGeneration();
+
+    /* Releases vulkan resources */
+    static void CleanUp();
+
     std::vector<glm::vec3> get_points();;
 
     std::vector<glm::vec4> get_colors();
@@ -124,6 +162,19 @@ class Mesh : public StaticFactory
 
     glm::vec3 get_centroid();
 
+    /* Computes the axis aligned bounding box of the mesh's points, and a bounding sphere centered on that box. */
+    void compute_bounds();
+
+    glm::vec3 get_min_aabb_corner();
+
+    glm::vec3 get_max_aabb_corner();
+
+    glm::vec3 get_aabb_center();
+
+    glm::vec3 get_bounding_sphere_center();
+
+    float get_bounding_sphere_radius();
+
     void edit_position(uint32_t index, glm::vec3 new_position);
     
     void edit_positions(uint32_t index, std::vector<glm::vec3> new_positions);
@@ -170,7 +221,7 @@ class Mesh : public StaticFactory
         bool submit_immediately
     );
 
-    void createBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties, vk::Buffer &buffer, vk::DeviceMemory &bufferMemory);
+    void createBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties, vk::Buffer &buffer, Libraries::MemoryAllocation &bufferMemory);
 
     void createPointBuffer(bool allow_edits, bool submit_immediately);
 
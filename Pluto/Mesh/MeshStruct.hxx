@@ -0,0 +1,11 @@
+/* File shared by both GLSL and C++ */
+
+#ifndef GLSL
+#include <glm/glm.hpp>
+using namespace glm;
+#endif
+
+struct MeshStruct {
+	/* Mesh space bounding sphere, with the center in xyz and the radius in w */
+	vec4 bounding_sphere;
+};
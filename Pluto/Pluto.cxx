@@ -51,7 +51,7 @@ void Initialize(
     vulkan->create_instance(validation_layers.size() > 0, validation_layers, instance_extensions, useOpenVR);
     
     auto surface = (useGLFW) ? glfw->create_vulkan_surface(vulkan, "Window") : vk::SurfaceKHR();
-    vulkan->create_device(device_extensions, device_features, 8, surface, useOpenVR);
+    vulkan->create_device(device_extensions, device_features, surface, useOpenVR);
     if (useGLFW) event_system->destroy_window("Window");
     
     /* Initialize Component Factories. Order is important. */
@@ -96,5 +96,6 @@ void CleanUp()
         Light::CleanUp();
         Camera::CleanUp();
         Entity::CleanUp();
+        Mesh::CleanUp();
     }
 }
@@ -6,6 +6,7 @@ layout(location = 3) in vec3 w_cameraPos;
 layout(location = 4) in vec4 vert_color;
 layout(location = 5) in vec3 m_position;
 layout(location = 6) in vec3 s_position;
+layout(location = 7) flat in int target_id;
 
 /* Outputs */
 layout(location = 0) out vec4 outColor;
@@ -13,6 +14,44 @@ layout(location = 0) out vec4 outColor;
 /* Definitions */
 #define PI 3.1415926535897932384626433832795
 
+/* Returns the light cluster grid of the view being drawn */
+LightClusterGrid getLightClusterGrid()
+{
+	#ifdef DISABLE_MULTIVIEW
+	int viewIndex = push.consts.viewIndex;
+	#else
+	int viewIndex = gl_ViewIndex;
+	#endif
+	return lgbo.grids[push.consts.light_cluster_grid + viewIndex];
+}
+
+/* Returns the cluster of lights which may reach the given world space position */
+LightCluster getLightCluster(LightClusterGrid grid, vec3 w_pos)
+{
+	vec4 clip = grid.world_to_clip * vec4(w_pos, 1.0);
+	vec2 ndc = clip.xy / clip.w;
+	float depth = -(grid.world_to_view * vec4(w_pos, 1.0)).z;
+	int x = clamp(int((ndc.x * 0.5 + 0.5) * LIGHT_CLUSTER_X), 0, LIGHT_CLUSTER_X - 1);
+	int y = clamp(int((ndc.y * 0.5 + 0.5) * LIGHT_CLUSTER_Y), 0, LIGHT_CLUSTER_Y - 1);
+	int z = clamp(int(log(max(depth / grid.near_pos, 1.0)) * grid.slice_scale), 0, LIGHT_CLUSTER_Z - 1);
+	return lcbo.clusters[grid.first_cluster + (z * LIGHT_CLUSTER_Y + y) * LIGHT_CLUSTER_X + x];
+}
+
+/* Returns the entity of the i'th light reaching a cluster. Global lights come first, then the cluster's own lights. */
+int getClusterLightEntity(LightClusterGrid grid, LightCluster cluster, int i)
+{
+	return libo.light_entity_ids[(i < grid.global_light_count) ? grid.first_global_light + i : cluster.first_light + i - grid.global_light_count];
+}
+
+/* Fades a light smoothly to nothing at its range. Lights without a range reach everywhere. */
+float getLightFalloff(LightStruct light, float dist)
+{
+	if (light.range <= 0.0) return 1.0;
+	float x = dist / light.range;
+	float window = clamp(1.0 - x * x * x * x, 0.0, 1.0);
+	return window * window;
+}
+
 
 vec3 getSky(vec3 dir)
 {
@@ -82,7 +121,7 @@ float checker(in vec3 uvw, float scale)
 
 vec4 getAlbedo()
 {
-	EntityStruct entity = ebo.entities[push.consts.target_id];
+	EntityStruct entity = ebo.entities[target_id];
 	MaterialStruct material = mbo.materials[entity.material_id];
 	vec4 albedo = material.base_color; 
 
@@ -112,7 +151,7 @@ vec4 getAlbedo()
 
 vec4 sampleVolume(vec3 position, float lod)
 {
-    EntityStruct entity = ebo.entities[push.consts.target_id];
+    EntityStruct entity = ebo.entities[target_id];
 	MaterialStruct material = mbo.materials[entity.material_id];
     TextureStruct tex = txbo.textures[material.volume_texture_id];
 
@@ -10,6 +10,7 @@
 #include "Pluto/Entity/EntityStruct.hxx"
 #include "Pluto/Material/MaterialStruct.hxx"
 #include "Pluto/Light/LightStruct.hxx"
+#include "Pluto/Light/LightClusterStruct.hxx"
 #include "Pluto/Transform/TransformStruct.hxx"
 #include "Pluto/Camera/CameraStruct.hxx"
 #include "Pluto/Texture/TextureStruct.hxx"
@@ -20,12 +21,19 @@ layout(std430, set = 0, binding = 1) readonly buffer TransformSSBO { TransformSt
 layout(std430, set = 0, binding = 2) readonly buffer CameraSSBO    { CameraStruct cameras[]; } cbo;
 layout(std430, set = 0, binding = 3) readonly buffer MaterialSSBO  { MaterialStruct materials[]; } mbo;
 layout(std430, set = 0, binding = 4) readonly buffer LightSSBO     { LightStruct lights[]; } lbo;
+layout(std430, set = 0, binding = 5) readonly buffer InstanceSSBO  { int entity_ids[]; } ibo; /* Entity drawn by each gl_InstanceIndex */
+layout(std430, set = 0, binding = 9) readonly buffer LightGridSSBO    { LightClusterGrid grids[]; } lgbo;
+layout(std430, set = 0, binding = 10) readonly buffer LightClusterSSBO { LightCluster clusters[]; } lcbo;
+layout(std430, set = 0, binding = 11) readonly buffer LightIndexSSBO   { int light_entity_ids[]; } libo;
 
 layout(set = 1, binding = 0) readonly buffer TextureSSBO           { TextureStruct textures[]; } txbo;
-layout(set = 1, binding = 1) uniform sampler samplers[MAX_SAMPLERS];
-layout(set = 1, binding = 2) uniform texture2D texture_2Ds[MAX_TEXTURES];
-layout(set = 1, binding = 3) uniform textureCube texture_cubes[MAX_TEXTURES];
-layout(set = 1, binding = 4) uniform texture3D texture_3Ds[MAX_TEXTURES];
+/* The texture tables are sized at runtime when bindless descriptors are supported, so their sizes are specialized at pipeline creation */
+layout(constant_id = 0) const int TEXTURE_CAPACITY = MAX_TEXTURES;
+layout(constant_id = 1) const int SAMPLER_CAPACITY = MAX_SAMPLERS;
+layout(set = 1, binding = 1) uniform sampler samplers[SAMPLER_CAPACITY];
+layout(set = 1, binding = 2) uniform texture2D texture_2Ds[TEXTURE_CAPACITY];
+layout(set = 1, binding = 3) uniform textureCube texture_cubes[TEXTURE_CAPACITY];
+layout(set = 1, binding = 4) uniform texture3D texture_3Ds[TEXTURE_CAPACITY];
 
 /* Push Constants */
 layout(push_constant) uniform PushConstants {
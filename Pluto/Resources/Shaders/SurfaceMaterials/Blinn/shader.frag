@@ -3,7 +3,7 @@
 #include "Pluto/Resources/Shaders/FragmentCommon.hxx"
 
 void main() {
-  EntityStruct entity = ebo.entities[push.consts.target_id];
+  EntityStruct entity = ebo.entities[target_id];
   MaterialStruct material = mbo.materials[entity.material_id];
 
   // EntityStruct camera_entity = ebo.entities[push.consts.camera_id];
@@ -24,36 +24,36 @@ void main() {
   // vec3 v = vec3(0.0, 0.0, 1.0);
   vec3 n = normalize(w_normal);
   vec3 temp = vec3(0.0, 0.0, 3.0);
-  /* Forward light pass */
-  for (int i = 0; i < MAX_LIGHTS; ++i) {
+  /* Objects which are lights glow */
+  if (entity.light_id != -1) {
+    diffuseColor += lbo.lights[entity.light_id].diffuse.rgb;
+  }
+
+  /* Forward light pass, over the lights reaching this fragment's cluster */
+  LightClusterGrid grid = getLightClusterGrid();
+  LightCluster cluster = getLightCluster(grid, w_position);
+  for (int i = 0; i < grid.global_light_count + cluster.light_count; ++i) {
 
-    int light_entity_id = push.consts.light_entity_ids[i];
-    if (light_entity_id == -1) continue;
+    int light_entity_id = getClusterLightEntity(grid, cluster, i);
+    if (light_entity_id == target_id) continue;
 
     EntityStruct light_entity = ebo.entities[light_entity_id];
 
-    if ( (light_entity.initialized != 1) || (light_entity.transform_id == -1)) continue;
+    if ( (light_entity.initialized != 1) || (light_entity.transform_id == -1) || (light_entity.light_id == -1)) continue;
     LightStruct light = lbo.lights[light_entity.light_id];
 
-    /* Objects which are lights glow */
-    if (light_entity_id == push.consts.target_id) {
-      diffuseColor += light.diffuse.rgb;
-    }
-    else 
-    {
-      TransformStruct light_transform = tbo.transforms[light_entity.transform_id];
-      vec3 l_p = vec3(light_transform.localToWorld[3]);
-      vec3 l = normalize(l_p - w_position);
-      //   vec3 h = normalize(v + l);
-        float diffterm = max(dot(l, n), 0.0);
-      //   float specterm = max(dot(h, n), 0.0);
-
-      //   //ambientColor += vec3(ubo.ka) * vec3(lbo.lights[i].ambient);
-
-        diffuseColor += base_color.rgb * vec3(light.diffuse) * diffterm;
-        
-      //   specularColor += vec3(lbo.lights[i].specular) * vec3(ubo.ks) * pow(specterm, 80.);
-    }
+    TransformStruct light_transform = tbo.transforms[light_entity.transform_id];
+    vec3 l_p = transform_position(light_transform);
+    vec3 l = normalize(l_p - w_position);
+    //   vec3 h = normalize(v + l);
+      float diffterm = max(dot(l, n), 0.0);
+    //   float specterm = max(dot(h, n), 0.0);
+
+    //   //ambientColor += vec3(ubo.ka) * vec3(lbo.lights[i].ambient);
+
+      diffuseColor += base_color.rgb * vec3(light.diffuse) * diffterm * getLightFalloff(light, distance(l_p, w_position));
+      
+    //   specularColor += vec3(lbo.lights[i].specular) * vec3(ubo.ks) * pow(specterm, 80.);
   }
 
   outColor = vec4(diffuseColor.xyz, 1.0);//material.base_color;//vec4((diffuseColor + specularColor), 1.0);
@@ -16,7 +16,7 @@ out gl_PerVertex {
 };
 
 void main() {
-    EntityStruct target_entity = ebo.entities[push.consts.target_id];
+    EntityStruct target_entity = ebo.entities[ibo.entity_ids[gl_InstanceIndex]];
     EntityStruct camera_entity = ebo.entities[push.consts.camera_id];
     
     CameraStruct camera = cbo.cameras[camera_entity.camera_id];
@@ -24,13 +24,13 @@ void main() {
 
     TransformStruct target_transform = tbo.transforms[target_entity.transform_id];
 
-    vec4 w_position = target_transform.localToWorld * vec4(point.xyz, 1.0);
+    vec4 w_position = transform_local_to_world(target_transform) * vec4(point.xyz, 1.0);
     #ifdef DISABLE_MULTIVIEW
     int viewIndex = push.consts.viewIndex;
     #else
     int viewIndex = gl_ViewIndex;
     #endif
-    gl_Position = camera.multiviews[viewIndex].proj * camera.multiviews[viewIndex].view * camera_transform.worldToLocal * w_position;
+    gl_Position = camera.multiviews[viewIndex].proj * camera.multiviews[viewIndex].view * transform_world_to_local(camera_transform) * w_position;
     fragTexCoord = texcoord;
     near = camera.multiviews[viewIndex].near_pos;
     depth = (gl_Position.z - near);
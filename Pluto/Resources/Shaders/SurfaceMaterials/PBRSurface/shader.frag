@@ -3,7 +3,7 @@
 #include "Pluto/Resources/Shaders/FragmentCommon.hxx"
 
 void main() {
-	EntityStruct entity = ebo.entities[push.consts.target_id];
+	EntityStruct entity = ebo.entities[target_id];
 	MaterialStruct material = mbo.materials[entity.material_id];
 
 	vec3 N = /*(material.hasNormalTexture == 1.0f) ? perturbNormal() :*/ normalize(w_normal);
@@ -53,29 +53,30 @@ void main() {
 	float ao = /*(material.hasOcclusionTexture == 1.0f) ? texture(aoMap, inUV).r : */ 1.0f;
 	vec3 ambient = (kD * diffuse + specular_reflection + specular_refraction + specular_refraction) * ao;
 
-	// Iterate over point lights
 	vec3 finalColor = ambient;
-	for (int i = 0; i < MAX_LIGHTS; ++i) {
-		int light_entity_id = push.consts.light_entity_ids[i];
-		if (light_entity_id == -1) continue;
+
+	/* If the object has a light component (fake emission) */
+	if (entity.light_id != -1) {
+		finalColor += lbo.lights[entity.light_id].diffuse.rgb;
+	}
+
+	// Iterate over the point lights reaching this fragment's cluster
+	LightClusterGrid grid = getLightClusterGrid();
+	LightCluster cluster = getLightCluster(grid, w_position);
+	for (int i = 0; i < grid.global_light_count + cluster.light_count; ++i) {
+		int light_entity_id = getClusterLightEntity(grid, cluster, i);
+		if (light_entity_id == target_id) continue;
 
 		EntityStruct light_entity = ebo.entities[light_entity_id];
-		if ( (light_entity.initialized != 1) || (light_entity.transform_id == -1)) continue;
+		if ( (light_entity.initialized != 1) || (light_entity.transform_id == -1) || (light_entity.light_id == -1)) continue;
 
 		LightStruct light = lbo.lights[light_entity.light_id];
+		TransformStruct light_transform = tbo.transforms[light_entity.transform_id];
 
-		/* If the object has a light component (fake emission) */
-		if (light_entity_id == push.consts.target_id) {
-			finalColor += light.diffuse.rgb;
-		}
-		else {
-			TransformStruct light_transform = tbo.transforms[light_entity.transform_id];
-
-			vec3 w_light = vec3(light_transform.localToWorld[3]);
-			vec3 L = normalize(w_light - w_position);
-			vec3 Lo = light.diffuse.rgb * specularContribution(L, V, N, albedo_mix, albedo.rgb, metallic, roughness);
-			finalColor += Lo;
-		}
+		vec3 w_light = transform_position(light_transform);
+		vec3 L = normalize(w_light - w_position);
+		vec3 Lo = light.diffuse.rgb * specularContribution(L, V, N, albedo_mix, albedo.rgb, metallic, roughness);
+		finalColor += Lo * getLightFalloff(light, distance(w_light, w_position));
 	}
 	
 	// Tone mapping
@@ -14,7 +14,7 @@ out gl_PerVertex {
 };
 
 void main() {
-    EntityStruct target_entity = ebo.entities[push.consts.target_id];
+    EntityStruct target_entity = ebo.entities[ibo.entity_ids[gl_InstanceIndex]];
     EntityStruct camera_entity = ebo.entities[push.consts.camera_id];
     
     CameraStruct camera = cbo.cameras[camera_entity.camera_id];
@@ -23,13 +23,13 @@ void main() {
     MaterialStruct material = mbo.materials[target_entity.material_id];
     TransformStruct target_transform = tbo.transforms[target_entity.transform_id];
 
-    vec3 w_position = vec3(target_transform.localToWorld * vec4(point.xyz, 1.0));
+    vec3 w_position = vec3(transform_local_to_world(target_transform) * vec4(point.xyz, 1.0));
     #ifdef DISABLE_MULTIVIEW
     int viewIndex = push.consts.viewIndex;
     #else
     int viewIndex = gl_ViewIndex;
     #endif
-    gl_Position = camera.multiviews[viewIndex].proj * camera.multiviews[viewIndex].view * camera_transform.worldToLocal * vec4(w_position, 1.0);
+    gl_Position = camera.multiviews[viewIndex].proj * camera.multiviews[viewIndex].view * transform_world_to_local(camera_transform) * vec4(w_position, 1.0);
     gl_PointSize = 1.0;
     fragColor = vec4(texcoord.x, 0.0, texcoord.y, 1.0);
 }
@@ -15,7 +15,7 @@ out gl_PerVertex {
 };
 
 void main() {
-    EntityStruct entity = ebo.entities[push.consts.target_id];
+    EntityStruct entity = ebo.entities[ibo.entity_ids[gl_InstanceIndex]];
     CameraStruct camera = cbo.cameras[push.consts.camera_id];
     MaterialStruct material = mbo.materials[entity.material_id];
     TransformStruct transform = tbo.transforms[entity.transform_id];
@@ -25,7 +25,7 @@ void main() {
     #else
     int viewIndex = gl_ViewIndex;
     #endif
-    gl_Position =  camera.multiviews[viewIndex].proj * camera.multiviews[viewIndex].view * transform.localToWorld * vec4(point, 1.0);
+    gl_Position =  camera.multiviews[viewIndex].proj * camera.multiviews[viewIndex].view * transform_local_to_world(transform) * vec4(point, 1.0);
     gl_PointSize = 1.0;
     fragColor = material.base_color;
     fragTexCoord = texcoord;
@@ -12,6 +12,7 @@ layout(location = 3) out vec3 w_cameraPos;
 layout(location = 4) out vec4 vert_color;
 layout(location = 5) out vec3 m_position;
 layout(location = 6) out vec3 s_position;
+layout(location = 7) flat out int target_id;
 
 out gl_PerVertex {
     vec4 gl_Position;
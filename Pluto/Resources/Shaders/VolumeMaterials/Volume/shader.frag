@@ -160,7 +160,7 @@
 // }
 
 // void main() {
-// 	EntityStruct entity = ebo.entities[push.consts.target_id];
+// 	EntityStruct entity = ebo.entities[target_id];
 // 	MaterialStruct material = mbo.materials[entity.material_id];
 
 // 	vec3 N = /*(material.hasNormalTexture == 1.0f) ? perturbNormal() :*/ normalize(w_normal);
@@ -222,13 +222,13 @@
 // 		LightStruct light = lbo.lights[light_entity.light_id];
 
 // 		/* If the object has a light component (fake emission) */
-// 		if (light_entity_id == push.consts.target_id) {
+// 		if (light_entity_id == target_id) {
 // 			finalColor += light.diffuse.rgb;
 // 		}
 // 		else {
 // 			TransformStruct light_transform = tbo.transforms[light_entity.transform_id];
 
-// 			vec3 w_light = vec3(light_transform.localToWorld[3]);
+// 			vec3 w_light = transform_position(light_transform);
 // 			vec3 L = normalize(w_light - w_position);
 // 			vec3 Lo = light.diffuse.rgb * specularContribution(L, V, N, albedo_mix, albedo.rgb, metallic, roughness);
 // 			finalColor += Lo;
@@ -290,12 +290,12 @@ const float maxDist = sqrt(2.0);
 float step_size = maxDist/float(samples);
 
 void main() {
-	EntityStruct target_entity = ebo.entities[push.consts.target_id];
+	EntityStruct target_entity = ebo.entities[target_id];
 	EntityStruct camera_entity = ebo.entities[push.consts.camera_id];
 	MaterialStruct material = mbo.materials[target_entity.material_id];
 	TransformStruct transform = tbo.transforms[target_entity.transform_id];
 
-	vec3 ray_origin = vec3(transform.worldToLocal * vec4(w_cameraPos, 1.0));
+	vec3 ray_origin = vec3(transform_world_to_local(transform) * vec4(w_cameraPos, 1.0));
 
 	/* Create ray from eye to fragment */
 	vec3 ray_direction = m_position - ray_origin;
@@ -9,9 +9,7 @@
 
 namespace Systems 
 {
-    std::condition_variable EventSystem::cv;
-    std::mutex EventSystem::qMutex;
-    std::queue<EventSystem::Command> EventSystem::commandQueue = {};
+    CommandRing<std::function<void()>> EventSystem::commandQueue(64);
 
 
     EventSystem* EventSystem::Get() {
@@ -46,23 +44,18 @@ namespace Systems
                 glfw->poll_events();
 
                 // glfw->wait_events(); // THIS CALL IS BLOCKING
-                {
-                    std::lock_guard<std::mutex> lock(qMutex);
-                    while (!commandQueue.empty()) {
-                        auto item = commandQueue.front();
-                        item.function();
-                        try {
-                            item.promise->set_value();
-                        }
-                        catch (std::future_error& e) {
-                            if (e.code() == std::make_error_condition(std::future_errc::promise_already_satisfied))
-                                std::cout << "EventSystem: [promise already satisfied]\n";
-                            else
-                                std::cout << "EventSystem: [unknown exception]\n";
-                        }
-                        commandQueue.pop();
+                commandQueue.drain([] (std::function<void()> &function) {
+                    try {
+                        function();
                     }
-                }
+                    catch (std::exception &e) {
+                        std::cout << "EventSystem: command failed. " << e.what() << std::endl;
+                    }
+                    /* Anything else thrown must not escape either, or the ring would stop advancing */
+                    catch (...) {
+                        std::cout << "EventSystem: command failed with an unknown exception." << std::endl;
+                    }
+                });
             }
 #if BUILD_OPENVR
             if (useOpenVR) {
@@ -80,22 +73,17 @@ namespace Systems
                 sm->poll_event();
             }
 #endif
-            std::this_thread::sleep_for (std::chrono::milliseconds(10));
+            /* Events are still polled every 10ms, but commands are run as soon as they're pushed */
+            commandQueue.wait_for_commands(std::chrono::milliseconds(10));
         }
         
         return true;
     }
 
-    std::future<void> EventSystem::enqueueCommand(std::function<void()> function)
+    void EventSystem::runCommand(std::function<void()> function)
     {
-        std::lock_guard<std::mutex> lock(qMutex);
-        Command c;
-        c.function = function;
-        c.promise = std::make_shared<std::promise<void>>();
-        auto new_future = c.promise->get_future();
-        commandQueue.push(c);
-        // cv.notify_one();
-        return new_future;
+        auto token = commandQueue.push(std::move(function));
+        commandQueue.wait(token);
     }
 
     /* These commands can be called from separate threads, but must be run on the event thread. */
@@ -118,8 +106,7 @@ namespace Systems
             // }
         };
 
-        auto future = enqueueCommand(createWindow);
-        future.wait();
+        runCommand(createWindow);
         return true;
     }
 
@@ -135,8 +122,7 @@ namespace Systems
             glfw->destroy_window(key);
         };
 
-        auto future = enqueueCommand(closeWindow);
-        future.wait();
+        runCommand(closeWindow);
         return true;
     }
 
@@ -147,8 +133,7 @@ namespace Systems
             glfw->resize_window(key, width, height);
         };
 
-        auto future = enqueueCommand(resizeWindow);
-        future.wait();
+        runCommand(resizeWindow);
         return true;
     }
 
@@ -159,8 +144,7 @@ namespace Systems
             glfw->set_window_pos(key, x, y);
         };
 
-        auto future = enqueueCommand(setWindowPos);
-        future.wait();
+        runCommand(setWindowPos);
         return true;
     }
 
@@ -171,8 +155,7 @@ namespace Systems
             glfw->set_window_visibility(key, visible);
         };
 
-        auto future = enqueueCommand(setWindowVisibility);
-        future.wait();
+        runCommand(setWindowVisibility);
         return true;
     }
 
@@ -183,6 +166,7 @@ namespace Systems
         if (!running) return false;
 
         close = true;
+        commandQueue.wake_consumer();
         auto glfw = GLFW::Get();
         if (glfw) glfw->post_empty_event();
         running = false;
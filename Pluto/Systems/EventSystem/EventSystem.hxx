@@ -2,9 +2,10 @@
 #pragma once
 
 #include "Pluto/Tools/System.hxx"
+#include "Pluto/Tools/CommandRing.hxx"
 #include "Pluto/Libraries/GLFW/GLFW.hxx"
 
-#include <queue>
+#include <functional>
 
 namespace Systems 
 {
@@ -28,15 +29,11 @@ namespace Systems
             EventSystem();
             ~EventSystem();
 
-            struct Command {
-                std::function<void()> function;
-                std::shared_ptr<std::promise<void>> promise;
-            };
+            /* Commands from other threads, run on the event thread. Producers never wait on a running command 
+                to push theirs, and the event thread sleeps until one arrives instead of polling on a fixed interval. */
+            static CommandRing<std::function<void()>> commandQueue;
 
-            static std::condition_variable cv;
-            static std::mutex qMutex;
-            static std::queue<Command> commandQueue;
-
-            std::future<void> enqueueCommand(std::function<void()> function);
+            /* Pushes the function for the event thread to run, and blocks until it has */
+            void runCommand(std::function<void()> function);
     };   
 }
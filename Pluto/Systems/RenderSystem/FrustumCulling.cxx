@@ -0,0 +1,120 @@
+#include "./FrustumCulling.hxx"
+
+#include <cmath>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+namespace FrustumCulling {
+
+Frustum extract_frustum(const float m[16])
+{
+    /* Element at row r, column c of the column major matrix */
+    auto at = [m](int r, int c) { return m[c * 4 + r]; };
+
+    Frustum frustum;
+    for (int c = 0; c < 4; ++c) {
+        frustum.planes[0][c] = at(3, c) + at(0, c); /* left */
+        frustum.planes[1][c] = at(3, c) - at(0, c); /* right */
+        frustum.planes[2][c] = at(3, c) + at(1, c); /* bottom */
+        frustum.planes[3][c] = at(3, c) - at(1, c); /* top */
+        frustum.planes[4][c] = at(2, c);            /* z >= 0 */
+        frustum.planes[5][c] = at(3, c) - at(2, c); /* z <= w */
+    }
+
+    for (auto &plane : frustum.planes) {
+        float length = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+        if (length > 0.0f) {
+            for (int c = 0; c < 4; ++c) plane[c] /= length;
+        } else {
+            plane[0] = plane[1] = plane[2] = 0.0f; plane[3] = 1.0f;
+        }
+    }
+    return frustum;
+}
+
+uint32_t cull_spheres_scalar(const SphereArrays &spheres, uint32_t first, uint32_t count, 
+    const Frustum *frustums, uint32_t frustum_count, uint8_t *visible)
+{
+    uint32_t total = 0;
+    for (uint32_t i = first; i < first + count; ++i) {
+        bool any = false;
+        for (uint32_t f = 0; f < frustum_count && !any; ++f) {
+            bool inside = true;
+            for (const auto &p : frustums[f].planes)
+                inside &= (p[0] * spheres.x[i] + p[1] * spheres.y[i] + p[2] * spheres.z[i] + p[3]) >= -spheres.radius[i];
+            any = inside;
+        }
+        visible[i] = any ? 1 : 0;
+        total += visible[i];
+    }
+    return total;
+}
+
+uint32_t cull_spheres(const SphereArrays &spheres, uint32_t first, uint32_t count, 
+    const Frustum *frustums, uint32_t frustum_count, uint8_t *visible)
+{
+    uint32_t i = first, end = first + count, total = 0;
+
+#if defined(__AVX__)
+    for (; i + 8 <= end; i += 8) {
+        __m256 x = _mm256_loadu_ps(&spheres.x[i]), y = _mm256_loadu_ps(&spheres.y[i]), z = _mm256_loadu_ps(&spheres.z[i]);
+        __m256 nr = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(&spheres.radius[i]));
+        __m256 any = _mm256_setzero_ps();
+        for (uint32_t f = 0; f < frustum_count; ++f) {
+            __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+            for (const auto &p : frustums[f].planes) {
+                __m256 d = _mm256_add_ps(
+                    _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(p[0]), x), _mm256_mul_ps(_mm256_set1_ps(p[1]), y)),
+                    _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(p[2]), z), _mm256_set1_ps(p[3])));
+                inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, nr, _CMP_GE_OQ));
+            }
+            any = _mm256_or_ps(any, inside);
+        }
+        int mask = _mm256_movemask_ps(any);
+        for (uint32_t lane = 0; lane < 8; ++lane) {
+            visible[i + lane] = (mask >> lane) & 1;
+            total += visible[i + lane];
+        }
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    for (; i + 4 <= end; i += 4) {
+        __m128 x = _mm_loadu_ps(&spheres.x[i]), y = _mm_loadu_ps(&spheres.y[i]), z = _mm_loadu_ps(&spheres.z[i]);
+        __m128 nr = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&spheres.radius[i]));
+        __m128 any = _mm_setzero_ps();
+        for (uint32_t f = 0; f < frustum_count; ++f) {
+            __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+            for (const auto &p : frustums[f].planes) {
+                __m128 d = _mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(_mm_set1_ps(p[0]), x), _mm_mul_ps(_mm_set1_ps(p[1]), y)),
+                    _mm_add_ps(_mm_mul_ps(_mm_set1_ps(p[2]), z), _mm_set1_ps(p[3])));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(d, nr));
+            }
+            any = _mm_or_ps(any, inside);
+        }
+        int mask = _mm_movemask_ps(any);
+        for (uint32_t lane = 0; lane < 4; ++lane) {
+            visible[i + lane] = (mask >> lane) & 1;
+            total += visible[i + lane];
+        }
+    }
+#endif
+
+    return total + cull_spheres_scalar(spheres, i, end - i, frustums, frustum_count, visible);
+}
+
+const char* get_instruction_set()
+{
+#if defined(__AVX__)
+    return "AVX";
+#elif defined(__SSE2__) || defined(_M_X64)
+    return "SSE";
+#else
+    return "Scalar";
+#endif
+}
+
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+/* World space bounding spheres in structure of arrays form, so that the culling loop can test 
+    several spheres against a plane at once. */
+struct SphereArrays {
+    std::vector<float> x, y, z, radius;
+
+    void resize(uint32_t count)
+    {
+        for (auto v : {&x, &y, &z, &radius}) v->resize(count);
+    }
+
+    uint32_t size() const
+    {
+        return (uint32_t) x.size();
+    }
+
+    void set(uint32_t index, const float center[3], float sphere_radius)
+    {
+        x[index] = center[0]; y[index] = center[1]; z[index] = center[2];
+        radius[index] = sphere_radius;
+    }
+};
+
+namespace FrustumCulling {
+    /* Six planes (a, b, c, d) bounding a view volume, with a*x + b*y + c*z + d >= 0 inside. */
+    struct Frustum {
+        float planes[6][4];
+    };
+
+    /* Extracts the planes of a column major world to clip space matrix, for Vulkan's clip volume 
+        (-w <= x, y <= w and 0 <= z <= w). Planes are normalized so distances are in world units.
+        Degenerate planes, like the far plane of an infinite reverse Z projection, never cull anything. */
+    Frustum extract_frustum(const float world_to_clip[16]);
+
+    /* Tests count spheres starting at first against the given frustums. visible[i] is set to 1 for spheres 
+        overlapping at least one frustum, and 0 otherwise. Returns the number of visible spheres.
+        Uses AVX (8 spheres per iteration) or SSE (4 per iteration) when compiled in, with a scalar tail. */
+    uint32_t cull_spheres(const SphereArrays &spheres, uint32_t first, uint32_t count, 
+        const Frustum *frustums, uint32_t frustum_count, uint8_t *visible);
+
+    /* The same test, one sphere at a time. Used for the tail, and on targets without SIMD. */
+    uint32_t cull_spheres_scalar(const SphereArrays &spheres, uint32_t first, uint32_t count, 
+        const Frustum *frustums, uint32_t frustum_count, uint8_t *visible);
+
+    /* Returns the instruction set cull_spheres was compiled with: "AVX", "SSE" or "Scalar" */
+    const char* get_instruction_set();
+}
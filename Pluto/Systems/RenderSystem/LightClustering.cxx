@@ -0,0 +1,180 @@
+#include "./LightClustering.hxx"
+
+#include <algorithm>
+#include <cmath>
+
+namespace LightClustering {
+
+namespace {
+    /* Inverts a column major 4x4 matrix through its cofactors. Returns false if the matrix is singular. */
+    bool invert(const float m[16], float out[16])
+    {
+        float inv[16];
+        inv[0] = m[5]*m[10]*m[15] - m[5]*m[11]*m[14] - m[9]*m[6]*m[15] + m[9]*m[7]*m[14] + m[13]*m[6]*m[11] - m[13]*m[7]*m[10];
+        inv[4] = -m[4]*m[10]*m[15] + m[4]*m[11]*m[14] + m[8]*m[6]*m[15] - m[8]*m[7]*m[14] - m[12]*m[6]*m[11] + m[12]*m[7]*m[10];
+        inv[8] = m[4]*m[9]*m[15] - m[4]*m[11]*m[13] - m[8]*m[5]*m[15] + m[8]*m[7]*m[13] + m[12]*m[5]*m[11] - m[12]*m[7]*m[9];
+        inv[12] = -m[4]*m[9]*m[14] + m[4]*m[10]*m[13] + m[8]*m[5]*m[14] - m[8]*m[6]*m[13] - m[12]*m[5]*m[10] + m[12]*m[6]*m[9];
+        inv[1] = -m[1]*m[10]*m[15] + m[1]*m[11]*m[14] + m[9]*m[2]*m[15] - m[9]*m[3]*m[14] - m[13]*m[2]*m[11] + m[13]*m[3]*m[10];
+        inv[5] = m[0]*m[10]*m[15] - m[0]*m[11]*m[14] - m[8]*m[2]*m[15] + m[8]*m[3]*m[14] + m[12]*m[2]*m[11] - m[12]*m[3]*m[10];
+        inv[9] = -m[0]*m[9]*m[15] + m[0]*m[11]*m[13] + m[8]*m[1]*m[15] - m[8]*m[3]*m[13] - m[12]*m[1]*m[11] + m[12]*m[3]*m[9];
+        inv[13] = m[0]*m[9]*m[14] - m[0]*m[10]*m[13] - m[8]*m[1]*m[14] + m[8]*m[2]*m[13] + m[12]*m[1]*m[10] - m[12]*m[2]*m[9];
+        inv[2] = m[1]*m[6]*m[15] - m[1]*m[7]*m[14] - m[5]*m[2]*m[15] + m[5]*m[3]*m[14] + m[13]*m[2]*m[7] - m[13]*m[3]*m[6];
+        inv[6] = -m[0]*m[6]*m[15] + m[0]*m[7]*m[14] + m[4]*m[2]*m[15] - m[4]*m[3]*m[14] - m[12]*m[2]*m[7] + m[12]*m[3]*m[6];
+        inv[10] = m[0]*m[5]*m[15] - m[0]*m[7]*m[13] - m[4]*m[1]*m[15] + m[4]*m[3]*m[13] + m[12]*m[1]*m[7] - m[12]*m[3]*m[5];
+        inv[14] = -m[0]*m[5]*m[14] + m[0]*m[6]*m[13] + m[4]*m[1]*m[14] - m[4]*m[2]*m[13] - m[12]*m[1]*m[6] + m[12]*m[2]*m[5];
+        inv[3] = -m[1]*m[6]*m[11] + m[1]*m[7]*m[10] + m[5]*m[2]*m[11] - m[5]*m[3]*m[10] - m[9]*m[2]*m[7] + m[9]*m[3]*m[6];
+        inv[7] = m[0]*m[6]*m[11] - m[0]*m[7]*m[10] - m[4]*m[2]*m[11] + m[4]*m[3]*m[10] + m[8]*m[2]*m[7] - m[8]*m[3]*m[6];
+        inv[11] = -m[0]*m[5]*m[11] + m[0]*m[7]*m[9] + m[4]*m[1]*m[11] - m[4]*m[3]*m[9] - m[8]*m[1]*m[7] + m[8]*m[3]*m[5];
+        inv[15] = m[0]*m[5]*m[10] - m[0]*m[6]*m[9] - m[4]*m[1]*m[10] + m[4]*m[2]*m[9] + m[8]*m[1]*m[6] - m[8]*m[2]*m[5];
+
+        float det = m[0] * inv[0] + m[1] * inv[4] + m[2] * inv[8] + m[3] * inv[12];
+        if (det == 0.0f) return false;
+        for (int i = 0; i < 16; ++i) out[i] = inv[i] / det;
+        return true;
+    }
+
+    /* Multiplies a column major matrix by (x, y, z, w) */
+    void transform(const float m[16], float x, float y, float z, float w, float out[4])
+    {
+        for (int r = 0; r < 4; ++r)
+            out[r] = m[r] * x + m[4 + r] * y + m[8 + r] * z + m[12 + r] * w;
+    }
+
+    struct Bounds {
+        float min[3], max[3];
+    };
+
+    /* Distance from the view origin, along -z, where depth slice i begins */
+    float slice_depth(float near_pos, float far_pos, uint32_t slice)
+    {
+        return near_pos * std::pow(far_pos / near_pos, (float) slice / (float) LIGHT_CLUSTER_Z);
+    }
+}
+
+float get_slice_scale(float near_pos, float far_pos)
+{
+    return (float) LIGHT_CLUSTER_Z / std::log(far_pos / near_pos);
+}
+
+void assign_lights(const float view_to_clip[16], float near_pos, float far_pos,
+    const ViewLight *lights, uint32_t light_count,
+    std::vector<LightCluster> &clusters, std::vector<int32_t> &light_indices)
+{
+    uint32_t first_cluster = (uint32_t) clusters.size();
+    clusters.resize(first_cluster + LIGHT_CLUSTER_COUNT, LightCluster{(int32_t) light_indices.size(), 0});
+
+    float clip_to_view[16];
+    if (light_count == 0 || !(near_pos > 0.0f) || !(far_pos > near_pos) || !invert(view_to_clip, clip_to_view)) return;
+
+    /* Bound each froxel by unprojecting the corners of its tile at the depths of its slice */
+    std::vector<Bounds> froxels(LIGHT_CLUSTER_COUNT);
+    for (uint32_t z = 0; z < LIGHT_CLUSTER_Z; ++z) {
+        float depths[2] = {slice_depth(near_pos, far_pos, z), slice_depth(near_pos, far_pos, z + 1)};
+        if (z == LIGHT_CLUSTER_Z - 1) depths[1] = far_pos;
+
+        /* Depth in normalized device coordinates of each end of the slice */
+        float ndc_z[2];
+        for (int d = 0; d < 2; ++d) {
+            float clip[4];
+            transform(view_to_clip, 0.0f, 0.0f, -depths[d], 1.0f, clip);
+            ndc_z[d] = (clip[3] != 0.0f) ? clip[2] / clip[3] : 0.0f;
+        }
+
+        for (uint32_t y = 0; y < LIGHT_CLUSTER_Y; ++y) {
+            for (uint32_t x = 0; x < LIGHT_CLUSTER_X; ++x) {
+                Bounds &bounds = froxels[(z * LIGHT_CLUSTER_Y + y) * LIGHT_CLUSTER_X + x];
+                for (int a = 0; a < 3; ++a) { bounds.min[a] = INFINITY; bounds.max[a] = -INFINITY; }
+                for (int corner = 0; corner < 8; ++corner) {
+                    float ndc_x = -1.0f + 2.0f * (float) (x + (corner & 1)) / (float) LIGHT_CLUSTER_X;
+                    float ndc_y = -1.0f + 2.0f * (float) (y + ((corner >> 1) & 1)) / (float) LIGHT_CLUSTER_Y;
+                    float view[4];
+                    transform(clip_to_view, ndc_x, ndc_y, ndc_z[corner >> 2], 1.0f, view);
+                    for (int a = 0; a < 3; ++a) {
+                        float v = view[a] / view[3];
+                        bounds.min[a] = std::min(bounds.min[a], v);
+                        bounds.max[a] = std::max(bounds.max[a], v);
+                    }
+                }
+            }
+        }
+    }
+
+    /* The last slice extends to infinity, so it keeps every light past its start */
+    for (uint32_t i = (LIGHT_CLUSTER_Z - 1) * LIGHT_CLUSTER_X * LIGHT_CLUSTER_Y; i < LIGHT_CLUSTER_COUNT; ++i)
+        froxels[i].min[2] = -INFINITY;
+
+    /* Find the (cluster, light) pairs that overlap, then sort them by cluster into the index list */
+    std::vector<std::pair<uint32_t, int32_t>> pairs;
+    for (uint32_t l = 0; l < light_count; ++l) {
+        const ViewLight &light = lights[l];
+        float depth_min = -light.z - light.radius, depth_max = -light.z + light.radius;
+        if (depth_max < near_pos) continue;
+
+        /* Narrow the candidate froxels down to the slices and tiles the light's view space box projects to.
+            If the box crosses the near plane, its projection is unbounded, so every tile is a candidate. */
+        auto to_slice = [&](float depth) {
+            if (depth <= near_pos) return 0;
+            return std::min((int) (std::log(depth / near_pos) * get_slice_scale(near_pos, far_pos)), LIGHT_CLUSTER_Z - 1);
+        };
+        int z0 = to_slice(depth_min), z1 = to_slice(depth_max);
+        int x0 = 0, x1 = LIGHT_CLUSTER_X - 1, y0 = 0, y1 = LIGHT_CLUSTER_Y - 1;
+        if (depth_min > near_pos) {
+            float ndc_min[2] = {INFINITY, INFINITY}, ndc_max[2] = {-INFINITY, -INFINITY};
+            bool bounded = true;
+            for (int corner = 0; corner < 8 && bounded; ++corner) {
+                float clip[4];
+                transform(view_to_clip,
+                    light.x + ((corner & 1) ? light.radius : -light.radius),
+                    light.y + ((corner & 2) ? light.radius : -light.radius),
+                    light.z + ((corner & 4) ? light.radius : -light.radius), 1.0f, clip);
+                bounded = clip[3] > 0.0f;
+                for (int a = 0; a < 2 && bounded; ++a) {
+                    ndc_min[a] = std::min(ndc_min[a], clip[a] / clip[3]);
+                    ndc_max[a] = std::max(ndc_max[a], clip[a] / clip[3]);
+                }
+            }
+            if (bounded) {
+                if (ndc_max[0] < -1.0f || ndc_min[0] > 1.0f || ndc_max[1] < -1.0f || ndc_min[1] > 1.0f) continue;
+                auto to_tile = [](float ndc, int tiles) {
+                    return std::max(0, std::min((int) std::floor((ndc * 0.5f + 0.5f) * (float) tiles), tiles - 1));
+                };
+                x0 = to_tile(ndc_min[0], LIGHT_CLUSTER_X); x1 = to_tile(ndc_max[0], LIGHT_CLUSTER_X);
+                y0 = to_tile(ndc_min[1], LIGHT_CLUSTER_Y); y1 = to_tile(ndc_max[1], LIGHT_CLUSTER_Y);
+            }
+        }
+
+        float radius_squared = light.radius * light.radius;
+        float center[3] = {light.x, light.y, light.z};
+        for (int z = z0; z <= z1; ++z) {
+            for (int y = y0; y <= y1; ++y) {
+                for (int x = x0; x <= x1; ++x) {
+                    uint32_t cluster = (uint32_t) ((z * LIGHT_CLUSTER_Y + y) * LIGHT_CLUSTER_X + x);
+                    const Bounds &bounds = froxels[cluster];
+                    float distance_squared = 0.0f;
+                    for (int a = 0; a < 3; ++a) {
+                        float d = std::max(std::max(bounds.min[a] - center[a], center[a] - bounds.max[a]), 0.0f);
+                        distance_squared += d * d;
+                    }
+                    if (distance_squared <= radius_squared) pairs.push_back({cluster, light.entity_id});
+                }
+            }
+        }
+    }
+
+    std::stable_sort(pairs.begin(), pairs.end(), [](const std::pair<uint32_t, int32_t> &a, const std::pair<uint32_t, int32_t> &b) {
+        return a.first < b.first;
+    });
+    int32_t first_light = (int32_t) light_indices.size();
+    for (auto &pair : pairs) {
+        LightCluster &cluster = clusters[first_cluster + pair.first];
+        if (cluster.light_count == 0) cluster.first_light = (int32_t) light_indices.size();
+        cluster.light_count++;
+        light_indices.push_back(pair.second);
+    }
+
+    /* Empty clusters point at the start of this view's lights, so every range stays in bounds */
+    for (uint32_t i = first_cluster; i < first_cluster + LIGHT_CLUSTER_COUNT; ++i)
+        if (clusters[i].light_count == 0) clusters[i].first_light = first_light;
+}
+
+}
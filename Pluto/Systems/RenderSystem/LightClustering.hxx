@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "Pluto/Light/LightClusterStruct.hxx"
+
+namespace LightClustering {
+    /* A light with a view space position. Lights reach radius units from their position. */
+    struct ViewLight {
+        float x, y, z, radius;
+        int32_t entity_id;
+    };
+
+    /* Returns the scale turning log(depth / near_pos) into a depth slice, for slices spanning near_pos to far_pos */
+    float get_slice_scale(float near_pos, float far_pos);
+
+    /* Assigns lights to the froxels of a view with the given column major view to clip matrix, for Vulkan's clip
+        volume (0 <= z <= w, with either depth direction). Depth slices span near_pos to far_pos, and fragments past
+        far_pos use the last slice. Appends LIGHT_CLUSTER_COUNT clusters, ordered x fastest then y then z, along with
+        the entity ids each cluster refers to. Lights are tested as spheres against each froxel's view space bounds,
+        so assignment is conservative. */
+    void assign_lights(const float view_to_clip[16], float near_pos, float far_pos,
+        const ViewLight *lights, uint32_t light_count,
+        std::vector<LightCluster> &clusters, std::vector<int32_t> &light_indices);
+}
@@ -2,6 +2,7 @@
 //#include <zmq.h>
 
 #include <string>
+#include <algorithm>
 #include <iostream>
 #include <assert.h>
 
@@ -11,7 +12,12 @@
 #include "Pluto/Texture/Texture.hxx"
 #include "Pluto/Entity/Entity.hxx"
 #include "Pluto/Tools/Options.hxx"
+#include "Pluto/Tools/SlotMap.hxx"
+#include "Pluto/Tools/WorkerPool.hxx"
 #include "Pluto/Material/Material.hxx"
+#include "Pluto/Mesh/Mesh.hxx"
+#include "Pluto/Transform/Transform.hxx"
+#include "Pluto/Light/Light.hxx"
 
 #if BUILD_OPENVR
 #include "Pluto/Libraries/OpenVR/OpenVR.hxx"
@@ -87,6 +93,8 @@ void RenderSystem::record_render_commands()
 {
     auto glfw = GLFW::Get();
 
+    recorded_commands.clear();
+
     /* We need some windows in order to render. */
     auto keys = glfw->get_window_keys();
     if (keys.size() == 0) return;
@@ -117,15 +125,14 @@ void RenderSystem::record_render_commands()
 #endif
 
 
-    /* Upload SSBO data */
-    Material::UploadSSBO();
-    Transform::UploadSSBO();
-    Light::UploadSSBO();
-    Camera::UploadSSBO();
-    Entity::UploadSSBO();
-    Texture::UploadSSBO();
-    Material::UpdateRasterDescriptorSets();
-    Material::UpdateRaytracingDescriptorSets();
+    /* Upload SSBO data into this frame's copy of each SSBO, and point this frame's descriptor sets at them */
+    Material::UploadSSBO(currentFrame);
+    Transform::UploadSSBO(currentFrame);
+    Light::UploadSSBO(currentFrame);
+    Camera::UploadSSBO(currentFrame);
+    Entity::UploadSSBO(currentFrame);
+    Texture::UploadSSBO(currentFrame);
+    Mesh::UploadSSBO(currentFrame);
 
     Texture* brdf = nullptr;
     try {
@@ -136,108 +143,109 @@ void RenderSystem::record_render_commands()
     push_constants.brdf_lut_id = brdf_id;
     push_constants.time = (float) glfwGetTime();
 
-    auto entities = Entity::GetFront();
 
-    /* Get light list */
-    std::vector<int32_t> light_entity_ids(MAX_LIGHTS, -1);
-    int32_t light_count = 0;
-    for (uint32_t i = 0; i < Entity::GetCount(); ++i)
-    {
-        if (entities[i].is_initialized() && (entities[i].get_light() != -1))
-        {
-            light_entity_ids[light_count] = i;
-            light_count++;
-        }
-        if (light_count == MAX_LIGHTS)
-            break;
-    }
-    memcpy(push_constants.light_entity_ids, light_entity_ids.data(), sizeof(push_constants.light_entity_ids)/*sizeof(int32_t) * light_entity_ids.size()*/);
-
-
-    /* Render all cameras */
-    auto cameras = Camera::GetFront();
+    /* Collect the cameras to render, along with a pass for each of their renderpasses. 
+        If we're the client, we recieve color data from "stream_frames", so only render a scene if not the client. */
+    camera_recordings.clear();
+    camera_passes.clear();
     for (uint32_t entity_id = 0; entity_id < Entity::GetCount(); ++entity_id) {
         /* Entity must be initialized */
-        if (!entities[entity_id].is_initialized()) continue;
+        auto camera_entity = Entity::GetFromIndex(entity_id);
+        if (!camera_entity->is_initialized()) continue;
 
         /* Entity needs a camera */
-        auto cam_id = entities[entity_id].get_camera();
+        auto cam_id = camera_entity->get_camera();
         if (cam_id < 0) continue;
+        auto camera = Camera::GetFromIndex(cam_id);
+        if (!camera) continue;
 
         /* Camera must allow recording. */
-        if (!cameras[cam_id].allows_recording()) continue;
+        if (!camera->allows_recording()) continue;
 
         /* Camera needs a texture */
-        Texture * texture = cameras[cam_id].get_texture();
+        Texture * texture = camera->get_texture();
         if (!texture) continue;
 
-        auto command_buffer = cameras[cam_id].get_command_buffer();
+        uint32_t camera_index = (uint32_t) camera_recordings.size();
+        uint32_t pass_count = (Options::IsClient()) ? 0 : camera->get_num_renderpasses();
+        camera_recordings.push_back({entity_id, camera_entity, camera, texture, (uint32_t) camera_passes.size(), pass_count, 0});
+        for (uint32_t rp_idx = 0; rp_idx < pass_count; rp_idx++)
+            camera_passes.push_back({camera_index, rp_idx, vk::CommandBuffer(), 0, 0, DrawStatistics(), CullingPushConsts()});
+    }
+
+    /* Every pass can draw each entity at most once, so reserving that many instances means recording never runs out.
+        This can reallocate the instance buffer, so descriptor sets are updated afterwards. */
+    compute_entity_bounds();
+    assign_lights();
+    culling_on_gpu = gpu_culling && Material::IsGPUCullingSupported();
+    Material::ReserveInstances((uint32_t) (camera_passes.size() * entity_bounds_index.size()));
+    if (culling_on_gpu) Material::ReserveIndirectDraws((uint32_t) (camera_passes.size() * entity_bounds_index.size()));
+    Material::UpdateRasterDescriptorSets(currentFrame);
+    Material::UpdateRaytracingDescriptorSets();
+    next_instance = 0;
+
+    /* Record every renderpass of every camera in parallel. Each thread records into secondary command buffers 
+        from its own pool, so no locking is needed while recording. */
+    WorkerPool::Get()->parallel_for((uint32_t) camera_passes.size(), [this](uint32_t i) {
+        try {
+            record_camera_pass(camera_passes[i], push_constants);
+        }
+        catch (const std::exception &e) {
+            std::cout << "Error while recording camera pass: " << e.what() << std::endl;
+            camera_passes[i].command_buffer = vk::CommandBuffer();
+        }
+    });
+
+    /* When culling on the GPU, the culling shader fills in the instance buffer instead */
+    if (culling_on_gpu) {
+        Material::UploadInstances(currentFrame, 0);
+        Material::UploadIndirectDraws(currentFrame, next_instance);
+    } else {
+        Material::UploadInstances(currentFrame, next_instance);
+    }
+
+    /* Stitch each camera's passes together into a primary command buffer */
+    auto vulkan = Vulkan::Get();
+    draw_statistics = DrawStatistics();
+    for (auto &recording : camera_recordings) {
+        auto camera = recording.camera;
+        auto command_buffer = vulkan->get_thread_command_buffer(currentFrame);
         vk::CommandBufferBeginInfo beginInfo;
-        // beginInfo.flags = vk::CommandBufferUsageFlagBits::eSimultaneousUse;
-        beginInfo.flags = vk::CommandBufferUsageFlagBits::eSimultaneousUse;
+        beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
         command_buffer.begin(beginInfo);
 
-        /* If we're the client, we recieve color data from "stream_frames". Only render a scene if not the client. */
-        if (!Options::IsClient())
-        {
-            for(uint32_t rp_idx = 0; rp_idx < cameras[cam_id].get_num_renderpasses(); rp_idx++) {
-                /* Get the renderpass for the current camera */
-                vk::RenderPass rp = cameras[cam_id].get_renderpass(rp_idx);
-
-                /* Bind all descriptor sets to that renderpass.
-                    Note that we're using a single bind. The same descriptors are shared across pipelines. */
-                Material::BindDescriptorSets(command_buffer, rp);
-
-                cameras[cam_id].begin_renderpass(command_buffer, rp_idx);
-                for (uint32_t i = 0; i < Entity::GetCount(); ++i)
-                {
-                    if (entities[rp_idx].is_initialized())
-                    {
-                        // Push constants
-                        push_constants.target_id = i;
-                        push_constants.camera_id = entity_id;
-                        push_constants.viewIndex = rp_idx;
-                        Material::DrawEntity(command_buffer, rp, entities[i], push_constants);
-                    }
-                }
-                
-                /* Draw volumes last */
-                for (uint32_t i = 0; i < Entity::GetCount(); ++i)
-                {
-                    if (entities[i].is_initialized())
-                    {
-                        // Push constants
-                        push_constants.target_id = i;
-                        push_constants.camera_id = entity_id;
-                        push_constants.viewIndex = rp_idx;
-                        Material::DrawVolume(command_buffer, rp, entities[i], push_constants);
-                    }
-                }
+        /* Cull this camera's candidates before its renderpasses draw them */
+        if (culling_on_gpu) {
+            std::vector<CullingPushConsts> dispatches;
+            for (uint32_t i = recording.first_pass; i < recording.first_pass + recording.pass_count; ++i)
+                if (camera_passes[i].command_buffer) dispatches.push_back(camera_passes[i].culling);
+            Material::RecordCulling(command_buffer, currentFrame, dispatches);
+        }
 
-                cameras[cam_id].end_renderpass(command_buffer, rp_idx);
-            }
+        uint32_t visible_count = 0, culled_count = 0;
+        for (uint32_t i = recording.first_pass; i < recording.first_pass + recording.pass_count; ++i) {
+            auto &pass = camera_passes[i];
+            camera->begin_renderpass(command_buffer, pass.renderpass_index, vk::SubpassContents::eSecondaryCommandBuffers);
+            if (pass.command_buffer) command_buffer.executeCommands(pass.command_buffer);
+            camera->end_renderpass(command_buffer, pass.renderpass_index);
+            visible_count += pass.visible_count;
+            culled_count += pass.culled_count;
+            draw_statistics.add(pass.statistics);
         }
+        camera->set_culling_statistics(visible_count, culled_count);
 
         /* See if we should blit to a GLFW window. */
-        auto connected_window_key = entities[entity_id].get_connected_window();
+        auto connected_window_key = recording.entity->get_connected_window();
         if (connected_window_key.size() > 0)
         {
-            /* It's possible the connected window was destroyed. Make sure it still exists... */
-            if (glfw->does_window_exist(connected_window_key)) {
-                
-                /* Window needs a swapchain */
-                auto swapchain = glfw->get_swapchain(connected_window_key);
-                if (!swapchain) {
-                    command_buffer.end();
-                    continue;
-                }
-
+            /* It's possible the connected window was destroyed. Make sure it still exists, and has a swapchain... */
+            if (glfw->does_window_exist(connected_window_key) && glfw->get_swapchain(connected_window_key)) {
                 /* Need to be able to get swapchain/texture by key...*/
                 auto swapchain_texture = glfw->get_texture(connected_window_key);
 
                 /* Record blit to swapchain */
                 if (swapchain_texture && swapchain_texture->is_initialized()) {
-                    texture->record_blit_to(command_buffer, swapchain_texture, 0);
+                    recording.texture->record_blit_to(command_buffer, swapchain_texture, 0);
                 }
             }
         }
@@ -245,19 +253,228 @@ void RenderSystem::record_render_commands()
         /* Record blit to OpenVR eyes. */
 #if BUILD_OPENVR
         if (using_openvr) {
-            if (entity_id == Entity::GetEntityForVR()) {
+            if (recording.entity_id == Entity::GetEntityForVR()) {
                 auto ovr = OpenVR::Get();
                 auto left_eye_texture = ovr->get_left_eye_texture();
                 auto right_eye_texture = ovr->get_right_eye_texture();
-                if (left_eye_texture)  texture->record_blit_to(command_buffer, left_eye_texture, 0);
-                if (right_eye_texture) texture->record_blit_to(command_buffer, right_eye_texture, 1);
+                if (left_eye_texture)  recording.texture->record_blit_to(command_buffer, left_eye_texture, 0);
+                if (right_eye_texture) recording.texture->record_blit_to(command_buffer, right_eye_texture, 1);
             }
         }
 #endif
 
         /* End this recording. */
         command_buffer.end();
+        recorded_commands.push_back(command_buffer);
+    }
+}
+
+void RenderSystem::compute_entity_bounds()
+{
+    uint32_t entity_count = Entity::GetCount();
+    entity_bounds_index.assign(entity_count, -1);
+    entity_bounds.resize(entity_count);
+
+    uint32_t sphere_count = 0;
+    for (uint32_t i = 0; i < entity_count; ++i)
+    {
+        auto entity = Entity::GetFromIndex(i);
+        if (!entity->is_initialized()) continue;
+
+        auto mesh_id = entity->get_mesh();
+        if (mesh_id < 0 || mesh_id >= (int32_t) Mesh::GetCount()) continue;
+        auto mesh = Mesh::GetFromIndex((uint32_t) mesh_id);
+        if (!mesh || !mesh->is_initialized()) continue;
+
+        auto transform_id = entity->get_transform();
+        if (transform_id < 0 || transform_id >= (int32_t) Transform::GetCount()) continue;
+        auto transform = Transform::GetFromIndex((uint32_t) transform_id);
+        if (!transform || !transform->is_initialized()) continue;
+
+        /* Move the mesh's sphere into world space, scaling the radius by the largest axis scale so it stays conservative */
+        glm::mat4 local_to_world = transform->local_to_world_matrix();
+        glm::vec3 center = glm::vec3(local_to_world * glm::vec4(mesh->get_bounding_sphere_center(), 1.0f));
+        float scale = glm::max(glm::length(glm::vec3(local_to_world[0])), 
+            glm::max(glm::length(glm::vec3(local_to_world[1])), glm::length(glm::vec3(local_to_world[2]))));
+        entity_bounds.set(sphere_count, &center[0], mesh->get_bounding_sphere_radius() * scale);
+        entity_bounds_index[i] = (int32_t) sphere_count++;
+    }
+    entity_bounds.resize(sphere_count);
+}
+
+void RenderSystem::assign_lights()
+{
+    /* Gather the registered lights. Lights without a range reach everywhere, so they're listed once up front 
+        as global lights, and only ranged lights are assigned to clusters. */
+    struct RangedLight {
+        glm::vec3 position;
+        float radius;
+        int32_t entity_id;
+    };
+    std::vector<RangedLight> ranged_lights;
+    std::vector<int32_t> light_indices;
+    for (auto entity_id : Entity::GetLightEntities())
+    {
+        auto entity = Entity::GetFromIndex(entity_id);
+        if (!entity || !entity->is_initialized()) continue;
+
+        auto light_id = entity->get_light();
+        if (light_id < 0 || light_id >= (int32_t) Light::GetCount()) continue;
+        auto light = Light::GetFromIndex((uint32_t) light_id);
+        if (!light || !light->is_initialized()) continue;
+
+        auto transform_id = entity->get_transform();
+        if (transform_id < 0 || transform_id >= (int32_t) Transform::GetCount()) continue;
+        auto transform = Transform::GetFromIndex((uint32_t) transform_id);
+        if (!transform || !transform->is_initialized()) continue;
+
+        if (light->get_range() > 0.0f)
+            ranged_lights.push_back({glm::vec3(transform->local_to_world_matrix()[3]), light->get_range(), (int32_t) entity_id});
+        else
+            light_indices.push_back((int32_t) entity_id);
     }
+    int32_t global_light_count = (int32_t) light_indices.size();
+
+    /* Build a froxel grid for every view of every camera being rendered */
+    std::vector<LightClusterGrid> grids;
+    std::vector<LightCluster> clusters;
+    std::vector<LightClustering::ViewLight> view_lights;
+    for (auto &recording : camera_recordings) {
+        auto camera = recording.camera;
+        recording.first_light_grid = (uint32_t) grids.size();
+
+        glm::mat4 world_to_camera = glm::mat4(1.0f);
+        auto transform_id = recording.entity->get_transform();
+        if (transform_id >= 0 && transform_id < (int32_t) Transform::GetCount()) {
+            auto transform = Transform::GetFromIndex((uint32_t) transform_id);
+            if (transform && transform->is_initialized()) world_to_camera = transform->world_to_local_matrix();
+        }
+
+        for (uint32_t view = 0; view < camera->get_view_count(); ++view) {
+            LightClusterGrid grid;
+            glm::mat4 view_to_clip = camera->get_projection(view);
+            grid.world_to_view = camera->get_view(view) * world_to_camera;
+            grid.world_to_clip = view_to_clip * grid.world_to_view;
+            grid.near_pos = camera->get_near_pos(view);
+            if (!(grid.near_pos > 0.0f)) grid.near_pos = .001f;
+
+            /* Scale ranges by the largest axis scale of the view, so that spheres stay conservative */
+            float scale = glm::max(glm::length(glm::vec3(grid.world_to_view[0])), 
+                glm::max(glm::length(glm::vec3(grid.world_to_view[1])), glm::length(glm::vec3(grid.world_to_view[2]))));
+
+            /* Slices only need to reach as deep as the furthest light */
+            float far_pos = grid.near_pos * 2.0f;
+            view_lights.clear();
+            for (auto &light : ranged_lights) {
+                glm::vec3 position = glm::vec3(grid.world_to_view * glm::vec4(light.position, 1.0f));
+                float radius = light.radius * scale;
+                view_lights.push_back({position.x, position.y, position.z, radius, light.entity_id});
+                far_pos = glm::max(far_pos, -position.z + radius);
+            }
+
+            grid.slice_scale = LightClustering::get_slice_scale(grid.near_pos, far_pos);
+            grid.first_cluster = (int32_t) clusters.size();
+            grid.first_global_light = 0;
+            grid.global_light_count = global_light_count;
+            grid.pad0 = grid.pad1 = grid.pad2 = 0;
+            LightClustering::assign_lights(&view_to_clip[0][0], grid.near_pos, far_pos, 
+                view_lights.data(), (uint32_t) view_lights.size(), clusters, light_indices);
+            grids.push_back(grid);
+        }
+    }
+
+    light_count = (uint32_t) (global_light_count + ranged_lights.size());
+    light_index_count = (uint32_t) light_indices.size();
+    Material::UploadLightClusters(currentFrame, grids, clusters, light_indices);
+}
+
+void RenderSystem::record_camera_pass(CameraPass &pass, PushConsts push_constants)
+{
+    auto &recording = camera_recordings[pass.camera_index];
+    auto camera = recording.camera;
+
+    /* Cull entity bounds against the views this pass draws to. With multiview, one pass draws every view,
+        so an entity is kept if it is inside any of them. */
+    std::vector<FrustumCulling::Frustum> frustums;
+#ifdef DISABLE_MULTIVIEW
+    uint32_t first_view = pass.renderpass_index, view_count = 1;
+#else
+    uint32_t first_view = 0, view_count = camera->get_view_count();
+#endif
+    bool cull = frustum_culling && (first_view + view_count <= camera->get_view_count());
+    pass.culling.camera_entity_id = (int32_t) recording.entity_id;
+    pass.culling.first_view = (int32_t) first_view;
+    pass.culling.view_count = (cull) ? (int32_t) view_count : 0;
+    if (cull && !culling_on_gpu) {
+        glm::mat4 world_to_camera = glm::mat4(1.0f);
+        auto transform_id = recording.entity->get_transform();
+        if (transform_id >= 0 && transform_id < (int32_t) Transform::GetCount()) {
+            auto transform = Transform::GetFromIndex((uint32_t) transform_id);
+            if (transform && transform->is_initialized()) world_to_camera = transform->world_to_local_matrix();
+        }
+        for (uint32_t view = first_view; view < first_view + view_count; ++view) {
+            glm::mat4 world_to_clip = camera->get_projection(view) * camera->get_view(view) * world_to_camera;
+            frustums.push_back(FrustumCulling::extract_frustum(&world_to_clip[0][0]));
+        }
+    }
+
+    std::vector<uint8_t> visible(entity_bounds.size(), 1);
+    if (frustums.size() > 0)
+        FrustumCulling::cull_spheres(entity_bounds, 0, entity_bounds.size(), frustums.data(), (uint32_t) frustums.size(), visible.data());
+
+    auto is_culled = [&](uint32_t entity_index) {
+        int32_t sphere = entity_bounds_index[entity_index];
+        return (sphere >= 0) && !visible[sphere];
+    };
+
+    auto command_buffer = Vulkan::Get()->get_thread_command_buffer(currentFrame, vk::CommandBufferLevel::eSecondary);
+    camera->begin_secondary_command_buffer(command_buffer, pass.renderpass_index);
+
+    /* Get the renderpass for the current camera */
+    vk::RenderPass rp = camera->get_renderpass(pass.renderpass_index);
+
+    /* Bind all descriptor sets to that renderpass.
+        Note that we're using a single bind. The same descriptors are shared across pipelines. */
+    Material::BindDescriptorSets(command_buffer, rp, currentFrame);
+
+    push_constants.camera_id = recording.entity_id;
+    push_constants.light_cluster_grid = (int32_t) recording.first_light_grid;
+    push_constants.viewIndex = pass.renderpass_index;
+    pass.visible_count = pass.culled_count = 0;
+    pass.statistics = DrawStatistics();
+
+    /* Resolve a draw packet for each visible entity, then sort them so that pipelines and meshes are only bound 
+        when they change. Volumes sort last. */
+    std::vector<DrawPacket> packets;
+    packets.reserve(entity_bounds_index.size());
+    for (uint32_t i = 0; i < (uint32_t) entity_bounds_index.size(); ++i)
+    {
+        auto entity = Entity::GetFromIndex(i);
+        if (entity->is_initialized())
+        {
+            if (is_culled(i)) {
+                pass.culled_count++;
+                continue;
+            }
+            if (entity_bounds_index[i] >= 0) 
+                pass.visible_count++;
+            DrawPacket packet;
+            if (Material::CreateDrawPacket(rp, *entity, (int32_t) i, packet))
+                packets.push_back(packet);
+        }
+    }
+    std::stable_sort(packets.begin(), packets.end());
+    uint32_t first_instance = next_instance.fetch_add((uint32_t) packets.size());
+    if (culling_on_gpu) {
+        pass.culling.first_candidate = (int32_t) first_instance;
+        pass.culling.candidate_count = (int32_t) packets.size();
+        Material::RecordIndirectDrawPackets(command_buffer, currentFrame, packets, push_constants, first_instance, pass.statistics);
+    } else {
+        Material::RecordDrawPackets(command_buffer, packets, push_constants, first_instance, pass.statistics);
+    }
+
+    command_buffer.end();
+    pass.command_buffer = command_buffer;
 }
 
 void RenderSystem::present_openvr_frames()
@@ -352,28 +569,9 @@ void RenderSystem::stream_frames()
 #endif
 }
 
-void RenderSystem::enqueue_render_commands() {
+void RenderSystem::submit_render_commands() {
     auto vulkan = Vulkan::Get();
     auto glfw = GLFW::Get();
-    std::vector<vk::CommandBuffer> commands;
-
-    auto entities = Entity::GetFront();
-    auto cameras = Camera::GetFront();
-    for (uint32_t entity_id = 0; entity_id < Entity::GetCount(); ++entity_id) {
-        /* Entity must be initialized */
-        if (!entities[entity_id].is_initialized()) continue;
-
-        /* Entity needs a camera */
-        auto cam_id = entities[entity_id].get_camera();
-        if (cam_id < 0) continue;
-
-        /* Camera needs a texture */
-        Texture * texture = cameras[cam_id].get_texture();
-        if (!texture) continue;
-
-        auto command_buffer = cameras[cam_id].get_command_buffer();
-        commands.push_back(command_buffer);
-    }
 
     auto submitPipelineStages = vk::PipelineStageFlags();
     submitPipelineStages = vk::PipelineStageFlagBits::eColorAttachmentOutput;
@@ -389,7 +587,7 @@ void RenderSystem::enqueue_render_commands() {
         waitDstStageMask.push_back(vk::PipelineStageFlagBits::eColorAttachmentOutput);
     }
 
-    vulkan->enqueue_graphics_commands(commands, waitSemaphores, waitDstStageMask, signalSemaphores, maincmd_fences[currentFrame], "drawcalls");
+    frame_submissions[currentFrame] = vulkan->submit_graphics_commands(recorded_commands, waitSemaphores, waitDstStageMask, signalSemaphores, vk::Fence(), "drawcalls");
 }
 
 void RenderSystem::release_vulkan_resources() 
@@ -406,13 +604,12 @@ void RenderSystem::release_vulkan_resources()
     /* Don't free vulkan resources more than once. */
     if (!vulkan_resources_created) return;
 
-    /* Release vulkan resources */
-    device.freeCommandBuffers(vulkan->get_command_pool(2), maincmds);
-    
-    for (int idx = 0; idx < maincmd_fences.size(); ++idx) {
-        device.destroyFence(maincmd_fences[idx]);
-    }
+    /* Let any frames still in flight finish before releasing what they use */
+    if (frame_submissions.size() > 0)
+        vulkan->get_graphics_submission_queue()->wait(*std::max_element(frame_submissions.begin(), frame_submissions.end()));
+    frame_submissions.clear();
 
+    /* Release vulkan resources. Command buffers are recycled by their thread's pools, so aren't freed here. */
     for (int idx = 0; idx < renderCompleteSemaphores.size(); ++idx) {
         device.destroySemaphore(renderCompleteSemaphores[idx]);
     }
@@ -428,19 +625,8 @@ void RenderSystem::allocate_vulkan_resources()
     auto vulkan = Vulkan::Get();
     auto device = vulkan->get_device();
     
-    /* Create a main command buffer if one does not already exist */
-    vk::CommandBufferAllocateInfo mainCmdAllocInfo;
-    mainCmdAllocInfo.level = vk::CommandBufferLevel::ePrimary;
-    mainCmdAllocInfo.commandPool = vulkan->get_command_pool(2);
-    mainCmdAllocInfo.commandBufferCount = max_frames_in_flight;
-    maincmds = device.allocateCommandBuffers(mainCmdAllocInfo);
-    
-    maincmd_fences.resize(max_frames_in_flight);
-    for (uint32_t idx = 0; idx < max_frames_in_flight; ++idx) {
-        vk::FenceCreateInfo fenceInfo;
-        // fenceInfo.flags |= vk::FenceCreateFlagBits::eSignaled;
-        maincmd_fences[idx] = device.createFence(fenceInfo);
-    }
+    /* No frame has used these slots yet. Value 0 counts as already complete. */
+    frame_submissions.assign(max_frames_in_flight, 0);
 
     /* Create semaphores to synchronize GPU between renderpasses and presenting. */
     renderCompleteSemaphores.resize(max_frames_in_flight);
@@ -460,25 +646,52 @@ bool RenderSystem::start()
     if (running) return false;
 
     auto loop = [this](future<void> futureObj) {
-        lastTime = glfwGetTime();
         auto glfw = GLFW::Get();
+        bool rendered = true;
 
         while (true)
         {
-            if (futureObj.wait_for(.1ms) == future_status::ready) break;
-
-            /* Regulate the framerate. */
-            currentTime = glfwGetTime();
-            if ((!using_openvr) && ((currentTime - lastTime) < .008)) continue;
-            lastTime = currentTime;
+            /* Regulate the framerate. OpenVR paces itself through the compositor. Sleeping precisely only 
+                matters while frames are being rendered. */
+            if (!using_openvr) pacer.wait(rendered);
+            if (futureObj.wait_for(0ms) == future_status::ready) break;
 
             /* Wait until vulkan is initialized before rendering. */
             auto vulkan = Vulkan::Get();
             if (!vulkan->is_initialized()) continue;
 
+            /* In on demand mode, skip the frame unless something changed since the last one. */
+            if (on_demand && !using_openvr) {
+                /* Flag the loop as idle before looking for changes, so a component changed after the check wakes the pacer */
+                idle = true;
+                bool changed = frame_requested.exchange(false);
+                changed |= SlotMapsModified.exchange(false);
+                changed |= glfw->consume_window_changes();
+                if (changed) frames_to_render = max_frames_in_flight;
+                rendered = (frames_to_render > 0);
+                if (!rendered) continue;
+                idle = false;
+                frames_to_render--;
+            }
+            else {
+                idle = false;
+                rendered = true;
+            }
+
             /* 0. Allocate the resources we'll need to render this scene. */
             allocate_vulkan_resources();
 
+            /* Wait for the GPU to finish the last frame which used this slot. Only then is it safe to overwrite 
+                this frame's SSBO copies, descriptor sets and command buffers. Other frames may still be in flight. */
+            vulkan->get_graphics_submission_queue()->wait(frame_submissions[currentFrame]);
+            vulkan->reset_thread_command_pools(currentFrame);
+
+            /* Send off every upload staged since the last frame as one batch, ahead of this frame's commands, 
+                and reclaim the staging space of batches the GPU has finished. */
+            auto uploads = vulkan->get_upload_queue();
+            uploads->retire();
+            uploads->flush();
+
             {
                 /* Lock the window mutex to get access to swapchains and window textures. */
                 std::shared_ptr<std::lock_guard<std::mutex>> window_lock;
@@ -492,18 +705,10 @@ bool RenderSystem::start()
                 /* 2. Record render commands. */
                 record_render_commands();
 
-                /* 3. Wait on image available. Enqueue graphics commands. Optionally signal render complete semaphore. */
-                enqueue_render_commands();
-
-                /* Submit enqueued graphics commands */
-                vulkan->submit_graphics_commands();
-                
-                /* Wait for GPU to finish execution */
-                // If i don't fence here, triangles seem to spread apart. 
-                // I think this is an issue with using the SSBO from frame to frame...
-                auto device = vulkan->get_device();
-                device.waitForFences(maincmd_fences[currentFrame], true, 100);
-                device.resetFences(maincmd_fences[currentFrame]);
+                /* 3. Wait on image available. Submit graphics commands. Optionally signal render complete semaphore. 
+                    We don't wait on these here, their timeline value is waited on the next time this frame slot 
+                    comes around. */
+                submit_render_commands();
 
                 /* 4. Optional: Wait on render complete. Present a frame. */
                 stream_frames();
@@ -537,6 +742,7 @@ bool RenderSystem::stop()
         return false;
 
     exitSignal.set_value();
+    pacer.wake();
     eventThread.join();
 
     if (Options::IsServer() || Options::IsClient())
@@ -549,87 +755,201 @@ bool RenderSystem::stop()
     return true;
 }
 
-RenderSystem::RenderSystem() {}
+RenderSystem::RenderSystem() 
+{
+    pacer.set_target_rate(125.0);
+
+    /* Component changes only cut the wait short while idle, so that frames being rendered stay paced */
+    SlotMapsModifiedCallback = []() {
+        auto render_system = RenderSystem::Get();
+        if (render_system->idle) render_system->pacer.wake();
+    };
+}
 RenderSystem::~RenderSystem() {}
 
 
 void RenderSystem::set_gamma(float gamma)
 {
     this->push_constants.gamma = gamma;
+    request_frame();
 }
 
 void RenderSystem::set_exposure(float exposure)
 {
     this->push_constants.exposure = exposure;
+    request_frame();
 }
 
 void RenderSystem::set_environment_map(int32_t id) 
 {
     this->push_constants.environment_id = id;
+    request_frame();
 }
 
 void RenderSystem::set_environment_map(Texture *texture) 
 {
     this->push_constants.environment_id = texture->get_id();
+    request_frame();
 }
 
 void RenderSystem::set_environment_roughness(float roughness)
 {
     this->push_constants.environment_roughness = roughness;
+    request_frame();
 }
 
 void RenderSystem::clear_environment_map()
 {
     this->push_constants.environment_id = -1;
+    request_frame();
 }
 
 void RenderSystem::set_irradiance_map(int32_t id)
 {
     this->push_constants.specular_environment_id = id;
+    request_frame();
 }
 
 void RenderSystem::set_irradiance_map(Texture *texture)
 {
     this->push_constants.specular_environment_id = texture->get_id();
+    request_frame();
 }
 
 void RenderSystem::clear_irradiance_map()
 {
     this->push_constants.specular_environment_id = -1;
+    request_frame();
 }
 
 void RenderSystem::set_diffuse_map(int32_t id)
 {
     this->push_constants.diffuse_environment_id = id;
+    request_frame();
 }
 
 void RenderSystem::set_diffuse_map(Texture *texture)
 {
     this->push_constants.diffuse_environment_id = texture->get_id();
+    request_frame();
 }
 
 void RenderSystem::clear_diffuse_map()
 {
     this->push_constants.diffuse_environment_id = -1;
+    request_frame();
 }
 
 void RenderSystem::set_top_sky_color(glm::vec3 color) 
 {
     push_constants.top_sky_color = glm::vec4(color.r, color.g, color.b, 1.0);
+    request_frame();
 }
 
 void RenderSystem::set_bottom_sky_color(glm::vec3 color) 
 {
     push_constants.bottom_sky_color = glm::vec4(color.r, color.g, color.b, 1.0);
+    request_frame();
 }
 
 void RenderSystem::set_sky_transition(float transition) 
 {
     push_constants.sky_transition = transition;
+    request_frame();
 }
 
 
 void RenderSystem::use_openvr(bool useOpenVR) {
     this->using_openvr = useOpenVR;
 }
+
+void RenderSystem::set_max_frame_rate(double frames_per_second)
+{
+    pacer.set_target_rate(frames_per_second);
+    pacer.wake();
+}
+
+double RenderSystem::get_max_frame_rate()
+{
+    return pacer.get_target_rate();
+}
+
+void RenderSystem::set_on_demand_rendering(bool on_demand)
+{
+    this->on_demand = on_demand;
+    pacer.wake();
+}
+
+bool RenderSystem::is_on_demand_rendering()
+{
+    return on_demand;
+}
+
+void RenderSystem::request_frame()
+{
+    frame_requested = true;
+    pacer.wake();
+}
+
+void RenderSystem::set_frustum_culling(bool enabled)
+{
+    frustum_culling = enabled;
+    request_frame();
+}
+
+bool RenderSystem::is_frustum_culling_enabled()
+{
+    return frustum_culling;
+}
+
+void RenderSystem::set_gpu_culling(bool enabled)
+{
+    gpu_culling = enabled;
+    request_frame();
+}
+
+bool RenderSystem::is_gpu_culling_enabled()
+{
+    return gpu_culling;
+}
+
+uint32_t RenderSystem::get_draw_count()
+{
+    return draw_statistics.draws;
+}
+
+uint32_t RenderSystem::get_instance_count()
+{
+    return draw_statistics.instances;
+}
+
+uint32_t RenderSystem::get_pipeline_bind_count()
+{
+    return draw_statistics.pipeline_binds;
+}
+
+uint32_t RenderSystem::get_mesh_bind_count()
+{
+    return draw_statistics.mesh_binds;
+}
+
+uint32_t RenderSystem::get_push_constant_count()
+{
+    return draw_statistics.push_constants;
+}
+
+uint32_t RenderSystem::get_push_constant_bytes()
+{
+    return draw_statistics.push_constant_bytes;
+}
+
+uint32_t RenderSystem::get_light_count()
+{
+    return light_count;
+}
+
+uint32_t RenderSystem::get_light_index_count()
+{
+    return light_index_count;
+}
 } // namespace Systems
@@ -3,10 +3,17 @@
 #include "Pluto/Tools/System.hxx"
 #include "Pluto/Libraries/GLFW/GLFW.hxx"
 #include "Pluto/Libraries/Vulkan/Vulkan.hxx"
+#include "Pluto/Libraries/Vulkan/StorageBuffer.hxx"
+#include "Pluto/Tools/FramePacer.hxx"
+#include "Pluto/Systems/RenderSystem/FrustumCulling.hxx"
+#include "Pluto/Systems/RenderSystem/LightClustering.hxx"
 
 #include "Pluto/Material/PushConstants.hxx"
+#include "Pluto/Material/DrawPacket.hxx"
 
 class Texture;
+class Camera;
+class Entity;
 
 namespace Systems 
 {
@@ -39,6 +46,46 @@ namespace Systems
             void set_sky_transition(float transition);
 
             void use_openvr(bool useOpenVR);
+
+            /* Sets the rate the render loop is paced to, in frames per second. Zero or less leaves it unpaced. */
+            void set_max_frame_rate(double frames_per_second);
+            double get_max_frame_rate();
+
+            /* In on demand mode, frames are only rendered after a component changes, a window is created or resized, 
+                a render setting changes, or request_frame is called. Otherwise no frames are rendered. Component changes, 
+                render settings and request_frame wake the render thread right away, while window changes are picked up 
+                the next time it checks, at most one frame period later. */
+            void set_on_demand_rendering(bool on_demand);
+            bool is_on_demand_rendering();
+
+            /* Renders a frame as soon as possible, including in on demand mode. */
+            void request_frame();
+
+            /* Enables or disables skipping entities whose bounds are outside of every view of a camera. On by default. 
+                Per camera results can be read with Camera::get_visible_entity_count and get_culled_entity_count. */
+            void set_frustum_culling(bool enabled);
+            bool is_frustum_culling_enabled();
+
+            /* Enables or disables culling on the GPU. When enabled, a compute pass culls each camera's entities and fills in 
+                indirect draws, instead of culling on the CPU while recording. Off by default, and ignored if the device can't 
+                support it. Visible counts then include every entity the camera might draw, since culling results stay on the GPU. */
+            void set_gpu_culling(bool enabled);
+            bool is_gpu_culling_enabled();
+
+            /* Counts of the commands recorded during the last frame, summed over every camera. Draws are sorted by state, 
+                so pipelines and meshes are only bound when they change, and entities sharing a pipeline and mesh are drawn 
+                as instances of a single draw. */
+            uint32_t get_draw_count();
+            uint32_t get_instance_count();
+            uint32_t get_pipeline_bind_count();
+            uint32_t get_mesh_bind_count();
+            uint32_t get_push_constant_count();
+            uint32_t get_push_constant_bytes();
+
+            /* The number of lights rendered last frame, and how many light references their froxel clusters held in total.
+                Lights with a range are only listed in the clusters they reach, while lights without one reach every fragment. */
+            uint32_t get_light_count();
+            uint32_t get_light_index_count();
         private:
             PushConsts push_constants;
 
@@ -52,7 +99,34 @@ namespace Systems
             // glm::vec3 bottom_sky_color;
             // float sky_transition;
 
-            double lastTime, currentTime;
+            FramePacer pacer;
+            std::atomic<bool> on_demand {false};
+            std::atomic<bool> frame_requested {false};
+
+            /* True while the loop is in on demand mode with nothing left to render, so changes need to wake it */
+            std::atomic<bool> idle {false};
+
+            /* Frames left to render in on demand mode. Each change renders a frame per slot in flight, so that 
+                swapchains recreated at the end of the first frame are also drawn to. */
+            uint32_t frames_to_render = 0;
+
+            std::atomic<bool> frustum_culling {true};
+            std::atomic<bool> gpu_culling {false};
+
+            /* True if this frame's passes are culled by the culling compute shader */
+            bool culling_on_gpu = false;
+
+            /* World space bounding spheres of this frame's entities. entity_bounds_index maps an entity to 
+                its sphere, or to -1 if the entity has no mesh or transform to bound. */
+            SphereArrays entity_bounds;
+            std::vector<int32_t> entity_bounds_index;
+
+            DrawStatistics draw_statistics;
+            uint32_t light_count = 0;
+            uint32_t light_index_count = 0;
+
+            /* The next free slot in this frame's instance buffer, claimed by each pass as it records */
+            std::atomic<uint32_t> next_instance {0};
 
 
             struct Bucket
@@ -64,15 +138,46 @@ namespace Systems
 
             uint32_t currentFrame = 0;
             
-            std::vector<vk::CommandBuffer> maincmds;
-            std::vector<vk::Fence> maincmd_fences;
+            /* A camera being rendered this frame, and the range of camera_passes recording its renderpasses */
+            struct CameraRecording {
+                uint32_t entity_id;
+                Entity* entity;
+                Camera* camera;
+                Texture* texture;
+                uint32_t first_pass, pass_count;
+                uint32_t first_light_grid;
+            };
+
+            /* One renderpass of one camera, recorded on the worker pool into its own secondary command buffer */
+            struct CameraPass {
+                uint32_t camera_index;
+                uint32_t renderpass_index;
+                vk::CommandBuffer command_buffer;
+                uint32_t visible_count, culled_count;
+                DrawStatistics statistics;
+
+                /* The range of culling candidates this pass recorded, when culling on the GPU */
+                CullingPushConsts culling;
+            };
+
+            std::vector<CameraRecording> camera_recordings;
+            std::vector<CameraPass> camera_passes;
+
+            /* The primary command buffers recorded this frame, submitted by submit_render_commands */
+            std::vector<vk::CommandBuffer> recorded_commands;
+
+            /* The graphics queue's timeline value for the last submission made by each frame in flight */
+            std::vector<uint64_t> frame_submissions;
 
             std::vector<vk::Semaphore> renderCompleteSemaphores;
             vk::Fence main_fence;
-            uint32_t max_frames_in_flight = 2;
+            uint32_t max_frames_in_flight = MAX_FRAMES_IN_FLIGHT;
 
             void record_render_commands();
-            void enqueue_render_commands();
+            void compute_entity_bounds();
+            void assign_lights();
+            void record_camera_pass(CameraPass &pass, PushConsts push_constants);
+            void submit_render_commands();
 
             void stream_frames();
             void present_openvr_frames();
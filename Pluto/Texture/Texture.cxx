@@ -12,12 +12,20 @@
 
 #include <gli/gli.hpp>
 
-Texture Texture::textures[MAX_TEXTURES];
-vk::Sampler Texture::samplers[MAX_SAMPLERS];
+#include <algorithm>
+#include <tuple>
+
+/* Texture ids index directly into the texture descriptor arrays, so texture storage cannot grow past their size.
+    That's MAX_TEXTURES until Initialize finds the device supports larger, bindless arrays. */
+SlotMap<Texture> Texture::textures(MAX_TEXTURES, MAX_TEXTURES);
+std::vector<vk::Sampler> Texture::samplers;
+std::map<Texture::SamplerState, uint32_t> Texture::samplerLookupTable;
+std::mutex Texture::samplerMutex;
+uint32_t Texture::samplerCapacity = MAX_SAMPLERS;
+uint32_t Texture::descriptorCapacity = MAX_TEXTURES;
+std::atomic<uint64_t> Texture::descriptorGeneration {1};
 std::map<std::string, uint32_t> Texture::lookupTable;
-TextureStruct* Texture::pinnedMemory;
-vk::Buffer Texture::ssbo;
-vk::DeviceMemory Texture::ssboMemory;
+Libraries::StorageBuffer Texture::ssbo;
 
 Texture::Texture()
 {
@@ -85,14 +93,8 @@ std::vector<float> Texture::download_color_data(uint32_t width, uint32_t height,
     bufferInfo.sharingMode = vk::SharingMode::eExclusive;
     vk::Buffer stagingBuffer = device.createBuffer(bufferInfo);
 
-    vk::MemoryRequirements stagingMemRequirements = device.getBufferMemoryRequirements(stagingBuffer);
-    vk::MemoryAllocateInfo stagingAllocInfo;
-    stagingAllocInfo.allocationSize = (uint32_t)stagingMemRequirements.size;
-    stagingAllocInfo.memoryTypeIndex = vulkan->find_memory_type(stagingMemRequirements.memoryTypeBits,
-                                                                vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-    vk::DeviceMemory stagingBufferMemory = device.allocateMemory(stagingAllocInfo);
-
-    device.bindBufferMemory(stagingBuffer, stagingBufferMemory, 0);
+    Libraries::MemoryAllocation stagingBufferMemory = vulkan->get_memory_allocator()->allocate_buffer(stagingBuffer,
+        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
 
     /* Create a copy of image */
     vk::ImageCreateInfo imInfo;
@@ -110,15 +112,7 @@ std::vector<float> Texture::download_color_data(uint32_t width, uint32_t height,
     vk::Image blitImage = device.createImage(imInfo);
 
     /* Create memory for that image */
-    vk::MemoryRequirements imageMemReqs = device.getImageMemoryRequirements(blitImage);
-    vk::MemoryAllocateInfo imageAllocInfo;
-    imageAllocInfo.allocationSize = imageMemReqs.size;
-    imageAllocInfo.memoryTypeIndex = vulkan->find_memory_type(
-        imageMemReqs.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
-    vk::DeviceMemory blitImageMemory = device.allocateMemory(imageAllocInfo);
-
-    /* Bind the image with its memory */
-    device.bindImageMemory(blitImage, blitImageMemory, 0);
+    Libraries::MemoryAllocation blitImageMemory = vulkan->get_memory_allocator()->allocate_image(blitImage, vk::MemoryPropertyFlagBits::eDeviceLocal);
 
     /* Now, we need to blit the texture to this host image */
 
@@ -214,20 +208,19 @@ std::vector<float> Texture::download_color_data(uint32_t width, uint32_t height,
         originalLayout,
         srcSubresourceRange);
     data.colorImageLayout = originalLayout;
-    vulkan->end_one_time_graphics_command(cmdBuffer, "download color data", true, submit_immediately);
+    vulkan->end_one_time_graphics_command(cmdBuffer, "download color data", true);
 
     /* Memcpy from host visable image here... */
     /* Copy texture data into staging buffer */
     std::vector<float> result(width * height * depth * 4, 0.0);
-    void *data = device.mapMemory(stagingBufferMemory, 0, width * height * depth * 4 * sizeof(float), vk::MemoryMapFlags());
+    void *data = stagingBufferMemory.mapped;
     memcpy(result.data(), data, width * height * depth * 4 * sizeof(float));
-    device.unmapMemory(stagingBufferMemory);
 
     /* Clean up */
     device.destroyBuffer(stagingBuffer);
-    device.freeMemory(stagingBufferMemory);
+    vulkan->get_memory_allocator()->free(stagingBufferMemory);
     device.destroyImage(blitImage);
-    device.freeMemory(blitImageMemory);
+    vulkan->get_memory_allocator()->free(blitImageMemory);
 
     return result;
 }
@@ -243,6 +236,7 @@ void Texture::set_procedural_color_1(float r, float g, float b, float a)
     if (texture_struct.type == 0)
         throw std::runtime_error("Error: texture must be procedural");
     texture_struct.color1 = glm::vec4(r, g, b, a);
+    mark_dirty();
 }
 
 void Texture::set_procedural_color_2(float r, float g, float b, float a)
@@ -250,6 +244,7 @@ void Texture::set_procedural_color_2(float r, float g, float b, float a)
     if (texture_struct.type == 0)
         throw std::runtime_error("Error: texture must be procedural");
     texture_struct.color2 = glm::vec4(r, g, b, a);
+    mark_dirty();
 }
 
 void Texture::set_procedural_scale(float scale)
@@ -257,6 +252,7 @@ void Texture::set_procedural_scale(float scale)
     if (texture_struct.type == 0)
         throw std::runtime_error("Error: texture must be procedural");
     texture_struct.scale = scale;
+    mark_dirty();
 }
 
 void Texture::upload_color_data(uint32_t width, uint32_t height, uint32_t depth, std::vector<float> color_data, bool submit_immediately)
@@ -277,27 +273,6 @@ void Texture::upload_color_data(uint32_t width, uint32_t height, uint32_t depth,
         throw std::runtime_error( std::string("Not enough data for provided image dimensions"));
 
 
-    /* Create staging buffer */
-    vk::BufferCreateInfo bufferInfo;
-    bufferInfo.size = textureSize;
-    bufferInfo.usage = vk::BufferUsageFlagBits::eTransferSrc;
-    bufferInfo.sharingMode = vk::SharingMode::eExclusive;
-    vk::Buffer stagingBuffer = device.createBuffer(bufferInfo);
-
-    vk::MemoryRequirements stagingMemRequirements = device.getBufferMemoryRequirements(stagingBuffer);
-    vk::MemoryAllocateInfo stagingAllocInfo;
-    stagingAllocInfo.allocationSize = (uint32_t)stagingMemRequirements.size;
-    stagingAllocInfo.memoryTypeIndex = vulkan->find_memory_type(stagingMemRequirements.memoryTypeBits,
-        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-    vk::DeviceMemory stagingBufferMemory = device.allocateMemory(stagingAllocInfo);
-
-    device.bindBufferMemory(stagingBuffer, stagingBufferMemory, 0);
-
-    /* Copy texture data into staging buffer */
-    void *dataptr = device.mapMemory(stagingBufferMemory, 0, textureSize, vk::MemoryMapFlags());
-    memcpy(dataptr, color_data.data(), textureSize);
-    device.unmapMemory(stagingBufferMemory);
-
     /* Setup buffer copy regions for one mip level */
     vk::BufferImageCopy bufferCopyRegion;
     bufferCopyRegion.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
@@ -324,19 +299,10 @@ void Texture::upload_color_data(uint32_t width, uint32_t height, uint32_t depth,
     vk::Image src_image = device.createImage(imageCreateInfo);
 
     /* Allocate and bind memory for the texture */
-    vk::MemoryRequirements imageMemReqs = device.getImageMemoryRequirements(src_image);
-    vk::MemoryAllocateInfo imageAllocInfo;
-    imageAllocInfo.allocationSize = imageMemReqs.size;
-    imageAllocInfo.memoryTypeIndex = vulkan->find_memory_type(
-        imageMemReqs.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
-    vk::DeviceMemory src_image_memory = device.allocateMemory(imageAllocInfo);
-
-    device.bindImageMemory(src_image, src_image_memory, 0);
+    Libraries::MemoryAllocation src_image_memory = vulkan->get_memory_allocator()->allocate_image(src_image, vk::MemoryPropertyFlagBits::eDeviceLocal);
 
     /* END CREATE IMAGE */
 
-    vk::CommandBuffer command_buffer = vulkan->begin_one_time_graphics_command();
-
     /* Which mip level, array layer, layer count, access mask to use */
     vk::ImageSubresourceLayers srcSubresourceLayers;
     srcSubresourceLayers.aspectMask = vk::ImageAspectFlagBits::eColor;
@@ -363,11 +329,12 @@ void Texture::upload_color_data(uint32_t width, uint32_t height, uint32_t depth,
     dstSubresourceRange.levelCount = data.colorMipLevels;
     dstSubresourceRange.layerCount = 1;
 
-    /* First, copy the staging buffer into our temporary source image. */
-    setImageLayout(command_buffer, src_image, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal, srcSubresourceRange);
+    /* First, stage the data for our temporary source image. The upload batch is sent ahead of the blit below, 
+        and leaves the image ready to be blitted from. */
+    vulkan->get_upload_queue()->upload_image(src_image, imageCreateInfo.extent, color_data.data(), textureSize, {bufferCopyRegion}, srcSubresourceRange,
+        vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferSrcOptimal);
 
-    /* Copy mip levels from staging buffer */
-    command_buffer.copyBufferToImage(stagingBuffer, src_image, vk::ImageLayout::eTransferDstOptimal, 1, &bufferCopyRegion);
+    vk::CommandBuffer command_buffer = vulkan->begin_one_time_graphics_command();
 
     /* Region to copy (Possibly multiple in the future) */
     vk::ImageBlit region;
@@ -381,9 +348,6 @@ void Texture::upload_color_data(uint32_t width, uint32_t height, uint32_t depth,
     /* Next, specify the filter we'd like to use */
     vk::Filter filter = vk::Filter::eLinear;
 
-    /* transition source to VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL  */
-    setImageLayout(command_buffer, src_image, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eTransferSrcOptimal, srcSubresourceRange);
-
     /* transition source to VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL  */
     setImageLayout(command_buffer, data.colorImage, data.colorImageLayout, vk::ImageLayout::eTransferDstOptimal, dstSubresourceRange);
 
@@ -396,12 +360,10 @@ void Texture::upload_color_data(uint32_t width, uint32_t height, uint32_t depth,
     /* transition source back VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL  */
     setImageLayout(command_buffer, data.colorImage, vk::ImageLayout::eTransferDstOptimal, data.colorImageLayout, dstSubresourceRange);
 
-    vulkan->end_one_time_graphics_command(command_buffer, "upload color data", true, submit_immediately);
+    vulkan->end_one_time_graphics_command(command_buffer, "upload color data", true);
 
     device.destroyImage(src_image);
-    device.freeMemory(src_image_memory);
-    device.destroyBuffer(stagingBuffer);
-    device.freeMemory(stagingBufferMemory);
+    vulkan->get_memory_allocator()->free(src_image_memory);
 }
 
 void Texture::record_blit_to(vk::CommandBuffer command_buffer, Texture * other, uint32_t layer)
@@ -471,6 +433,20 @@ void Texture::record_blit_to(vk::CommandBuffer command_buffer, Texture * other,
 // TODO
 void Texture::Initialize()
 {
+    auto vulkan = Libraries::Vulkan::Get();
+
+    /* With bindless descriptors, the texture table can grow past MAX_TEXTURES. The 2D, cube and 3D arrays 
+        are all visible to the same stages, so they split the device's sampled image limit. */
+    if (vulkan->is_bindless_enabled()) {
+        auto limits = vulkan->get_physical_device_descriptor_indexing_properties();
+        uint32_t sampled_images = std::min(limits.maxPerStageDescriptorUpdateAfterBindSampledImages, limits.maxDescriptorSetUpdateAfterBindSampledImages);
+        uint32_t sampler_limit = std::min(limits.maxPerStageDescriptorUpdateAfterBindSamplers, limits.maxDescriptorSetUpdateAfterBindSamplers);
+        descriptorCapacity = std::max((uint32_t) MAX_TEXTURES, std::min((uint32_t) MAX_BINDLESS_TEXTURES, sampled_images / 3));
+        samplerCapacity = std::max((uint32_t) MAX_SAMPLERS, std::min((uint32_t) MAX_BINDLESS_SAMPLERS, sampler_limit));
+        textures.set_max_capacity(descriptorCapacity);
+    }
+    samplers.assign(samplerCapacity, vk::Sampler());
+
     // Create the default texture here
     std::string resource_path = Options::GetResourcePath();
     CreateFromKTX("BRDF", resource_path + "/Defaults/brdf-lut.ktx");
@@ -479,7 +455,6 @@ void Texture::Initialize()
     CreateFromKTX("DefaultTex3D", resource_path + "/Defaults/missing-volume.ktx");    
     // fatal error here if result is nullptr...
 
-    auto vulkan = Libraries::Vulkan::Get();
     auto device = vulkan->get_device();
     if (device == vk::Device())
         throw std::runtime_error( std::string("Invalid vulkan device"));
@@ -488,72 +463,142 @@ void Texture::Initialize()
     if (physical_device == vk::PhysicalDevice())
         throw std::runtime_error( std::string("Invalid vulkan physical device"));
 
-    vk::BufferCreateInfo bufferInfo = {};
-    bufferInfo.size = MAX_TEXTURES * sizeof(TextureStruct);
-    bufferInfo.usage = vk::BufferUsageFlagBits::eStorageBuffer;
-    bufferInfo.sharingMode = vk::SharingMode::eExclusive;
-    ssbo = device.createBuffer(bufferInfo);
+    ssbo.create(textures.get_capacity() * sizeof(TextureStruct));
+    textures.mark_all_dirty();
+
+    /* Create the default sampler, which every texture starts out with. Being first, it's always sampler 0. */
+    GetSamplerId(vk::Filter::eLinear, vk::SamplerMipmapMode::eLinear, vk::SamplerAddressMode::eClampToEdge, 16.0f);
+}
+
+bool Texture::SamplerState::operator<(const SamplerState &other) const
+{
+    return std::tie(filter, mipmapMode, addressMode, maxAnisotropy) 
+        < std::tie(other.filter, other.mipmapMode, other.addressMode, other.maxAnisotropy);
+}
 
-    vk::MemoryRequirements memReqs = device.getBufferMemoryRequirements(ssbo);
-    vk::MemoryAllocateInfo allocInfo = {};
-    allocInfo.allocationSize = memReqs.size;
+uint32_t Texture::GetSamplerId(vk::Filter filter, vk::SamplerMipmapMode mipmap_mode, vk::SamplerAddressMode address_mode, float max_anisotropy)
+{
+    auto vulkan = Libraries::Vulkan::Get();
+    auto device = vulkan->get_device();
+    if (device == vk::Device())
+        throw std::runtime_error( std::string("Invalid vulkan device"));
 
-    vk::PhysicalDeviceMemoryProperties memProperties = physical_device.getMemoryProperties();
-    vk::MemoryPropertyFlags properties = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
-    allocInfo.memoryTypeIndex = vulkan->find_memory_type(memReqs.memoryTypeBits, properties);
+    /* Clamp anisotropy to what the device supports first, so requests past the limit share a sampler */
+    float anisotropy_limit = (vulkan->get_physical_device_features().samplerAnisotropy) ? 
+        vulkan->get_physical_device_properties().limits.maxSamplerAnisotropy : 1.0f;
+    max_anisotropy = std::max(1.0f, std::min(max_anisotropy, anisotropy_limit));
 
-    ssboMemory = device.allocateMemory(allocInfo);
-    device.bindBufferMemory(ssbo, ssboMemory, 0);
+    SamplerState state = {filter, mipmap_mode, address_mode, max_anisotropy};
+    std::lock_guard<std::mutex> lock(samplerMutex);
+    auto existing = samplerLookupTable.find(state);
+    if (existing != samplerLookupTable.end()) return existing->second;
 
-    /* Pin the buffer */
-    pinnedMemory = (TextureStruct*) device.mapMemory(ssboMemory, 0, MAX_TEXTURES * sizeof(TextureStruct));
+    uint32_t id = (uint32_t) samplerLookupTable.size();
+    if (id >= samplers.size())
+        throw std::runtime_error(std::string("Error: max sampler limit of " + std::to_string(samplers.size()) + " reached."));
 
-    /* Create a sampler to sample from the attachment in the fragment shader */
     vk::SamplerCreateInfo sInfo;
-    sInfo.magFilter = vk::Filter::eLinear;
-    sInfo.minFilter = vk::Filter::eLinear;
-    sInfo.mipmapMode = vk::SamplerMipmapMode::eLinear;
-    sInfo.addressModeU = vk::SamplerAddressMode::eClampToEdge;
-    sInfo.addressModeV = vk::SamplerAddressMode::eClampToEdge;
-    sInfo.addressModeW = vk::SamplerAddressMode::eClampToEdge;
+    sInfo.magFilter = filter;
+    sInfo.minFilter = filter;
+    sInfo.mipmapMode = mipmap_mode;
+    sInfo.addressModeU = address_mode;
+    sInfo.addressModeV = address_mode;
+    sInfo.addressModeW = address_mode;
     sInfo.mipLodBias = 0.0;
-    sInfo.maxAnisotropy = 16.0; // todo, get limit here.
-    sInfo.anisotropyEnable = VK_TRUE;
+    sInfo.maxAnisotropy = max_anisotropy;
+    sInfo.anisotropyEnable = (max_anisotropy > 1.0f) ? VK_TRUE : VK_FALSE;
     sInfo.minLod = 0.0;
     sInfo.maxLod = 12.0;
     sInfo.borderColor = vk::BorderColor::eFloatTransparentBlack;
-    samplers[0] = device.createSampler(sInfo);
+    samplers[id] = device.createSampler(sInfo);
+    samplerLookupTable[state] = id;
+
+    /* The new sampler needs to be written into the sampler descriptor array */
+    descriptorGeneration++;
+    return id;
 }
 
+uint32_t Texture::GetSamplerCount()
+{
+    std::lock_guard<std::mutex> lock(samplerMutex);
+    return (uint32_t) samplerLookupTable.size();
+}
 
-void Texture::UploadSSBO()
+uint32_t Texture::GetSamplerCapacity()
 {
-    if (pinnedMemory == nullptr) return;
-    TextureStruct texture_structs[MAX_TEXTURES];
-    
-    /* TODO: remove this for loop */
-    for (int i = 0; i < MAX_TEXTURES; ++i) {
-        if (!textures[i].is_initialized()) continue;
-        texture_structs[i] = textures[i].texture_struct;
-    };
-
-    /* Copy to GPU mapped memory */
-    memcpy(pinnedMemory, texture_structs, sizeof(texture_structs));
+    return samplerCapacity;
+}
+
+uint32_t Texture::GetDescriptorCapacity()
+{
+    return descriptorCapacity;
+}
+
+void Texture::set_sampler(bool linear, bool repeat, float max_anisotropy)
+{
+    uint32_t sampler_id = GetSamplerId(
+        (linear) ? vk::Filter::eLinear : vk::Filter::eNearest,
+        (linear) ? vk::SamplerMipmapMode::eLinear : vk::SamplerMipmapMode::eNearest,
+        (repeat) ? vk::SamplerAddressMode::eRepeat : vk::SamplerAddressMode::eClampToEdge,
+        max_anisotropy);
+    data.colorSamplerId = sampler_id;
+    texture_struct.sampler_id = (int32_t) sampler_id;
+    mark_dirty();
+}
+
+
+void Texture::UploadSSBO(uint32_t frame)
+{
+    if (!ssbo.is_created()) return;
+
+    /* Grow the SSBO if the texture table grew since the last upload */
+    ssbo.reserve(textures.get_capacity() * sizeof(TextureStruct));
+
+    /* Copy only the modified textures into the staging copy, then bring this frame's copy of the SSBO up to date */
+    TextureStruct* texture_structs = (TextureStruct*) ssbo.get_staging();
+    textures.consume_dirty_ranges([&](uint32_t first, uint32_t count) {
+        for (uint32_t i = first; i < first + count; ++i)
+            texture_structs[i] = textures[i].texture_struct;
+        ssbo.mark_range(first * sizeof(TextureStruct), count * sizeof(TextureStruct));
+    });
+    ssbo.flush(frame);
 }
 
 vk::Buffer Texture::GetSSBO()
 {
-    return ssbo;
+    return ssbo.get_buffer();
 }
 
 uint32_t Texture::GetSSBOSize()
 {
-    return MAX_TEXTURES * sizeof(TextureStruct);
+    return (uint32_t) ssbo.get_size();
+}
+
+uint32_t Texture::GetSSBOOffset(uint32_t frame)
+{
+    return (uint32_t) ssbo.get_offset(frame);
+}
+
+uint64_t Texture::GetSSBOBytesUploaded()
+{
+    return ssbo.get_bytes_uploaded();
+}
+
+uint64_t Texture::GetSSBOGeneration()
+{
+    return ssbo.get_generation();
+}
+
+void Texture::mark_dirty()
+{
+    if (!initialized) return;
+    textures.mark_dirty(id);
+    descriptorGeneration++;
 }
 
 void Texture::CleanUp()
 {
-    for (int i = 0; i < MAX_TEXTURES; ++i)
+    for (uint32_t i = 0; i < textures.get_capacity(); ++i)
         textures[i].cleanup();
 
     auto vulkan = Libraries::Vulkan::Get();
@@ -563,15 +608,15 @@ void Texture::CleanUp()
     if (device == vk::Device())
         throw std::runtime_error( std::string("Invalid vulkan device"));
 
-    for (int i = 0; i < MAX_SAMPLERS; ++i) {
+    for (uint32_t i = 0; i < samplers.size(); ++i) {
         if (samplers[i] != vk::Sampler()) {
             device.destroySampler(samplers[i]);
         }
     }
+    samplers.clear();
+    samplerLookupTable.clear();
 
-    device.destroyBuffer(ssbo);
-    device.unmapMemory(ssboMemory);
-    device.freeMemory(ssboMemory);
+    ssbo.destroy();
 }
 
 std::vector<vk::ImageView> Texture::GetImageViews(vk::ImageViewType view_type) 
@@ -583,10 +628,10 @@ std::vector<vk::ImageView> Texture::GetImageViews(vk::ImageViewType view_type)
     else if (view_type == vk::ImageViewType::eCube) DefaultTex = Get("DefaultTexCube");
     else return {};
 
-    std::vector<vk::ImageView> image_views(MAX_TEXTURES);
+    std::vector<vk::ImageView> image_views(textures.get_capacity());
 
     // For each texture
-    for (int i = 0; i < MAX_TEXTURES; ++i) {
+    for (uint32_t i = 0; i < image_views.size(); ++i) {
         if (textures[i].initialized 
             && (textures[i].data.colorImageView != vk::ImageView())
             && (textures[i].data.colorImageLayout == vk::ImageLayout::eShaderReadOnlyOptimal) 
@@ -858,6 +903,7 @@ void Texture::loadKTX(std::string imagePath, bool submit_immediately)
     cleanup();
 
     texture_struct.mip_levels = data.colorMipLevels;
+    mark_dirty();
 
     auto vulkan = Libraries::Vulkan::Get();
     if (!vulkan->is_initialized())
@@ -877,27 +923,6 @@ void Texture::loadKTX(std::string imagePath, bool submit_immediately)
         && formatProperties.optimalTilingFeatures == vk::FormatFeatureFlags())
         throw std::runtime_error( std::string("Error: Unsupported image format used in " + imagePath));
 
-    /* Create staging buffer */
-    vk::BufferCreateInfo bufferInfo;
-    bufferInfo.size = textureSize;
-    bufferInfo.usage = vk::BufferUsageFlagBits::eTransferSrc;
-    bufferInfo.sharingMode = vk::SharingMode::eExclusive;
-    vk::Buffer stagingBuffer = device.createBuffer(bufferInfo);
-
-    vk::MemoryRequirements stagingMemRequirements = device.getBufferMemoryRequirements(stagingBuffer);
-    vk::MemoryAllocateInfo stagingAllocInfo;
-    stagingAllocInfo.allocationSize = (uint32_t)stagingMemRequirements.size;
-    stagingAllocInfo.memoryTypeIndex = vulkan->find_memory_type(stagingMemRequirements.memoryTypeBits,
-        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-    vk::DeviceMemory stagingBufferMemory = device.allocateMemory(stagingAllocInfo);
-
-    device.bindBufferMemory(stagingBuffer, stagingBufferMemory, 0);
-
-    /* Copy texture data into staging buffer */
-    void *dataptr = device.mapMemory(stagingBufferMemory, 0, textureSize, vk::MemoryMapFlags());
-    memcpy(dataptr, textureData, textureSize);
-    device.unmapMemory(stagingBufferMemory);
-
     /* Setup buffer copy regions for each mip level */
     std::vector<vk::BufferImageCopy> bufferCopyRegions;
     uint32_t offset = 0;
@@ -954,55 +979,21 @@ void Texture::loadKTX(std::string imagePath, bool submit_immediately)
     data.colorImage = device.createImage(imageCreateInfo);
 
     /* Allocate and bind memory for the texture */
-    vk::MemoryRequirements imageMemReqs = device.getImageMemoryRequirements(data.colorImage);
-    vk::MemoryAllocateInfo imageAllocInfo;
-    imageAllocInfo.allocationSize = imageMemReqs.size;
-    imageAllocInfo.memoryTypeIndex = vulkan->find_memory_type(
-        imageMemReqs.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
-    data.colorImageMemory = device.allocateMemory(imageAllocInfo);
+    data.colorImageMemory = vulkan->get_memory_allocator()->allocate_image(data.colorImage, vk::MemoryPropertyFlagBits::eDeviceLocal);
 
-    device.bindImageMemory(data.colorImage, data.colorImageMemory, 0);
-
-    /* Create a command buffer for changing layouts and copying */
-    vk::CommandBuffer copyCmd = vulkan->begin_one_time_graphics_command();
-
-    /* Transition between formats */
+    /* Every mip level and layer of the image */
     vk::ImageSubresourceRange subresourceRange;
     subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
     subresourceRange.baseMipLevel = 0;
     subresourceRange.levelCount = data.colorMipLevels;
     subresourceRange.layerCount = data.layers;
 
-    /* Transition to transfer destination optimal */
-    setImageLayout(
-        copyCmd,
-        data.colorImage,
-        vk::ImageLayout::eUndefined,
-        vk::ImageLayout::eTransferDstOptimal,
-        subresourceRange);
-
-    /* Copy mip levels from staging buffer */
-    copyCmd.copyBufferToImage(
-        stagingBuffer,
-        data.colorImage,
-        vk::ImageLayout::eTransferDstOptimal,
-        (uint32_t)bufferCopyRegions.size(),
-        bufferCopyRegions.data());
-
-    /* Transition to shader read optimal */
+    /* Stage the mip levels. They're copied in with the next upload batch, which leaves the image shader read optimal. */
+    auto uploads = vulkan->get_upload_queue();
+    uploadToken = uploads->upload_image(data.colorImage, imageCreateInfo.extent, textureData, textureSize, bufferCopyRegions, subresourceRange,
+        vk::ImageLayout::eUndefined, vk::ImageLayout::eShaderReadOnlyOptimal, gli::block_size(texture.format()));
     data.colorImageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
-    setImageLayout(
-        copyCmd,
-        data.colorImage,
-        vk::ImageLayout::eTransferDstOptimal,
-        vk::ImageLayout::eShaderReadOnlyOptimal,
-        subresourceRange);
-
-    vulkan->end_one_time_graphics_command(copyCmd, "transition new ktx image", true, submit_immediately);
-
-    /* Clean up staging resources */
-    device.destroyBuffer(stagingBuffer);
-    device.freeMemory(stagingBufferMemory);
+    if (submit_immediately) uploads->flush();
     
     /* Create the image view */
     vk::ImageViewCreateInfo vInfo;
@@ -1040,7 +1031,7 @@ void Texture::create_color_image_resources(bool submit_immediately)
 
     /* Free Memory */
     if (data.colorImageMemory)
-        device.freeMemory(data.colorImageMemory);
+        vulkan->get_memory_allocator()->free(data.colorImageMemory);
 
     /* For now, assume the following format: */
     data.colorFormat = vk::Format::eR16G16B16A16Sfloat;
@@ -1065,12 +1056,7 @@ void Texture::create_color_image_resources(bool submit_immediately)
     }
     data.colorImage = device.createImage(imageInfo);
 
-    vk::MemoryRequirements memReqs = device.getImageMemoryRequirements(data.colorImage);
-    vk::MemoryAllocateInfo memAlloc;
-    memAlloc.allocationSize = memReqs.size;
-    memAlloc.memoryTypeIndex = vulkan->find_memory_type(memReqs.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
-    data.colorImageMemory = device.allocateMemory(memAlloc);
-    device.bindImageMemory(data.colorImage, data.colorImageMemory, 0);
+    data.colorImageMemory = vulkan->get_memory_allocator()->allocate_image(data.colorImage, vk::MemoryPropertyFlagBits::eDeviceLocal);
 
     /* Transition to a usable format */
     vk::ImageSubresourceRange subresourceRange;
@@ -1083,7 +1069,7 @@ void Texture::create_color_image_resources(bool submit_immediately)
     vk::CommandBuffer cmdBuffer = vulkan->begin_one_time_graphics_command();
     setImageLayout(cmdBuffer, data.colorImage, vk::ImageLayout::eUndefined, vk::ImageLayout::eColorAttachmentOptimal, subresourceRange);
     data.colorImageLayout = vk::ImageLayout::eColorAttachmentOptimal;
-    vulkan->end_one_time_graphics_command(cmdBuffer, "transition new color image", true, submit_immediately);
+    vulkan->end_one_time_graphics_command(cmdBuffer, "transition new color image", true);
 
     /* Create the image view */
     vk::ImageViewCreateInfo vInfo;
@@ -1135,7 +1121,7 @@ void Texture::create_depth_stencil_resources(bool submit_immediately)
 
     /* Free Memory */
     if (data.depthImageMemory)
-        device.freeMemory(data.depthImageMemory);
+        vulkan->get_memory_allocator()->free(data.depthImageMemory);
 
     bool result = get_supported_depth_format(physicalDevice, &data.depthFormat);
     if (!result)
@@ -1161,12 +1147,7 @@ void Texture::create_depth_stencil_resources(bool submit_immediately)
     }
     data.depthImage = device.createImage(imageInfo);
 
-    vk::MemoryRequirements memReqs = device.getImageMemoryRequirements(data.depthImage);
-    vk::MemoryAllocateInfo memAlloc;
-    memAlloc.allocationSize = memReqs.size;
-    memAlloc.memoryTypeIndex = vulkan->find_memory_type(memReqs.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
-    data.depthImageMemory = device.allocateMemory(memAlloc);
-    device.bindImageMemory(data.depthImage, data.depthImageMemory, 0);
+    data.depthImageMemory = vulkan->get_memory_allocator()->allocate_image(data.depthImage, vk::MemoryPropertyFlagBits::eDeviceLocal);
 
     /* Transition to a usable format */
     vk::ImageSubresourceRange subresourceRange;
@@ -1179,7 +1160,7 @@ void Texture::create_depth_stencil_resources(bool submit_immediately)
     vk::CommandBuffer cmdBuffer = vulkan->begin_one_time_graphics_command();
     setImageLayout(cmdBuffer, data.depthImage, vk::ImageLayout::eUndefined, vk::ImageLayout::eDepthStencilAttachmentOptimal, subresourceRange);
     data.depthImageLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
-    vulkan->end_one_time_graphics_command(cmdBuffer, "transition new depth image", true, submit_immediately);
+    vulkan->end_one_time_graphics_command(cmdBuffer, "transition new depth image", true);
 
     /* Create the image view */
     vk::ImageViewCreateInfo vInfo;
@@ -1266,6 +1247,9 @@ void Texture::cleanup()
     if (device == vk::Device())
         throw std::runtime_error( std::string("Invalid vulkan device"));
 
+    /* Staged data may not have been copied into the image yet */
+    if (uploadToken) vulkan->get_upload_queue()->wait(uploadToken);
+
     /* Destroy samplers */
     // if (data.colorSampler)
     //     device.destroySampler(data.colorSampler);
@@ -1286,9 +1270,9 @@ void Texture::cleanup()
 
     /* Free Memory */
     if (data.colorImageMemory)
-        device.freeMemory(data.colorImageMemory);
+        vulkan->get_memory_allocator()->free(data.colorImageMemory);
     if (data.depthImageMemory)
-        device.freeMemory(data.depthImageMemory);
+        vulkan->get_memory_allocator()->free(data.depthImageMemory);
 }
 
 std::vector<vk::Sampler> Texture::GetSamplers() 
@@ -1296,10 +1280,10 @@ std::vector<vk::Sampler> Texture::GetSamplers()
     // Get the default texture (for now, just use the default 2D texture)
     auto DefaultTex = Get("DefaultTex2D");
     
-    std::vector<vk::Sampler> samplers_(MAX_SAMPLERS);
+    std::vector<vk::Sampler> samplers_(samplers.size());
 
-    // For each texture
-    for (int i = 0; i < MAX_SAMPLERS; ++i) {
+    // For each sampler
+    for (uint32_t i = 0; i < samplers.size(); ++i) {
         if (samplers[i] == vk::Sampler())
             samplers_[i] = samplers[0]; //  Sampler 0 is always defined. (this might change)
         else
@@ -1319,10 +1303,10 @@ std::vector<vk::ImageLayout> Texture::GetLayouts(vk::ImageViewType view_type)
     else if (view_type == vk::ImageViewType::eCube) DefaultTex = Get("DefaultTexCube");
     else return {};
 
-    std::vector<vk::ImageLayout> layouts(MAX_TEXTURES);
+    std::vector<vk::ImageLayout> layouts(textures.get_capacity());
 
     // For each texture
-    for (int i = 0; i < MAX_TEXTURES; ++i) {
+    for (uint32_t i = 0; i < layouts.size(); ++i) {
         if (textures[i].initialized 
             && (textures[i].data.colorImageView != vk::ImageView())
             && (textures[i].data.colorImageLayout == vk::ImageLayout::eShaderReadOnlyOptimal) 
@@ -1340,20 +1324,49 @@ std::vector<vk::ImageLayout> Texture::GetLayouts(vk::ImageViewType view_type)
     return layouts;
 }
 
+uint32_t Texture::GetImageInfos(vk::ImageViewType view_type, vk::DescriptorImageInfo *infos)
+{
+    // Get the default texture
+    Texture *DefaultTex;
+    if (view_type == vk::ImageViewType::e2D) DefaultTex = Get("DefaultTex2D");
+    else if (view_type == vk::ImageViewType::e3D) DefaultTex = Get("DefaultTex3D");
+    else if (view_type == vk::ImageViewType::eCube) DefaultTex = Get("DefaultTexCube");
+    else return 0;
+
+    uint32_t count = textures.get_capacity();
+    for (uint32_t i = 0; i < count; ++i) {
+        bool usable = textures[i].initialized 
+            && (textures[i].data.colorImageView != vk::ImageView())
+            && (textures[i].data.colorImageLayout == vk::ImageLayout::eShaderReadOnlyOptimal) 
+            && (textures[i].data.viewType == view_type);
+        auto &texture = (usable) ? textures[i] : *DefaultTex;
+        infos[i].sampler = vk::Sampler();
+        infos[i].imageView = texture.data.colorImageView;
+        infos[i].imageLayout = texture.data.colorImageLayout;
+    }
+    return count;
+}
+
+uint64_t Texture::GetDescriptorGeneration()
+{
+    return descriptorGeneration;
+}
+
 /* Static Factory Implementations */
 Texture *Texture::CreateFromKTX(std::string name, std::string filepath, bool submit_immediately)
 {
-    auto tex = StaticFactory::Create(name, "Texture", lookupTable, textures, MAX_TEXTURES);
+    auto tex = StaticFactory::Create(name, "Texture", lookupTable, textures);
     if (!tex) return nullptr;
     tex->loadKTX(filepath, submit_immediately);
     tex->texture_struct.sampler_id = 0;
+    tex->mark_dirty();
     return tex;
 }
 
 Texture* Texture::CreateCubemap(
     std::string name, uint32_t width, uint32_t height, bool hasColor, bool hasDepth, bool submit_immediately) 
 {
-    auto tex = StaticFactory::Create(name, "Texture", lookupTable, textures, MAX_TEXTURES);
+    auto tex = StaticFactory::Create(name, "Texture", lookupTable, textures);
     if (!tex) return nullptr;
 
     tex->data.width = width;
@@ -1364,6 +1377,7 @@ Texture* Texture::CreateCubemap(
     if (hasColor) tex->create_color_image_resources(submit_immediately);
     if (hasDepth) tex->create_depth_stencil_resources(submit_immediately);
     tex->texture_struct.sampler_id = 0;
+    tex->mark_dirty();
     return tex;
 }
 
@@ -1373,11 +1387,12 @@ Texture* Texture::CreateChecker(std::string name, bool submit_immediately)
     std::string ResourcePath = Options::GetResourcePath();
     auto checkerTexturePath = ResourcePath + std::string("/Defaults/checker.ktx");
 
-    auto tex = StaticFactory::Create(name, "Texture", lookupTable, textures, MAX_TEXTURES);
+    auto tex = StaticFactory::Create(name, "Texture", lookupTable, textures);
     if (!tex) return nullptr;
     tex->texture_struct.type = 1;
     tex->texture_struct.mip_levels = 0;
     tex->texture_struct.sampler_id = 0;
+    tex->mark_dirty();
     return tex;
 }
 
@@ -1386,7 +1401,7 @@ Texture* Texture::Create2D(
     bool hasColor, bool hasDepth, uint32_t sampleCount, uint32_t layers, 
     bool submit_immediately)
 {
-    auto tex = StaticFactory::Create(name, "Texture", lookupTable, textures, MAX_TEXTURES);
+    auto tex = StaticFactory::Create(name, "Texture", lookupTable, textures);
     if (!tex) return nullptr;
 
     auto vulkan = Libraries::Vulkan::Get();
@@ -1408,6 +1423,7 @@ Texture* Texture::Create2D(
     if (hasDepth) tex->create_depth_stencil_resources(submit_immediately);
 
     tex->texture_struct.sampler_id = 0;
+    tex->mark_dirty();
 
     return tex;
 }
@@ -1415,7 +1431,7 @@ Texture* Texture::Create2D(
 Texture* Texture::Create2DFromColorData (
     std::string name, uint32_t width, uint32_t height, std::vector<float> data, bool submit_immediately)
 {
-    auto tex = StaticFactory::Create(name, "Texture", lookupTable, textures, MAX_TEXTURES);
+    auto tex = StaticFactory::Create(name, "Texture", lookupTable, textures);
     if (!tex) return nullptr;
     tex->data.width = width;
     tex->data.height = height;
@@ -1426,38 +1442,46 @@ Texture* Texture::Create2DFromColorData (
     tex->upload_color_data(width, height, 1, data);
 
     tex->texture_struct.sampler_id = 0;
+    tex->mark_dirty();
     return tex;
 }
 
 Texture* Texture::CreateFromExternalData(std::string name, Data data)
 {
-    auto tex = StaticFactory::Create(name, "Texture", lookupTable, textures, MAX_TEXTURES);
+    auto tex = StaticFactory::Create(name, "Texture", lookupTable, textures);
     if (!tex) return nullptr;
     tex->setData(data);
     tex->texture_struct.sampler_id = 0;
+    tex->mark_dirty();
     return tex;
 }
 
 Texture* Texture::Get(std::string name) {
-    return StaticFactory::Get(name, "Texture", lookupTable, textures, MAX_TEXTURES);
+    return StaticFactory::Get(name, "Texture", lookupTable, textures);
 }
 
 Texture* Texture::Get(uint32_t id) {
-    return StaticFactory::Get(id, "Texture", lookupTable, textures, MAX_TEXTURES);
+    return StaticFactory::Get(id, "Texture", lookupTable, textures);
+}
+
+Texture* Texture::Get(uint32_t id, uint32_t generation) {
+    return StaticFactory::Get(id, generation, "Texture", lookupTable, textures);
 }
 
 void Texture::Delete(std::string name) {
-    StaticFactory::Delete(name, "Texture", lookupTable, textures, MAX_TEXTURES);
+    StaticFactory::Delete(name, "Texture", lookupTable, textures);
+    descriptorGeneration++;
 }
 
 void Texture::Delete(uint32_t id) {
-    StaticFactory::Delete(id, "Texture", lookupTable, textures, MAX_TEXTURES);
+    StaticFactory::Delete(id, "Texture", lookupTable, textures);
+    descriptorGeneration++;
 }
 
-Texture* Texture::GetFront() {
-    return textures;
+Texture* Texture::GetFromIndex(uint32_t index) {
+    return StaticFactory::GetFromIndex(index, textures);
 }
 
 uint32_t Texture::GetCount() {
-    return MAX_TEXTURES;
+    return textures.get_capacity();
 }
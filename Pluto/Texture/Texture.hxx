@@ -1,10 +1,13 @@
 #pragma once
 
+#include <atomic>
 #include <iostream>
 #include <map>
+#include <mutex>
 #include <vector>
 
 #include "Pluto/Libraries/Vulkan/Vulkan.hxx"
+#include "Pluto/Libraries/Vulkan/StorageBuffer.hxx"
 #include "Pluto/Tools/StaticFactory.hxx"
 #include "Pluto/Texture/TextureStruct.hxx"
 
@@ -17,7 +20,7 @@ class Texture : public StaticFactory
 		{
 			vk::Image colorImage, depthImage;
 			vk::Format colorFormat, depthFormat;
-			vk::DeviceMemory colorImageMemory, depthImageMemory;
+			Libraries::MemoryAllocation colorImageMemory, depthImageMemory;
             vk::ImageView colorImageView, depthImageView;
             std::vector<vk::ImageView> colorImageViewLayers, depthImageViewLayers;
 			vk::ImageLayout colorImageLayout, depthImageLayout;
@@ -53,8 +56,11 @@ class Texture : public StaticFactory
 		/* Retrieves a texture component by id */
 		static Texture *Get(uint32_t id);
 
-		/* Returns a pointer to the list of texture components */
-		static Texture *GetFront();
+		/* Retrieves a texture component by id, failing if that texture has since been deleted and its slot reused */
+		static Texture *Get(uint32_t id, uint32_t generation);
+
+		/* Returns the texture in the given slot, initialized or not, or nullptr if the slot is out of range */
+		static Texture *GetFromIndex(uint32_t index);
 
 		/* Returns the total number of reserved textures */
 		static uint32_t GetCount();
@@ -69,7 +75,7 @@ class Texture : public StaticFactory
 		static void Initialize();
 
 		/* Transfers all texture components to an SSBO */
-        static void UploadSSBO();
+        static void UploadSSBO(uint32_t frame);
 
 		/* Returns the SSBO vulkan buffer handle */
         static vk::Buffer GetSSBO();
@@ -77,10 +83,38 @@ class Texture : public StaticFactory
         /* Returns the size in bytes of the current texture SSBO */
         static uint32_t GetSSBOSize();
 
-		/* Returns a list of samplers corresponding to the texture list, or defaults if the texture isn't usable. 
+        /* Returns the byte offset of the given frame's copy within the SSBO */
+        static uint32_t GetSSBOOffset(uint32_t frame);
+
+        /* Returns the total number of bytes written into the texture SSBO, for measuring upload traffic */
+        static uint64_t GetSSBOBytesUploaded();
+
+        /* Returns an id which changes whenever the SSBO is reallocated, so descriptors know to be rewritten */
+        static uint64_t GetSSBOGeneration();
+
+        /* Flags this texture to be copied into the SSBO on the next upload. Called by every setter. */
+        void mark_dirty();
+
+		/* Returns GetSamplerCapacity() samplers, with sampler 0 standing in for sampler ids not yet in use. 
 			Useful for updating descriptor sets. */
 		static std::vector<vk::Sampler> GetSamplers();
 
+		/* Returns the id of a sampler with the given state, creating it if no texture has used that state yet. 
+			Throws if the sampler table is full. */
+		static uint32_t GetSamplerId(vk::Filter filter, vk::SamplerMipmapMode mipmap_mode, vk::SamplerAddressMode address_mode, float max_anisotropy);
+
+		/* Returns the number of distinct samplers created so far */
+		static uint32_t GetSamplerCount();
+
+		/* Returns the number of samplers the sampler descriptor array holds. MAX_SAMPLERS, unless bindless 
+			descriptors are enabled, in which case it's sized from the device limits up to MAX_BINDLESS_SAMPLERS. */
+		static uint32_t GetSamplerCapacity();
+
+		/* Returns the number of textures each texture descriptor array holds, and so the most textures which can 
+			exist at once. MAX_TEXTURES, unless bindless descriptors are enabled, in which case it's sized from the 
+			device limits up to MAX_BINDLESS_TEXTURES. */
+		static uint32_t GetDescriptorCapacity();
+
 		/* Returns a list of samplers corresponding to the texture list, or defaults if the texture isn't usable. 
 			Useful for updating descriptor sets. */
 		static std::vector<vk::ImageView> GetImageViews(vk::ImageViewType view_type);
@@ -89,6 +123,15 @@ class Texture : public StaticFactory
 			Useful for updating descriptor sets. */
 		static std::vector<vk::ImageLayout> GetLayouts(vk::ImageViewType view_type);
 
+		/* Fills one image info per texture slot (GetCount() of them) with the view and layout of each texture of the 
+			given view type, or of the default texture if the texture isn't usable. Like GetImageViews and GetLayouts, 
+			but without allocating. Returns the number of infos filled. */
+		static uint32_t GetImageInfos(vk::ImageViewType view_type, vk::DescriptorImageInfo *infos);
+
+		/* Returns an id which changes whenever a texture is created, modified or deleted. Descriptor sets 
+			written before the id last changed may refer to stale image views or layouts. */
+		static uint64_t GetDescriptorGeneration();
+
 		/* Releases vulkan resources */
 		static void CleanUp();
 
@@ -139,6 +182,10 @@ class Texture : public StaticFactory
 		/* Sets the scale to be used on a procedural texture type */
 		void set_procedural_scale(float scale);
 
+		/* Sets how the texture is filtered and addressed when sampled. Uses linear or nearest filtering, and either 
+			repeats or clamps to the edge. Textures sampled the same way share a sampler. */
+		void set_sampler(bool linear, bool repeat, float max_anisotropy = 16.0f);
+
 		/* Returns a json string summarizing the texture */
 		std::string to_string();
 
@@ -155,23 +202,37 @@ class Texture : public StaticFactory
 
 	private:
 
-		/* The list of texture components, allocated statically */
-		static Texture textures[MAX_TEXTURES];
+		/* The list of texture components, stored in chunks and capped at GetDescriptorCapacity() */
+		static SlotMap<Texture> textures;
+
+		/* The state a sampler is created from. Used to look up samplers, so textures sampled the same way share one. */
+		struct SamplerState {
+			vk::Filter filter;
+			vk::SamplerMipmapMode mipmapMode;
+			vk::SamplerAddressMode addressMode;
+			float maxAnisotropy;
+			bool operator<(const SamplerState &other) const;
+		};
 		
 		/* The list of texture samplers, which a texture refers to in a shader for sampling. */
-		static vk::Sampler samplers[MAX_SAMPLERS];
+		static std::vector<vk::Sampler> samplers;
+
+		/* A lookup table of sampler state to sampler id */
+		static std::map<SamplerState, uint32_t> samplerLookupTable;
+		static std::mutex samplerMutex;
+
+		/* The sizes of the sampler and texture descriptor arrays. See GetSamplerCapacity and GetDescriptorCapacity. */
+		static uint32_t samplerCapacity;
+		static uint32_t descriptorCapacity;
+
+		/* Incremented whenever the texture table changes. See GetDescriptorGeneration. */
+		static std::atomic<uint64_t> descriptorGeneration;
 	
 		/* A lookup table of name to texture id */
 		static std::map<std::string, uint32_t> lookupTable;
 
-		/* A pointer to the mapped texture SSBO. This memory is shared between the GPU and CPU. */
-        static TextureStruct* pinnedMemory;
-
-        /* A vulkan buffer handle corresponding to the texture SSBO  */
-        static vk::Buffer ssbo;
-
-        /* The corresponding texture SSBO memory */
-        static vk::DeviceMemory ssboMemory;
+		/* The mapped texture SSBO. This memory is shared between the GPU and CPU. */
+        static Libraries::StorageBuffer ssbo;
 
 		/* The struct of texture data, aggregating vulkan resources */
 		Data data;
@@ -183,6 +244,9 @@ class Texture : public StaticFactory
 			be freed internally. */
 		bool madeExternally = false;
 
+		/* The upload batch the color image was last staged in */
+		Libraries::UploadToken uploadToken = 0;
+
 		/* Frees the current texture's vulkan resources*/
 		void cleanup();
 
@@ -17,6 +17,16 @@
 #define MAX_SAMPLERS 16
 #endif
 
+/* With descriptor indexing, the texture and sampler tables are sized at runtime from the 
+    device's limits, up to these caps. MAX_TEXTURES and MAX_SAMPLERS are used otherwise. */
+#ifndef MAX_BINDLESS_TEXTURES
+#define MAX_BINDLESS_TEXTURES 4096
+#endif
+
+#ifndef MAX_BINDLESS_SAMPLERS
+#define MAX_BINDLESS_SAMPLERS 256
+#endif
+
 #ifndef GLSL
 #include <glm/glm.hpp>
 using namespace glm;
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <utility>
+
+#include "Pluto/Tools/Wakeup.hxx"
+
+/* A bounded ring which any number of threads push commands into, and one thread pops and runs them from.
+    Pushing and popping don't lock. Each slot carries a sequence number saying whether it's free, written,
+    or being written, so a producer claims a slot with one compare and swap, and the consumer only ever
+    touches the slot at its own read position.
+
+    Every push returns a token. The consumer marks tokens complete once it has run their commands, in the
+    order they were pushed, so waiting on a command is a comparison against one counter rather than a
+    promise per command. With wakeups enabled, the consumer can sleep until something is pushed, and
+    waiters sleep until their command is done. Without them, both sides yield and retry. */
+template<typename T>
+class CommandRing {
+    public:
+    typedef uint64_t Token;
+
+    /* The capacity is rounded up to a power of two */
+    explicit CommandRing(uint32_t capacity = 256, bool use_wakeups = true)
+        : useWakeups(use_wakeups)
+    {
+        uint64_t size = 2;
+        while (size < capacity) size <<= 1;
+        mask = size - 1;
+        cells.reset(new Cell[size]);
+        for (uint64_t i = 0; i < size; ++i)
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    CommandRing(const CommandRing&) = delete;
+    CommandRing& operator=(const CommandRing&) = delete;
+
+    /* Pushes a command, unless the ring is full. Returns false if it was, in which case the command is left
+        as it was. */
+    bool try_push(T &&command, Token &token)
+    {
+        uint64_t position = writePosition.load(std::memory_order_relaxed);
+        Cell *cell;
+        while (true) {
+            cell = &cells[position & mask];
+            uint64_t sequence = cell->sequence.load(std::memory_order_acquire);
+            int64_t difference = (int64_t) sequence - (int64_t) position;
+            if (difference == 0) {
+                if (writePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+            }
+            else if (difference < 0) return false;
+            else position = writePosition.load(std::memory_order_relaxed);
+        }
+
+        cell->command = std::move(command);
+        cell->sequence.store(position + 1, std::memory_order_release);
+        token = position + 1;
+        if (useWakeups) pushed.notify();
+        return true;
+    }
+
+    /* Pushes a command, yielding while the ring is full. Must not be called from the consumer thread, which
+        would never make room. */
+    Token push(T command)
+    {
+        Token token;
+        while (!try_push(std::move(command), token)) std::this_thread::yield();
+        return token;
+    }
+
+    /* Pops and runs every command written so far, calling the given function on each outside of any lock,
+        then marks them complete. Only one thread may consume. The function must not throw. Returns the number
+        of commands run. */
+    template<typename Function>
+    uint32_t drain(Function &&function)
+    {
+        uint32_t count = 0;
+        while (true) {
+            Cell &cell = cells[readPosition & mask];
+            if (cell.sequence.load(std::memory_order_acquire) != readPosition + 1) break;
+
+            T command = std::move(cell.command);
+            cell.command = T();
+            cell.sequence.store(readPosition + mask + 1, std::memory_order_release);
+            readPosition++;
+
+            function(command);
+            completed.store(readPosition, std::memory_order_release);
+            count++;
+        }
+        if (count > 0 && useWakeups) done.notify();
+        return count;
+    }
+
+    /* Returns true once the consumer has run the command with the given token */
+    bool is_complete(Token token) const
+    {
+        return completed.load(std::memory_order_acquire) >= token;
+    }
+
+    /* Blocks until the consumer has run the command with the given token */
+    void wait(Token token)
+    {
+        while (!is_complete(token)) {
+            if (!useWakeups) {
+                std::this_thread::yield();
+                continue;
+            }
+            uint64_t key = done.prepare_wait();
+            if (is_complete(token)) return;
+            done.wait(key);
+        }
+    }
+
+    /* For the consumer. Blocks until a command has been pushed, or the timeout passes, and returns true if there
+        are commands to drain. Without wakeups, this just sleeps for the timeout. */
+    template<typename Rep, typename Period>
+    bool wait_for_commands(std::chrono::duration<Rep, Period> timeout)
+    {
+        if (!useWakeups) {
+            if (empty()) std::this_thread::sleep_for(timeout);
+            return !empty();
+        }
+        uint64_t key = pushed.prepare_wait();
+        if (!empty()) return true;
+        pushed.wait(key, timeout);
+        return !empty();
+    }
+
+    /* Ends the consumer's current wait_for_commands early, eg so it can shut down */
+    void wake_consumer()
+    {
+        if (useWakeups) pushed.notify();
+    }
+
+    /* For the consumer. Returns true if no written command is waiting to be run. */
+    bool empty() const
+    {
+        return cells[readPosition & mask].sequence.load(std::memory_order_acquire) != readPosition + 1;
+    }
+
+    uint32_t get_capacity() const
+    {
+        return (uint32_t) (mask + 1);
+    }
+
+    private:
+    struct Cell {
+        std::atomic<uint64_t> sequence;
+        T command;
+    };
+
+    std::unique_ptr<Cell[]> cells;
+    uint64_t mask = 0;
+    bool useWakeups;
+
+    /* Kept on separate cache lines, since producers and the consumer update them from different threads */
+    alignas(64) std::atomic<uint64_t> writePosition {0};
+    alignas(64) uint64_t readPosition = 0;
+    alignas(64) std::atomic<uint64_t> completed {0};
+
+    Wakeup pushed, done;
+};
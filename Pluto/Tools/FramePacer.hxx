@@ -0,0 +1,75 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+/* Paces a render loop to a target frame rate. Rather than polling the clock, the loop thread sleeps until
+    shortly before the next frame is due, then yields for the remainder, since OS sleeps tend to overshoot.
+    Another thread can cut a wait short with wake, eg to request a frame right away or to shut the loop down. */
+class FramePacer {
+    public:
+    typedef std::chrono::steady_clock Clock;
+
+    /* Sets the frame rate to pace to. A rate of zero or less leaves frames unpaced. */
+    void set_target_rate(double frames_per_second)
+    {
+        double seconds = (frames_per_second > 0.0) ? 1.0 / frames_per_second : 0.0;
+        period.store(std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds)).count());
+    }
+
+    double get_target_rate() const
+    {
+        auto ticks = period.load();
+        if (ticks <= 0) return 0.0;
+        return 1.0 / std::chrono::duration<double>(Clock::duration(ticks)).count();
+    }
+
+    /* Blocks until one period after the last frame was due, or until wake is called.
+        Returns true if the wait was cut short by wake. An imprecise wait only sleeps, which is cheaper when 
+        nothing is being rendered and a late wakeup doesn't matter. */
+    bool wait(bool precise = true)
+    {
+        /* Falling more than a frame behind restarts the schedule, rather than rendering a burst of frames to catch up */
+        auto now = Clock::now();
+        auto step = Clock::duration(period.load());
+        deadline = (now - deadline > step) ? now : deadline + step;
+
+        std::unique_lock<std::mutex> lock(mutex);
+        auto spin = precise ? SpinThreshold : Clock::duration(0);
+        if (deadline - now > spin)
+            wakeup.wait_until(lock, deadline - spin, [this]() { return woken; });
+        while (precise && !woken && Clock::now() < deadline) {
+            lock.unlock();
+            std::this_thread::yield();
+            lock.lock();
+        }
+
+        bool result = woken;
+        woken = false;
+        return result;
+    }
+
+    /* Ends the current or next wait early. Safe to call from any thread. */
+    void wake()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            woken = true;
+        }
+        wakeup.notify_all();
+    }
+
+    private:
+    /* How long before the deadline to stop sleeping and start yielding */
+    static constexpr Clock::duration SpinThreshold = std::chrono::milliseconds(1);
+
+    std::atomic<Clock::rep> period {0};
+    Clock::time_point deadline = Clock::now();
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    bool woken = false;
+};
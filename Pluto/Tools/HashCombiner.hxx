@@ -1,5 +1,13 @@
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <type_traits>
+#include <vector>
+
 inline void hash_combine(std::size_t& seed) { }
 
 template <typename T, typename... Rest>
@@ -7,4 +15,39 @@ inline void hash_combine(std::size_t& seed, const T& v, Rest... rest) {
 	std::hash<T> hasher;
 	seed ^= hasher(v) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
 	hash_combine(seed, rest...);
-}
\ No newline at end of file
+}
+
+/* Appends values to a key which is compared in full, for lookups where two different inputs must never be
+	mistaken for one another, as they could be by hash alone. Enums and integers are widened, floating point 
+	values are stored by their bits, and strings by their length followed by their characters. */
+inline void key_append(std::vector<uint64_t>& key) { }
+
+template <typename T, typename... Rest>
+inline void key_append(std::vector<uint64_t>& key, const T& v, Rest... rest) {
+	if constexpr (std::is_same<T, std::string>::value) {
+		key.push_back(v.size());
+		for (size_t i = 0; i < v.size(); i += sizeof(uint64_t)) {
+			uint64_t word = 0;
+			memcpy(&word, v.data() + i, std::min(sizeof(uint64_t), v.size() - i));
+			key.push_back(word);
+		}
+	}
+	else if constexpr (std::is_floating_point<T>::value) {
+		double value = v;
+		uint64_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		key.push_back(bits);
+	}
+	else if constexpr (std::is_enum<T>::value) key.push_back((uint64_t) static_cast<typename std::underlying_type<T>::type>(v));
+	else key.push_back((uint64_t) v);
+	key_append(key, rest...);
+}
+
+/* Hashes a key built with key_append, eg to bucket it in an unordered map */
+struct KeyHasher {
+	size_t operator()(const std::vector<uint64_t>& key) const {
+		size_t seed = key.size();
+		for (auto word : key) hash_combine(seed, word);
+		return seed;
+	}
+};
\ No newline at end of file
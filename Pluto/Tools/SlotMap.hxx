@@ -0,0 +1,239 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/* Set whenever a slot in any slot map is flagged dirty, so the renderer can tell whether anything
+    changed since it last looked without scanning every map. Cleared by whoever consumes it. */
+inline std::atomic<bool> SlotMapsModified {false};
+
+/* Called whenever SlotMapsModified goes from clear to set, eg to wake a render loop waiting for changes. */
+inline std::atomic<void (*)()> SlotMapsModifiedCallback {nullptr};
+
+/* Sets SlotMapsModified, calling SlotMapsModifiedCallback if it wasn't already set */
+inline void SetSlotMapsModified()
+{
+    /* Check first, so threads marking slots in parallel don't all write to the same cache line */
+    if (SlotMapsModified.load(std::memory_order_relaxed)) return;
+    if (SlotMapsModified.exchange(true, std::memory_order_acq_rel)) return;
+    auto callback = SlotMapsModifiedCallback.load(std::memory_order_acquire);
+    if (callback) callback();
+}
+
+/* A growable, chunked slot map used as backing storage for the static component factories.
+    Items live in fixed size chunks which are never moved once allocated, so pointers handed out
+    to python or to other systems stay valid as the map grows. Each slot carries a generation
+    which is bumped whenever the slot is released, so a (index, generation) handle can detect
+    when the item it refers to has been deleted and the slot reused. Slots can also be flagged dirty, 
+    so that only modified items are copied into GPU buffers. */
+template<class T, uint32_t ChunkBits = 8>
+class SlotMap {
+    public:
+    static constexpr uint32_t ChunkSize = 1u << ChunkBits;
+    static constexpr uint32_t MaxChunks = 4096;
+    static_assert(ChunkBits >= 6, "Slot map chunks must hold at least 64 items to track dirty slots");
+
+    /* An index into the slot map, paired with the generation of the slot at the time it was handed out. */
+    struct Handle {
+        uint32_t index = (uint32_t)-1;
+        uint32_t generation = 0;
+    };
+
+    SlotMap(uint32_t initial_capacity = ChunkSize, uint32_t max_capacity = ChunkSize * MaxChunks)
+    {
+        for (uint32_t i = 0; i < MaxChunks; ++i) chunks[i].store(nullptr, std::memory_order_relaxed);
+        set_max_capacity(max_capacity);
+        reserve(initial_capacity);
+    }
+
+    ~SlotMap()
+    {
+        for (uint32_t i = 0; i < MaxChunks; ++i) {
+            delete chunks[i].load(std::memory_order_relaxed);
+            chunks[i].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    SlotMap(const SlotMap&) = delete;
+    SlotMap& operator=(const SlotMap&) = delete;
+
+    /* Returns the item at the given index. The index must be less than get_capacity(). */
+    T& operator[](uint32_t index)
+    {
+        return chunks[index >> ChunkBits].load(std::memory_order_acquire)->items[index & (ChunkSize - 1)];
+    }
+
+    /* Returns the number of addressable slots. Slots below this count may or may not be in use.
+        Safe to call from a thread other than the one allocating. */
+    uint32_t get_capacity() const
+    {
+        return capacity.load(std::memory_order_acquire);
+    }
+
+    /* Returns the number of slots currently in use. */
+    uint32_t get_size() const
+    {
+        return size.load(std::memory_order_relaxed);
+    }
+
+    /* Returns the largest number of slots this map is allowed to grow to. */
+    uint32_t get_max_capacity() const
+    {
+        return maxCapacity;
+    }
+
+    /* Limits how far this map can grow. Components whose slots are bound to fixed size
+        descriptor arrays (eg textures) use this to keep ids in range. */
+    void set_max_capacity(uint32_t max_capacity)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (max_capacity > ChunkSize * MaxChunks)
+            throw std::runtime_error(std::string("Error: slot map capacity cannot exceed " + std::to_string(ChunkSize * MaxChunks)));
+        if (max_capacity < capacity.load(std::memory_order_relaxed))
+            throw std::runtime_error(std::string("Error: slot map max capacity cannot be less than the current capacity"));
+        maxCapacity = max_capacity;
+
+        /* Slots in the tail of the last chunk may have been held back by the previous limit */
+        uint32_t current = capacity.load(std::memory_order_relaxed);
+        if (current % ChunkSize != 0) expose(std::min(((current / ChunkSize) + 1) * ChunkSize, maxCapacity));
+    }
+
+    /* Allocates chunks until at least the requested number of slots are addressable. */
+    void reserve(uint32_t requested_capacity)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (requested_capacity > maxCapacity)
+            throw std::runtime_error(std::string("Error: requested capacity " + std::to_string(requested_capacity)
+                + " exceeds max capacity " + std::to_string(maxCapacity)));
+        if (requested_capacity > capacity.load(std::memory_order_relaxed)) expose(requested_capacity);
+    }
+
+    /* Takes a slot off of the free list, growing the map by a chunk if none are available.
+        Returns -1 if the map is full. */
+    int32_t allocate()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (freeList.empty()) {
+            uint32_t current = capacity.load(std::memory_order_relaxed);
+            if (current >= maxCapacity) return -1;
+            expose(std::min(current + ChunkSize, maxCapacity));
+        }
+        uint32_t index = freeList.back();
+        freeList.pop_back();
+        size.fetch_add(1, std::memory_order_relaxed);
+        return (int32_t) index;
+    }
+
+    /* Returns a slot to the free list and invalidates any outstanding handles to it. */
+    void release(uint32_t index)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto chunk = chunks[index >> ChunkBits].load(std::memory_order_relaxed);
+        chunk->generations[index & (ChunkSize - 1)]++;
+        freeList.push_back(index);
+        size.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    /* Returns the current generation of a slot. */
+    uint32_t get_generation(uint32_t index)
+    {
+        return chunks[index >> ChunkBits].load(std::memory_order_acquire)->generations[index & (ChunkSize - 1)];
+    }
+
+    /* Flags a slot as needing to be re-uploaded to the GPU. Safe to call from any thread. */
+    void mark_dirty(uint32_t index)
+    {
+        auto chunk = chunks[index >> ChunkBits].load(std::memory_order_acquire);
+        uint32_t local = index & (ChunkSize - 1);
+        chunk->dirty[local >> 6].fetch_or(1ull << (local & 63), std::memory_order_release);
+        chunk->anyDirty.store(true, std::memory_order_release);
+        SetSlotMapsModified();
+    }
+
+    /* Flags every addressable slot as dirty, eg after the GPU copy of this map has been reallocated. */
+    void mark_all_dirty()
+    {
+        uint32_t count = get_capacity();
+        for (uint32_t i = 0; i < count; i += 64) {
+            auto chunk = chunks[i >> ChunkBits].load(std::memory_order_acquire);
+            uint32_t bits = std::min(count - i, 64u);
+            uint64_t mask = (bits == 64) ? ~0ull : ((1ull << bits) - 1);
+            chunk->dirty[(i & (ChunkSize - 1)) >> 6].fetch_or(mask, std::memory_order_release);
+            chunk->anyDirty.store(true, std::memory_order_release);
+        }
+        SetSlotMapsModified();
+    }
+
+    /* Clears all dirty flags, calling fn(first, count) once for each run of consecutive dirty slots. 
+        Chunks without any dirty slots are skipped without looking at their flags. */
+    template<class F>
+    void consume_dirty_ranges(F fn)
+    {
+        uint32_t count = get_capacity();
+        uint32_t run_start = 0, run_count = 0;
+        for (uint32_t c = 0; c < (count + ChunkSize - 1) / ChunkSize; ++c) {
+            auto chunk = chunks[c].load(std::memory_order_acquire);
+            if (!chunk->anyDirty.exchange(false, std::memory_order_acq_rel)) continue;
+            for (uint32_t w = 0; w < ChunkSize / 64; ++w) {
+                uint64_t bits = chunk->dirty[w].exchange(0, std::memory_order_acquire);
+                if (bits == 0) continue;
+                uint32_t base = c * ChunkSize + w * 64;
+                for (uint32_t b = 0; b < 64 && (bits >> b) != 0; ++b) {
+                    if (((bits >> b) & 1ull) == 0) continue;
+                    uint32_t index = base + b;
+                    if (index >= count) break;
+                    if (run_count > 0 && run_start + run_count == index) { run_count++; continue; }
+                    if (run_count > 0) fn(run_start, run_count);
+                    run_start = index;
+                    run_count = 1;
+                }
+            }
+        }
+        if (run_count > 0) fn(run_start, run_count);
+    }
+
+    /* Returns true if the handle still refers to the item it was created for. */
+    bool is_valid(Handle handle)
+    {
+        if (handle.index >= get_capacity()) return false;
+        return get_generation(handle.index) == handle.generation;
+    }
+
+    private:
+    struct Chunk {
+        T items[ChunkSize];
+        uint32_t generations[ChunkSize] = {};
+        std::atomic<uint64_t> dirty[ChunkSize / 64] = {};
+        std::atomic<bool> anyDirty {false};
+    };
+
+    /* Chunks are published through a fixed size table so that readers never observe the table itself moving. */
+    std::atomic<Chunk*> chunks[MaxChunks];
+    std::atomic<uint32_t> capacity {0};
+    std::atomic<uint32_t> size {0};
+    uint32_t maxCapacity = ChunkSize * MaxChunks;
+    std::vector<uint32_t> freeList;
+    std::mutex mutex;
+
+    /* Makes slots [capacity, new_capacity) addressable, allocating chunks as needed, and pushes them onto
+        the free list lowest index last so that low ids are handed out first. Must be called with the mutex held. */
+    void expose(uint32_t new_capacity)
+    {
+        uint32_t current = capacity.load(std::memory_order_relaxed);
+        uint32_t chunks_needed = (new_capacity + ChunkSize - 1) / ChunkSize;
+        if (chunks_needed > MaxChunks)
+            throw std::runtime_error(std::string("Error: slot map out of chunks"));
+        for (uint32_t i = (current + ChunkSize - 1) / ChunkSize; i < chunks_needed; ++i)
+            if (chunks[i].load(std::memory_order_relaxed) == nullptr)
+                chunks[i].store(new Chunk(), std::memory_order_release);
+        for (uint32_t i = new_capacity; i > current; --i)
+            freeList.push_back(i - 1);
+        capacity.store(new_capacity, std::memory_order_release);
+    }
+};
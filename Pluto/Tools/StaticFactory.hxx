@@ -22,6 +22,8 @@
 
 #include <exception>
 
+#include "Pluto/Tools/SlotMap.hxx"
+
 class StaticFactory {
     public:
 
@@ -33,6 +35,10 @@ class StaticFactory {
 
     /* returns the id of the current item. */
     virtual int32_t get_id() { return id; };
+
+    /* returns the generation of the slot this item was created in. Together with the id, this 
+        uniquely identifies the item even after its slot is reused. */
+    uint32_t get_generation() { return generation; };
     
     /* an item may be empty, in which case 'initialized' will return false. */
     bool is_initialized() {
@@ -46,37 +52,30 @@ class StaticFactory {
         return (it != lookupTable.end());
     }
 
-    /* Returns the first index where an item of type T is uninitialized. */
+    /* Reserves a location in items and adds an entry in the lookup table. Slots come off of the item
+        storage's free list, and the storage grows by a chunk when no slot is available. */
     template<class T>
-    static int32_t FindAvailableID(T *items, uint32_t max_items) 
-    {
-        for (uint32_t i = 0; i < max_items; ++i)
-            if (items[i].initialized == false)
-                return (int32_t)i;
-        return -1;
-    }
-    
-    /* Reserves a location in items and adds an entry in the lookup table */
-    template<class T>
-    static T* Create(std::string name, std::string type, std::map<std::string, uint32_t> &lookupTable, T* items, uint32_t maxItems) 
+    static T* Create(std::string name, std::string type, std::map<std::string, uint32_t> &lookupTable, SlotMap<T> &items) 
     {
         if (DoesItemExist(lookupTable, name))
             throw std::runtime_error(std::string("Error: " + type + " \"" + name + "\" already exists."));
 
-        int32_t id = FindAvailableID(items, maxItems);
+        int32_t id = items.allocate();
 
         if (id < 0) 
-            throw std::runtime_error(std::string("Error: max " + type + " limit reached."));
+            throw std::runtime_error(std::string("Error: max " + type + " limit of " + std::to_string(items.get_max_capacity()) + " reached."));
 
         std::cout << "Adding " << type << " \"" << name << "\"" << std::endl;
         items[id] = T(name, id);
+        items[id].generation = items.get_generation(id);
+        items.mark_dirty(id);
         lookupTable[name] = id;
         return &items[id];
     }
 
     /* Retrieves an element with a lookup table indirection */
     template<class T>
-    static T* Get(std::string name, std::string type, std::map<std::string, uint32_t> &lookupTable, T* items, uint32_t maxItems) 
+    static T* Get(std::string name, std::string type, std::map<std::string, uint32_t> &lookupTable, SlotMap<T> &items) 
     {
         if (DoesItemExist(lookupTable, name)) {
             uint32_t id = lookupTable[name];
@@ -89,9 +88,9 @@ class StaticFactory {
 
     /* Retrieves an element by ID directly */
     template<class T>
-    static T* Get(uint32_t id, std::string type, std::map<std::string, uint32_t> &lookupTable, T* items, uint32_t maxItems) 
+    static T* Get(uint32_t id, std::string type, std::map<std::string, uint32_t> &lookupTable, SlotMap<T> &items) 
     {
-        if (id >= maxItems) 
+        if (id >= items.get_capacity()) 
             throw std::runtime_error(std::string("Error: id greater than max " + type));
 
         else if (!items[id].initialized) 
@@ -100,22 +99,36 @@ class StaticFactory {
         return &items[id];
     }
 
+    /* Retrieves an element by ID and generation, failing if the slot has since been deleted or reused */
+    template<class T>
+    static T* Get(uint32_t id, uint32_t generation, std::string type, std::map<std::string, uint32_t> &lookupTable, SlotMap<T> &items) 
+    {
+        if (!items.is_valid({id, generation}) || !items[id].initialized)
+            throw std::runtime_error(std::string("Error: " + type + " with id " + std::to_string(id) 
+                + " and generation " + std::to_string(generation) + " does not exist"));
+
+        return &items[id];
+    }
+
     /* Removes an element with a lookup table indirection, removing from both items and the lookup table */
     template<class T>
-    static void Delete(std::string name, std::string type, std::map<std::string, uint32_t> &lookupTable, T* items, uint32_t maxItems)
+    static void Delete(std::string name, std::string type, std::map<std::string, uint32_t> &lookupTable, SlotMap<T> &items)
     {
         if (!DoesItemExist(lookupTable, name))
             throw std::runtime_error(std::string("Error: " + type + " \"" + name + "\" does not exist."));
 
-        items[lookupTable[name]] = T();
+        uint32_t id = lookupTable[name];
+        items[id] = T();
+        items.mark_dirty(id);
+        items.release(id);
         lookupTable.erase(name);
     }
 
     /* Removes an element by ID directly, removing from both items and the lookup table */
     template<class T>
-    static void Delete(uint32_t id, std::string type, std::map<std::string, uint32_t> &lookupTable, T* items, uint32_t maxItems)
+    static void Delete(uint32_t id, std::string type, std::map<std::string, uint32_t> &lookupTable, SlotMap<T> &items)
     {
-        if (id >= maxItems)
+        if (id >= items.get_capacity())
             throw std::runtime_error(std::string("Error: id greater than max " + type));
 
         if (!items[id].initialized)
@@ -123,6 +136,17 @@ class StaticFactory {
 
         lookupTable.erase(items[id].name);
         items[id] = T();
+        items.mark_dirty(id);
+        items.release(id);
+    }
+
+    /* Returns an item by index without checking that it has been initialized, or nullptr if the index is 
+        out of range. Used by systems which walk every slot, since items are no longer stored contiguously. */
+    template<class T>
+    static T* GetFromIndex(uint32_t index, SlotMap<T> &items)
+    {
+        if (index >= items.get_capacity()) return nullptr;
+        return &items[index];
     }
 
     protected:
@@ -133,6 +157,7 @@ class StaticFactory {
     /* Inheriting factories should set these fields when a component is created. */
     std::string name = "";
     uint32_t id = -1;
+    uint32_t generation = 0;
 
     /* All items keep track of the entities which use them. */
     std::set<uint32_t> entities;
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* A few long lived threads which run queued jobs in the background, oldest first. Unlike the worker pool,
+    the caller doesn't wait, so this is meant for slow one off work (eg pipeline compilation) which shouldn't
+    hold up the thread asking for it. */
+class TaskQueue {
+    public:
+    explicit TaskQueue(uint32_t thread_count)
+    {
+        for (uint32_t i = 0; i < std::max(thread_count, 1u); ++i)
+            threads.emplace_back([this]() { thread_loop(); });
+    }
+
+    /* Jobs still queued are dropped. Jobs already running are finished. */
+    ~TaskQueue()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            jobs.clear();
+        }
+        wake.notify_all();
+        for (auto &thread : threads) thread.join();
+    }
+
+    TaskQueue(const TaskQueue&) = delete;
+    TaskQueue& operator=(const TaskQueue&) = delete;
+
+    /* Queues a job. The returned future becomes ready once the job has run, and rethrows anything it threw. */
+    std::shared_future<void> enqueue(std::function<void()> job)
+    {
+        std::packaged_task<void()> task(std::move(job));
+        std::shared_future<void> future = task.get_future().share();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(std::move(task));
+        }
+        wake.notify_one();
+        return future;
+    }
+
+    /* Returns the number of jobs queued or running */
+    uint32_t get_pending_count()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return (uint32_t) jobs.size() + running;
+    }
+
+    /* Blocks until every queued job has run */
+    void wait_idle()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this]() { return jobs.empty() && running == 0; });
+    }
+
+    private:
+    std::vector<std::thread> threads;
+    std::deque<std::packaged_task<void()>> jobs;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    uint32_t running = 0;
+    bool stopping = false;
+
+    void thread_loop()
+    {
+        while (true) {
+            std::packaged_task<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this]() { return stopping || !jobs.empty(); });
+                if (stopping) return;
+                task = std::move(jobs.front());
+                jobs.pop_front();
+                running++;
+            }
+            task();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                running--;
+                if (jobs.empty() && running == 0) idle.notify_all();
+            }
+        }
+    }
+};
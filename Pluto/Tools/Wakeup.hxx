@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+/* Lets a thread sleep until another thread has something for it, without the notifying side taking a lock
+    unless someone is actually asleep. A waiter first takes a key with prepare_wait, then checks whatever it's
+    waiting for, and only if that isn't ready yet, sleeps with wait. Any notify after the key was taken ends
+    the wait, so a notify which lands between the check and the sleep isn't lost. */
+class Wakeup {
+    public:
+    uint64_t prepare_wait()
+    {
+        return epoch.load();
+    }
+
+    /* Sleeps until notify is called after the key was taken, or the timeout passes. Returns false on timeout. */
+    template<typename Rep, typename Period>
+    bool wait(uint64_t key, std::chrono::duration<Rep, Period> timeout)
+    {
+        sleepers++;
+        bool notified;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            notified = condition.wait_for(lock, timeout, [this, key]() { return epoch.load() != key; });
+        }
+        sleepers--;
+        return notified;
+    }
+
+    void wait(uint64_t key)
+    {
+        sleepers++;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [this, key]() { return epoch.load() != key; });
+        }
+        sleepers--;
+    }
+
+    /* Wakes every thread sleeping in wait. Cheap when nothing is asleep. Safe to call from any thread. */
+    void notify()
+    {
+        epoch++;
+        if (sleepers.load() == 0) return;
+
+        /* Taking the lock makes sure a waiter between its check and its sleep gets this notification */
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+        }
+        condition.notify_all();
+    }
+
+    private:
+    /* Both sides use sequentially consistent operations, so either the waiter sees the new epoch, or the
+        notifier sees the waiter */
+    std::atomic<uint64_t> epoch {0};
+    std::atomic<uint32_t> sleepers {0};
+    std::mutex mutex;
+    std::condition_variable condition;
+};
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* A fixed pool of worker threads used to split per frame work (eg transform propagation) across cores.
+    The calling thread takes part in each batch, so on a single core machine everything simply runs inline. */
+class WorkerPool {
+    public:
+    /* Returns the shared pool, which has one worker per hardware thread minus one for the caller. */
+    static WorkerPool* Get()
+    {
+        static WorkerPool pool(std::max(std::thread::hardware_concurrency(), 1u) - 1);
+        return &pool;
+    }
+
+    explicit WorkerPool(uint32_t worker_count)
+    {
+        for (uint32_t i = 0; i < worker_count; ++i)
+            workers.emplace_back([this]() { worker_loop(); });
+    }
+
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto &worker : workers) worker.join();
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    /* Returns the number of threads work is spread across, including the caller. */
+    uint32_t get_thread_count() const
+    {
+        return (uint32_t) workers.size() + 1;
+    }
+
+    /* Calls fn(i) once for each i in [0, count), spread across the workers and the calling thread.
+        Returns once every call has finished. fn must not throw. Only one batch runs at a time. */
+    void parallel_for(uint32_t count, const std::function<void(uint32_t)> &fn)
+    {
+        if (count == 0) return;
+        if (workers.empty() || count == 1) {
+            for (uint32_t i = 0; i < count; ++i) fn(i);
+            return;
+        }
+
+        std::lock_guard<std::mutex> dispatch(dispatchMutex);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobFn = &fn;
+            jobCount = count;
+            next.store(0, std::memory_order_relaxed);
+            jobId++;
+        }
+        wake.notify_all();
+
+        run(fn, count);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this]() { return busy == 0; });
+        jobFn = nullptr;
+    }
+
+    private:
+    std::vector<std::thread> workers;
+    std::mutex dispatchMutex;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(uint32_t)>* jobFn = nullptr;
+    uint32_t jobCount = 0;
+    uint64_t jobId = 0;
+    uint32_t busy = 0;
+    bool stopping = false;
+    std::atomic<uint32_t> next {0};
+
+    void run(const std::function<void(uint32_t)> &fn, uint32_t count)
+    {
+        for (uint32_t i = next.fetch_add(1, std::memory_order_relaxed); i < count; i = next.fetch_add(1, std::memory_order_relaxed))
+            fn(i);
+    }
+
+    void worker_loop()
+    {
+        uint64_t seen = 0;
+        while (true) {
+            const std::function<void(uint32_t)>* fn;
+            uint32_t count;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&]() { return stopping || jobId != seen; });
+                if (stopping) return;
+                seen = jobId;
+                /* The batch may already be over if this worker woke late */
+                if (!jobFn) continue;
+                fn = jobFn;
+                count = jobCount;
+                busy++;
+            }
+            run(*fn, count);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--busy == 0) done.notify_all();
+            }
+        }
+    }
+};
@@ -1,103 +1,464 @@
 #include "./Transform.hxx"
+#include "./TransformKernel.hxx"
+#include "Pluto/Tools/WorkerPool.hxx"
 
-Transform Transform::transforms[MAX_TRANSFORMS];
-TransformStruct* Transform::pinnedMemory;
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+SlotMap<Transform> Transform::transforms(MAX_TRANSFORMS);
 std::map<std::string, uint32_t> Transform::lookupTable;
-vk::Buffer Transform::transformSSBO;
-vk::DeviceMemory Transform::transformSSBOMemory;
+Libraries::StorageBuffer Transform::ssbo;
+Transform::Hierarchy Transform::hierarchy;
+std::atomic<bool> Transform::hierarchyOutOfDate(true);
+
+/* Subtrees with more nodes than this are split up, and smaller subtrees are batched together, 
+    so each job on the worker pool has roughly this many nodes to evaluate. */
+static const uint32_t HierarchyGrain = 256;
+
+/* The layout written by the matrix kernel, which matches the full (non compact) TransformStruct */
+struct MatrixPair {
+    mat4 inverse;
+    mat4 forward;
+};
+static_assert(sizeof(MatrixPair) == 32 * sizeof(float), "MatrixPair must be two tightly packed mat4s");
+
+/* Reused between updates by ComposeLocalMatrices. kernelEdits holds the edit count each transform's TRS was read at. */
+static std::vector<uint32_t> kernelIds;
+static std::vector<uint32_t> kernelEdits;
+static TRSArrays kernelInput;
+static std::vector<MatrixPair> kernelOutput;
 
 void Transform::Initialize()
 {
-    auto vulkan = Libraries::Vulkan::Get();
-    auto device = vulkan->get_device();
-    auto physical_device = vulkan->get_physical_device();
+    ssbo.create(transforms.get_capacity() * sizeof(TransformStruct));
+    transforms.mark_all_dirty();
+    hierarchyOutOfDate = true;
+}
+
+void Transform::RebuildHierarchy()
+{
+    auto &h = hierarchy;
+    uint32_t count = transforms.get_capacity();
+
+    auto has_parent = [count](uint32_t i) {
+        int32_t p = transforms[i].parent;
+        return (p >= 0) && ((uint32_t) p < count) && transforms[p].is_initialized();
+    };
+
+    /* Gather children as linked lists, in id order */
+    std::vector<int32_t> firstChild(count, -1), nextSibling(count, -1);
+    for (uint32_t i = count; i-- > 0;) {
+        if (!transforms[i].is_initialized() || !has_parent(i)) continue;
+        uint32_t p = (uint32_t) transforms[i].parent;
+        nextSibling[i] = firstChild[p];
+        firstChild[p] = (int32_t) i;
+    }
 
-    vk::BufferCreateInfo bufferInfo = {};
-    bufferInfo.size = MAX_TRANSFORMS * sizeof(TransformStruct);
-    bufferInfo.usage = vk::BufferUsageFlagBits::eStorageBuffer;
-    bufferInfo.sharingMode = vk::SharingMode::eExclusive;
-    transformSSBO = device.createBuffer(bufferInfo);
+    /* Depth first traversal from each root, so that subtrees are contiguous */
+    h.order.clear();
+    h.parent.clear();
+    h.position.assign(count, (uint32_t) -1);
+    std::vector<std::pair<uint32_t, int32_t>> stack;
+    for (uint32_t root = 0; root < count; ++root) {
+        if (!transforms[root].is_initialized() || has_parent(root)) continue;
+        stack.push_back({root, -1});
+        while (!stack.empty()) {
+            auto node = stack.back();
+            stack.pop_back();
+            uint32_t position = (uint32_t) h.order.size();
+            h.position[node.first] = position;
+            h.order.push_back(node.first);
+            h.parent.push_back(node.second);
+            for (int32_t c = firstChild[node.first]; c != -1; c = nextSibling[c])
+                stack.push_back({(uint32_t) c, (int32_t) position});
+        }
+    }
+
+    uint32_t n = (uint32_t) h.order.size();
+    h.end.resize(n);
+    for (uint32_t i = 0; i < n; ++i) h.end[i] = i + 1;
+    for (uint32_t i = n; i-- > 0;)
+        if (h.parent[i] >= 0) h.end[h.parent[i]] = std::max(h.end[h.parent[i]], h.end[i]);
+
+    /* Large subtrees are evaluated top down on one thread until what remains fits in a task */
+    h.branches.clear();
+    h.tasks.clear();
+    h.taskOf.assign(n, -1);
+    for (uint32_t i = 0; i < n; ++i) {
+        if (h.end[i] - i > HierarchyGrain) { h.branches.push_back(i); continue; }
+        if (h.taskOf[i] != -1) continue;
+        int32_t task = (int32_t) h.tasks.size();
+        h.tasks.push_back(i);
+        for (uint32_t j = i; j < h.end[i]; ++j) h.taskOf[j] = task;
+    }
+
+    h.changed.assign(n, 0);
+    h.taskChanged.assign(h.tasks.size(), 0);
+    h.branchUpdated.assign(n, 0);
+}
+
+void Transform::ComputeWorldMatrices(uint32_t position)
+{
+    auto &h = hierarchy;
+    Transform &t = transforms[h.order[position]];
+    t.compose_matrices();
+    if (h.parent[position] < 0) {
+        t.localToWorldMatrix = t.localToParentMatrix;
+        t.worldToLocalMatrix = t.parentToLocalMatrix;
+        return;
+    }
+    Transform &p = transforms[h.order[h.parent[position]]];
+    t.localToWorldMatrix = p.localToWorldMatrix * t.localToParentMatrix;
+    t.worldToLocalMatrix = t.parentToLocalMatrix * p.worldToLocalMatrix;
+}
+
+void Transform::ComposeLocalMatrices(const std::vector<uint32_t> &ids)
+{
+    kernelIds.clear();
+    kernelEdits.clear();
+    for (auto id : ids) {
+        Transform &t = transforms[id];
+        if (t.useCustomTransform) continue;
+        uint32_t edits = t.edits.value.load();
+        if (edits == t.composedEdits) continue;
+        kernelIds.push_back(id);
+        kernelEdits.push_back(edits);
+    }
+    if (kernelIds.empty()) return;
 
-    vk::MemoryRequirements memReqs = device.getBufferMemoryRequirements(transformSSBO);
-    vk::MemoryAllocateInfo allocInfo = {};
-    allocInfo.allocationSize = memReqs.size;
+    uint32_t count = (uint32_t) kernelIds.size();
+    kernelInput.resize(count);
+    kernelOutput.resize(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        Transform &t = transforms[kernelIds[i]];
+        float p[3] = {t.position.x, t.position.y, t.position.z};
+        float q[4] = {t.rotation.x, t.rotation.y, t.rotation.z, t.rotation.w};
+        float s[3] = {t.scale.x, t.scale.y, t.scale.z};
+        kernelInput.set(i, p, q, s);
+    }
 
-    vk::PhysicalDeviceMemoryProperties memProperties = physical_device.getMemoryProperties();
-    vk::MemoryPropertyFlags properties = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
-    allocInfo.memoryTypeIndex = vulkan->find_memory_type(memReqs.memoryTypeBits, properties);
+    TransformKernel::build_matrices(kernelInput, 0, count, (float*) kernelOutput.data());
 
-    transformSSBOMemory = device.allocateMemory(allocInfo);
-    device.bindBufferMemory(transformSSBO, transformSSBOMemory, 0);
+    for (uint32_t i = 0; i < count; ++i) {
+        Transform &t = transforms[kernelIds[i]];
+        t.parentToLocalMatrix = kernelOutput[i].inverse;
+        t.localToParentMatrix = kernelOutput[i].forward;
 
-    /* Pin the buffer */
-    pinnedMemory = (TransformStruct*) device.mapMemory(transformSSBOMemory, 0, MAX_TRANSFORMS * sizeof(TransformStruct));
+        /* An edit made after the TRS was read may not be in these matrices. Leave them out of date, 
+            and the slot dirty, so the next update composes them again. */
+        if (t.edits.value.load() == kernelEdits[i]) t.composedEdits = kernelEdits[i];
+        else transforms.mark_dirty(kernelIds[i]);
+    }
 }
 
-void Transform::UploadSSBO() 
+void Transform::UpdateWorldMatrices()
 {
-    if (pinnedMemory == nullptr) return;
-    TransformStruct transformObjects[MAX_TRANSFORMS];
-    
-    /* TODO: remove this for loop */
-    for (int i = 0; i < MAX_TRANSFORMS; ++i) {
-        if (!transforms[i].is_initialized()) continue;
+    auto &h = hierarchy;
+    h.updated.clear();
 
-        /* TODO: account for parent transforms */
-        transformObjects[i].worldToLocal = transforms[i].parent_to_local_matrix();
-        transformObjects[i].localToWorld = transforms[i].local_to_parent_matrix();
+    bool full = false;
+    if (hierarchyOutOfDate.exchange(false)) {
+        RebuildHierarchy();
+        full = true;
+    }
+    /* Collect the transforms whose local matrices changed */
+    std::vector<uint32_t> changed;
+    transforms.consume_dirty_ranges([&](uint32_t first, uint32_t count) {
+        for (uint32_t i = first; i < first + count; ++i) {
+            /* Deleted transforms fall out of the hierarchy, but their reset matrices still need uploading */
+            if (i >= h.position.size() || h.position[i] == (uint32_t) -1) {
+                h.updated.push_back(i);
+                continue;
+            }
+            uint32_t position = h.position[i];
+            h.changed[position] = 1;
+            if (h.taskOf[position] >= 0) h.taskChanged[h.taskOf[position]] = 1;
+            changed.push_back(position);
+        }
+    });
+    if (!full && changed.empty()) {
+        std::sort(h.updated.begin(), h.updated.end());
+        return;
+    }
+
+    /* Compose the changed local matrices in one batch, rather than one at a time during propagation */
+    if (full) ComposeLocalMatrices(h.order);
+    else {
+        std::vector<uint32_t> changedIds(changed.size());
+        for (size_t i = 0; i < changed.size(); ++i) changedIds[i] = h.order[changed[i]];
+        ComposeLocalMatrices(changedIds);
+    }
+
+    /* Walk the branches in order. A node needs recomputing if it changed, or if it lies within the 
+        subtree of a node which was recomputed, ie before the furthest subtree end seen so far. */
+    uint32_t dirtyEnd = 0;
+    for (auto position : h.branches) {
+        if (!(full || h.changed[position] || position < dirtyEnd)) continue;
+        ComputeWorldMatrices(position);
+        h.branchUpdated[position] = 1;
+        h.updated.push_back(h.order[position]);
+        dirtyEnd = std::max(dirtyEnd, h.end[position]);
+    }
+
+    /* Skip tasks with nothing changed inside them and an untouched parent */
+    std::vector<uint32_t> dirtyTasks;
+    for (uint32_t t = 0; t < (uint32_t) h.tasks.size(); ++t) {
+        int32_t parent = h.parent[h.tasks[t]];
+        if (full || h.taskChanged[t] || (parent >= 0 && h.branchUpdated[parent]))
+            dirtyTasks.push_back(t);
+    }
+
+    /* Batch the remaining tasks into jobs of roughly even size */
+    std::vector<uint32_t> jobStarts;
+    uint32_t nodes = HierarchyGrain;
+    for (uint32_t i = 0; i < (uint32_t) dirtyTasks.size(); ++i) {
+        if (nodes >= HierarchyGrain) { jobStarts.push_back(i); nodes = 0; }
+        uint32_t root = h.tasks[dirtyTasks[i]];
+        nodes += h.end[root] - root;
+    }
+    jobStarts.push_back((uint32_t) dirtyTasks.size());
+    uint32_t jobCount = (uint32_t) jobStarts.size() - 1;
+    if (h.jobUpdates.size() < jobCount) h.jobUpdates.resize(jobCount);
+
+    WorkerPool::Get()->parallel_for(jobCount, [&](uint32_t job) {
+        auto &updates = h.jobUpdates[job];
+        updates.clear();
+        for (uint32_t i = jobStarts[job]; i < jobStarts[job + 1]; ++i) {
+            uint32_t root = h.tasks[dirtyTasks[i]];
+            int32_t parent = h.parent[root];
+            uint32_t taskDirtyEnd = (full || (parent >= 0 && h.branchUpdated[parent])) ? h.end[root] : root;
+            for (uint32_t position = root; position < h.end[root]; ++position) {
+                if (!(h.changed[position] || position < taskDirtyEnd)) continue;
+                ComputeWorldMatrices(position);
+                updates.push_back(h.order[position]);
+                taskDirtyEnd = std::max(taskDirtyEnd, h.end[position]);
+            }
+        }
+    });
+
+    for (uint32_t job = 0; job < jobCount; ++job)
+        h.updated.insert(h.updated.end(), h.jobUpdates[job].begin(), h.jobUpdates[job].end());
+    std::sort(h.updated.begin(), h.updated.end());
+
+    /* Reset the flags for the next update */
+    for (auto position : changed) {
+        h.changed[position] = 0;
+        if (h.taskOf[position] >= 0) h.taskChanged[h.taskOf[position]] = 0;
+    }
+    for (auto position : h.branches) h.branchUpdated[position] = 0;
+}
+
+uint32_t Transform::GetUpdatedCount()
+{
+    return (uint32_t) hierarchy.updated.size();
+}
+
+std::vector<double> Transform::BenchmarkMatrixKernel(uint32_t count, uint32_t iterations)
+{
+    iterations = std::max(iterations, 1u);
+
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    std::vector<Transform> scratch(count);
+    for (auto &t : scratch) {
+        t.position = vec3(unit(random), unit(random), unit(random)) * 100.0f;
+        t.rotation = glm::normalize(glm::quat(unit(random), unit(random), unit(random), unit(random)));
+        t.scale = vec3(1.5f) + vec3(unit(random), unit(random), unit(random));
+    }
+    std::vector<MatrixPair> output(count);
+    TRSArrays input;
+    input.resize(count);
+
+    using clock = std::chrono::high_resolution_clock;
+    auto start = clock::now();
+    for (uint32_t iteration = 0; iteration < iterations; ++iteration) {
+        for (uint32_t i = 0; i < count; ++i) {
+            scratch[i].build_local_matrices(output[i].forward, output[i].inverse);
+        }
+    }
+    double glmTime = std::chrono::duration<double, std::milli>(clock::now() - start).count() / iterations;
+
+    /* Both kernel passes include gathering into structure of arrays form, as ComposeLocalMatrices has to */
+    auto gather = [&]() {
+        for (uint32_t i = 0; i < count; ++i) {
+            Transform &t = scratch[i];
+            float p[3] = {t.position.x, t.position.y, t.position.z};
+            float q[4] = {t.rotation.x, t.rotation.y, t.rotation.z, t.rotation.w};
+            float s[3] = {t.scale.x, t.scale.y, t.scale.z};
+            input.set(i, p, q, s);
+        }
     };
 
-    auto device = Libraries::Vulkan::Get()->get_device();
+    start = clock::now();
+    for (uint32_t iteration = 0; iteration < iterations; ++iteration) {
+        gather();
+        TransformKernel::build_matrices_scalar(input, 0, count, (float*) output.data());
+    }
+    double scalarTime = std::chrono::duration<double, std::milli>(clock::now() - start).count() / iterations;
 
-    /* Copy to GPU mapped memory */
-    memcpy(pinnedMemory, transformObjects, sizeof(transformObjects));
+    start = clock::now();
+    for (uint32_t iteration = 0; iteration < iterations; ++iteration) {
+        gather();
+        TransformKernel::build_matrices(input, 0, count, (float*) output.data());
+    }
+    double kernelTime = std::chrono::duration<double, std::milli>(clock::now() - start).count() / iterations;
+
+    return {glmTime, scalarTime, kernelTime};
+}
+
+std::string Transform::GetMatrixKernelInstructionSet()
+{
+    return TransformKernel::get_instruction_set();
+}
+
+void Transform::UploadSSBO(uint32_t frame) 
+{
+    if (!ssbo.is_created()) return;
+
+    /* Grow the SSBO if transforms were added since the last upload. The staging copy is kept, so nothing needs to be re-marked. */
+    ssbo.reserve(transforms.get_capacity() * sizeof(TransformStruct));
+
+    /* Propagate local changes down the hierarchy */
+    UpdateWorldMatrices();
+
+    /* Copy only the recomputed world matrices into the staging copy, then bring this frame's copy of the SSBO up to date */
+    TransformStruct* transformObjects = (TransformStruct*) ssbo.get_staging();
+    auto &updated = hierarchy.updated;
+    for (size_t i = 0; i < updated.size();) {
+        size_t j = i;
+        do {
+            Transform &t = transforms[updated[j]];
+            #ifdef COMPACT_TRANSFORMS
+            transformObjects[updated[j]].rows[0] = glm::row(t.localToWorldMatrix, 0);
+            transformObjects[updated[j]].rows[1] = glm::row(t.localToWorldMatrix, 1);
+            transformObjects[updated[j]].rows[2] = glm::row(t.localToWorldMatrix, 2);
+            #else
+            transformObjects[updated[j]].worldToLocal = t.worldToLocalMatrix;
+            transformObjects[updated[j]].localToWorld = t.localToWorldMatrix;
+            #endif
+            ++j;
+        } while (j < updated.size() && updated[j] == updated[j - 1] + 1);
+        ssbo.mark_range(updated[i] * sizeof(TransformStruct), (j - i) * sizeof(TransformStruct));
+        i = j;
+    }
+    ssbo.flush(frame);
 }
 
 vk::Buffer Transform::GetSSBO() 
 {
-    return transformSSBO;
+    return ssbo.get_buffer();
 }
 
 uint32_t Transform::GetSSBOSize()
 {
-    return MAX_TRANSFORMS * sizeof(TransformStruct);
+    return (uint32_t) ssbo.get_size();
+}
+
+uint32_t Transform::GetSSBOOffset(uint32_t frame)
+{
+    return (uint32_t) ssbo.get_offset(frame);
+}
+
+uint64_t Transform::GetSSBOBytesUploaded()
+{
+    return ssbo.get_bytes_uploaded();
+}
+
+uint64_t Transform::GetSSBOGeneration()
+{
+    return ssbo.get_generation();
+}
+
+void Transform::mark_dirty()
+{
+    if (!initialized) return;
+    transforms.mark_dirty(id);
+}
+
+void Transform::set_parent(uint32_t parent_id)
+{
+    if (!initialized)
+        throw std::runtime_error( std::string("Transform not initialized"));
+    if (parent_id >= transforms.get_capacity() || !transforms[parent_id].is_initialized())
+        throw std::runtime_error( std::string("Error: parent transform does not exist"));
+
+    /* Walk up from the new parent to make sure we aren't one of its ancestors */
+    int32_t ancestor = (int32_t) parent_id;
+    for (uint32_t depth = 0; ancestor != -1; ++depth) {
+        if ((uint32_t) ancestor == id || depth > transforms.get_capacity())
+            throw std::runtime_error( std::string("Error: a transform cannot be parented to its own descendant"));
+        ancestor = transforms[ancestor].parent;
+    }
+
+    parent = (int32_t) parent_id;
+    hierarchyOutOfDate = true;
+    mark_dirty();
+}
+
+void Transform::set_parent(Transform* parent)
+{
+    if (!parent)
+        throw std::runtime_error( std::string("Invalid transform handle."));
+    set_parent(parent->get_id());
+}
+
+void Transform::clear_parent()
+{
+    if (parent == -1) return;
+    parent = -1;
+    hierarchyOutOfDate = true;
+    mark_dirty();
+}
+
+int32_t Transform::get_parent()
+{
+    return parent;
 }
 
 void Transform::CleanUp() 
 {
-    auto vulkan = Libraries::Vulkan::Get();
-    auto device = vulkan->get_device();
-    device.destroyBuffer(transformSSBO);
-    device.unmapMemory(transformSSBOMemory);
-    device.freeMemory(transformSSBOMemory);
+    ssbo.destroy();
 }
 
 
 /* Static Factory Implementations */
 Transform* Transform::Create(std::string name) {
-    return StaticFactory::Create(name, "Transform", lookupTable, transforms, MAX_TRANSFORMS);
+    auto transform = StaticFactory::Create(name, "Transform", lookupTable, transforms);
+    hierarchyOutOfDate = true;
+    return transform;
 }
 
 Transform* Transform::Get(std::string name) {
-    return StaticFactory::Get(name, "Transform", lookupTable, transforms, MAX_TRANSFORMS);
+    return StaticFactory::Get(name, "Transform", lookupTable, transforms);
 }
 
 Transform* Transform::Get(uint32_t id) {
-    return StaticFactory::Get(id, "Transform", lookupTable, transforms, MAX_TRANSFORMS);
+    return StaticFactory::Get(id, "Transform", lookupTable, transforms);
+}
+
+Transform* Transform::Get(uint32_t id, uint32_t generation) {
+    return StaticFactory::Get(id, generation, "Transform", lookupTable, transforms);
 }
 
 void Transform::Delete(std::string name) {
-    StaticFactory::Delete(name, "Transform", lookupTable, transforms, MAX_TRANSFORMS);
+    auto transform = StaticFactory::Get(name, "Transform", lookupTable, transforms);
+    Transform::Delete(transform->get_id());
 }
 
 void Transform::Delete(uint32_t id) {
-    StaticFactory::Delete(id, "Transform", lookupTable, transforms, MAX_TRANSFORMS);
+    /* Children of a deleted transform become roots */
+    for (uint32_t i = 0; i < transforms.get_capacity(); ++i)
+        if (transforms[i].is_initialized() && transforms[i].parent == (int32_t) id) 
+            transforms[i].clear_parent();
+    StaticFactory::Delete(id, "Transform", lookupTable, transforms);
+    hierarchyOutOfDate = true;
 }
 
-Transform* Transform::GetFront() {
-    return transforms;
+Transform* Transform::GetFromIndex(uint32_t index) {
+    return StaticFactory::GetFromIndex(index, transforms);
 }
 
 uint32_t Transform::GetCount() {
-    return MAX_TRANSFORMS;
+    return transforms.get_capacity();
 }
@@ -19,8 +19,11 @@
 #include <glm/gtx/matrix_interpolation.hpp>
 #include <glm/gtx/matrix_decompose.hpp>
 #include <map>
+#include <atomic>
+#include <vector>
 
 #include "Pluto/Libraries/Vulkan/Vulkan.hxx"
+#include "Pluto/Libraries/Vulkan/StorageBuffer.hxx"
 #include "Pluto/Tools/StaticFactory.hxx"
 
 using namespace glm;
@@ -34,50 +37,103 @@ class Transform : public StaticFactory
     vec3 scale = vec3(1.0);
     vec3 position = vec3(0.0);
     quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
-    
-    /* TODO: Make these constants */
-    vec3 worldRight = vec3(1.0, 0.0, 0.0);
-    vec3 worldUp = vec3(0.0, 1.0, 0.0);
-    vec3 worldForward = vec3(0.0, 0.0, 1.0);
-
-    vec3 right = vec3(1.0, 0.0, 0.0);
-    vec3 up = vec3(0.0, 1.0, 0.0);
-    vec3 forward = vec3(0.0, 0.0, 1.0);
 
+    /* An optional non-TRS transformation applied on top of scale, rotation and position, set through set_transform */
+    bool useCustomTransform = false;
     mat4 localToParentTransform = mat4(1);
-    mat4 localToParentRotation = mat4(1);
-    mat4 localToParentPosition = mat4(1);
-    mat4 localToParentScale = mat4(1);
-
     mat4 parentToLocalTransform = mat4(1);
-    mat4 parentToLocalRotation = mat4(1);
-    mat4 parentToLocalPosition = mat4(1);
-    mat4 parentToLocalScale = mat4(1);
 
+    /* Counts edits to TRS or the custom transform. Setters run on the python thread while the render thread 
+        composes matrices, so the count is atomic. It's still copyable, since the factory resets slots by assignment. */
+    struct EditCounter {
+        std::atomic<uint32_t> value {0};
+        EditCounter() = default;
+        EditCounter(const EditCounter &other) : value(other.value.load()) {}
+        EditCounter &operator=(const EditCounter &other) { value.store(other.value.load()); return *this; }
+    };
+    EditCounter edits;
+
+    /* Composed lazily from TRS on the render thread. composedEdits is the edit count they were composed from, 
+        so they're out of date whenever it differs from edits. */
+    uint32_t composedEdits = 0;
     mat4 localToParentMatrix = mat4(1);
     mat4 parentToLocalMatrix = mat4(1);
 
+    /* Composed with all ancestors. Written by UpdateWorldMatrices once per frame. */
+    mat4 localToWorldMatrix = mat4(1);
+    mat4 worldToLocalMatrix = mat4(1);
+
+    /* The id of the parent transform, or -1 if this transform is a root. */
+    int32_t parent = -1;
+
     // float interpolation = 1.0;
 
-    static Transform transforms[MAX_TRANSFORMS];
-    static TransformStruct* pinnedMemory;
+    static SlotMap<Transform> transforms;
     static std::map<std::string, uint32_t> lookupTable;
-    static vk::Buffer transformSSBO;
-    static vk::DeviceMemory transformSSBOMemory;
+    static Libraries::StorageBuffer ssbo;
+
+    /* The transform hierarchy, flattened into depth first order so that every parent comes before its children, 
+        and every subtree occupies a contiguous range of positions. Rebuilt whenever a parent link changes. */
+    struct Hierarchy {
+        std::vector<uint32_t> order;        // position -> transform id
+        std::vector<int32_t> parent;        // position -> position of the parent, or -1 for roots
+        std::vector<uint32_t> end;          // position -> one past the last position in its subtree
+        std::vector<uint32_t> position;     // transform id -> position, or -1 if not in the hierarchy
+        std::vector<uint32_t> branches;     // positions of nodes whose subtrees are too large for one task, evaluated serially
+        std::vector<uint32_t> tasks;        // positions of the roots of the remaining subtrees, evaluated in parallel
+        std::vector<int32_t> taskOf;        // position -> index into tasks, or -1 for branch nodes
+        std::vector<uint8_t> changed;       // position -> local matrix changed since the last update
+        std::vector<uint8_t> taskChanged;   // task -> some local matrix in the task changed since the last update
+        std::vector<uint8_t> branchUpdated; // position -> this branch's world matrix was recomputed this update
+        std::vector<std::vector<uint32_t>> jobUpdates;
+        std::vector<uint32_t> updated;      // transform ids whose world matrices were recomputed by the last update
+    };
+    static Hierarchy hierarchy;
+    static std::atomic<bool> hierarchyOutOfDate;
+
+    /* Flattens the parent links of all transforms into the hierarchy */
+    static void RebuildHierarchy();
+
+    /* Composes the world matrices of the transform at the given hierarchy position from its parent */
+    static void ComputeWorldMatrices(uint32_t position);
+
+    /* Composes the out of date local matrices of the given transforms in one batch, using the SIMD matrix kernel.
+        Transforms with a custom transform are left to compose_matrices. */
+    static void ComposeLocalMatrices(const std::vector<uint32_t> &ids);
 
   public:
     static Transform* Create(std::string name);
     static Transform* Get(std::string name);
     static Transform* Get(uint32_t id);
-    static Transform* GetFront();
+    static Transform* Get(uint32_t id, uint32_t generation);
+    static Transform* GetFromIndex(uint32_t index);
 	static uint32_t GetCount();
     static void Delete(std::string name);
     static void Delete(uint32_t id);
 
     static void Initialize();
-    static void UploadSSBO();
+
+    /* Recomputes world matrices for every transform whose local matrix, or whose ancestor's local matrix, changed 
+        since the last update. Independent subtrees are evaluated in parallel on the worker pool. */
+    static void UpdateWorldMatrices();
+
+    /* Returns the number of world matrices recomputed by the last update */
+    static uint32_t GetUpdatedCount();
+
+    /* Composes count random TRS transforms into matrix pairs, first with glm one transform at a time, 
+        then with the kernel's scalar path, then with the SIMD matrix kernel. Returns the average milliseconds 
+        per pass as {glm, scalar, kernel}. Pluto/Benchmarks runs it at 1k, 10k and 100k transforms. */
+    static std::vector<double> BenchmarkMatrixKernel(uint32_t count, uint32_t iterations = 10);
+
+    /* Returns the instruction set the matrix kernel was built with, "AVX2", "SSE4.1" or "Scalar" */
+    static std::string GetMatrixKernelInstructionSet();
+
+    static void UploadSSBO(uint32_t frame);
     static vk::Buffer GetSSBO();
     static uint32_t GetSSBOSize();
+    static uint32_t GetSSBOOffset(uint32_t frame);
+    static uint64_t GetSSBOBytesUploaded();
+    static uint64_t GetSSBOGeneration();
     static void CleanUp();
 
     Transform() { 
@@ -88,6 +144,20 @@ class Transform : public StaticFactory
         initialized = true; this->name = name; this->id = id;
     }
 
+    /* Flags this transform to be copied into the SSBO on the next upload. */
+    void mark_dirty();
+
+    /* Parents this transform to another, so that its world matrix is composed with its parent's.
+        Throws if this would make the transform its own ancestor. */
+    void set_parent(uint32_t parent_id);
+    void set_parent(Transform* parent);
+
+    /* Makes this transform a root of the hierarchy */
+    void clear_parent();
+
+    /* Returns the id of the parent transform, or -1 if this transform is a root */
+    int32_t get_parent();
+
     std::string to_string()
     {
         std::string output;
@@ -98,9 +168,9 @@ class Transform : public StaticFactory
         output += "\tscale: " + glm::to_string(get_scale()) + "\n";
         output += "\tposition: " + glm::to_string(get_position()) + "\n";
         output += "\trotation: " + glm::to_string(get_rotation()) + "\n";
-        output += "\tright: " + glm::to_string(right) + "\n";
-        output += "\tup: " + glm::to_string(up) + "\n";
-        output += "\tforward: " + glm::to_string(forward) + "\n";
+        output += "\tright: " + glm::to_string(get_right()) + "\n";
+        output += "\tup: " + glm::to_string(get_up()) + "\n";
+        output += "\tforward: " + glm::to_string(get_forward()) + "\n";
         output += "\tlocal_to_parent_matrix: " + glm::to_string(local_to_parent_matrix()) + "\n";
         output += "\tparent_to_local_matrix: " + glm::to_string(parent_to_local_matrix()) + "\n";
         output += "}";
@@ -114,8 +184,7 @@ class Transform : public StaticFactory
     */
     vec3 transform_direction(vec3 direction)
     {
-
-        return vec3(localToParentRotation * vec4(direction, 0.0));
+        return rotation * direction;
     }
 
     /*
@@ -124,7 +193,7 @@ class Transform : public StaticFactory
     */
     vec3 transform_point(vec3 point)
     {
-        return vec3(localToParentMatrix * vec4(point, 1.0));
+        return vec3(local_to_parent_matrix() * vec4(point, 1.0));
     }
 
     /*
@@ -134,7 +203,7 @@ class Transform : public StaticFactory
     */
     vec3 transform_vector(vec3 vector)
     {
-        return vec3(localToParentMatrix * vec4(vector, 0.0));
+        return vec3(local_to_parent_matrix() * vec4(vector, 0.0));
     }
 
     /*
@@ -144,7 +213,7 @@ class Transform : public StaticFactory
     */
     vec3 inverse_transform_direction(vec3 direction)
     {
-        return vec3(parentToLocalRotation * vec4(direction, 0.0));
+        return glm::conjugate(rotation) * direction;
     }
 
     /*
@@ -154,7 +223,7 @@ class Transform : public StaticFactory
     */
     vec3 inverse_transform_point(vec3 point)
     {
-        return vec3(parentToLocalMatrix * vec4(point, 1.0));
+        return vec3(parent_to_local_matrix() * vec4(point, 1.0));
     }
 
     /*
@@ -164,7 +233,7 @@ class Transform : public StaticFactory
     */
     vec3 inverse_transform_vector(vec3 vector)
     {
-        return vec3(localToParentMatrix * vec4(vector, 0.0));
+        return vec3(local_to_parent_matrix() * vec4(vector, 0.0));
     }
 
     /*
@@ -191,13 +260,7 @@ class Transform : public StaticFactory
         newPosition = newPosition - direction * glm::angleAxis(radians(-angle), axis);
 
         rotation = glm::normalize(newRotation);
-        localToParentRotation = glm::toMat4(rotation);
-        parentToLocalRotation = glm::inverse(localToParentRotation);
-
         position = newPosition;
-        localToParentPosition = glm::translate(glm::mat4(1.0), position);
-        parentToLocalPosition = glm::translate(glm::mat4(1.0), -position);
-
         update_matrix();
     }
 
@@ -209,17 +272,14 @@ class Transform : public StaticFactory
         newPosition = newPosition - direction * glm::inverse(rot);
 
         rotation = glm::normalize(newRotation);
-        localToParentRotation = glm::toMat4(rotation);
-        parentToLocalRotation = glm::inverse(localToParentRotation);
-
         position = newPosition;
-        localToParentPosition = glm::translate(glm::mat4(1.0), position);
-        parentToLocalPosition = glm::translate(glm::mat4(1.0), -position);
-
         update_matrix();
     }
 
-    /* Used primarily for non-trivial transformations */
+    /* Used primarily for non-trivial transformations. With decompose, the matrix is split into position, scale and 
+        rotation. Otherwise it's kept as is, and applied on top of them. Position, scale and rotation are then left 
+        unchanged, so get_position doesn't include the matrix's translation. Read local_to_parent_matrix instead 
+        for the combined result, as get_right, get_up and get_forward do. */
     void set_transform(glm::mat4 transformation, bool decompose = true)
     {
         if (decompose)
@@ -236,6 +296,8 @@ class Transform : public StaticFactory
             set_rotation(rotation);
         }
         else {
+            /* The only place a generic inverse is still needed, since the matrix may not be TRS */
+            this->useCustomTransform = true;
             this->localToParentTransform = transformation;
             this->parentToLocalTransform = glm::inverse(transformation);
             update_matrix();
@@ -261,7 +323,6 @@ class Transform : public StaticFactory
     void add_rotation(quat additionalRotation)
     {
         set_rotation(get_rotation() * additionalRotation);
-        update_rotation();
     }
 
     void add_rotation(float angle, vec3 axis)
@@ -271,8 +332,6 @@ class Transform : public StaticFactory
 
     void update_rotation()
     {
-        localToParentRotation = glm::toMat4(rotation);
-        parentToLocalRotation = glm::inverse(localToParentRotation);
         update_matrix();
     }
 
@@ -283,17 +342,17 @@ class Transform : public StaticFactory
 
     vec3 get_right()
     {
-        return right;
+        return vec3(local_to_parent_matrix()[0]);
     }
 
     vec3 get_up()
     {
-        return up;
+        return vec3(local_to_parent_matrix()[2]);
     }
 
     vec3 get_forward()
     {
-        return forward;
+        return vec3(local_to_parent_matrix()[1]);
     }
 
     void set_position(vec3 newPosition)
@@ -305,7 +364,6 @@ class Transform : public StaticFactory
     void add_position(vec3 additionalPosition)
     {
         set_position(get_position() + additionalPosition);
-        update_position();
     }
 
     void set_position(float x, float y, float z)
@@ -320,8 +378,6 @@ class Transform : public StaticFactory
 
     void update_position()
     {
-        localToParentPosition = glm::translate(glm::mat4(1.0), position);
-        parentToLocalPosition = glm::translate(glm::mat4(1.0), -position);
         update_matrix();
     }
 
@@ -345,7 +401,6 @@ class Transform : public StaticFactory
     void add_scale(vec3 additionalScale)
     {
         set_scale(get_scale() + additionalScale);
-        update_scale();
     }
 
     void set_scale(float x, float y, float z)
@@ -365,61 +420,112 @@ class Transform : public StaticFactory
 
     void update_scale()
     {
-        localToParentScale = glm::scale(glm::mat4(1.0), scale);
-        parentToLocalScale = glm::scale(glm::mat4(1.0), glm::vec3(1.0 / scale.x, 1.0 / scale.y, 1.0 / scale.z));
         update_matrix();
     }
 
+    /* Setters only record that TRS changed. The render thread composes the matrices the next time it updates. */
     void update_matrix()
     {
+        edits.value++;
+        mark_dirty();
+    }
+
+    /* Composes the local to parent and parent to local matrices from TRS into the given matrices. 
+        The inverse is built in closed form, S^-1 * R^T * T^-1, rather than with a generic 4x4 inverse. */
+    void build_local_matrices(glm::mat4 &localToParent, glm::mat4 &parentToLocal) const
+    {
+        glm::mat3 r = glm::mat3_cast(rotation);
+        localToParent = glm::mat4(
+            glm::vec4(r[0] * scale.x, 0.0f),
+            glm::vec4(r[1] * scale.y, 0.0f),
+            glm::vec4(r[2] * scale.z, 0.0f),
+            glm::vec4(position, 1.0f));
+
+        glm::vec3 inverseScale = glm::vec3(1.0f) / scale;
+        glm::mat3 inverse = glm::transpose(r);
+        inverse[0] *= inverseScale;
+        inverse[1] *= inverseScale;
+        inverse[2] *= inverseScale;
+        parentToLocal = glm::mat4(
+            glm::vec4(inverse[0], 0.0f),
+            glm::vec4(inverse[1], 0.0f),
+            glm::vec4(inverse[2], 0.0f),
+            glm::vec4(-(inverse * position), 1.0f));
+
+        if (useCustomTransform) {
+            localToParent = localToParentTransform * localToParent;
+            parentToLocal = parentToLocal * parentToLocalTransform;
+        }
+    }
 
-        localToParentMatrix = (localToParentTransform * localToParentPosition * localToParentRotation * localToParentScale);
-        parentToLocalMatrix = (parentToLocalScale * parentToLocalRotation * parentToLocalPosition * parentToLocalTransform);
-
-        right = glm::vec3(localToParentMatrix[0]);
-        forward = glm::vec3(localToParentMatrix[1]);
-        up = glm::vec3(localToParentMatrix[2]);
-        position = glm::vec3(localToParentMatrix[3]);
+  private:
+    /* Render thread only. Brings the cached local matrices up to date. If the transform is edited while they're 
+        being composed, they're left out of date, and the slot dirty, so the next update composes them again. */
+    void compose_matrices()
+    {
+        uint32_t snapshot = edits.value.load();
+        if (snapshot == composedEdits) return;
+        build_local_matrices(localToParentMatrix, parentToLocalMatrix);
+        if (edits.value.load() == snapshot) composedEdits = snapshot;
+        else mark_dirty();
     }
 
+  public:
+    /* Composed fresh from TRS, rather than read from the matrices cached for the render thread */
     glm::mat4 parent_to_local_matrix()
     {
-        return /*(interpolation >= 1.0 ) ?*/ parentToLocalMatrix /*: glm::interpolate(glm::mat4(1.0), parentToLocalMatrix, interpolation)*/;
+        glm::mat4 localToParent, parentToLocal;
+        build_local_matrices(localToParent, parentToLocal);
+        return /*(interpolation >= 1.0 ) ?*/ parentToLocal /*: glm::interpolate(glm::mat4(1.0), parentToLocal, interpolation)*/;
     }
 
     glm::mat4 local_to_parent_matrix()
     {
-        return /*(interpolation >= 1.0 ) ?*/ localToParentMatrix /*: glm::interpolate(glm::mat4(1.0), localToParentMatrix, interpolation)*/;
+        glm::mat4 localToParent, parentToLocal;
+        build_local_matrices(localToParent, parentToLocal);
+        return /*(interpolation >= 1.0 ) ?*/ localToParent /*: glm::interpolate(glm::mat4(1.0), localToParent, interpolation)*/;
+    }
+
+    /* Returns the local to world matrix, as of the last call to UpdateWorldMatrices */
+    glm::mat4 local_to_world_matrix()
+    {
+        return localToWorldMatrix;
+    }
+
+    /* Returns the world to local matrix, as of the last call to UpdateWorldMatrices */
+    glm::mat4 world_to_local_matrix()
+    {
+        return worldToLocalMatrix;
     }
 
     glm::mat4 local_to_parent_position()
     {
-        return localToParentPosition;
+        return glm::translate(glm::mat4(1.0), position);
     }
 
     glm::mat4 local_to_parent_scale()
     {
-        return localToParentScale;
+        return glm::scale(glm::mat4(1.0), scale);
     }
 
     glm::mat4 local_to_parent_rotation()
     {
-        return localToParentRotation;
+        return glm::toMat4(rotation);
     }
 
     glm::mat4 parent_to_local_position()
     {
-        return parentToLocalPosition;
+        return glm::translate(glm::mat4(1.0), -position);
     }
 
     glm::mat4 parent_to_local_scale()
     {
-        return parentToLocalScale;
+        return glm::scale(glm::mat4(1.0), glm::vec3(1.0) / scale);
     }
 
     glm::mat4 parent_to_local_rotation()
     {
-        return parentToLocalRotation;
+        return glm::toMat4(glm::conjugate(rotation));
     }
 
     // void set_test_interpolation(float value) {
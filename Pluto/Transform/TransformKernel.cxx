@@ -0,0 +1,152 @@
+#include "./TransformKernel.hxx"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE4_1__)
+#include <smmintrin.h>
+#endif
+
+namespace TransformKernel {
+
+/* Arithmetic on a lane type, so the matrix math below is written once for scalar and SIMD paths */
+struct ScalarLanes {
+    typedef float V;
+    static float load(const float* p) { return *p; }
+    static float set(float v) { return v; }
+    static float add(float a, float b) { return a + b; }
+    static float sub(float a, float b) { return a - b; }
+    static float mul(float a, float b) { return a * b; }
+    static float div(float a, float b) { return a / b; }
+};
+
+#if defined(__AVX2__)
+struct AVX2Lanes {
+    typedef __m256 V;
+    static __m256 load(const float* p) { return _mm256_loadu_ps(p); }
+    static __m256 set(float v) { return _mm256_set1_ps(v); }
+    static __m256 add(__m256 a, __m256 b) { return _mm256_add_ps(a, b); }
+    static __m256 sub(__m256 a, __m256 b) { return _mm256_sub_ps(a, b); }
+    static __m256 mul(__m256 a, __m256 b) { return _mm256_mul_ps(a, b); }
+    static __m256 div(__m256 a, __m256 b) { return _mm256_div_ps(a, b); }
+};
+#elif defined(__SSE4_1__)
+struct SSELanes {
+    typedef __m128 V;
+    static __m128 load(const float* p) { return _mm_loadu_ps(p); }
+    static __m128 set(float v) { return _mm_set1_ps(v); }
+    static __m128 add(__m128 a, __m128 b) { return _mm_add_ps(a, b); }
+    static __m128 sub(__m128 a, __m128 b) { return _mm_sub_ps(a, b); }
+    static __m128 mul(__m128 a, __m128 b) { return _mm_mul_ps(a, b); }
+    static __m128 div(__m128 a, __m128 b) { return _mm_div_ps(a, b); }
+};
+#endif
+
+/* Computes the 32 output floats (inverse, then forward, column major) for one lane group starting at i */
+template<class L>
+static inline void compute(const TRSArrays &trs, uint32_t i, typename L::V m[32])
+{
+    typedef typename L::V V;
+    V px = L::load(&trs.px[i]), py = L::load(&trs.py[i]), pz = L::load(&trs.pz[i]);
+    V qx = L::load(&trs.qx[i]), qy = L::load(&trs.qy[i]), qz = L::load(&trs.qz[i]), qw = L::load(&trs.qw[i]);
+    V sx = L::load(&trs.sx[i]), sy = L::load(&trs.sy[i]), sz = L::load(&trs.sz[i]);
+    V one = L::set(1.0f), two = L::set(2.0f), zero = L::set(0.0f);
+
+    V xx = L::mul(qx, qx), yy = L::mul(qy, qy), zz = L::mul(qz, qz);
+    V xy = L::mul(qx, qy), xz = L::mul(qx, qz), yz = L::mul(qy, qz);
+    V wx = L::mul(qw, qx), wy = L::mul(qw, qy), wz = L::mul(qw, qz);
+
+    /* Rotation matrix, r<column><row>, matching glm::mat3_cast */
+    V r00 = L::sub(one, L::mul(two, L::add(yy, zz)));
+    V r01 = L::mul(two, L::add(xy, wz));
+    V r02 = L::mul(two, L::sub(xz, wy));
+    V r10 = L::mul(two, L::sub(xy, wz));
+    V r11 = L::sub(one, L::mul(two, L::add(xx, zz)));
+    V r12 = L::mul(two, L::add(yz, wx));
+    V r20 = L::mul(two, L::add(xz, wy));
+    V r21 = L::mul(two, L::sub(yz, wx));
+    V r22 = L::sub(one, L::mul(two, L::add(xx, yy)));
+
+    /* Inverse: S^-1 * R^T, then -(S^-1 * R^T) * p for the translation */
+    V ix = L::div(one, sx), iy = L::div(one, sy), iz = L::div(one, sz);
+    m[0] = L::mul(ix, r00); m[1] = L::mul(iy, r10); m[2] = L::mul(iz, r20); m[3] = zero;
+    m[4] = L::mul(ix, r01); m[5] = L::mul(iy, r11); m[6] = L::mul(iz, r21); m[7] = zero;
+    m[8] = L::mul(ix, r02); m[9] = L::mul(iy, r12); m[10] = L::mul(iz, r22); m[11] = zero;
+    m[12] = L::sub(zero, L::add(L::add(L::mul(m[0], px), L::mul(m[4], py)), L::mul(m[8], pz)));
+    m[13] = L::sub(zero, L::add(L::add(L::mul(m[1], px), L::mul(m[5], py)), L::mul(m[9], pz)));
+    m[14] = L::sub(zero, L::add(L::add(L::mul(m[2], px), L::mul(m[6], py)), L::mul(m[10], pz)));
+    m[15] = one;
+
+    /* Forward: T * R * S */
+    m[16] = L::mul(r00, sx); m[17] = L::mul(r01, sx); m[18] = L::mul(r02, sx); m[19] = zero;
+    m[20] = L::mul(r10, sy); m[21] = L::mul(r11, sy); m[22] = L::mul(r12, sy); m[23] = zero;
+    m[24] = L::mul(r20, sz); m[25] = L::mul(r21, sz); m[26] = L::mul(r22, sz); m[27] = zero;
+    m[28] = px; m[29] = py; m[30] = pz; m[31] = one;
+}
+
+void build_matrices_scalar(const TRSArrays &trs, uint32_t first, uint32_t count, float* out)
+{
+    for (uint32_t i = first; i < first + count; ++i, out += 32)
+        compute<ScalarLanes>(trs, i, out);
+}
+
+#if defined(__AVX2__)
+/* Turns 8 vectors of one element across 8 sets into 8 vectors of 8 elements for one set */
+static inline void transpose8(__m256 r[8])
+{
+    __m256 t0 = _mm256_unpacklo_ps(r[0], r[1]), t1 = _mm256_unpackhi_ps(r[0], r[1]);
+    __m256 t2 = _mm256_unpacklo_ps(r[2], r[3]), t3 = _mm256_unpackhi_ps(r[2], r[3]);
+    __m256 t4 = _mm256_unpacklo_ps(r[4], r[5]), t5 = _mm256_unpackhi_ps(r[4], r[5]);
+    __m256 t6 = _mm256_unpacklo_ps(r[6], r[7]), t7 = _mm256_unpackhi_ps(r[6], r[7]);
+    __m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0)), s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0)), s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0)), s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0)), s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+    r[0] = _mm256_permute2f128_ps(s0, s4, 0x20); r[1] = _mm256_permute2f128_ps(s1, s5, 0x20);
+    r[2] = _mm256_permute2f128_ps(s2, s6, 0x20); r[3] = _mm256_permute2f128_ps(s3, s7, 0x20);
+    r[4] = _mm256_permute2f128_ps(s0, s4, 0x31); r[5] = _mm256_permute2f128_ps(s1, s5, 0x31);
+    r[6] = _mm256_permute2f128_ps(s2, s6, 0x31); r[7] = _mm256_permute2f128_ps(s3, s7, 0x31);
+}
+#endif
+
+void build_matrices(const TRSArrays &trs, uint32_t first, uint32_t count, float* out)
+{
+    uint32_t i = first, end = first + count;
+
+#if defined(__AVX2__)
+    for (; i + 8 <= end; i += 8, out += 8 * 32) {
+        __m256 m[32];
+        compute<AVX2Lanes>(trs, i, m);
+        for (uint32_t group = 0; group < 4; ++group) {
+            transpose8(&m[group * 8]);
+            for (uint32_t lane = 0; lane < 8; ++lane)
+                _mm256_storeu_ps(out + lane * 32 + group * 8, m[group * 8 + lane]);
+        }
+    }
+#elif defined(__SSE4_1__)
+    for (; i + 4 <= end; i += 4, out += 4 * 32) {
+        __m128 m[32];
+        compute<SSELanes>(trs, i, m);
+        for (uint32_t group = 0; group < 8; ++group) {
+            __m128* r = &m[group * 4];
+            _MM_TRANSPOSE4_PS(r[0], r[1], r[2], r[3]);
+            for (uint32_t lane = 0; lane < 4; ++lane)
+                _mm_storeu_ps(out + lane * 32 + group * 4, r[lane]);
+        }
+    }
+#endif
+
+    build_matrices_scalar(trs, i, end - i, out);
+}
+
+const char* get_instruction_set()
+{
+#if defined(__AVX2__)
+    return "AVX2";
+#elif defined(__SSE4_1__)
+    return "SSE4.1";
+#else
+    return "Scalar";
+#endif
+}
+
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+/* Scale, rotation and position sets in structure of arrays form, so that the matrix kernel can
+    load several transforms worth of each component at once. Quaternions are expected to be normalized. */
+struct TRSArrays {
+    std::vector<float> px, py, pz;
+    std::vector<float> qx, qy, qz, qw;
+    std::vector<float> sx, sy, sz;
+
+    void resize(uint32_t count)
+    {
+        for (auto v : {&px, &py, &pz, &qx, &qy, &qz, &qw, &sx, &sy, &sz}) v->resize(count);
+    }
+
+    uint32_t size() const
+    {
+        return (uint32_t) px.size();
+    }
+
+    void set(uint32_t index, const float position[3], const float rotation_xyzw[4], const float scale[3])
+    {
+        px[index] = position[0]; py[index] = position[1]; pz[index] = position[2];
+        qx[index] = rotation_xyzw[0]; qy[index] = rotation_xyzw[1]; qz[index] = rotation_xyzw[2]; qw[index] = rotation_xyzw[3];
+        sx[index] = scale[0]; sy[index] = scale[1]; sz[index] = scale[2];
+    }
+};
+
+namespace TransformKernel {
+    /* Builds T * R * S and its closed form inverse S^-1 * R^T * T^-1 for count sets starting at first.
+        For each set, out receives 16 floats of the inverse followed by 16 floats of the forward matrix, 
+        both column major, ie the layout of the full (non compact) TransformStruct.
+        Uses AVX2 (8 sets per iteration) or SSE4.1 (4 per iteration) when compiled in, with a scalar tail. */
+    void build_matrices(const TRSArrays &trs, uint32_t first, uint32_t count, float* out);
+
+    /* The same computation, one set at a time. Used for the tail, and on targets without SIMD. */
+    void build_matrices_scalar(const TRSArrays &trs, uint32_t first, uint32_t count, float* out);
+
+    /* Returns the instruction set build_matrices was compiled with: "AVX2", "SSE4.1" or "Scalar" */
+    const char* get_instruction_set();
+}
@@ -1,5 +1,6 @@
 /* File shared by both GLSL and C++ */
 
+/* The initial number of transform slots. Storage and the transform SSBO grow past this at runtime. */
 #ifndef MAX_TRANSFORMS
 #define MAX_TRANSFORMS 256
 #endif
@@ -9,8 +10,63 @@
 using namespace glm;
 #endif
 
+#ifdef COMPACT_TRANSFORMS
+/* The compact encoding keeps only the top three rows of the local to world matrix, 48 bytes rather than 128.
+    The bottom row of an affine matrix is always (0, 0, 0, 1), and shaders rebuild the inverse when they need it. */
+struct TransformStruct
+{
+    vec4 rows[3];
+};
+#else
 struct TransformStruct
 {
     mat4 worldToLocal;
     mat4 localToWorld;
-};
\ No newline at end of file
+};
+#endif
+
+#ifdef GLSL
+/* Shaders read transforms through these, so they compile against either encoding */
+mat4 transform_local_to_world(TransformStruct t)
+{
+    #ifdef COMPACT_TRANSFORMS
+    return transpose(mat4(t.rows[0], t.rows[1], t.rows[2], vec4(0.0, 0.0, 0.0, 1.0)));
+    #else
+    return t.localToWorld;
+    #endif
+}
+
+mat4 transform_world_to_local(TransformStruct t)
+{
+    #ifdef COMPACT_TRANSFORMS
+    mat3 inv = inverse(transpose(mat3(t.rows[0].xyz, t.rows[1].xyz, t.rows[2].xyz)));
+    vec3 translation = vec3(t.rows[0].w, t.rows[1].w, t.rows[2].w);
+    return mat4(vec4(inv[0], 0.0), vec4(inv[1], 0.0), vec4(inv[2], 0.0), vec4(-(inv * translation), 1.0));
+    #else
+    return t.worldToLocal;
+    #endif
+}
+
+/* Returns the world space position of the transform's origin */
+vec3 transform_position(TransformStruct t)
+{
+    #ifdef COMPACT_TRANSFORMS
+    return vec3(t.rows[0].w, t.rows[1].w, t.rows[2].w);
+    #else
+    return vec3(t.localToWorld[3]);
+    #endif
+}
+
+/* Returns a matrix taking local normals to world space, ie the inverse transpose of the upper 3x3, up to a positive scale.
+    The compact path uses the cofactor matrix, which avoids dividing by the determinant. */
+mat3 transform_normal_matrix(TransformStruct t)
+{
+    #ifdef COMPACT_TRANSFORMS
+    mat3 m = transpose(mat3(t.rows[0].xyz, t.rows[1].xyz, t.rows[2].xyz));
+    mat3 cofactor = mat3(cross(m[1], m[2]), cross(m[2], m[0]), cross(m[0], m[1]));
+    return (dot(m[0], cofactor[0]) < 0.0) ? -cofactor : cofactor;
+    #else
+    return transpose(mat3(t.worldToLocal));
+    #endif
+}
+#endif
\ No newline at end of file